@@ -0,0 +1,298 @@
+/***
+ * Boot-to-fix benchmark
+ *
+ * Time to first fix is measured from CPU reset to the first line of UART A
+ * output matching the fix pattern, in emulated time (what a real receiver
+ * would take) and in wall-clock time (how fast the emulator got there). The
+ * first number checks the signal model, the second the emulator.
+ *
+ * Each run boots in a forked child, so runs can't affect each other and
+ * every run starts from exactly the same state. Runs take consecutive noise
+ * seeds (which only matters with --noise or --fading), and go one at a
+ * time so their wall-clock times are comparable. The parent collects each
+ * child's result through a pipe and prints the table.
+ *
+ * UART input comes from a script (see uartscript.c) instead of a client,
+ * timed from reset. The enabled slots, their power and phase offsets can
+ * be given as for a sweep (see sweep.c); otherwise main() sets them up.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <regex.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "machine.h"
+#include "main.h"
+#include "uart.h"
+#include "sweep.h"
+#include "uartscript.h"
+
+#include "bench.h"
+
+
+// Longest UART output line examined for the fix pattern
+#define BENCH_MAX_LINE 256
+// Result of one run, sent from the child to the parent
+typedef struct {
+	bool fixed;
+	uint64_t ttffMs;			// emulated time to fix (or to the timeout)
+	double wallSec;				// wall-clock time for the same
+	char line[BENCH_MAX_LINE];	// the line that matched
+} BENCH_RESULT;
+
+static struct {
+	bool enabled;
+	regex_t fix;
+	uint64_t timeoutMs;
+
+	bool setSlots, setPower, setPhase;
+	uint32_t slots;					// enabled slots (bitmap)
+	long power;						// their power
+	int16_t phase[24];				// slot phase offsets
+
+	char line[BENCH_MAX_LINE];		// current UART A output line
+	size_t lineLen;
+
+	struct timespec start;
+	BENCH_RESULT result;
+	int resultFd;					// pipe to the parent (child only)
+} Bench = { .resultFd = -1 };
+
+
+static double BenchElapsed(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+// UART transmit tap: collect UART A lines and look for the fix
+static void BenchUartTx(const int channel, const uint8_t byte)
+{
+	if ((channel != 0) || Bench.result.fixed) {
+		return;
+	}
+
+	if ((byte == '\r') || (byte == '\n')) {
+		Bench.line[Bench.lineLen] = '\0';
+		if ((Bench.lineLen > 0) && (regexec(&Bench.fix, Bench.line, 0, NULL, 0) == 0)) {
+			Bench.result.fixed = true;
+			strcpy(Bench.result.line, Bench.line);
+		}
+		Bench.lineLen = 0;
+	} else if (Bench.lineLen < BENCH_MAX_LINE - 1) {
+		Bench.line[Bench.lineLen++] = byte;
+	}
+}
+
+/**
+ * Set up the benchmark.
+ *
+ * scriptPath  - UART input script (NULL for none)
+ * fixPattern  - extended regex matching a fix report on UART A
+ * timeoutSec  - give up after this much emulated time
+ */
+int BenchInit(const char *scriptPath, const char *fixPattern, const unsigned int timeoutSec)
+{
+	int err = regcomp(&Bench.fix, fixPattern, REG_EXTENDED | REG_NOSUB);
+	if (err != 0) {
+		char msg[128];
+		regerror(err, &Bench.fix, msg, sizeof(msg));
+		fprintf(stderr, "BENCH: bad fix pattern: %s\n", msg);
+		return -1;
+	}
+
+	if (UartScriptLoad(scriptPath) != 0) {
+		return -1;
+	}
+
+	Bench.timeoutMs = (uint64_t)timeoutSec * 1000;
+	Bench.enabled = true;
+	UartSetTxTap(BenchUartTx);
+
+	return 0;
+}
+
+/**
+ * Set the generator up for every run, with the same syntax as a sweep's
+ * settings. Any of them may be NULL, to leave it as main() sets it up.
+ *
+ * slots - enabled slots, e.g. "0-6" or "0,4,5,9,11"
+ * power - transmit power of the enabled slots
+ * phase - slot phase offsets, e.g. "4:100,5:-50"
+ *
+ * Returns -1 if a setting is invalid.
+ */
+int BenchSetSlots(const char *slots, const char *power, const char *phase)
+{
+	if (slots != NULL) {
+		if (SweepParseSlots(slots, &Bench.slots) != 0) {
+			fprintf(stderr, "BENCH: bad slot list '%s'\n", slots);
+			return -1;
+		}
+		Bench.setSlots = true;
+	}
+
+	if (power != NULL) {
+		char *end;
+		Bench.power = strtol(power, &end, 0);
+		if ((end == power) || (*end != '\0') || (Bench.power < DATATRAK_RSSI_MIN) || (Bench.power > 255)) {
+			fprintf(stderr, "BENCH: bad power '%s' (%d-255)\n", power, DATATRAK_RSSI_MIN);
+			return -1;
+		}
+		Bench.setPower = true;
+	}
+
+	if (phase != NULL) {
+		if (SweepParsePhase(phase, Bench.phase) != 0) {
+			fprintf(stderr, "BENCH: bad phase list '%s'\n", phase);
+			return -1;
+		}
+		Bench.setPhase = true;
+	}
+
+	return 0;
+}
+
+/// Apply the settings from BenchSetSlots(). Call before the LF source starts.
+void BenchApply(DATATRAK_LF_CTX *ctx)
+{
+	// Enabled slots, at the given power or full power
+	if (Bench.setSlots || Bench.setPower) {
+		uint32_t slots = Bench.slots;
+		if (!Bench.setSlots) {
+			for (int i = 0; i < ctx->numNavslotsTotal; i++) {
+				if (ctx->slotPower[i] > DATATRAK_RSSI_MIN) {
+					slots |= 1UL << i;
+				}
+			}
+		}
+		const long power = Bench.setPower ? Bench.power : 255;
+		for (int i = 0; i < 24; i++) {
+			ctx->slotPower[i] = (slots & (1UL << i)) ? power : DATATRAK_RSSI_MIN;
+		}
+	}
+
+	if (Bench.setPhase) {
+		memcpy(ctx->slotPhaseOffset, Bench.phase, sizeof(Bench.phase));
+	}
+}
+
+/**
+ * Run the benchmark runs[] times, each in a child process.
+ *
+ * Returns the run number (0 to runs-1) in the child, which should then boot
+ * and run the emulator with noise seed firstSeed + run. The parent waits for
+ * each child in turn, prints the results and exits.
+ */
+int BenchFork(const unsigned int runs, const uint64_t firstSeed)
+{
+	unsigned int fixed = 0;
+	double sumTtff = 0, sumWall = 0, minTtff = 0, maxTtff = 0;
+
+	printf("BENCH: %4s %8s %10s %8s %8s  %s\n", "run", "seed", "ttff_ms", "wall_s", "speed", "fix");
+	fflush(stdout);
+
+	for (unsigned int run = 0; run < runs; run++) {
+		int fds[2];
+		if (pipe(fds) != 0) {
+			perror("BENCH: pipe");
+			exit(EXIT_FAILURE);
+		}
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("BENCH: fork");
+			exit(EXIT_FAILURE);
+		} else if (pid == 0) {
+			close(fds[0]);
+			Bench.resultFd = fds[1];
+			return run;
+		}
+
+		close(fds[1]);
+		BENCH_RESULT r;
+		ssize_t n;
+		do {
+			n = read(fds[0], &r, sizeof(r));
+		} while ((n < 0) && (errno == EINTR));
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+
+		if (n != sizeof(r)) {
+			printf("BENCH: %4u %8llu %10s %8s %8s  (run failed)\n", run,
+					(unsigned long long)(firstSeed + run), "-", "-", "-");
+			continue;
+		}
+
+		printf("BENCH: %4u %8llu %10llu %8.2f %7.1fx  %s\n", run,
+				(unsigned long long)(firstSeed + run), (unsigned long long)r.ttffMs, r.wallSec,
+				(r.wallSec > 0) ? (r.ttffMs / 1000.0) / r.wallSec : 0.0,
+				r.fixed ? r.line : "(timed out)");
+		fflush(stdout);
+
+		if (r.fixed) {
+			if ((fixed == 0) || (r.ttffMs < minTtff)) {
+				minTtff = r.ttffMs;
+			}
+			if ((fixed == 0) || (r.ttffMs > maxTtff)) {
+				maxTtff = r.ttffMs;
+			}
+			fixed++;
+			sumTtff += r.ttffMs;
+			sumWall += r.wallSec;
+		}
+	}
+
+	if (fixed > 0) {
+		printf("BENCH: %u/%u fixed; TTFF mean %.1f s (%.1f-%.1f), wall mean %.2f s\n",
+				fixed, runs, sumTtff / fixed / 1000.0, minTtff / 1000.0, maxTtff / 1000.0, sumWall / fixed);
+	} else {
+		printf("BENCH: 0/%u fixed\n", runs);
+	}
+
+	exit((fixed == runs) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/// Start the clock. Call at CPU reset.
+void BenchStart(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &Bench.start);
+}
+
+/// Per-tick update. Returns true when the run is over (fix found or timed out).
+bool BenchTick(const uint64_t timeMs)
+{
+	if (!Bench.enabled) {
+		return false;
+	}
+
+	if (Bench.result.fixed || (timeMs >= Bench.timeoutMs)) {
+		Bench.result.ttffMs  = timeMs;
+		Bench.result.wallSec = BenchElapsed(&Bench.start);
+		return true;
+	}
+
+	return false;
+}
+
+/// Hand the run's result to the parent
+void BenchFinish(void)
+{
+	if (Bench.resultFd >= 0) {
+		if (write(Bench.resultFd, &Bench.result, sizeof(Bench.result)) != sizeof(Bench.result)) {
+			perror("BENCH: write");
+		}
+		close(Bench.resultFd);
+		Bench.resultFd = -1;
+	}
+}
@@ -0,0 +1,29 @@
+/****************************************************************************
+ * Boot-to-fix benchmark
+ *
+ * Boots the firmware headless, drives it with scripted UART commands and
+ * times how long it takes to report a position.
+ ****************************************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+// Default pattern marking a fix in the UART A output (POSIX extended regex)
+#define BENCH_DEFAULT_FIX "(position|fixed:) +-?[0-9]+ +-?[0-9]+"
+// Default give-up time (emulated seconds)
+#define BENCH_DEFAULT_TIMEOUT 600
+
+int BenchInit(const char *scriptPath, const char *fixPattern, const unsigned int timeoutSec);
+int BenchSetSlots(const char *slots, const char *power, const char *phase);
+void BenchApply(DATATRAK_LF_CTX *ctx);
+int BenchFork(const unsigned int runs, const uint64_t firstSeed);
+void BenchStart(void);
+bool BenchTick(const uint64_t timeMs);
+void BenchFinish(void);
+
+#endif // BENCH_H
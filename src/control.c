@@ -0,0 +1,459 @@
+/***
+ * Control socket
+ *
+ * --control=PATH listens on a UNIX socket at PATH for a few clients at a
+ * time (socat - UNIX-CONNECT:PATH). Each command is one line, and gets one
+ * reply line: "OK" or "ERR reason". 'status' sends "key value" lines first.
+ *
+ *     power SLOT|all N       slot transmit power (1-255)
+ *     phase SLOT|all N       slot phase offset
+ *     f2delta SLOT|all N     extra phase offset for the slot's F2 transmissions
+ *     noise N                RF noise level (returned for unmodulated slots)
+ *     clock N                clock_n
+ *     goldcode N             goldcode_n
+ *     mode interlaced|eightslot
+ *     compensation mk2|none
+ *     seek N                 replay from capture cycle N (needs --replay)
+ *     ignition on|off        UART input port IP4 (ignition sense)
+ *     pause, resume          stop and restart the CPU
+ *     rewind MS              go back MS ms (needs --rewind)
+ *     status                 show the emulator and generator state
+ *     help
+ *
+ * Generator changes are queued, and applied together when the CPU moves on
+ * to the next cycle: the generator restarts from that cycle with the new
+ * settings, discarding what it had generated ahead. None of that had been
+ * output yet (see lfsource.c), so the lock-margin analyser, LF streams and
+ * the capture go straight from the last cycle with the old settings to the
+ * first with the new. Changes are applied to the generator state before
+ * the propagation model and fading, so with --trajectory the model
+ * overrides slot power and phase. While a capture is replayed, seek is the
+ * only generator change allowed.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "m68k.h"
+
+#include "datatrak_gen.h"
+#include "lfsource.h"
+#include "main.h"
+#include "uart.h"
+
+#include "control.h"
+
+
+// Clients at once
+#define CONTROL_MAX_CLIENTS 4
+// Longest command line
+#define CONTROL_MAX_LINE 256
+// Generator changes waiting for the next cycle
+#define CONTROL_MAX_PENDING 64
+
+// Queued generator change
+typedef enum {
+	CONTROL_POWER,
+	CONTROL_PHASE,
+	CONTROL_F2DELTA,
+	CONTROL_NOISE,
+	CONTROL_CLOCK,
+	CONTROL_GOLDCODE,
+	CONTROL_MODE,
+	CONTROL_COMPENSATION,
+	CONTROL_SEEK
+} CONTROL_FIELD;
+
+typedef struct {
+	CONTROL_FIELD field;
+	int slot;					// -1 = all slots
+	long value;
+} CONTROL_CHANGE;
+
+typedef struct {
+	int sock;					// -1 when free
+	char line[CONTROL_MAX_LINE];
+	size_t len;
+} CONTROL_CLIENT;
+
+static struct {
+	char path[108];
+	int listenSock;
+	CONTROL_CLIENT clients[CONTROL_MAX_CLIENTS];
+
+	CONTROL_CHANGE pending[CONTROL_MAX_PENDING];
+	size_t numPending;
+
+	bool paused;
+} Control = { .listenSock = -1 };
+
+
+/**
+ * Listen for control clients on a UNIX socket at path.
+ */
+int ControlInit(const char *path)
+{
+	struct sockaddr_un sa;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "CONTROL: socket path too long\n");
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("CONTROL: socket");
+		return -1;
+	}
+
+	unlink(path);
+	if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) || (listen(fd, CONTROL_MAX_CLIENTS) < 0) ||
+			(fcntl(fd, F_SETFL, O_NONBLOCK) < 0)) {
+		perror("CONTROL: bind/listen");
+		close(fd);
+		return -1;
+	}
+
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		Control.clients[i].sock = -1;
+	}
+	strcpy(Control.path, path);
+	Control.listenSock = fd;
+	fprintf(stderr, "CONTROL: listening on %s\n", path);
+
+	return 0;
+}
+
+void ControlDone(void)
+{
+	if (Control.listenSock < 0) {
+		return;
+	}
+
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (Control.clients[i].sock >= 0) {
+			close(Control.clients[i].sock);
+			Control.clients[i].sock = -1;
+		}
+	}
+	close(Control.listenSock);
+	Control.listenSock = -1;
+	unlink(Control.path);
+}
+
+/// Whether a client has paused the CPU
+bool ControlPaused(void)
+{
+	return Control.paused;
+}
+
+/// Whether there are generator changes waiting for the next cycle
+bool ControlPending(void)
+{
+	return Control.numPending > 0;
+}
+
+/**
+ * Apply the queued generator changes to ctx, in the order they were sent.
+ * Call at a cycle boundary, with the state the next cycle is generated from.
+ */
+void ControlApply(DATATRAK_LF_CTX *ctx)
+{
+	for (size_t i = 0; i < Control.numPending; i++) {
+		const CONTROL_CHANGE *c = &Control.pending[i];
+		const int first = (c->slot < 0) ? 0 : c->slot;
+		const int last  = (c->slot < 0) ? 23 : c->slot;
+
+		for (int s = first; s <= last; s++) {
+			switch (c->field) {
+				case CONTROL_POWER:		ctx->slotPower[s] = c->value;			break;
+				case CONTROL_PHASE:		ctx->slotPhaseOffset[s] = c->value;		break;
+				case CONTROL_F2DELTA:	ctx->slotF2PhaseDelta[s] = c->value;	break;
+				default:				break;
+			}
+		}
+
+		switch (c->field) {
+			case CONTROL_NOISE:
+				ctx->rfNoiseLevel = c->value;
+				break;
+			case CONTROL_CLOCK:
+				ctx->clock_n = c->value;
+				break;
+			case CONTROL_GOLDCODE:
+				ctx->goldcode_n = c->value;
+				break;
+			case CONTROL_MODE:
+				datatrak_gen_reconfigure(ctx, c->value, ctx->compensation);
+				break;
+			case CONTROL_COMPENSATION:
+				datatrak_gen_reconfigure(ctx, ctx->mode, c->value);
+				break;
+			case CONTROL_SEEK:
+				ctx->replay_n = c->value;
+				break;
+			default:
+				break;
+		}
+	}
+
+	fprintf(stderr, "CONTROL: %zu change(s) applied at clock_n %d goldcode_n %d\n",
+			Control.numPending, ctx->clock_n, ctx->goldcode_n);
+	Control.numPending = 0;
+}
+
+static void ControlReply(CONTROL_CLIENT *c, const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+
+	if (c->sock < 0) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	int len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+		return;
+	}
+	if (len > (int)sizeof(buf) - 2) {
+		len = sizeof(buf) - 2;
+	}
+	buf[len++] = '\n';
+
+	// Replies are short: if a client isn't reading them, it's gone
+	if (send(c->sock, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+		close(c->sock);
+		c->sock = -1;
+	}
+}
+
+static void ControlStatus(CONTROL_CLIENT *c)
+{
+	DATATRAK_LF_CTX ctx;
+	char list[24 * 7 + 1];
+	size_t n;
+
+	LfSourceGetState(&ctx);
+
+	ControlReply(c, "time_ms %llu", (unsigned long long)emulatedMs);
+	ControlReply(c, "state %s", Control.paused ? "paused" : "running");
+	ControlReply(c, "pc %06X", m68k_get_reg(NULL, M68K_REG_PC));
+	ControlReply(c, "ignition %s", (Uart.InPort & (1 << 4)) ? "on" : "off");
+	ControlReply(c, "clock_n %d", ctx.clock_n);
+	ControlReply(c, "goldcode_n %d", ctx.goldcode_n);
+	ControlReply(c, "mode %s", (ctx.mode == DATATRAK_MODE_EIGHTSLOT) ? "eightslot" : "interlaced");
+	ControlReply(c, "compensation %s", (ctx.compensation == DATATRAK_COMPENSATION_NONE) ? "none" : "mk2");
+	ControlReply(c, "noise %d", ctx.rfNoiseLevel);
+	if (LfSourceReplaying()) {
+		ControlReply(c, "replay_n %lu", (unsigned long)ctx.replay_n);
+	}
+
+	n = 0;
+	for (int i = 0; i < 24; i++) {
+		n += snprintf(&list[n], sizeof(list) - n, " %d", ctx.slotPower[i]);
+	}
+	ControlReply(c, "power%s", list);
+	n = 0;
+	for (int i = 0; i < 24; i++) {
+		n += snprintf(&list[n], sizeof(list) - n, " %d", ctx.slotPhaseOffset[i]);
+	}
+	ControlReply(c, "phase%s", list);
+	n = 0;
+	for (int i = 0; i < 24; i++) {
+		n += snprintf(&list[n], sizeof(list) - n, " %d", ctx.slotF2PhaseDelta[i]);
+	}
+	ControlReply(c, "f2delta%s", list);
+
+	ControlReply(c, "pending %zu", Control.numPending);
+	ControlReply(c, "OK");
+}
+
+/// Parse an integer argument within [min, max]
+static bool ControlInt(const char *s, const long min, const long max, long *value)
+{
+	char *end;
+	if (s == NULL) {
+		return false;
+	}
+	*value = strtol(s, &end, 0);
+	return (end != s) && (*end == '\0') && (*value >= min) && (*value <= max);
+}
+
+static void ControlQueue(CONTROL_CLIENT *c, const CONTROL_FIELD field, const int slot, const long value)
+{
+	if (LfSourceReplaying() != (field == CONTROL_SEEK)) {
+		ControlReply(c, LfSourceReplaying() ? "ERR the signal is replayed from a capture" : "ERR seek needs --replay");
+		return;
+	}
+	if (Control.numPending >= CONTROL_MAX_PENDING) {
+		ControlReply(c, "ERR too many changes waiting for the next cycle");
+		return;
+	}
+	Control.pending[Control.numPending++] = (CONTROL_CHANGE){ .field = field, .slot = slot, .value = value };
+	ControlReply(c, "OK");
+}
+
+static void ControlCommand(CONTROL_CLIENT *c, char *line)
+{
+	char *save;
+	const char *cmd = strtok_r(line, " \t", &save);
+	const char *arg1 = strtok_r(NULL, " \t", &save);
+	const char *arg2 = strtok_r(NULL, " \t", &save);
+	long v, slot;
+
+	if (cmd == NULL) {
+		return;
+	}
+
+	if ((strcmp(cmd, "power") == 0) || (strcmp(cmd, "phase") == 0) || (strcmp(cmd, "f2delta") == 0)) {
+		const bool power = (strcmp(cmd, "power") == 0);
+		if ((arg1 != NULL) && (strcmp(arg1, "all") == 0)) {
+			slot = -1;
+		} else if (!ControlInt(arg1, 0, 23, &slot)) {
+			ControlReply(c, "ERR slot must be 0-23 or all");
+			return;
+		}
+		if (!ControlInt(arg2, power ? DATATRAK_RSSI_MIN : -32768, power ? 255 : 32767, &v)) {
+			ControlReply(c, "ERR bad value");
+			return;
+		}
+		ControlQueue(c, power ? CONTROL_POWER : (strcmp(cmd, "phase") == 0) ? CONTROL_PHASE : CONTROL_F2DELTA, slot, v);
+	} else if (strcmp(cmd, "noise") == 0) {
+		if (!ControlInt(arg1, 0, 255, &v)) {
+			ControlReply(c, "ERR noise level must be 0-255");
+			return;
+		}
+		ControlQueue(c, CONTROL_NOISE, 0, v);
+	} else if (strcmp(cmd, "clock") == 0) {
+		if (!ControlInt(arg1, 0, 65535, &v)) {
+			ControlReply(c, "ERR clock_n must be 0-65535");
+			return;
+		}
+		ControlQueue(c, CONTROL_CLOCK, 0, v);
+	} else if (strcmp(cmd, "goldcode") == 0) {
+		if (!ControlInt(arg1, 0, 63, &v)) {
+			ControlReply(c, "ERR goldcode_n must be 0-63");
+			return;
+		}
+		ControlQueue(c, CONTROL_GOLDCODE, 0, v);
+	} else if (strcmp(cmd, "seek") == 0) {
+		if (!ControlInt(arg1, 0, INT32_MAX, &v)) {
+			ControlReply(c, "ERR seek needs a capture cycle number");
+			return;
+		}
+		ControlQueue(c, CONTROL_SEEK, 0, v);
+	} else if (strcmp(cmd, "mode") == 0) {
+		if ((arg1 != NULL) && (strcmp(arg1, "interlaced") == 0)) {
+			ControlQueue(c, CONTROL_MODE, 0, DATATRAK_MODE_INTERLACED);
+		} else if ((arg1 != NULL) && (strcmp(arg1, "eightslot") == 0)) {
+			ControlQueue(c, CONTROL_MODE, 0, DATATRAK_MODE_EIGHTSLOT);
+		} else {
+			ControlReply(c, "ERR mode must be interlaced or eightslot");
+		}
+	} else if (strcmp(cmd, "compensation") == 0) {
+		if ((arg1 != NULL) && (strcmp(arg1, "mk2") == 0)) {
+			ControlQueue(c, CONTROL_COMPENSATION, 0, DATATRAK_COMPENSATION_MK2);
+		} else if ((arg1 != NULL) && (strcmp(arg1, "none") == 0)) {
+			ControlQueue(c, CONTROL_COMPENSATION, 0, DATATRAK_COMPENSATION_NONE);
+		} else {
+			ControlReply(c, "ERR compensation must be mk2 or none");
+		}
+	} else if (strcmp(cmd, "ignition") == 0) {
+		if ((arg1 != NULL) && (strcmp(arg1, "on") == 0)) {
+			Uart.InPort |= (1 << 4);
+		} else if ((arg1 != NULL) && (strcmp(arg1, "off") == 0)) {
+			Uart.InPort &= ~(1 << 4);
+		} else {
+			ControlReply(c, "ERR ignition must be on or off");
+			return;
+		}
+		ControlReply(c, "OK");
+	} else if (strcmp(cmd, "pause") == 0) {
+		Control.paused = true;
+		ControlReply(c, "OK");
+	} else if (strcmp(cmd, "resume") == 0) {
+		Control.paused = false;
+		ControlReply(c, "OK");
+	} else if (strcmp(cmd, "rewind") == 0) {
+		if (!ControlInt(arg1, 0, LONG_MAX, &v)) {
+			ControlReply(c, "ERR rewind needs a time in ms");
+		} else if (MachineRewind(v) != 0) {
+			ControlReply(c, "ERR can't rewind (is --rewind on?)");
+		} else {
+			ControlReply(c, "OK");
+		}
+	} else if (strcmp(cmd, "status") == 0) {
+		ControlStatus(c);
+	} else if (strcmp(cmd, "help") == 0) {
+		ControlReply(c, "power|phase|f2delta SLOT|all N, noise N, clock N, goldcode N,");
+		ControlReply(c, "mode interlaced|eightslot, compensation mk2|none, seek N, ignition on|off,");
+		ControlReply(c, "pause, resume, rewind MS, status");
+		ControlReply(c, "OK");
+	} else {
+		ControlReply(c, "ERR unknown command '%s' (try help)", cmd);
+	}
+}
+
+/// Accept clients and run any commands they've sent. Call once per tick.
+void ControlPoll(void)
+{
+	if (Control.listenSock < 0) {
+		return;
+	}
+
+	int fd = accept(Control.listenSock, NULL, NULL);
+	if (fd >= 0) {
+		int i;
+		for (i = 0; (i < CONTROL_MAX_CLIENTS) && (Control.clients[i].sock >= 0); i++)
+			;
+		if (i < CONTROL_MAX_CLIENTS) {
+			Control.clients[i].sock = fd;
+			Control.clients[i].len = 0;
+		} else {
+			close(fd);
+		}
+	}
+
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		CONTROL_CLIENT *c = &Control.clients[i];
+		char buf[256];
+
+		if (c->sock < 0) {
+			continue;
+		}
+
+		ssize_t n = recv(c->sock, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			close(c->sock);
+			c->sock = -1;
+			continue;
+		}
+
+		for (ssize_t j = 0; (j < n) && (c->sock >= 0); j++) {
+			if ((buf[j] == '\n') || (buf[j] == '\r')) {
+				c->line[c->len] = '\0';
+				c->len = 0;
+				ControlCommand(c, c->line);
+			} else if (c->len < CONTROL_MAX_LINE - 1) {
+				c->line[c->len++] = buf[j];
+			}
+		}
+	}
+}
@@ -0,0 +1,23 @@
+/****************************************************************************
+ * Control socket
+ *
+ * Line-based command interface on a UNIX socket, for changing the signal
+ * scenario and driving the emulator while it runs.
+ ****************************************************************************/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+int ControlInit(const char *path);
+void ControlDone(void);
+void ControlPoll(void);
+bool ControlPaused(void);
+bool ControlPending(void);
+void ControlApply(DATATRAK_LF_CTX *ctx);
+
+#endif // CONTROL_H
@@ -0,0 +1,373 @@
+/***
+ * 8051 I/O co-processor
+ *
+ * The 68000 sends bytes to the 8051 with the routine at 0x20B68 in the ROM:
+ * it waits for IP3 on the UART's input port to go high (ready), writes the
+ * byte to the latch at 0x240401, sets OP2 (strobe), waits for IP3 to go low
+ * (taken), and clears OP2. It only polls IP3 a dozen or so times, about
+ * 20us, before giving up and retrying later, so the handshake is answered
+ * here on the CPU thread: a strobe queues the latched byte into a lock-free
+ * mailbox and acknowledges it at once. IP3 only stays low if the mailbox
+ * fills up.
+ *
+ * How the 8051 side is wired isn't known, so the 8051 program sees the
+ * mailbox as follows until someone traces the board: a MOVX read (from any
+ * address) takes the next byte from the 68000 (0xFF if there is none), and
+ * /INT0 (P3.2) is held low while one is waiting. A MOVX write sends a byte
+ * the other way, which the 68000 reads from 0x240401 (0xFF if none).
+ *
+ * With --8051=ROM the 8051 runs on its own thread, COPROC_SKEW_MS of
+ * emulated time at most ahead of or behind the 68000. Each side publishes
+ * how far it has got after every millisecond, and only waits (on a
+ * condition variable) when the other has fallen a whole skew behind, so
+ * both CPUs run in parallel. Mailbox bytes carry the sender's emulated time
+ * and are only delivered COPROC_SKEW_MS later, by which point the sync
+ * guarantees the receiver has seen every byte sent up to then. What each
+ * CPU sees is therefore the same on every run, however the threads are
+ * scheduled. Without a ROM image the 8051 isn't run, and bytes from the
+ * 68000 are simply accepted.
+ *
+ * The 8051 isn't saved in rewind snapshots.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "mcs51.h"
+#include "spsc.h"
+#include "uart.h"
+
+#include "coproc.h"
+
+// Define this to log the bytes sent to the 8051 when it isn't running
+// #define LOG_COPROC
+
+// UART port bits used for the handshake
+#define COPROC_IP_READY		0x08	///< IP3: 8051 ready / byte taken
+#define COPROC_OP_STROBE	0x04	///< OP2: byte latched
+
+typedef struct {
+	uint64_t timeMs;			///< Sender's emulated time
+	uint8_t value;
+} COPROC_MSG;
+
+typedef struct {
+	SPSC_RING ring;
+	COPROC_MSG msgs[COPROC_MAILBOX_SIZE];
+} COPROC_MAILBOX;
+
+static struct {
+	bool enabled;
+	bool hasCore;				///< ROM loaded: run the 8051
+	MCS51 cpu;
+	unsigned long cyclesPerMs;
+
+	uint8_t latch;				///< Last byte written to 0x240401
+	bool strobe;				///< OP2 as last seen
+
+	COPROC_MAILBOX toCo;		///< 68000 -> 8051
+	COPROC_MAILBOX fromCo;		///< 8051 -> 68000
+	uint64_t sent, received, dropped;
+
+	uint64_t hostMs;			///< 68000 ticks complete (written by CPU thread)
+	uint64_t coMs;				///< 8051 milliseconds complete (written by 8051 thread)
+	bool hostWaiting, coWaiting;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool stop;
+} Coproc;
+
+
+// Next message deliverable at time nowMs, or NULL
+static COPROC_MSG *CoprocPeek(COPROC_MAILBOX *mb, const uint64_t nowMs)
+{
+	ptrdiff_t slot = SpscReadSlot(&mb->ring);
+
+	if ((slot < 0) || ((mb->msgs[slot].timeMs + COPROC_SKEW_MS) > nowMs)) {
+		return NULL;
+	}
+	return &mb->msgs[slot];
+}
+
+static bool CoprocPost(COPROC_MAILBOX *mb, const uint64_t nowMs, const uint8_t value)
+{
+	ptrdiff_t slot = SpscWriteSlot(&mb->ring);
+
+	if (slot < 0) {
+		return false;
+	}
+	mb->msgs[slot].timeMs = nowMs;
+	mb->msgs[slot].value  = value;
+	SpscPublish(&mb->ring);
+	return true;
+}
+
+// Wake the other thread if it is waiting for this one
+static void CoprocWake(bool *waiting)
+{
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&Coproc.lock);
+		pthread_cond_broadcast(&Coproc.cond);
+		pthread_mutex_unlock(&Coproc.lock);
+	}
+}
+
+
+/****************************************************************************
+ * 8051 side
+ ****************************************************************************/
+
+static uint8_t CoprocXRead(void *user, const uint16_t addr)
+{
+	COPROC_MSG *msg = CoprocPeek(&Coproc.toCo, Coproc.coMs);
+	uint8_t val;
+
+	(void)user;
+	(void)addr;
+
+	if (msg == NULL) {
+		return 0xFF;
+	}
+	val = msg->value;
+	SpscRelease(&Coproc.toCo.ring);
+	return val;
+}
+
+static void CoprocXWrite(void *user, const uint16_t addr, const uint8_t val)
+{
+	(void)user;
+	(void)addr;
+
+	if (!CoprocPost(&Coproc.fromCo, Coproc.coMs, val)) {
+		Coproc.dropped++;
+	}
+}
+
+static uint8_t CoprocPortRead(void *user, const int port)
+{
+	(void)user;
+
+	// /INT0 low while a byte from the 68000 is waiting
+	if ((port == 3) && (CoprocPeek(&Coproc.toCo, Coproc.coMs) != NULL)) {
+		return 0xFF & ~0x04;
+	}
+	return 0xFF;
+}
+
+static void *CoprocThread(void *arg)
+{
+	(void)arg;
+
+	while (!__atomic_load_n(&Coproc.stop, __ATOMIC_ACQUIRE)) {
+		uint64_t ms = Coproc.coMs;
+
+		// Don't start millisecond ms until the 68000 has finished ms - skew
+		if ((ms + 1) > (__atomic_load_n(&Coproc.hostMs, __ATOMIC_SEQ_CST) + COPROC_SKEW_MS)) {
+			pthread_mutex_lock(&Coproc.lock);
+			__atomic_store_n(&Coproc.coWaiting, true, __ATOMIC_SEQ_CST);
+			while (!__atomic_load_n(&Coproc.stop, __ATOMIC_ACQUIRE) &&
+					((ms + 1) > (__atomic_load_n(&Coproc.hostMs, __ATOMIC_SEQ_CST) + COPROC_SKEW_MS))) {
+				pthread_cond_wait(&Coproc.cond, &Coproc.lock);
+			}
+			__atomic_store_n(&Coproc.coWaiting, false, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&Coproc.lock);
+			continue;
+		}
+
+		mcs51_run(&Coproc.cpu, (ms + 1) * Coproc.cyclesPerMs);
+		__atomic_store_n(&Coproc.coMs, ms + 1, __ATOMIC_SEQ_CST);
+		CoprocWake(&Coproc.hostWaiting);
+	}
+
+	return NULL;
+}
+
+
+/****************************************************************************
+ * 68000 side
+ ****************************************************************************/
+
+// UART output port changed
+static void CoprocOutPort(const uint8_t outPort)
+{
+	bool strobe = (outPort & COPROC_OP_STROBE) != 0;
+
+	if (strobe && !Coproc.strobe) {
+		if (CoprocPost(&Coproc.toCo, emulatedMs, Coproc.latch)) {
+			Coproc.sent++;
+			Uart.InPort &= ~COPROC_IP_READY;
+		}
+	} else if (!strobe && Coproc.strobe) {
+		if (SpscWriteSlot(&Coproc.toCo.ring) >= 0) {
+			Uart.InPort |= COPROC_IP_READY;
+		}
+	}
+	Coproc.strobe = strobe;
+}
+
+/**
+ * Set up the mailbox, and load the 8051 program from romPath (NULL to only
+ * accept bytes from the 68000). clockHz is the 8051's crystal frequency.
+ */
+int CoprocInit(const char *romPath, const unsigned long clockHz)
+{
+	memset(&Coproc, 0, sizeof(Coproc));
+	SpscInit(&Coproc.toCo.ring, COPROC_MAILBOX_SIZE);
+	SpscInit(&Coproc.fromCo.ring, COPROC_MAILBOX_SIZE);
+
+	Coproc.cyclesPerMs = clockHz / 12 / 1000;
+	if (Coproc.cyclesPerMs == 0) {
+		fprintf(stderr, "8051: clock of %lu Hz is too slow\n", clockHz);
+		return -1;
+	}
+
+	mcs51_init(&Coproc.cpu);
+	if (romPath != NULL) {
+		if (mcs51_load(&Coproc.cpu, romPath) != 0) {
+			return -1;
+		}
+		Coproc.cpu.xread    = CoprocXRead;
+		Coproc.cpu.xwrite   = CoprocXWrite;
+		Coproc.cpu.portRead = CoprocPortRead;
+		Coproc.hasCore = true;
+		fprintf(stderr, "8051: running %s at %.4g MHz\n", romPath, clockHz / 1e6);
+	}
+
+	pthread_mutex_init(&Coproc.lock, NULL);
+	pthread_cond_init(&Coproc.cond, NULL);
+
+	UartSetOutPortTap(CoprocOutPort);
+	Coproc.enabled = true;
+	return 0;
+}
+
+bool CoprocEnabled(void)
+{
+	return Coproc.enabled;
+}
+
+/// Start (or restart, after CoprocSuspend) the 8051 thread
+int CoprocStart(void)
+{
+	if (!Coproc.enabled) {
+		return 0;
+	}
+	if (!Coproc.strobe && (SpscWriteSlot(&Coproc.toCo.ring) >= 0)) {
+		Uart.InPort |= COPROC_IP_READY;
+	}
+	if (!Coproc.hasCore || Coproc.running) {
+		return 0;
+	}
+
+	Coproc.stop = false;
+	if (pthread_create(&Coproc.thread, NULL, CoprocThread, NULL) != 0) {
+		fprintf(stderr, "8051: can't start thread\n");
+		return -1;
+	}
+	Coproc.running = true;
+	return 0;
+}
+
+/**
+ * Stop the 8051 thread, keeping its state, e.g. before fork(). CoprocStart()
+ * carries on from where it was.
+ */
+void CoprocSuspend(void)
+{
+	if (!Coproc.running) {
+		return;
+	}
+
+	pthread_mutex_lock(&Coproc.lock);
+	__atomic_store_n(&Coproc.stop, true, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&Coproc.cond);
+	pthread_mutex_unlock(&Coproc.lock);
+	pthread_join(Coproc.thread, NULL);
+	Coproc.running = false;
+}
+
+/**
+ * The 68000 has finished timeMs milliseconds. Let the 8051 run on, and wait
+ * for it if it is more than the skew behind.
+ */
+void CoprocSync(const uint64_t timeMs)
+{
+	if (!Coproc.enabled) {
+		return;
+	}
+
+	if (!Coproc.hasCore) {
+		// Nothing to run: take the bytes as they arrive
+		ptrdiff_t slot;
+		while ((slot = SpscReadSlot(&Coproc.toCo.ring)) >= 0) {
+#ifdef LOG_COPROC
+			fprintf(stderr, "8051: <- %02X\n", Coproc.toCo.msgs[slot].value);
+#endif
+			SpscRelease(&Coproc.toCo.ring);
+		}
+	} else {
+		__atomic_store_n(&Coproc.hostMs, timeMs, __ATOMIC_SEQ_CST);
+		CoprocWake(&Coproc.coWaiting);
+
+		// Don't start millisecond timeMs until the 8051 has finished timeMs - skew
+		if ((timeMs + 1) > (__atomic_load_n(&Coproc.coMs, __ATOMIC_SEQ_CST) + COPROC_SKEW_MS)) {
+			pthread_mutex_lock(&Coproc.lock);
+			__atomic_store_n(&Coproc.hostWaiting, true, __ATOMIC_SEQ_CST);
+			while (Coproc.running &&
+					((timeMs + 1) > (__atomic_load_n(&Coproc.coMs, __ATOMIC_SEQ_CST) + COPROC_SKEW_MS))) {
+				pthread_cond_wait(&Coproc.cond, &Coproc.lock);
+			}
+			__atomic_store_n(&Coproc.hostWaiting, false, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&Coproc.lock);
+		}
+	}
+
+	// The 8051 has taken bytes, so there's room again
+	if (!Coproc.strobe && (SpscWriteSlot(&Coproc.toCo.ring) >= 0)) {
+		Uart.InPort |= COPROC_IP_READY;
+	}
+}
+
+/// Stop the 8051, and print the mailbox totals
+void CoprocDone(void)
+{
+	if (!Coproc.enabled) {
+		return;
+	}
+
+	CoprocSuspend();
+	fprintf(stderr, "8051: %llu bytes from the 68000, %llu to it",
+			(unsigned long long)Coproc.sent, (unsigned long long)Coproc.received);
+	if (Coproc.dropped > 0) {
+		fprintf(stderr, " (%llu lost, mailbox full)", (unsigned long long)Coproc.dropped);
+	}
+	fprintf(stderr, "\n");
+	Coproc.enabled = false;
+}
+
+/// 68000 write to the mailbox latch (0x240401)
+void CoprocWrite(const uint8_t value)
+{
+	Coproc.latch = value;
+}
+
+/// 68000 read from the mailbox (0x240401): the next byte from the 8051
+uint8_t CoprocRead(void)
+{
+	COPROC_MSG *msg = CoprocPeek(&Coproc.fromCo, emulatedMs);
+	uint8_t val;
+
+	if (msg == NULL) {
+		return 0xFF;
+	}
+	val = msg->value;
+	SpscRelease(&Coproc.fromCo.ring);
+	Coproc.received++;
+	return val;
+}
@@ -0,0 +1,34 @@
+/****************************************************************************
+ * 8051 I/O co-processor
+ *
+ * The byte mailbox at 0x240400 between the 68000 and the I/O board's 8051,
+ * with the 8051 itself run on its own thread, a bounded distance in
+ * emulated time from the 68000.
+ ****************************************************************************/
+
+#ifndef COPROC_H
+#define COPROC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Default 8051 crystal (Hz). One machine cycle is 12 clocks.
+#define COPROC_DEFAULT_CLOCK 12000000
+
+// Most the two CPUs' emulated times may differ by (ms). Mailbox bytes are
+// delivered this long after they were sent.
+#define COPROC_SKEW_MS 1
+
+// Mailbox size each way, in bytes (power of two)
+#define COPROC_MAILBOX_SIZE 4096
+
+int CoprocInit(const char *romPath, const unsigned long clockHz);
+bool CoprocEnabled(void);
+int CoprocStart(void);
+void CoprocSuspend(void);
+void CoprocSync(const uint64_t timeMs);
+void CoprocDone(void);
+void CoprocWrite(const uint8_t value);
+uint8_t CoprocRead(void);
+
+#endif // COPROC_H
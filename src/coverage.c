@@ -0,0 +1,185 @@
+/***
+ * ROM execution coverage
+ *
+ * Records which words of the firmware ROM have been executed, one bit per
+ * 16-bit word, set from the CPU's instruction hook. Marking is a single
+ * compare and OR per instruction, so it is always on; --coverage=FILE saves
+ * the map when the emulator exits (or on SIGUSR1).
+ *
+ * Only the first word of each instruction is marked. Extension words and
+ * operands aren't, so a fully covered routine doesn't show as solid.
+ *
+ * File format: the 8-byte magic "EMTKCOV1", the ROM length in bytes as a
+ * 32-bit little-endian value, then the map. Bit n (LSB first) of map byte k
+ * covers the word at ROM address ((k * 8) + n) * 2.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+#include "coverage.h"
+
+
+static const char CoverageMagic[8] = { 'E', 'M', 'T', 'K', 'C', 'O', 'V', '1' };
+
+uint8_t CoverageMap[COVERAGE_BYTES];
+
+
+/**
+ * Load a coverage file into map (COVERAGE_BYTES long).
+ */
+int CoverageLoad(const char *path, uint8_t *map)
+{
+	uint8_t hdr[12];
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "coverage: can't open %s\n", path);
+		return -1;
+	}
+
+	if ((fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) || (memcmp(hdr, CoverageMagic, sizeof(CoverageMagic)) != 0)) {
+		fprintf(stderr, "coverage: %s is not a coverage file\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	uint32_t len = hdr[8] | (hdr[9] << 8) | (hdr[10] << 16) | ((uint32_t)hdr[11] << 24);
+	if (len != ROM_LENGTH) {
+		fprintf(stderr, "coverage: %s is for a %u byte ROM, expected %u\n", path, len, ROM_LENGTH);
+		fclose(fp);
+		return -1;
+	}
+
+	if (fread(map, 1, COVERAGE_BYTES, fp) != COVERAGE_BYTES) {
+		fprintf(stderr, "coverage: %s is truncated\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * Save a coverage map to a file.
+ */
+int CoverageSave(const char *path, const uint8_t *map)
+{
+	uint8_t hdr[12];
+	FILE *fp = fopen(path, "wb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "coverage: can't create %s\n", path);
+		return -1;
+	}
+
+	memcpy(hdr, CoverageMagic, sizeof(CoverageMagic));
+	hdr[8]  = ROM_LENGTH & 0xFF;
+	hdr[9]  = (ROM_LENGTH >> 8) & 0xFF;
+	hdr[10] = (ROM_LENGTH >> 16) & 0xFF;
+	hdr[11] = (ROM_LENGTH >> 24) & 0xFF;
+
+	if ((fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) ||
+			(fwrite(map, 1, COVERAGE_BYTES, fp) != COVERAGE_BYTES) ||
+			(fclose(fp) != 0)) {
+		fprintf(stderr, "coverage: error writing %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/// Number of ROM words marked in a coverage map
+unsigned long CoverageCount(const uint8_t *map)
+{
+	unsigned long count = 0;
+
+	for (size_t i = 0; i < COVERAGE_BYTES; i++) {
+		count += __builtin_popcount(map[i]);
+	}
+
+	return count;
+}
+
+/**
+ * Merge (OR) several coverage files into one.
+ */
+int CoverageMerge(const char *outPath, const char * const *inPaths, const size_t numIn)
+{
+	static uint8_t merged[COVERAGE_BYTES], map[COVERAGE_BYTES];
+
+	memset(merged, 0, sizeof(merged));
+
+	for (size_t n = 0; n < numIn; n++) {
+		if (CoverageLoad(inPaths[n], map) != 0) {
+			return -1;
+		}
+		for (size_t i = 0; i < COVERAGE_BYTES; i++) {
+			merged[i] |= map[i];
+		}
+		fprintf(stderr, "%s: %lu words\n", inPaths[n], CoverageCount(map));
+	}
+
+	if (CoverageSave(outPath, merged) != 0) {
+		return -1;
+	}
+	fprintf(stderr, "%s: %lu words (%.1f%% of ROM)\n", outPath, CoverageCount(merged),
+			100.0 * CoverageCount(merged) / (ROM_LENGTH / 2));
+
+	return 0;
+}
+
+/// Print the runs of words set in a but not in b, prefixed with tag
+static unsigned long CoverageDiffRuns(const uint8_t *a, const uint8_t *b, const char tag)
+{
+	unsigned long count = 0;
+	long start = -1;
+
+	for (uint32_t w = 0; w <= ROM_LENGTH / 2; w++) {
+		bool set = false;
+		if (w < ROM_LENGTH / 2) {
+			const uint8_t bit = 1 << (w & 7);
+			set = (a[w >> 3] & bit) && !(b[w >> 3] & bit);
+		}
+
+		if (set) {
+			count++;
+			if (start < 0) {
+				start = w;
+			}
+		} else if (start >= 0) {
+			printf("%c %06lX-%06X  %lu words\n", tag, (unsigned long)start * 2, (w * 2) - 1, (unsigned long)(w - start));
+			start = -1;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Print the ROM ranges executed in one coverage file and not the other.
+ *
+ * Lines starting '-' were only reached in pathA, '+' only in pathB.
+ */
+int CoverageDiff(const char *pathA, const char *pathB)
+{
+	static uint8_t a[COVERAGE_BYTES], b[COVERAGE_BYTES];
+
+	if ((CoverageLoad(pathA, a) != 0) || (CoverageLoad(pathB, b) != 0)) {
+		return -1;
+	}
+
+	unsigned long onlyA = CoverageDiffRuns(a, b, '-');
+	unsigned long onlyB = CoverageDiffRuns(b, a, '+');
+
+	printf("# %s: %lu words, %s: %lu words; %lu only in the first, %lu only in the second\n",
+			pathA, CoverageCount(a), pathB, CoverageCount(b), onlyA, onlyB);
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef COVERAGE_H_INCLUDED
+#define COVERAGE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+// Coverage map size: one bit per ROM word
+#define COVERAGE_BYTES (ROM_LENGTH / 16)
+
+// Words of ROM which have been fetched as the first word of an instruction
+extern uint8_t CoverageMap[COVERAGE_BYTES];
+
+/// Instruction hook: mark the word at pc as executed
+#define COVERAGE_MARK(pc) do {													\
+		if ((pc) < ROM_LENGTH) {												\
+			CoverageMap[(pc) >> 4] |= (1 << (((pc) >> 1) & 7));				\
+		}																		\
+	} while (0)
+
+int CoverageLoad(const char *path, uint8_t *map);
+int CoverageSave(const char *path, const uint8_t *map);
+unsigned long CoverageCount(const uint8_t *map);
+int CoverageMerge(const char *outPath, const char * const *inPaths, const size_t numIn);
+int CoverageDiff(const char *pathA, const char *pathB);
+
+#endif // COVERAGE_H_INCLUDED
@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "datatrak_gen.h"
 
@@ -200,8 +201,10 @@ void datatrak_gen_init(DATATRAK_LF_CTX *ctx, const DATATRAK_MODE mode, const DAT
 	// Set initial conditions
 	ctx->goldcode_n = 0;
 	ctx->clock_n = 0;
+	ctx->rfNoiseLevel = 0;
 	for (size_t i=0; i<ctx->numNavslotsTotal; i++) {
 		ctx->slotPhaseOffset[i] = 0;
+		ctx->slotF2PhaseDelta[i] = 0;
 		ctx->slotPower[i] = DATATRAK_RSSI_MIN;
 	}
 
@@ -231,6 +234,46 @@ void datatrak_gen_init(DATATRAK_LF_CTX *ctx, const DATATRAK_MODE mode, const DAT
 	gen_trigger(ctx->trig375_template, 37.5, phi375, 0);
 }
 
+/**
+ * Change the mode and IF-strip compensation of an initialised context,
+ * keeping its signal configuration and cycle position.
+ */
+void datatrak_gen_reconfigure(DATATRAK_LF_CTX *ctx, const DATATRAK_MODE mode, const DATATRAK_COMPENSATION comp)
+{
+	const DATATRAK_LF_CTX old = *ctx;
+
+	datatrak_gen_init(ctx, mode, comp);
+	ctx->rfNoiseLevel = old.rfNoiseLevel;
+	memcpy(ctx->slotPhaseOffset, old.slotPhaseOffset, sizeof(ctx->slotPhaseOffset));
+	memcpy(ctx->slotF2PhaseDelta, old.slotF2PhaseDelta, sizeof(ctx->slotF2PhaseDelta));
+	memcpy(ctx->slotPower, old.slotPower, sizeof(ctx->slotPower));
+	ctx->goldcode_n = old.goldcode_n;
+	ctx->clock_n    = old.clock_n;
+}
+
+/**
+ * Copy the signal configuration and cycle position from one generator
+ * context to another, leaving the destination's compensation mode and
+ * trigger templates alone.
+ *
+ * This lets a second generator (e.g. one with DATATRAK_COMPENSATION_NONE,
+ * for transmission) produce the same cycle as the one driving the emulator.
+ * Both contexts must have been initialised with the same mode.
+ */
+void datatrak_gen_sync(DATATRAK_LF_CTX *dst, const DATATRAK_LF_CTX *src)
+{
+	assert(dst->mode == src->mode);
+
+	dst->rfNoiseLevel = src->rfNoiseLevel;
+	memcpy(dst->slotPhaseOffset, src->slotPhaseOffset, sizeof(dst->slotPhaseOffset));
+	memcpy(dst->slotF2PhaseDelta, src->slotF2PhaseDelta, sizeof(dst->slotF2PhaseDelta));
+	memcpy(dst->slotPower, src->slotPower, sizeof(dst->slotPower));
+	dst->trig1Power = src->trig1Power;
+	dst->trig2Power = src->trig2Power;
+	dst->goldcode_n = src->goldcode_n;
+	dst->clock_n    = src->clock_n;
+}
+
 /**
  * Wrap phase measurement into 0..999 range.
  *
@@ -249,6 +292,15 @@ static inline int phaseWrap(const int x)
 	return xm;
 }
 
+/**
+ * Gold code bit sent in the trigger slot at a given goldcode_n (0-63).
+ * 1 is sent as the 37.5Hz waveform, 0 as the 50Hz waveform.
+ */
+int datatrak_gen_goldcode_bit(const int goldcode_n)
+{
+	return (GOLDCODE[goldcode_n / 32] >> (goldcode_n % 32)) & 1;
+}
+
 void datatrak_gen_generate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf)
 {
 	uint8_t goldcode_word = (ctx->goldcode_n / 32);
@@ -368,7 +420,7 @@ void datatrak_gen_generate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf)
 			// Interlaced mode? If so, generate F2 interlaced slots.
 			if (ctx->mode == DATATRAK_MODE_INTERLACED) {
 				int ilslot_n = navslot_n + (ctx->goldcode_n & 1 ? 16 : 8);
-				int il_phase_ofs = PHASE_ZERO + ctx->slotPhaseOffset[ilslot_n];
+				int il_phase_ofs = PHASE_ZERO + ctx->slotPhaseOffset[ilslot_n] + ctx->slotF2PhaseDelta[ilslot_n];
 
 				if (time_in_slot < 40) {
 					// IL F2+ slot, phase advance.
@@ -405,7 +457,7 @@ void datatrak_gen_generate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf)
 			// We achieve this with phase rotation. One full rotation happens every 25ms.
 			// 1000 counts / 25ms = an increment of 40 counts per ms
 
-			int slot_phase_ofs = PHASE_ZERO + ctx->slotPhaseOffset[navslot_n];
+			int slot_phase_ofs = PHASE_ZERO + ctx->slotPhaseOffset[navslot_n] + ctx->slotF2PhaseDelta[navslot_n];
 
 			if (time_in_slot < 40) {
 				// F2+ slot, phase advance.
@@ -479,22 +531,23 @@ void datatrak_gen_dumpRaw(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char *file
 	fclose(fp);
 }
 
-float phi_f1 = 0, phi_f2 = 0;
-void datatrak_gen_dumpModulated(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char *filename)
+/**
+ * Modulate one cycle of phase data onto a 1 kHz audio carrier.
+ *
+ * Writes ctx->msPerCycle * DATATRAK_MOD_SAMPLES_PER_MS stereo frames (F1 left,
+ * F2 right, 16bit signed) to samp, and returns the number of frames written.
+ * The carrier phase is carried over between calls in *mod.
+ */
+size_t datatrak_gen_modulate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, DATATRAK_MODSTATE *mod, int16_t *samp)
 {
-	FILE *fp = fopen(filename, "ab");
-
-	const double SAMPLERATE = 44100;
+	const double SAMPLERATE = DATATRAK_MOD_SAMPLERATE;
 	const double FREQUENCY  = 1000;
 
-	const size_t SAMPLES_PER_MS = SAMPLERATE/1000;
+	const size_t SAMPLES_PER_MS = DATATRAK_MOD_SAMPLES_PER_MS;
 
 	// Phase shift per cycle (to generate the base modulation frequency)
 	const double theta = (2.0 * M_PI) * FREQUENCY / SAMPLERATE;
 
-	// Sample buffer
-	int16_t samp[SAMPLES_PER_MS*2];
-
 	// Previous phase offset
 	int last_ph_f1 = PHASE_ZERO;
 	int last_ph_f2 = PHASE_ZERO;
@@ -507,17 +560,33 @@ void datatrak_gen_dumpModulated(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char
 		last_ph_f1 = buf->f1_phase[msec];
 		last_ph_f2 = buf->f2_phase[msec];
 
+		int16_t *out = &samp[msec * SAMPLES_PER_MS * 2];
 		for (size_t s = 0; s < SAMPLES_PER_MS; s++) {
 			// update phase
-			phi_f1 = phi_f1 + theta + ph_sh_f1;
-			phi_f2 = phi_f2 + theta + ph_sh_f2;
+			mod->phi_f1 = mod->phi_f1 + theta + ph_sh_f1;
+			mod->phi_f2 = mod->phi_f2 + theta + ph_sh_f2;
 
 			// generate sine point
-			samp[s*2 + 0] = roundf((16383.0 * (buf->f1_amplitude[msec] / 255.0)) * sin(phi_f1));
-			samp[s*2 + 1] = roundf((16383.0 * (buf->f2_amplitude[msec] / 255.0)) * sin(phi_f2));
+			out[s*2 + 0] = roundf((16383.0 * (buf->f1_amplitude[msec] / 255.0)) * sin(mod->phi_f1));
+			out[s*2 + 1] = roundf((16383.0 * (buf->f2_amplitude[msec] / 255.0)) * sin(mod->phi_f2));
 		}
-		fwrite(samp, sizeof(int16_t), SAMPLES_PER_MS*2, fp);
 	}
-	fclose(fp);
+
+	// Keep the accumulators small so float precision doesn't degrade over long runs
+	mod->phi_f1 = fmodf(mod->phi_f1, 2.0 * M_PI);
+	mod->phi_f2 = fmodf(mod->phi_f2, 2.0 * M_PI);
+
+	return ctx->msPerCycle * SAMPLES_PER_MS;
 }
 
+void datatrak_gen_dumpModulated(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char *filename)
+{
+	static DATATRAK_MODSTATE mod = { 0, 0 };
+	static int16_t samp[DATATRAK_BUF_LEN * DATATRAK_MOD_SAMPLES_PER_MS * 2];
+
+	FILE *fp = fopen(filename, "ab");
+
+	size_t n = datatrak_gen_modulate(ctx, buf, &mod, samp);
+	fwrite(samp, sizeof(int16_t), n*2, fp);
+	fclose(fp);
+}
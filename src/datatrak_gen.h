@@ -5,6 +5,7 @@
 #ifndef _DATATRAK_GEN_H
 #define _DATATRAK_GEN_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define DATATRAK_BUF_LEN 1680
@@ -14,6 +15,14 @@
 // RSSI maximum
 #define DATATRAK_RSSI_MAX 255
 
+// Trigger (Gold code) window: start time in the cycle and length, in ms
+#define DATATRAK_TRIG_START 45
+#define DATATRAK_TRIG_LEN 40
+
+// Firmware trigger templates (IIR filter output for a 0 and a 1 bit)
+extern int16_t DT_TRIG50_TEMPLATE[DATATRAK_TRIG_LEN];
+extern int16_t DT_TRIG375_TEMPLATE[DATATRAK_TRIG_LEN];
+
 
 typedef enum {
 	DATATRAK_MODE_EIGHTSLOT,		///< F1 chain only, 8 slots, no interlacing.
@@ -29,6 +38,7 @@ typedef struct {
 	// -- User configurable parameters (at any time) --
 	uint8_t rfNoiseLevel;						///< RF noise level (returned for unmodulated slots)
 	int16_t slotPhaseOffset[24];				///< Slot phase offsets
+	int16_t slotF2PhaseDelta[24];				///< Extra phase offset for each slot's F2 transmissions
 	uint8_t slotPower[24];						///< Slot transmit power
 	uint8_t trig1Power, trig2Power;				///< F1/F2 trigger transmit power
 	DATATRAK_COMPENSATION compensation;			///< IF-strip compensation mode
@@ -44,6 +54,7 @@ typedef struct {
 	int goldcode_n;								///< Current Goldcode offset (0-63)
 	int clock_n;								///< Current Clock value (0-65535)
 	DATATRAK_MODE mode;							///< Eight-slot or interlaced mode select
+	uint32_t replay_n;							///< Next capture cycle, when replaying a capture
 } DATATRAK_LF_CTX;
 
 typedef struct {
@@ -53,9 +64,28 @@ typedef struct {
 	uint8_t  f2_amplitude[DATATRAK_BUF_LEN];	///< F2 signal strength 0-255
 } DATATRAK_OUTBUF;
 
+/// One generated cycle, with the generator state it was generated from
+typedef struct {
+	DATATRAK_LF_CTX ctx;						///< Generator state before the cycle was generated
+	DATATRAK_OUTBUF buf;						///< Generated phase and amplitude data
+} DATATRAK_CYCLE;
+
+// Modulated output sample rate (Hz) and whole samples per millisecond
+#define DATATRAK_MOD_SAMPLERATE 44100
+#define DATATRAK_MOD_SAMPLES_PER_MS (DATATRAK_MOD_SAMPLERATE / 1000)
+
+/// Modulator state, carried from one cycle to the next
+typedef struct {
+	float phi_f1, phi_f2;						///< F1/F2 carrier phase accumulators (radians)
+} DATATRAK_MODSTATE;
+
 void datatrak_gen_init(DATATRAK_LF_CTX *ctx, const DATATRAK_MODE mode, const DATATRAK_COMPENSATION comp);
+void datatrak_gen_reconfigure(DATATRAK_LF_CTX *ctx, const DATATRAK_MODE mode, const DATATRAK_COMPENSATION comp);
+void datatrak_gen_sync(DATATRAK_LF_CTX *dst, const DATATRAK_LF_CTX *src);
+int datatrak_gen_goldcode_bit(const int goldcode_n);
 void datatrak_gen_generate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf);
 void datatrak_gen_dumpRaw(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char *filename);
+size_t datatrak_gen_modulate(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, DATATRAK_MODSTATE *mod, int16_t *samp);
 void datatrak_gen_dumpModulated(DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf, char *filename);
 
 #endif
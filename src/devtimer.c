@@ -0,0 +1,138 @@
+/***
+ * Device timers
+ *
+ * Timers on the devices (the UART's counter/timer, the up/down counters)
+ * were stepped from the main loop, which tied them to how often it ran.
+ * Here a timer is just the machine cycle it started on, its count rate and
+ * the count at which it next expires: the current count is worked out from
+ * MachineCycles() when the firmware reads it, and nothing happens between
+ * reads. The state lives in the owning device's structure, so it's saved
+ * and rewound with the rest of the device.
+ *
+ * Expiries are the only events. The main loop asks DevTimerNext() for the
+ * earliest, runs the CPU no further than that, then calls DevTimerRun() to
+ * call the owners of the timers which are due. A timer started while the
+ * CPU is running tells MachineSchedule(), which cuts the current slice short
+ * if the new expiry comes before its end. So expiries land on the
+ * instruction they're due at, whatever the slice length.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "machine.h"
+#include "main.h"
+
+#include "devtimer.h"
+
+
+static struct {
+	DEVTIMER *timer;
+	void (*expired)(void);
+} DevTimers[DEVTIMER_MAX];
+static unsigned int DevTimerCount = 0;
+
+
+// Machine cycles from the start until count counts have passed (rounded up)
+static uint64_t DevTimerCycles(const uint64_t counts, const uint32_t hz)
+{
+	// Split to keep counts * SYSTEM_CLOCK from overflowing
+	return ((counts / hz) * SYSTEM_CLOCK) + ((((counts % hz) * SYSTEM_CLOCK) + hz - 1) / hz);
+}
+
+/**
+ * Add a timer to those checked for expiry. expired is called when it
+ * expires, after which periodic timers carry on to the next.
+ */
+void DevTimerRegister(DEVTIMER *t, void (*expired)(void))
+{
+	if (DevTimerCount >= DEVTIMER_MAX) {
+		fprintf(stderr, "DEVTIMER: too many timers\n");
+		return;
+	}
+
+	DevTimers[DevTimerCount].timer   = t;
+	DevTimers[DevTimerCount].expired = expired;
+	DevTimerCount++;
+
+	t->hz     = 0;
+	t->expiry = DEVTIMER_NEVER;
+}
+
+/**
+ * Start counting at hz from machine cycle now. The timer first expires
+ * after first counts, then every period counts (never again if period is 0).
+ * A first of 0 counts without ever expiring.
+ */
+void DevTimerStart(DEVTIMER *t, const uint64_t now, const uint32_t hz, const uint64_t first, const uint32_t period)
+{
+	t->start  = now;
+	t->hz     = hz;
+	t->due    = first;
+	t->period = period;
+
+	if (first == 0) {
+		t->expiry = DEVTIMER_NEVER;
+	} else {
+		t->expiry = now + DevTimerCycles(first, hz);
+		MachineSchedule(t->expiry);
+	}
+}
+
+/// Stop counting, and cancel the expiry
+void DevTimerStop(DEVTIMER *t)
+{
+	t->hz     = 0;
+	t->expiry = DEVTIMER_NEVER;
+}
+
+/// Counts since the timer was started, as of machine cycle now (0 if stopped)
+uint64_t DevTimerCounts(const DEVTIMER *t, const uint64_t now)
+{
+	if ((t->hz == 0) || (now < t->start)) {
+		return 0;
+	}
+
+	const uint64_t cycles = now - t->start;
+	return ((cycles / SYSTEM_CLOCK) * t->hz) + (((cycles % SYSTEM_CLOCK) * t->hz) / SYSTEM_CLOCK);
+}
+
+/// Machine cycle of the earliest expiry, or DEVTIMER_NEVER
+uint64_t DevTimerNext(void)
+{
+	uint64_t next = DEVTIMER_NEVER;
+
+	for (unsigned int i = 0; i < DevTimerCount; i++) {
+		if (DevTimers[i].timer->expiry < next) {
+			next = DevTimers[i].timer->expiry;
+		}
+	}
+	return next;
+}
+
+/**
+ * Expire the timers that are due by machine cycle now. An owner is called
+ * once however many periods have gone by, as a latched flag would be set.
+ */
+void DevTimerRun(const uint64_t now)
+{
+	for (unsigned int i = 0; i < DevTimerCount; i++) {
+		DEVTIMER *t = DevTimers[i].timer;
+
+		if (t->expiry > now) {
+			continue;
+		}
+
+		if (t->period == 0) {
+			t->expiry = DEVTIMER_NEVER;
+		} else {
+			// Skip any whole periods missed, to the first expiry after now
+			const uint64_t counts = DevTimerCounts(t, now);
+			t->due   += ((counts - t->due) / t->period + 1) * t->period;
+			t->expiry = t->start + DevTimerCycles(t->due, t->hz);
+		}
+
+		DevTimers[i].expired();
+	}
+}
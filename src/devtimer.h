@@ -0,0 +1,37 @@
+/****************************************************************************
+ * Device timers
+ *
+ * Counters worked out from the emulated cycle count when they're read,
+ * rather than stepped as time passes. A timer keeps the cycle it was started
+ * on and its count rate; the only thing scheduled is its next expiry, which
+ * the CPU is run up to.
+ ****************************************************************************/
+
+#ifndef DEVTIMER_H
+#define DEVTIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Expiry of a timer that isn't going to expire
+#define DEVTIMER_NEVER UINT64_MAX
+
+// Most timers that can be registered
+#define DEVTIMER_MAX 4
+
+typedef struct {
+	uint64_t start;				///< Machine cycle the count started on
+	uint64_t due;				///< Counts from start to the next expiry
+	uint64_t expiry;			///< Machine cycle of the next expiry, or DEVTIMER_NEVER
+	uint32_t hz;				///< Count rate, 0 when stopped
+	uint32_t period;			///< Counts between expiries after the first, 0 for one-shot
+} DEVTIMER;
+
+void DevTimerRegister(DEVTIMER *t, void (*expired)(void));
+void DevTimerStart(DEVTIMER *t, const uint64_t now, const uint32_t hz, const uint64_t first, const uint32_t period);
+void DevTimerStop(DEVTIMER *t);
+uint64_t DevTimerCounts(const DEVTIMER *t, const uint64_t now);
+uint64_t DevTimerNext(void);
+void DevTimerRun(const uint64_t now);
+
+#endif // DEVTIMER_H
@@ -0,0 +1,311 @@
+/***
+ * Serial EEPROM
+ *
+ * The firmware bit-bangs a Microwire serial EEPROM through DIGOP2: SK is
+ * bit 1, CS bit 2 and DI bit 3 (bits 4, 5 and 7 drive other things and are
+ * ignored here). DO comes back on bit 2 of RDIO. The routines are at
+ * 0x1FC18-0x1FEDE in the ROM. Every command is 11 bits long (start bit,
+ * 2-bit opcode, 8-bit address) and data is 16 bits, so the part is a 93C66
+ * in x16 mode:
+ *
+ *   1 10 AAAAAAAA          READ   (a dummy 0, then D15..D0 on DO)
+ *   1 01 AAAAAAAA D*16     WRITE
+ *   1 11 AAAAAAAA          ERASE
+ *   1 00 11xxxxxx          EWEN   (write enable)
+ *   1 00 00xxxxxx          EWDS   (write disable)
+ *   1 00 10xxxxxx          ERAL   (erase all)
+ *   1 00 01xxxxxx D*16     WRAL   (write all)
+ *
+ * Bits are taken on the rising edge of SK while CS is high, and leading
+ * zeroes before the start bit are ignored. Write and erase cycles happen
+ * when CS goes low, and complete at once: the firmware raises CS again and
+ * polls DO for the ready (1) status, which it sees straight away.
+ *
+ * The contents are mmap()ed from an image file (256 big-endian words,
+ * address 0 first), so they are in the file as soon as the firmware writes
+ * them and survive the emulator being killed. A private mapping is used
+ * when runs must all start from the same stored state (--bench, --sweep and
+ * --lockstep): the file is read, and changes to it are discarded.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "eeprom.h"
+
+// Define this to log EEPROM commands
+// #define LOG_EEPROM
+
+// Protocol states
+enum {
+	EEPROM_STATE_IDLE,		///< Waiting for a start bit
+	EEPROM_STATE_CMD,		///< Shifting in the opcode and address
+	EEPROM_STATE_READ,		///< Shifting out data
+	EEPROM_STATE_DATA,		///< Shifting in data for WRITE or WRAL
+	EEPROM_STATE_ARMED,		///< Command complete, runs when CS goes low
+	EEPROM_STATE_DONE		///< Command complete, ignore clocks until CS goes low
+};
+
+// Opcodes
+#define EEPROM_OP_EXT	0
+#define EEPROM_OP_WRITE	1
+#define EEPROM_OP_READ	2
+#define EEPROM_OP_ERASE	3
+
+// Command length after the start bit (opcode + address)
+#define EEPROM_CMD_BITS 10
+
+static struct {
+	uint8_t *image;			///< EEPROM_BYTES of contents
+	bool shared;			///< image is a shared mapping of a file
+	EEPROM_STATE s;
+} Eeprom;
+
+
+static inline uint16_t EepromGetWord(const uint8_t addr)
+{
+	return (Eeprom.image[addr * 2] << 8) | Eeprom.image[(addr * 2) + 1];
+}
+
+static inline void EepromSetWord(const uint8_t addr, const uint16_t val)
+{
+	Eeprom.image[addr * 2]       = val >> 8;
+	Eeprom.image[(addr * 2) + 1] = val & 0xFF;
+}
+
+/**
+ * Map the EEPROM contents from the image file at path, creating a blank
+ * (all 0xFF) image if it doesn't exist. If shared is false, writes go to a
+ * private copy and the file isn't changed. With no path the EEPROM starts
+ * blank and its contents are lost on exit.
+ */
+int EepromInit(const char *path, const bool shared)
+{
+	struct stat st;
+	bool blank = false;
+	int fd;
+
+	memset(&Eeprom, 0, sizeof(Eeprom));
+	Eeprom.s.dout = true;
+
+	if (path == NULL) {
+		Eeprom.image = mmap(NULL, EEPROM_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (Eeprom.image == MAP_FAILED) {
+			Eeprom.image = NULL;
+			fprintf(stderr, "EEPROM: can't allocate image: %s\n", strerror(errno));
+			return -1;
+		}
+		memset(Eeprom.image, 0xFF, EEPROM_BYTES);
+		return 0;
+	}
+
+	fd = open(path, shared ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "EEPROM: can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "EEPROM: can't stat %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if ((st.st_size == 0) && shared) {
+		if (ftruncate(fd, EEPROM_BYTES) != 0) {
+			fprintf(stderr, "EEPROM: can't extend %s: %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		blank = true;
+	} else if (st.st_size != EEPROM_BYTES) {
+		fprintf(stderr, "EEPROM: %s is %lld bytes, expected %d\n", path, (long long)st.st_size, EEPROM_BYTES);
+		close(fd);
+		return -1;
+	}
+
+	Eeprom.image = mmap(NULL, EEPROM_BYTES, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (Eeprom.image == MAP_FAILED) {
+		Eeprom.image = NULL;
+		fprintf(stderr, "EEPROM: can't map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	Eeprom.shared = shared;
+
+	if (blank) {
+		memset(Eeprom.image, 0xFF, EEPROM_BYTES);
+	}
+
+	fprintf(stderr, "EEPROM: %s%s\n", path,
+			blank ? " (new, blank)" : (shared ? "" : " (changes discarded)"));
+	return 0;
+}
+
+/// Write the contents back to the image file, and unmap it
+void EepromDone(void)
+{
+	if (Eeprom.image == NULL) {
+		return;
+	}
+	if (Eeprom.shared && (msync(Eeprom.image, EEPROM_BYTES, MS_SYNC) != 0)) {
+		fprintf(stderr, "EEPROM: can't save image: %s\n", strerror(errno));
+	}
+	munmap(Eeprom.image, EEPROM_BYTES);
+	Eeprom.image = NULL;
+}
+
+// CS has gone low: run an armed write or erase command
+static void EepromEndCommand(void)
+{
+	if (Eeprom.s.state == EEPROM_STATE_ARMED) {
+		if (!Eeprom.s.writeEnable) {
+#ifdef LOG_EEPROM
+			fprintf(stderr, "EEPROM: op %u addr %02X while write disabled\n", Eeprom.s.cmd, Eeprom.s.addr);
+#endif
+		} else if (Eeprom.s.cmd == EEPROM_OP_WRITE) {
+			EepromSetWord(Eeprom.s.addr, Eeprom.s.shift);
+		} else if (Eeprom.s.cmd == EEPROM_OP_ERASE) {
+			EepromSetWord(Eeprom.s.addr, 0xFFFF);
+		} else {
+			// ERAL or WRAL
+			uint16_t val = ((Eeprom.s.addr >> 6) == 2) ? 0xFFFF : Eeprom.s.shift;
+			for (unsigned int i = 0; i < EEPROM_WORDS; i++) {
+				EepromSetWord(i, val);
+			}
+		}
+#ifdef LOG_EEPROM
+		fprintf(stderr, "EEPROM: op %u addr %02X data %04X\n", Eeprom.s.cmd, Eeprom.s.addr, Eeprom.s.shift);
+#endif
+	}
+
+	Eeprom.s.state = EEPROM_STATE_IDLE;
+	Eeprom.s.bits  = 0;
+	Eeprom.s.dout  = true;
+}
+
+// Opcode and address shifted in
+static void EepromDecode(void)
+{
+	Eeprom.s.cmd  = (Eeprom.s.shift >> 8) & 3;
+	Eeprom.s.addr = Eeprom.s.shift & 0xFF;
+	Eeprom.s.bits = 0;
+
+	switch (Eeprom.s.cmd) {
+		case EEPROM_OP_READ:
+			Eeprom.s.shift = EepromGetWord(Eeprom.s.addr);
+			Eeprom.s.dout  = false;			// dummy bit
+			Eeprom.s.state = EEPROM_STATE_READ;
+			break;
+
+		case EEPROM_OP_WRITE:
+			Eeprom.s.shift = 0;
+			Eeprom.s.state = EEPROM_STATE_DATA;
+			break;
+
+		case EEPROM_OP_ERASE:
+			Eeprom.s.state = EEPROM_STATE_ARMED;
+			break;
+
+		default:
+			switch (Eeprom.s.addr >> 6) {
+				case 3:		// EWEN
+				case 0:		// EWDS
+					Eeprom.s.writeEnable = (Eeprom.s.addr >> 6) == 3;
+					Eeprom.s.state = EEPROM_STATE_DONE;
+					break;
+				case 2:		// ERAL
+					Eeprom.s.state = EEPROM_STATE_ARMED;
+					break;
+				default:	// WRAL
+					Eeprom.s.shift = 0;
+					Eeprom.s.state = EEPROM_STATE_DATA;
+					break;
+			}
+			break;
+	}
+}
+
+// Rising edge on SK while CS is high
+static void EepromClock(const bool din)
+{
+	switch (Eeprom.s.state) {
+		case EEPROM_STATE_IDLE:
+			if (din) {
+				Eeprom.s.state = EEPROM_STATE_CMD;
+				Eeprom.s.shift = 0;
+				Eeprom.s.bits  = 0;
+			}
+			break;
+
+		case EEPROM_STATE_CMD:
+			Eeprom.s.shift = (Eeprom.s.shift << 1) | din;
+			if (++Eeprom.s.bits == EEPROM_CMD_BITS) {
+				EepromDecode();
+			}
+			break;
+
+		case EEPROM_STATE_READ:
+			// Reads carry on into the following words while clocks keep coming
+			Eeprom.s.dout = (Eeprom.s.shift & 0x8000) != 0;
+			Eeprom.s.shift <<= 1;
+			if (++Eeprom.s.bits == 16) {
+				Eeprom.s.addr++;
+				Eeprom.s.shift = EepromGetWord(Eeprom.s.addr);
+				Eeprom.s.bits  = 0;
+			}
+			break;
+
+		case EEPROM_STATE_DATA:
+			Eeprom.s.shift = (Eeprom.s.shift << 1) | din;
+			if (++Eeprom.s.bits == 16) {
+				Eeprom.s.state = EEPROM_STATE_ARMED;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/// CPU write to DIGOP2
+void EepromWrite(const uint8_t value)
+{
+	const uint8_t prev = Eeprom.s.digop2;
+
+	Eeprom.s.digop2 = value;
+
+	if (!(value & EEPROM_CS)) {
+		if (prev & EEPROM_CS) {
+			EepromEndCommand();
+		}
+		return;
+	}
+
+	if ((value & EEPROM_SK) && !(prev & EEPROM_SK)) {
+		EepromClock((value & EEPROM_DI) != 0);
+	}
+}
+
+/// CPU read from RDIO. Other inputs on the port read as 1.
+uint8_t EepromRead(void)
+{
+	return Eeprom.s.dout ? 0xFF : (0xFF & ~EEPROM_DO);
+}
+
+/// Save the serial interface state (not the contents)
+void EepromGetState(EEPROM_STATE *s)
+{
+	*s = Eeprom.s;
+}
+
+/// Restore the serial interface state
+void EepromSetState(const EEPROM_STATE *s)
+{
+	Eeprom.s = *s;
+}
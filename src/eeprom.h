@@ -0,0 +1,46 @@
+/****************************************************************************
+ * Serial EEPROM
+ *
+ * The 93C66-style Microwire EEPROM (256 x 16 bits) which holds the
+ * Locator's settings, bit-banged through DIGOP2 (0x240801) and read back
+ * through RDIO (0x240101). The contents can be kept in an image file.
+ ****************************************************************************/
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size of the EEPROM in 16-bit words, and of its image file in bytes
+#define EEPROM_WORDS 256
+#define EEPROM_BYTES (EEPROM_WORDS * 2)
+
+// DIGOP2 (output) bits
+#define EEPROM_SK	0x02		///< Serial clock
+#define EEPROM_CS	0x04		///< Chip select
+#define EEPROM_DI	0x08		///< Data in (to the EEPROM)
+
+// RDIO (input) bits
+#define EEPROM_DO	0x04		///< Data out (from the EEPROM)
+
+/// Serial interface state, saved with each rewind snapshot
+typedef struct {
+	uint8_t digop2;		///< Last value written to DIGOP2
+	uint8_t state;		///< Protocol state (EEPROM_STATE_xxx in eeprom.c)
+	uint8_t bits;		///< Bits shifted in or out in this state
+	uint8_t cmd;		///< Opcode of the current command
+	uint8_t addr;		///< Word address of the current command
+	uint16_t shift;		///< Shift register
+	bool dout;			///< DO pin level
+	bool writeEnable;	///< Set by EWEN, cleared by EWDS
+} EEPROM_STATE;
+
+int EepromInit(const char *path, const bool shared);
+void EepromDone(void);
+void EepromWrite(const uint8_t value);
+uint8_t EepromRead(void);
+void EepromGetState(EEPROM_STATE *s);
+void EepromSetState(const EEPROM_STATE *s);
+
+#endif // EEPROM_H
@@ -0,0 +1,904 @@
+/***
+ * GDB remote stub
+ *
+ * Implements enough of the GDB Remote Serial Protocol to debug the firmware
+ * from GDB: register and memory access, single step, continue, breakpoints
+ * (Z0/Z1) and watchpoints (Z2/Z3/Z4).
+ *
+ * The CPU only pays for breakpoints in pages that have one. Musashi calls
+ * GDB_INSTR_HOOK before every instruction, which tests one bit of
+ * GdbBreakPages and only calls GdbInstrHook() if the instruction's page is
+ * marked. Watchpoints work the same way through GdbWatchPages, tested in the
+ * bus handlers. To stop the CPU (single step, Ctrl-C, attach, watchpoint
+ * hit) every page is marked, so the next instruction comes here.
+ *
+ * While the target is stopped the stub runs its packet loop inside the
+ * instruction hook, with the CPU between instructions, and returns to let
+ * it carry on when GDB sends 'c' or 's'.
+ *
+ * Memory reads and writes from GDB go straight to the ROM and RAM arrays,
+ * so inspecting memory never triggers side effects in the I/O devices
+ * (peripheral space reads as zero).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "m68k.h"
+
+#include "machine.h"
+#include "main.h"
+#include "wordops.h"
+
+#include "rewind.h"
+#include "statehash.h"
+#include "gdbstub.h"
+
+
+// Define to log every packet to stderr
+// #define GDB_DEBUG_PACKETS
+
+// Maximum packet size (advertised to GDB in qSupported)
+#define GDB_PACKET_MAX 4096
+
+// How often a wait for GDB checks for Ctrl-C on the emulator (milliseconds)
+#define GDB_QUIT_POLL_MS 100
+
+// Maximum number of breakpoints and watchpoints
+#define GDB_MAX_BREAKS 64
+#define GDB_MAX_WATCHES 16
+
+// Stop signals
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+// Z packet types
+enum {
+	GDB_Z_SWBREAK = 0,
+	GDB_Z_HWBREAK = 1,
+	GDB_Z_WATCH   = 2,
+	GDB_Z_RWATCH  = 3,
+	GDB_Z_AWATCH  = 4
+};
+
+uint32_t GdbBreakPages[GDB_NUM_PAGES / 32];
+uint8_t GdbWatchPages[GDB_NUM_PAGES];
+
+static struct {
+	int listen;					// listening socket (-1 if the stub is off)
+	int sock;					// connected GDB (-1 when none)
+	bool noAck;					// QStartNoAckMode negotiated
+
+	uint8_t rxbuf[256];			// receive buffer
+	size_t rxlen, rxpos;
+
+	bool attachStop;			// stopping because GDB just connected
+	bool haltRequest;			// stop at the next instruction
+	int haltSignal;				// signal to report for a halt request
+	bool stepping;				// stop after one instruction
+	bool skipBreak;				// resuming from the breakpoint at skipPc
+	uint32_t skipPc;
+
+	bool watchHit;				// a watchpoint fired during the last instruction
+	uint32_t watchAddr;
+	int watchType;
+
+	uint32_t breaks[GDB_MAX_BREAKS];
+	size_t numBreaks;
+
+	struct {
+		uint32_t addr, len;
+		int type;
+	} watches[GDB_MAX_WATCHES];
+	size_t numWatches;
+} Gdb = { .listen = -1, .sock = -1 };
+
+static const char GdbTargetXml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target version=\"1.0\">"
+	"<architecture>m68k</architecture>"
+	"<feature name=\"org.gnu.gdb.m68k.core\">"
+	"<reg name=\"d0\" bitsize=\"32\"/><reg name=\"d1\" bitsize=\"32\"/>"
+	"<reg name=\"d2\" bitsize=\"32\"/><reg name=\"d3\" bitsize=\"32\"/>"
+	"<reg name=\"d4\" bitsize=\"32\"/><reg name=\"d5\" bitsize=\"32\"/>"
+	"<reg name=\"d6\" bitsize=\"32\"/><reg name=\"d7\" bitsize=\"32\"/>"
+	"<reg name=\"a0\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"a1\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"a2\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"a3\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"a4\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"a5\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"fp\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"ps\" bitsize=\"32\"/><reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+	"</feature>"
+	"</target>";
+
+// GDB register numbers, in 'g' packet order
+static const m68k_register_t GdbRegs[] = {
+	M68K_REG_D0, M68K_REG_D1, M68K_REG_D2, M68K_REG_D3,
+	M68K_REG_D4, M68K_REG_D5, M68K_REG_D6, M68K_REG_D7,
+	M68K_REG_A0, M68K_REG_A1, M68K_REG_A2, M68K_REG_A3,
+	M68K_REG_A4, M68K_REG_A5, M68K_REG_A6, M68K_REG_A7,
+	M68K_REG_SR, M68K_REG_PC
+};
+#define GDB_NUM_REGS (sizeof(GdbRegs) / sizeof(GdbRegs[0]))
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Breakpoint and watchpoint page maps
+
+static inline void GdbMarkPage(const uint32_t address)
+{
+	const uint32_t page = (address & 0xFFFFFF) >> GDB_PAGE_BITS;
+	GdbBreakPages[page / 32] |= (1UL << (page % 32));
+}
+
+static bool GdbStopPending(void)
+{
+	return Gdb.haltRequest || Gdb.stepping || Gdb.watchHit;
+}
+
+// Rebuild the page maps from the breakpoint and watchpoint lists
+static void GdbUpdatePages(void)
+{
+	if (GdbStopPending()) {
+		memset(GdbBreakPages, 0xFF, sizeof(GdbBreakPages));
+	} else {
+		memset(GdbBreakPages, 0, sizeof(GdbBreakPages));
+		for (size_t i = 0; i < Gdb.numBreaks; i++) {
+			GdbMarkPage(Gdb.breaks[i]);
+		}
+	}
+
+	memset(GdbWatchPages, 0, sizeof(GdbWatchPages));
+	for (size_t i = 0; i < Gdb.numWatches; i++) {
+		uint8_t flags;
+		switch (Gdb.watches[i].type) {
+			case GDB_Z_WATCH:  flags = GDB_WATCH_WRITE; break;
+			case GDB_Z_RWATCH: flags = GDB_WATCH_READ; break;
+			default:           flags = GDB_WATCH_READ | GDB_WATCH_WRITE; break;
+		}
+		// Start three bytes early, so a long access starting in the page
+		// before and overlapping the watched range is seen
+		uint32_t first = ((Gdb.watches[i].addr - 3) & 0xFFFFFF) >> GDB_PAGE_BITS;
+		uint32_t last  = ((Gdb.watches[i].addr + Gdb.watches[i].len - 1) & 0xFFFFFF) >> GDB_PAGE_BITS;
+		for (uint32_t p = first; p != ((last + 1) % GDB_NUM_PAGES); p = (p + 1) % GDB_NUM_PAGES) {
+			GdbWatchPages[p] |= flags;
+		}
+	}
+}
+
+// Forget all breakpoints and watchpoints, and let the CPU run freely
+static void GdbClearAll(void)
+{
+	Gdb.numBreaks = Gdb.numWatches = 0;
+	Gdb.haltRequest = Gdb.stepping = Gdb.watchHit = Gdb.skipBreak = false;
+	GdbUpdatePages();
+}
+
+static bool GdbIsBreak(const uint32_t pc)
+{
+	for (size_t i = 0; i < Gdb.numBreaks; i++) {
+		if (Gdb.breaks[i] == pc) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Connection and packet I/O
+
+static void GdbDisconnect(void)
+{
+	if (Gdb.sock >= 0) {
+		close(Gdb.sock);
+		Gdb.sock = -1;
+		fprintf(stderr, "GDB: client disconnected\n");
+	}
+	GdbClearAll();
+}
+
+// Blocking read of one byte from GDB. Returns -1 if the connection is lost,
+// or the emulator has been told to quit: the target can be stopped waiting
+// here for as long as GDB likes, and Ctrl-C must still get out.
+static int GdbGetChar(void)
+{
+	if (Gdb.rxpos >= Gdb.rxlen) {
+		ssize_t n;
+		for (;;) {
+			if (quitRequested) {
+				return -1;
+			}
+			struct pollfd pfd = { .fd = Gdb.sock, .events = POLLIN };
+			int r = poll(&pfd, 1, GDB_QUIT_POLL_MS);
+			if ((r == 0) || ((r < 0) && (errno == EINTR))) {
+				continue;
+			} else if (r < 0) {
+				return -1;
+			}
+			n = recv(Gdb.sock, Gdb.rxbuf, sizeof(Gdb.rxbuf), 0);
+			if ((n >= 0) || (errno != EINTR)) {
+				break;
+			}
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		Gdb.rxlen = n;
+		Gdb.rxpos = 0;
+	}
+	return Gdb.rxbuf[Gdb.rxpos++];
+}
+
+static bool GdbSendRaw(const char *s, const size_t len)
+{
+	return send(Gdb.sock, s, len, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+static const char GdbHex[] = "0123456789abcdef";
+
+static int GdbHexVal(const char c)
+{
+	if ((c >= '0') && (c <= '9')) return c - '0';
+	if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+	return -1;
+}
+
+// Send a packet and wait for it to be acknowledged. Returns false if GDB went away.
+static bool GdbSendPacket(const char *data)
+{
+	static char buf[GDB_PACKET_MAX + 4];
+	size_t len = strlen(data);
+	uint8_t sum = 0;
+
+	if (len > GDB_PACKET_MAX) {
+		len = GDB_PACKET_MAX;
+	}
+
+	buf[0] = '$';
+	for (size_t i = 0; i < len; i++) {
+		buf[i + 1] = data[i];
+		sum += (uint8_t)data[i];
+	}
+	buf[len + 1] = '#';
+	buf[len + 2] = GdbHex[sum >> 4];
+	buf[len + 3] = GdbHex[sum & 15];
+
+#ifdef GDB_DEBUG_PACKETS
+	fprintf(stderr, "GDB -> %.*s\n", (int)len, data);
+#endif
+
+	for (;;) {
+		if (!GdbSendRaw(buf, len + 4)) {
+			return false;
+		}
+		if (Gdb.noAck) {
+			return true;
+		}
+		int c = GdbGetChar();
+		if (c < 0) {
+			return false;
+		} else if (c == '+') {
+			return true;
+		}
+		// '-' or noise: send again
+	}
+}
+
+/**
+ * Receive one packet into buf (NUL terminated, without framing).
+ * Returns false if GDB went away.
+ */
+static bool GdbGetPacket(char *buf, const size_t bufsize)
+{
+	for (;;) {
+		int c;
+
+		// Wait for the start of a packet; stray acks and interrupts are ignored
+		do {
+			c = GdbGetChar();
+			if (c < 0) {
+				return false;
+			}
+		} while (c != '$');
+
+		size_t len = 0;
+		uint8_t sum = 0;
+		for (;;) {
+			c = GdbGetChar();
+			if (c < 0) {
+				return false;
+			} else if (c == '#') {
+				break;
+			}
+			sum += (uint8_t)c;
+			if (len < bufsize - 1) {
+				buf[len++] = c;
+			}
+		}
+		buf[len] = '\0';
+
+		int hi = GdbGetChar(), lo = GdbGetChar();
+		if ((hi < 0) || (lo < 0)) {
+			return false;
+		}
+
+		if (!Gdb.noAck) {
+			if (((GdbHexVal(hi) << 4) | GdbHexVal(lo)) != sum) {
+				GdbSendRaw("-", 1);
+				continue;
+			}
+			GdbSendRaw("+", 1);
+		}
+
+#ifdef GDB_DEBUG_PACKETS
+		fprintf(stderr, "GDB <- %s\n", buf);
+#endif
+		return true;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Target access
+
+// Read a byte for the debugger, without touching any I/O device
+static uint8_t GdbPeek(uint32_t address)
+{
+	address &= 0xFFFFFF;
+	if (address < ROM_LENGTH) {
+		return BYTE_READ(rom, address);
+	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
+		return BYTE_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
+	}
+	return 0;
+}
+
+// Write a byte for the debugger. ROM can be patched; I/O space can't be written.
+static bool GdbPoke(uint32_t address, const uint8_t value)
+{
+	address &= 0xFFFFFF;
+	if (address < ROM_LENGTH) {
+		BYTE_WRITE(rom, address, value);
+	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
+		StateHashRamWrite((address - RAM_BASE) & (RAM_LENGTH - 1), value, 1);
+		BYTE_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
+		REWIND_MARK_DIRTY(address - RAM_BASE, 1);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static char *GdbPutHex32(char *p, const uint32_t val)
+{
+	for (int shift = 28; shift >= 0; shift -= 4) {
+		*p++ = GdbHex[(val >> shift) & 15];
+	}
+	return p;
+}
+
+// Parse up to 8 hex digits from *p, advancing *p past them
+static uint32_t GdbGetHex(const char **p)
+{
+	uint32_t val = 0;
+	int d;
+	while ((d = GdbHexVal(**p)) >= 0) {
+		val = (val << 4) | d;
+		(*p)++;
+	}
+	return val;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Command handling
+
+static void GdbStopReply(char *out, const int signal)
+{
+	if (Gdb.watchHit) {
+		const char *kind = (Gdb.watchType == GDB_Z_RWATCH) ? "rwatch" :
+				(Gdb.watchType == GDB_Z_AWATCH) ? "awatch" : "watch";
+		sprintf(out, "T%02x%s:%x;", GDB_SIGTRAP, kind, Gdb.watchAddr);
+	} else {
+		sprintf(out, "S%02x", signal);
+	}
+}
+
+static bool GdbInsertPoint(const int type, const uint32_t addr, const uint32_t len)
+{
+	if ((type == GDB_Z_SWBREAK) || (type == GDB_Z_HWBREAK)) {
+		if (GdbIsBreak(addr)) {
+			return true;
+		}
+		if (Gdb.numBreaks >= GDB_MAX_BREAKS) {
+			return false;
+		}
+		Gdb.breaks[Gdb.numBreaks++] = addr;
+	} else {
+		if (Gdb.numWatches >= GDB_MAX_WATCHES) {
+			return false;
+		}
+		Gdb.watches[Gdb.numWatches].addr = addr;
+		Gdb.watches[Gdb.numWatches].len  = (len > 0) ? len : 1;
+		Gdb.watches[Gdb.numWatches].type = type;
+		Gdb.numWatches++;
+	}
+	GdbUpdatePages();
+	return true;
+}
+
+static bool GdbRemovePoint(const int type, const uint32_t addr, const uint32_t len)
+{
+	if ((type == GDB_Z_SWBREAK) || (type == GDB_Z_HWBREAK)) {
+		for (size_t i = 0; i < Gdb.numBreaks; i++) {
+			if (Gdb.breaks[i] == addr) {
+				Gdb.breaks[i] = Gdb.breaks[--Gdb.numBreaks];
+				GdbUpdatePages();
+				return true;
+			}
+		}
+	} else {
+		for (size_t i = 0; i < Gdb.numWatches; i++) {
+			if ((Gdb.watches[i].addr == addr) && (Gdb.watches[i].type == type) &&
+					(Gdb.watches[i].len == ((len > 0) ? len : 1))) {
+				Gdb.watches[i] = Gdb.watches[--Gdb.numWatches];
+				GdbUpdatePages();
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Handle qXfer:features:read:target.xml:OFFSET,LENGTH
+static void GdbXferFeatures(const char *args, char *out)
+{
+	const char *p = args;
+	const size_t total = sizeof(GdbTargetXml) - 1;
+
+	if (strncmp(p, "target.xml:", 11) != 0) {
+		strcpy(out, "E00");
+		return;
+	}
+	p += 11;
+	uint32_t off = GdbGetHex(&p);
+	if (*p++ != ',') {
+		strcpy(out, "E00");
+		return;
+	}
+	uint32_t len = GdbGetHex(&p);
+
+	if (len > GDB_PACKET_MAX - 2) {
+		len = GDB_PACKET_MAX - 2;
+	}
+	if (off >= total) {
+		strcpy(out, "l");
+		return;
+	}
+	if (off + len >= total) {
+		len = total - off;
+		out[0] = 'l';
+	} else {
+		out[0] = 'm';
+	}
+	memcpy(&out[1], &GdbTargetXml[off], len);
+	out[len + 1] = '\0';
+}
+
+// Print a message on the GDB console
+static void GdbConsole(const char *msg)
+{
+	static char buf[GDB_PACKET_MAX + 1];
+	char *o = buf;
+
+	*o++ = 'O';
+	while ((*msg != '\0') && (o < &buf[GDB_PACKET_MAX - 1])) {
+		*o++ = GdbHex[(uint8_t)*msg >> 4];
+		*o++ = GdbHex[(uint8_t)*msg & 15];
+		msg++;
+	}
+	*o = '\0';
+	GdbSendPacket(buf);
+}
+
+/**
+ * Handle a 'monitor' command (qRcmd, hex encoded)
+ *
+ * Supported commands:
+ *   rewind N    step the machine back N ms of emulated time (needs --rewind)
+ */
+static void GdbMonitor(const char *hex, char *out)
+{
+	char cmd[256];
+	size_t len = 0;
+
+	while ((hex[0] != '\0') && (hex[1] != '\0') && (len < sizeof(cmd) - 1)) {
+		cmd[len++] = (GdbHexVal(hex[0]) << 4) | GdbHexVal(hex[1]);
+		hex += 2;
+	}
+	cmd[len] = '\0';
+
+	unsigned long long ms;
+	if (sscanf(cmd, "rewind %llu", &ms) == 1) {
+		if (MachineRewind(ms) == 0) {
+			char msg[80];
+			snprintf(msg, sizeof(msg), "Rewound, pc=%08x. Use 'flushregs' to refresh GDB's view.\n",
+					m68k_get_reg(NULL, M68K_REG_PC));
+			GdbConsole(msg);
+			strcpy(out, "OK");
+		} else {
+			GdbConsole("Rewind failed (is --rewind enabled?)\n");
+			strcpy(out, "E01");
+		}
+	} else {
+		GdbConsole("Commands: rewind N (ms)\n");
+		strcpy(out, "OK");
+	}
+}
+
+/**
+ * Handle one packet while the target is stopped.
+ *
+ * Returns true if the CPU should resume.
+ */
+static bool GdbHandlePacket(const char *pkt, char *out)
+{
+	const char *p = pkt + 1;
+	out[0] = '\0';
+
+	switch (pkt[0]) {
+		case '?':
+			GdbStopReply(out, Gdb.haltSignal);
+			break;
+
+		case 'g':
+			{
+				char *o = out;
+				for (size_t i = 0; i < GDB_NUM_REGS; i++) {
+					o = GdbPutHex32(o, m68k_get_reg(NULL, GdbRegs[i]));
+				}
+				*o = '\0';
+			}
+			break;
+
+		case 'G':
+			if (strlen(p) < GDB_NUM_REGS * 8) {
+				strcpy(out, "E01");
+				break;
+			}
+			for (size_t i = 0; i < GDB_NUM_REGS; i++) {
+				char hex[9];
+				const char *h = hex;
+				memcpy(hex, &p[i * 8], 8);
+				hex[8] = '\0';
+				m68k_set_reg(GdbRegs[i], GdbGetHex(&h));
+			}
+			strcpy(out, "OK");
+			break;
+
+		case 'p':
+			{
+				uint32_t n = GdbGetHex(&p);
+				if (n < GDB_NUM_REGS) {
+					*GdbPutHex32(out, m68k_get_reg(NULL, GdbRegs[n])) = '\0';
+				} else {
+					strcpy(out, "E01");
+				}
+			}
+			break;
+
+		case 'P':
+			{
+				uint32_t n = GdbGetHex(&p);
+				if ((n < GDB_NUM_REGS) && (*p++ == '=')) {
+					m68k_set_reg(GdbRegs[n], GdbGetHex(&p));
+					strcpy(out, "OK");
+				} else {
+					strcpy(out, "E01");
+				}
+			}
+			break;
+
+		case 'm':
+			{
+				uint32_t addr = GdbGetHex(&p);
+				uint32_t len = (*p++ == ',') ? GdbGetHex(&p) : 0;
+				char *o = out;
+				if (len > (GDB_PACKET_MAX / 2) - 1) {
+					len = (GDB_PACKET_MAX / 2) - 1;
+				}
+				for (uint32_t i = 0; i < len; i++) {
+					uint8_t b = GdbPeek(addr + i);
+					*o++ = GdbHex[b >> 4];
+					*o++ = GdbHex[b & 15];
+				}
+				*o = '\0';
+			}
+			break;
+
+		case 'M':
+			{
+				uint32_t addr = GdbGetHex(&p);
+				uint32_t len = (*p++ == ',') ? GdbGetHex(&p) : 0;
+				bool ok = (*p++ == ':') && (strlen(p) >= len * 2);
+				for (uint32_t i = 0; ok && (i < len); i++) {
+					int hi = GdbHexVal(p[i * 2]), lo = GdbHexVal(p[(i * 2) + 1]);
+					ok = (hi >= 0) && (lo >= 0) && GdbPoke(addr + i, (hi << 4) | lo);
+				}
+				strcpy(out, ok ? "OK" : "E01");
+			}
+			break;
+
+		case 'c':
+		case 's':
+			if (*p != '\0') {
+				m68k_set_reg(M68K_REG_PC, GdbGetHex(&p));
+			}
+			Gdb.stepping = (pkt[0] == 's');
+			return true;
+
+		case 'Z':
+		case 'z':
+			{
+				int type = GdbGetHex(&p);
+				uint32_t addr = (*p++ == ',') ? GdbGetHex(&p) : 0;
+				uint32_t len  = (*p++ == ',') ? GdbGetHex(&p) : 0;
+				if (type > GDB_Z_AWATCH) {
+					break;	// unsupported
+				}
+				bool ok = (pkt[0] == 'Z') ? GdbInsertPoint(type, addr & 0xFFFFFF, len) :
+						GdbRemovePoint(type, addr & 0xFFFFFF, len);
+				strcpy(out, ok ? "OK" : "E01");
+			}
+			break;
+
+		case 'H':
+		case 'T':
+			strcpy(out, "OK");
+			break;
+
+		case 'q':
+			if (strncmp(pkt, "qSupported", 10) == 0) {
+				sprintf(out, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_MAX);
+			} else if (strncmp(pkt, "qXfer:features:read:", 20) == 0) {
+				GdbXferFeatures(pkt + 20, out);
+			} else if (strncmp(pkt, "qRcmd,", 6) == 0) {
+				GdbMonitor(pkt + 6, out);
+			} else if (strcmp(pkt, "qAttached") == 0) {
+				strcpy(out, "1");
+			} else if (strcmp(pkt, "qC") == 0) {
+				strcpy(out, "QC1");
+			} else if (strcmp(pkt, "qfThreadInfo") == 0) {
+				strcpy(out, "m1");
+			} else if (strcmp(pkt, "qsThreadInfo") == 0) {
+				strcpy(out, "l");
+			}
+			break;
+
+		case 'Q':
+			if (strcmp(pkt, "QStartNoAckMode") == 0) {
+				GdbSendPacket("OK");
+				Gdb.noAck = true;
+				return false;
+			}
+			break;
+
+		case 'D':
+			GdbSendPacket("OK");
+			GdbDisconnect();
+			return true;
+
+		case 'k':
+			fprintf(stderr, "GDB: kill requested, exiting\n");
+			GdbDisconnect();
+			exit(EXIT_SUCCESS);
+
+		default:
+			// Unsupported: empty reply
+			break;
+	}
+
+	GdbSendPacket(out);
+	return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Public interface
+
+/**
+ * Start listening for GDB on the given TCP port (localhost only).
+ */
+int GdbInit(const int port)
+{
+	int fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd < 0) {
+		perror("GDB: socket");
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		perror("GDB: fcntl O_NONBLOCK");
+		close(fd);
+		return -1;
+	}
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family      = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port        = htons(port);
+
+	if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) || (listen(fd, 1) < 0)) {
+		perror("GDB: bind/listen");
+		close(fd);
+		return -1;
+	}
+
+	Gdb.listen = fd;
+	Gdb.sock = -1;
+	GdbClearAll();
+	fprintf(stderr, "GDB: listening on localhost:%d\n", port);
+
+	return 0;
+}
+
+void GdbDone(void)
+{
+	GdbDisconnect();
+	if (Gdb.listen >= 0) {
+		close(Gdb.listen);
+		Gdb.listen = -1;
+	}
+}
+
+/**
+ * Poll for a new GDB connection, or an interrupt (Ctrl-C) from a connected
+ * one. Call regularly from the main loop while the CPU is running.
+ */
+void GdbPoll(void)
+{
+	if (Gdb.listen < 0) {
+		return;
+	}
+
+	if (Gdb.sock < 0) {
+		int fd = accept(Gdb.listen, NULL, NULL);
+		if (fd < 0) {
+			return;
+		}
+		Gdb.sock = fd;
+		Gdb.noAck = false;
+		Gdb.rxlen = Gdb.rxpos = 0;
+		fprintf(stderr, "GDB: client connected\n");
+
+		// GDB expects the target to be stopped when it attaches
+		GdbClearAll();
+		Gdb.attachStop  = true;
+		Gdb.haltRequest = true;
+		Gdb.haltSignal  = GDB_SIGTRAP;
+		GdbUpdatePages();
+		return;
+	}
+
+	uint8_t c;
+	ssize_t n = recv(Gdb.sock, &c, 1, MSG_DONTWAIT);
+	if (n == 1) {
+		if (c == 0x03) {
+			Gdb.haltRequest = true;
+			Gdb.haltSignal  = GDB_SIGINT;
+			GdbUpdatePages();
+		}
+	} else if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+		GdbDisconnect();
+	}
+}
+
+/**
+ * Instruction hook slow path, called via GDB_INSTR_HOOK when the page
+ * holding pc is marked in GdbBreakPages. Returns when the CPU may execute
+ * the instruction at pc.
+ */
+void GdbInstrHook(const uint32_t pc)
+{
+	static char pkt[GDB_PACKET_MAX + 1], out[GDB_PACKET_MAX + 1];
+	int signal = GDB_SIGTRAP;
+
+	if (Gdb.sock < 0) {
+		// Left over from a debugger that has gone away
+		GdbClearAll();
+		return;
+	}
+
+	if (Gdb.haltRequest) {
+		signal = Gdb.haltSignal;
+	} else if (!Gdb.stepping && !Gdb.watchHit) {
+		bool skip = Gdb.skipBreak && (pc == Gdb.skipPc);
+		Gdb.skipBreak = false;
+		if (skip || !GdbIsBreak(pc & 0xFFFFFF)) {
+			return;
+		}
+	}
+
+	// The target is now stopped. Report why, unless GDB has only just
+	// connected -- then it asks with '?'.
+	if (!Gdb.attachStop) {
+		GdbStopReply(out, signal);
+		if (!GdbSendPacket(out)) {
+			GdbDisconnect();
+			return;
+		}
+	}
+	Gdb.attachStop  = false;
+	Gdb.haltRequest = false;
+	Gdb.haltSignal  = signal;
+	Gdb.stepping    = false;
+
+	for (;;) {
+		if (!GdbGetPacket(pkt, sizeof(pkt))) {
+			// Told to quit while stopped: let go of GDB, and have the main
+			// loop stop at the end of this slice
+			if (quitRequested) {
+				fprintf(stderr, "GDB: quitting with the target stopped\n");
+				m68k_end_timeslice();
+			}
+			GdbDisconnect();
+			return;
+		}
+		if (GdbHandlePacket(pkt, out)) {
+			break;
+		}
+	}
+
+	// Resuming. Don't stop straight away on a breakpoint at the new PC.
+	Gdb.watchHit  = false;
+	Gdb.skipPc    = m68k_get_reg(NULL, M68K_REG_PC) & 0xFFFFFF;
+	Gdb.skipBreak = true;
+	GdbUpdatePages();
+}
+
+/**
+ * Bus access slow path, called via GdbWatchCheck() when the page holds a
+ * watchpoint. Stops the CPU after the current instruction if the access
+ * overlaps one.
+ */
+void GdbWatchAccess(const uint32_t address, const unsigned int size, const bool write)
+{
+	const uint32_t addr = address & 0xFFFFFF;
+
+	if ((Gdb.sock < 0) || Gdb.watchHit) {
+		return;
+	}
+
+	for (size_t i = 0; i < Gdb.numWatches; i++) {
+		const int type = Gdb.watches[i].type;
+		if ((write && (type == GDB_Z_RWATCH)) || (!write && (type == GDB_Z_WATCH))) {
+			continue;
+		}
+		if ((addr < Gdb.watches[i].addr + Gdb.watches[i].len) && (Gdb.watches[i].addr < addr + size)) {
+			Gdb.watchHit  = true;
+			Gdb.watchAddr = Gdb.watches[i].addr;
+			Gdb.watchType = type;
+			GdbUpdatePages();
+			return;
+		}
+	}
+}
@@ -0,0 +1,54 @@
+/****************************************************************************
+ * GDB remote stub
+ *
+ * GDB Remote Serial Protocol server on a local TCP port, so the firmware
+ * can be debugged with m68k-elf-gdb ("target remote localhost:1234").
+ ****************************************************************************/
+
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Default TCP port for --gdb
+#define GDB_DEFAULT_PORT 1234
+
+// Breakpoint and watchpoint page size (log2 bytes) and count, over the
+// 68000's 24-bit address space
+#define GDB_PAGE_BITS 8
+#define GDB_NUM_PAGES (1 << (24 - GDB_PAGE_BITS))
+
+// Watchpoint page flags
+#define GDB_WATCH_READ  0x01
+#define GDB_WATCH_WRITE 0x02
+
+// Pages holding a breakpoint, one bit per page. While the stub wants the
+// CPU to stop (single step, halt request, watchpoint hit) every bit is set.
+extern uint32_t GdbBreakPages[GDB_NUM_PAGES / 32];
+// Pages holding a watchpoint, GDB_WATCH_* flags per page
+extern uint8_t GdbWatchPages[GDB_NUM_PAGES];
+
+int GdbInit(const int port);
+void GdbDone(void);
+void GdbPoll(void);
+void GdbInstrHook(const uint32_t pc);
+void GdbWatchAccess(const uint32_t address, const unsigned int size, const bool write);
+
+/// Instruction hook fast path: only calls out if the page has a breakpoint
+#define GDB_INSTR_HOOK(pc) do {													\
+		const uint32_t _page = ((pc) & 0xFFFFFF) >> GDB_PAGE_BITS;				\
+		if (GdbBreakPages[_page / 32] & (1UL << (_page % 32))) {				\
+			GdbInstrHook(pc);													\
+		}																		\
+	} while (0)
+
+/// Bus access fast path: only calls out if the page has a watchpoint
+static inline void GdbWatchCheck(const uint32_t address, const unsigned int size, const bool write)
+{
+	if (GdbWatchPages[(address & 0xFFFFFF) >> GDB_PAGE_BITS] & (write ? GDB_WATCH_WRITE : GDB_WATCH_READ)) {
+		GdbWatchAccess(address, size, write);
+	}
+}
+
+#endif // GDBSTUB_H
@@ -0,0 +1,49 @@
+/**************
+ * Datatrak receiver IF-strip simulation
+ */
+
+#ifndef _IFSTRIP_H
+#define _IFSTRIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+// Maximum number of tuned sections in the IF filter
+#define IFSTRIP_MAX_SECTIONS 4
+
+// Default IF sample rate (Hz). Must be a multiple of 1000.
+#define IFSTRIP_DEFAULT_RATE 168000
+
+// Mk2 Locator IF strip: two stagger-tuned LC sections
+#define IFSTRIP_MK2_F1 21100.0
+#define IFSTRIP_MK2_F2 19200.0
+// Section Q, chosen so the group delay at the passband peak matches the
+// ~1.017ms seen in the firmware's trigger templates (see datatrak_gen.c)
+#define IFSTRIP_MK2_Q 60.6
+// IF carrier frequency (the passband peak)
+#define IFSTRIP_MK2_CARRIER 21087.0
+
+
+typedef struct {
+	double freq;							///< Section centre frequency (Hz)
+	double q;								///< Section Q
+} IFSTRIP_SECTION;
+
+typedef struct {
+	unsigned int sampleRate;				///< IF sample rate (Hz), a multiple of 1000
+	double carrier;							///< IF carrier frequency (Hz)
+	size_t numSections;						///< Number of tuned sections (0 = pass through)
+	IFSTRIP_SECTION section[IFSTRIP_MAX_SECTIONS];	///< Tuned sections, in signal order
+} IFSTRIP_CONFIG;
+
+typedef struct IFSTRIP IFSTRIP;
+
+void ifstrip_config_mk2(IFSTRIP_CONFIG *cfg);
+IFSTRIP *ifstrip_init(const IFSTRIP_CONFIG *cfg);
+double ifstrip_group_delay(const IFSTRIP *f);
+void ifstrip_process(IFSTRIP *f, const DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf);
+void ifstrip_free(IFSTRIP *f);
+
+#endif
@@ -0,0 +1,231 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "datatrak_gen.h"
+#include "iqgen.h"
+
+/*
+ * Complex baseband synthesis
+ * ==========================
+ *
+ * The generator produces one phase/amplitude pair per millisecond for each
+ * of F1 and F2. Each pair is turned into a complex envelope sample
+ *
+ *     x[n] = (amplitude / 255) * exp(j * 2π * phase / 1000)
+ *
+ * at 1 kHz, which is interpolated up to the output rate by a polyphase FIR,
+ * then shifted to its carrier offset by an NCO and summed:
+ *
+ *     x_F1[n] → [polyphase interp] → × NCO(f1Offset) ─┐
+ *                                                     (+) → × ½ → output
+ *     x_F2[n] → [polyphase interp] → × NCO(f2Offset) ─┘
+ *
+ * The interpolator has IQGEN_PHASES filter phases of IQGEN_TAPS taps each.
+ * For every output sample the fractional position between two input
+ * samples picks the nearest phase, so any output rate works, not only
+ * integer multiples of 1 kHz. With 512 phases the worst-case timing error
+ * is under 1µs of envelope, far below anything the ~100 Hz wide modulation
+ * can show.
+ *
+ * Cost per output sample is 2 × IQGEN_TAPS complex-by-real MACs plus two
+ * table NCO lookups, which is comfortably real-time at 1 MS/s on one core.
+ *
+ * The filter delays the envelope by IQGEN_TAPS/2 ms. This is constant and
+ * doesn't affect the relative timing of anything within the signal.
+ */
+
+// Interpolator phases (must be a power of two)
+#define IQGEN_PHASES_LOG2 9
+#define IQGEN_PHASES (1 << IQGEN_PHASES_LOG2)
+// Taps per interpolator phase
+#define IQGEN_TAPS 8
+// Interpolator passband edge, as a fraction of the 1 kHz input rate
+#define IQGEN_CUTOFF 0.45
+
+// NCO lookup table size (must be a power of two)
+#define IQGEN_NCO_BITS 12
+#define IQGEN_NCO_LEN (1 << IQGEN_NCO_BITS)
+
+// Phase register counts per carrier cycle
+#define IQGEN_PHASE_COUNTS 1000
+
+/// Envelope history for one channel. Each sample is stored twice, IQGEN_TAPS
+/// apart, so the filter always sees a contiguous window.
+typedef struct {
+	float re[IQGEN_TAPS * 2];
+	float im[IQGEN_TAPS * 2];
+} IQGEN_HIST;
+
+struct IQGEN {
+	IQGEN_CONFIG cfg;
+
+	float coeffs[IQGEN_PHASES][IQGEN_TAPS];	///< Interpolator, [phase][tap]; tap 0 applies to the newest sample
+	float nco_cos[IQGEN_NCO_LEN];
+	float nco_sin[IQGEN_NCO_LEN];
+
+	IQGEN_HIST f1, f2;
+	size_t hpos;						///< Next history write position (0..IQGEN_TAPS-1)
+
+	uint64_t pos;						///< Output position within the current input sample (32.32 fixed point)
+	uint64_t step;						///< Input samples per output sample (32.32 fixed point)
+	uint32_t nco1, nco2;				///< NCO phase accumulators
+	uint32_t nco1_inc, nco2_inc;		///< NCO phase increments
+};
+
+
+/// Windowed-sinc prototype, split into polyphase components
+static void iqgen_design(IQGEN *iq)
+{
+	const size_t N = IQGEN_PHASES * IQGEN_TAPS;
+	const double fc = IQGEN_CUTOFF / IQGEN_PHASES;	// cutoff, cycles per prototype sample
+	const double centre = (N - 1) / 2.0;
+
+	for (size_t p = 0; p < IQGEN_PHASES; p++) {
+		double sum = 0;
+		for (size_t k = 0; k < IQGEN_TAPS; k++) {
+			size_t m = (k * IQGEN_PHASES) + p;
+			double t = m - centre;
+			double sinc = (t == 0) ? 1.0 : sin(2.0 * M_PI * fc * t) / (2.0 * M_PI * fc * t);
+			double win = 0.42 - 0.5 * cos(2.0 * M_PI * m / (N - 1)) + 0.08 * cos(4.0 * M_PI * m / (N - 1));
+			iq->coeffs[p][k] = sinc * win;
+			sum += iq->coeffs[p][k];
+		}
+		// Unity DC gain in every phase, so a constant envelope stays constant
+		for (size_t k = 0; k < IQGEN_TAPS; k++) {
+			iq->coeffs[p][k] /= sum;
+		}
+	}
+}
+
+/// Convert a frequency offset into an NCO phase increment
+static uint32_t iqgen_nco_inc(const double offset, const unsigned int rate)
+{
+	double cycles = fmod(offset / rate, 1.0);
+	if (cycles < 0) {
+		cycles += 1.0;
+	}
+	return (uint32_t)llround(cycles * 4294967296.0);
+}
+
+IQGEN *iqgen_init(const IQGEN_CONFIG *cfg)
+{
+	// Below 2 kHz the interpolator's images would fold back into the band
+	if (cfg->sampleRate < 2000) {
+		fprintf(stderr, "iqgen: sample rate %u too low (minimum 2000)\n", cfg->sampleRate);
+		return NULL;
+	}
+	if ((fabs(cfg->f1Offset) >= cfg->sampleRate / 2.0) || (fabs(cfg->f2Offset) >= cfg->sampleRate / 2.0)) {
+		fprintf(stderr, "iqgen: carrier offsets must be within ±%u Hz\n", cfg->sampleRate / 2);
+		return NULL;
+	}
+
+	IQGEN *iq = calloc(1, sizeof(IQGEN));
+	if (iq == NULL) {
+		return NULL;
+	}
+
+	iq->cfg = *cfg;
+	iqgen_design(iq);
+
+	for (size_t i = 0; i < IQGEN_NCO_LEN; i++) {
+		iq->nco_cos[i] = cos(2.0 * M_PI * i / IQGEN_NCO_LEN);
+		iq->nco_sin[i] = sin(2.0 * M_PI * i / IQGEN_NCO_LEN);
+	}
+
+	iq->step = (uint64_t)llround((1000.0 / cfg->sampleRate) * 4294967296.0);
+	iq->nco1_inc = iqgen_nco_inc(cfg->f1Offset, cfg->sampleRate);
+	iq->nco2_inc = iqgen_nco_inc(cfg->f2Offset, cfg->sampleRate);
+
+	return iq;
+}
+
+/// Upper bound on the number of samples iqgen_process_ms() produces per call
+size_t iqgen_max_samples_per_ms(const IQGEN *iq)
+{
+	return (iq->cfg.sampleRate / 1000) + 1;
+}
+
+/// Size of one complex output sample, in bytes
+size_t iqgen_sample_size(const IQGEN *iq)
+{
+	return (iq->cfg.format == IQGEN_FORMAT_F32) ? 2 * sizeof(float) : 2 * sizeof(int16_t);
+}
+
+static inline void iqgen_push(IQGEN_HIST *h, const size_t pos, const uint8_t ampl, const uint16_t phase)
+{
+	double a = ampl / 255.0;
+	double th = 2.0 * M_PI * phase / IQGEN_PHASE_COUNTS;
+
+	h->re[pos] = h->re[pos + IQGEN_TAPS] = a * cos(th);
+	h->im[pos] = h->im[pos + IQGEN_TAPS] = a * sin(th);
+}
+
+/**
+ * Generate the output samples for one millisecond of the cycle in buf.
+ *
+ * Call once for every millisecond of every cycle, in order. Writes up to
+ * iqgen_max_samples_per_ms() interleaved I/Q samples to out, in the
+ * configured format, and returns the number of samples written.
+ */
+size_t iqgen_process_ms(IQGEN *iq, const DATATRAK_OUTBUF *buf, const size_t msec, void *out)
+{
+	float *outf = out;
+	int16_t *outs = out;
+	size_t n = 0;
+
+	// History is written backwards: [hpos] is the newest sample and
+	// [hpos+k] is k samples older, matching the coefficient order.
+	iq->hpos = (iq->hpos + IQGEN_TAPS - 1) % IQGEN_TAPS;
+	iqgen_push(&iq->f1, iq->hpos, buf->f1_amplitude[msec], buf->f1_phase[msec]);
+	iqgen_push(&iq->f2, iq->hpos, buf->f2_amplitude[msec], buf->f2_phase[msec]);
+
+	const float *f1re = &iq->f1.re[iq->hpos], *f1im = &iq->f1.im[iq->hpos];
+	const float *f2re = &iq->f2.re[iq->hpos], *f2im = &iq->f2.im[iq->hpos];
+
+	while (iq->pos < ((uint64_t)1 << 32)) {
+		const float *c = iq->coeffs[(iq->pos >> (32 - IQGEN_PHASES_LOG2)) & (IQGEN_PHASES - 1)];
+
+		// Interpolate the envelopes
+		float a_re = 0, a_im = 0, b_re = 0, b_im = 0;
+		for (size_t k = 0; k < IQGEN_TAPS; k++) {
+			a_re += c[k] * f1re[k];
+			a_im += c[k] * f1im[k];
+			b_re += c[k] * f2re[k];
+			b_im += c[k] * f2im[k];
+		}
+
+		// Shift each to its carrier offset and sum
+		const size_t p1 = iq->nco1 >> (32 - IQGEN_NCO_BITS);
+		const size_t p2 = iq->nco2 >> (32 - IQGEN_NCO_BITS);
+		float i = 0.5f * ((a_re * iq->nco_cos[p1]) - (a_im * iq->nco_sin[p1]) +
+						  (b_re * iq->nco_cos[p2]) - (b_im * iq->nco_sin[p2]));
+		float q = 0.5f * ((a_re * iq->nco_sin[p1]) + (a_im * iq->nco_cos[p1]) +
+						  (b_re * iq->nco_sin[p2]) + (b_im * iq->nco_cos[p2]));
+		iq->nco1 += iq->nco1_inc;
+		iq->nco2 += iq->nco2_inc;
+
+		if (iq->cfg.format == IQGEN_FORMAT_F32) {
+			outf[n*2 + 0] = i;
+			outf[n*2 + 1] = q;
+		} else {
+			// Filter overshoot can take the sum slightly past full scale
+			outs[n*2 + 0] = lrintf(fmaxf(-1.0f, fminf(1.0f, i)) * 32767.0f);
+			outs[n*2 + 1] = lrintf(fmaxf(-1.0f, fminf(1.0f, q)) * 32767.0f);
+		}
+		n++;
+
+		iq->pos += iq->step;
+	}
+	iq->pos -= ((uint64_t)1 << 32);
+
+	return n;
+}
+
+void iqgen_free(IQGEN *iq)
+{
+	free(iq);
+}
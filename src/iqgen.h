@@ -0,0 +1,40 @@
+/**************
+ * Datatrak complex baseband (I/Q) output
+ */
+
+#ifndef _IQGEN_H
+#define _IQGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+// Default output sample rate (Hz)
+#define IQGEN_DEFAULT_RATE 48000
+// Default F1/F2 offsets from the centre frequency (Hz)
+#define IQGEN_DEFAULT_F1_OFFSET  10000.0
+#define IQGEN_DEFAULT_F2_OFFSET -10000.0
+
+
+typedef enum {
+	IQGEN_FORMAT_F32,						///< Interleaved float32 I/Q, full scale ±1.0
+	IQGEN_FORMAT_S16						///< Interleaved int16 I/Q, full scale ±32767
+} IQGEN_FORMAT;
+
+typedef struct {
+	unsigned int sampleRate;				///< Output sample rate (Hz)
+	double f1Offset;						///< F1 carrier offset from the centre frequency (Hz)
+	double f2Offset;						///< F2 carrier offset from the centre frequency (Hz)
+	IQGEN_FORMAT format;					///< Output sample format
+} IQGEN_CONFIG;
+
+typedef struct IQGEN IQGEN;
+
+IQGEN *iqgen_init(const IQGEN_CONFIG *cfg);
+size_t iqgen_max_samples_per_ms(const IQGEN *iq);
+size_t iqgen_sample_size(const IQGEN *iq);
+size_t iqgen_process_ms(IQGEN *iq, const DATATRAK_OUTBUF *buf, const size_t msec, void *out);
+void iqgen_free(IQGEN *iq);
+
+#endif
@@ -0,0 +1,573 @@
+/***
+ * LF signal capture
+ *
+ * The raw phase dump (datatrak_gen_dumpRaw) opens and closes its file on
+ * every cycle, and writes 6.7 KB per 1.68 second cycle, most of it
+ * unchanged idle slots and straight phase ramps. A day of it is about
+ * 350 MB, and the only way to find a cycle is to count through.
+ *
+ * A capture is a file of delta and run-length coded cycles (the format is
+ * described in lfcapture.h). Each record carries the generator's clock_n
+ * and goldcode_n, and the index at the end gives every record's offset, so
+ * any cycle can be found at once in a memory mapping of the file.
+ *
+ * As with LF streams, cycles are handed to a writer thread through a
+ * lock-free ring, which does the coding and the file writes. Unlike a
+ * stream, a capture never drops a cycle: if the ring is full, the producer
+ * waits for the writer to catch up. The producer is the LF source's
+ * generator thread, which runs a few cycles ahead of the CPU, so a short
+ * stall isn't seen by the CPU. It pushes each cycle once the CPU has read
+ * it (see lfsource.c), so the capture holds the cycles the firmware
+ * received, in the order it received them.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "datatrak_gen.h"
+#include "spsc.h"
+
+#include "lfcapture.h"
+
+
+// Number of cycles buffered between the producer and the writer thread.
+// Must be a power of two.
+#define LFCAPTURE_RING_SIZE 16
+
+// How long the writer thread (or a producer with a full ring) sleeps (microseconds)
+#define LFCAPTURE_IDLE_US 1000
+
+// stdio buffer for the capture file
+#define LFCAPTURE_FILE_BUF (1024 * 1024)
+
+// Largest coded channel: a control byte per difference, and at most
+// three bytes per difference
+#define LFCAPTURE_MAX_CHANNEL (DATATRAK_BUF_LEN * 4)
+
+// Largest payload: four channels
+#define LFCAPTURE_MAX_PAYLOAD (4 * LFCAPTURE_MAX_CHANNEL)
+
+// Shortest run of equal differences coded as a repeat
+#define LFCAPTURE_MIN_RUN 3
+
+// Longest literal or repeat run
+#define LFCAPTURE_MAX_RUN 128
+
+struct LFCAPTURE {
+	char *path;
+	FILE *fp;
+	uint64_t offset;			// file offset of the next record (writer-owned)
+	uint64_t *index;			// offset of each cycle written (writer-owned)
+	size_t cycles, indexSize;
+	bool failed;				// a write has failed; stop writing
+
+	SPSC_RING ring;
+	DATATRAK_CYCLE frames[LFCAPTURE_RING_SIZE];
+	uint8_t payload[LFCAPTURE_MAX_PAYLOAD];	// encode buffer (writer-owned)
+
+	pthread_t thread;
+	bool running;				// writer thread has been started
+	bool stop;					// writer thread should exit
+};
+
+struct LFCAPTURE_FILE {
+	const uint8_t *map;
+	size_t size;
+	const uint8_t *index;		// cycles uint64_t offsets (in the map, or indexBuf)
+	uint64_t *indexBuf;			// index rebuilt from the records, if the file has none
+	size_t cycles;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Coding
+
+static uint8_t *LfCapturePutVarint(uint8_t *p, const int32_t v)
+{
+	uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+
+	while (z >= 0x80) {
+		*p++ = (z & 0x7F) | 0x80;
+		z >>= 7;
+	}
+	*p++ = z;
+	return p;
+}
+
+static const uint8_t *LfCaptureGetVarint(const uint8_t *p, const uint8_t *end, int32_t *v)
+{
+	uint32_t z = 0;
+
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (p >= end) {
+			return NULL;
+		}
+		z |= (uint32_t)(*p & 0x7F) << shift;
+		if (!(*p++ & 0x80)) {
+			*v = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Code n values (16-bit if u16 is set, else 8-bit) into p. Returns the end of the coded data.
+static uint8_t *LfCaptureEncodeChannel(uint8_t *p, const uint16_t *u16, const uint8_t *u8, const size_t n)
+{
+	int32_t d[DATATRAK_BUF_LEN];
+	int32_t prev = 0;
+	size_t i = 0;
+
+	for (size_t k = 0; k < n; k++) {
+		const int32_t v = (u16 != NULL) ? u16[k] : u8[k];
+		d[k] = v - prev;
+		prev = v;
+	}
+
+	while (i < n) {
+		// Length of the run of equal differences starting here
+		size_t run = 1;
+		while ((i + run < n) && (run < LFCAPTURE_MAX_RUN) && (d[i + run] == d[i])) {
+			run++;
+		}
+
+		if (run >= LFCAPTURE_MIN_RUN) {
+			*p++ = 0x80 | (run - 1);
+			p = LfCapturePutVarint(p, d[i]);
+			i += run;
+			continue;
+		}
+
+		// Literals, up to the start of the next run worth coding
+		size_t lit = 0;
+		while ((i + lit < n) && (lit < LFCAPTURE_MAX_RUN)) {
+			if ((i + lit + LFCAPTURE_MIN_RUN <= n) &&
+					(d[i + lit] == d[i + lit + 1]) && (d[i + lit] == d[i + lit + 2])) {
+				break;
+			}
+			lit++;
+		}
+
+		*p++ = lit - 1;
+		for (size_t k = 0; k < lit; k++) {
+			p = LfCapturePutVarint(p, d[i + k]);
+		}
+		i += lit;
+	}
+
+	return p;
+}
+
+// Decode n values from p. Returns the end of the coded data, or NULL if it's bad.
+static const uint8_t *LfCaptureDecodeChannel(const uint8_t *p, const uint8_t *end, int32_t *vals, const size_t n)
+{
+	int32_t prev = 0, d;
+	size_t i = 0;
+
+	while (i < n) {
+		if (p >= end) {
+			return NULL;
+		}
+		const uint8_t c = *p++;
+		const size_t run = (c & 0x7F) + 1;
+
+		if (i + run > n) {
+			return NULL;
+		}
+
+		if (c & 0x80) {
+			if ((p = LfCaptureGetVarint(p, end, &d)) == NULL) {
+				return NULL;
+			}
+			for (size_t k = 0; k < run; k++) {
+				prev += d;
+				vals[i++] = prev;
+			}
+		} else {
+			for (size_t k = 0; k < run; k++) {
+				if ((p = LfCaptureGetVarint(p, end, &d)) == NULL) {
+					return NULL;
+				}
+				prev += d;
+				vals[i++] = prev;
+			}
+		}
+	}
+
+	return p;
+}
+
+// Code one cycle into c->payload. Returns the payload length.
+static size_t LfCaptureEncode(LFCAPTURE *c, const DATATRAK_CYCLE *cyc)
+{
+	const size_t ms = cyc->ctx.msPerCycle;
+	uint8_t *p = c->payload;
+
+	p = LfCaptureEncodeChannel(p, cyc->buf.f1_phase, NULL, ms);
+	p = LfCaptureEncodeChannel(p, cyc->buf.f2_phase, NULL, ms);
+	p = LfCaptureEncodeChannel(p, NULL, cyc->buf.f1_amplitude, ms);
+	p = LfCaptureEncodeChannel(p, NULL, cyc->buf.f2_amplitude, ms);
+
+	return p - c->payload;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Writing
+
+static bool LfCaptureWrite(LFCAPTURE *c, const void *data, const size_t len)
+{
+	if (fwrite(data, 1, len, c->fp) != len) {
+		fprintf(stderr, "LFCAPTURE %s: write failed: %s\n", c->path, strerror(errno));
+		c->failed = true;
+		return false;
+	}
+	c->offset += len;
+	return true;
+}
+
+// Code and write one cycle, and add it to the index
+static void LfCaptureWriteCycle(LFCAPTURE *c, const DATATRAK_CYCLE *cyc)
+{
+	if (c->cycles == c->indexSize) {
+		size_t size = (c->indexSize == 0) ? 1024 : (c->indexSize * 2);
+		uint64_t *index = realloc(c->index, size * sizeof(uint64_t));
+		if (index == NULL) {
+			fprintf(stderr, "LFCAPTURE %s: out of memory for the index\n", c->path);
+			c->failed = true;
+			return;
+		}
+		c->index = index;
+		c->indexSize = size;
+	}
+
+	LFCAPTURE_CYCLE_HEADER hdr = {
+		.magic      = LFCAPTURE_CYCLE_MAGIC,
+		.clock_n    = cyc->ctx.clock_n,
+		.goldcode_n = cyc->ctx.goldcode_n,
+		.msPerCycle = cyc->ctx.msPerCycle,
+		.mode       = cyc->ctx.mode
+	};
+	hdr.payloadLen = LfCaptureEncode(c, cyc);
+
+	const uint64_t offset = c->offset;
+	if (LfCaptureWrite(c, &hdr, sizeof(hdr)) && LfCaptureWrite(c, c->payload, hdr.payloadLen)) {
+		c->index[c->cycles++] = offset;
+	}
+}
+
+static void *LfCaptureThread(void *arg)
+{
+	LFCAPTURE *c = arg;
+
+	for (;;) {
+		ptrdiff_t slot = SpscReadSlot(&c->ring);
+		if (slot < 0) {
+			// Only stop once everything pushed has been written
+			if (__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			usleep(LFCAPTURE_IDLE_US);
+			continue;
+		}
+
+		if (!c->failed) {
+			LfCaptureWriteCycle(c, &c->frames[slot]);
+		}
+		SpscRelease(&c->ring);
+	}
+
+	return NULL;
+}
+
+/**
+ * Create a capture file at path (replacing any existing file), and start
+ * its writer thread.
+ *
+ * Returns NULL on error.
+ */
+LFCAPTURE *LfCaptureOpen(const char *path)
+{
+	LFCAPTURE *c = calloc(1, sizeof(LFCAPTURE));
+	if (c == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	c->path = strdup(path);
+	if (c->path == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		LfCaptureClose(c);
+		return NULL;
+	}
+	SpscInit(&c->ring, LFCAPTURE_RING_SIZE);
+
+	c->fp = fopen(path, "wb");
+	if (c->fp == NULL) {
+		fprintf(stderr, "LFCAPTURE: can't create %s: %s\n", path, strerror(errno));
+		LfCaptureClose(c);
+		return NULL;
+	}
+	setvbuf(c->fp, NULL, _IOFBF, LFCAPTURE_FILE_BUF);
+
+	LFCAPTURE_FILE_HEADER hdr = {
+		.magic    = LFCAPTURE_MAGIC,
+		.version  = LFCAPTURE_VERSION,
+		.reserved = 0
+	};
+	if (!LfCaptureWrite(c, &hdr, sizeof(hdr))) {
+		LfCaptureClose(c);
+		return NULL;
+	}
+
+	if (pthread_create(&c->thread, NULL, LfCaptureThread, c) != 0) {
+		fprintf(stderr, "LFCAPTURE: can't start writer thread\n");
+		LfCaptureClose(c);
+		return NULL;
+	}
+	c->running = true;
+
+	fprintf(stderr, "LFCAPTURE: capturing phase data to %s\n", path);
+	return c;
+}
+
+/**
+ * Queue one generated cycle for the capture.
+ *
+ * ctx is the generator state the cycle was generated from. Waits for the
+ * writer if the ring is full, so no cycle is lost.
+ */
+void LfCapturePush(LFCAPTURE *c, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf)
+{
+	ptrdiff_t slot;
+
+	while ((slot = SpscWriteSlot(&c->ring)) < 0) {
+		usleep(LFCAPTURE_IDLE_US);
+	}
+
+	DATATRAK_CYCLE *cyc = &c->frames[slot];
+	cyc->ctx = *ctx;
+	memcpy(cyc->buf.f1_phase,     buf->f1_phase,     ctx->msPerCycle * sizeof(uint16_t));
+	memcpy(cyc->buf.f2_phase,     buf->f2_phase,     ctx->msPerCycle * sizeof(uint16_t));
+	memcpy(cyc->buf.f1_amplitude, buf->f1_amplitude, ctx->msPerCycle);
+	memcpy(cyc->buf.f2_amplitude, buf->f2_amplitude, ctx->msPerCycle);
+
+	SpscPublish(&c->ring);
+}
+
+/// Write out the queued cycles, then the index and footer, and close the file
+void LfCaptureClose(LFCAPTURE *c)
+{
+	if (c == NULL) {
+		return;
+	}
+
+	if (c->running) {
+		__atomic_store_n(&c->stop, true, __ATOMIC_RELEASE);
+		pthread_join(c->thread, NULL);
+	}
+
+	if (c->fp != NULL) {
+		if (!c->failed) {
+			LFCAPTURE_FOOTER footer = {
+				.indexOffset = c->offset,
+				.cycles      = c->cycles,
+				.magic       = LFCAPTURE_FOOTER_MAGIC,
+				.reserved    = 0
+			};
+			if (LfCaptureWrite(c, c->index, c->cycles * sizeof(uint64_t)) &&
+					LfCaptureWrite(c, &footer, sizeof(footer))) {
+				fprintf(stderr, "LFCAPTURE: %zu cycles, %llu bytes written to %s\n",
+						c->cycles, (unsigned long long)c->offset, c->path);
+			}
+		}
+		if (fclose(c->fp) != 0) {
+			fprintf(stderr, "LFCAPTURE %s: close failed: %s\n", c->path, strerror(errno));
+		}
+	}
+
+	free(c->index);
+	free(c->path);
+	free(c);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Reading
+
+// Rebuild the index of a file with no footer by walking the records
+static int LfCaptureScan(LFCAPTURE_FILE *f)
+{
+	size_t size = 0;
+	uint64_t offset = sizeof(LFCAPTURE_FILE_HEADER);
+
+	f->cycles = 0;
+	while (offset + sizeof(LFCAPTURE_CYCLE_HEADER) <= f->size) {
+		LFCAPTURE_CYCLE_HEADER hdr;
+		memcpy(&hdr, f->map + offset, sizeof(hdr));
+		if ((hdr.magic != LFCAPTURE_CYCLE_MAGIC) ||
+				(hdr.payloadLen > f->size - offset - sizeof(hdr))) {
+			break;
+		}
+
+		if (f->cycles == size) {
+			size = (size == 0) ? 1024 : (size * 2);
+			uint64_t *index = realloc(f->indexBuf, size * sizeof(uint64_t));
+			if (index == NULL) {
+				fprintf(stderr, "Error allocating memory.\n");
+				return -1;
+			}
+			f->indexBuf = index;
+		}
+		f->indexBuf[f->cycles++] = offset;
+		offset += sizeof(hdr) + hdr.payloadLen;
+	}
+
+	f->index = (const uint8_t *)f->indexBuf;
+	return 0;
+}
+
+/**
+ * Map a capture file for reading. A file with no index (its writer didn't
+ * finish) is indexed up to its last whole record.
+ *
+ * Returns NULL on error.
+ */
+LFCAPTURE_FILE *LfCaptureMap(const char *path)
+{
+	struct stat st;
+	LFCAPTURE_FILE_HEADER hdr;
+	LFCAPTURE_FOOTER footer;
+
+	LFCAPTURE_FILE *f = calloc(1, sizeof(LFCAPTURE_FILE));
+	if (f == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "LFCAPTURE: can't open %s: %s\n", path, strerror(errno));
+		free(f);
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(hdr))) {
+		fprintf(stderr, "LFCAPTURE: %s is not a capture file\n", path);
+		close(fd);
+		free(f);
+		return NULL;
+	}
+
+	f->size = st.st_size;
+	f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		fprintf(stderr, "LFCAPTURE: can't map %s: %s\n", path, strerror(errno));
+		free(f);
+		return NULL;
+	}
+
+	memcpy(&hdr, f->map, sizeof(hdr));
+	if ((hdr.magic != LFCAPTURE_MAGIC) || (hdr.version != LFCAPTURE_VERSION)) {
+		fprintf(stderr, "LFCAPTURE: %s is not a version %d capture file\n", path, LFCAPTURE_VERSION);
+		LfCaptureUnmap(f);
+		return NULL;
+	}
+
+	if (f->size >= sizeof(hdr) + sizeof(footer)) {
+		memcpy(&footer, f->map + f->size - sizeof(footer), sizeof(footer));
+	} else {
+		footer.magic = 0;
+	}
+
+	if ((footer.magic == LFCAPTURE_FOOTER_MAGIC) &&
+			(footer.indexOffset <= f->size - sizeof(footer)) &&
+			(footer.cycles == (f->size - sizeof(footer) - footer.indexOffset) / sizeof(uint64_t))) {
+		f->index  = f->map + footer.indexOffset;
+		f->cycles = footer.cycles;
+	} else {
+		fprintf(stderr, "LFCAPTURE: %s has no index (capture not closed?), rebuilding it\n", path);
+		if (LfCaptureScan(f) != 0) {
+			LfCaptureUnmap(f);
+			return NULL;
+		}
+	}
+
+	return f;
+}
+
+/// Number of cycles in a mapped capture
+size_t LfCaptureCycles(const LFCAPTURE_FILE *f)
+{
+	return f->cycles;
+}
+
+/**
+ * Decode cycle n (from 0) of a mapped capture into buf. The clock_n,
+ * goldcode_n, msPerCycle and mode it was captured with are set in ctx; the
+ * rest of ctx is left alone.
+ *
+ * Returns 0, or -1 if n is out of range or the record is damaged.
+ */
+int LfCaptureRead(const LFCAPTURE_FILE *f, const size_t n, DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf)
+{
+	LFCAPTURE_CYCLE_HEADER hdr;
+	uint64_t offset;
+	int32_t vals[DATATRAK_BUF_LEN];
+
+	if (n >= f->cycles) {
+		return -1;
+	}
+
+	memcpy(&offset, f->index + (n * sizeof(uint64_t)), sizeof(offset));
+	if ((offset > f->size) || (f->size - offset < sizeof(hdr))) {
+		return -1;
+	}
+	memcpy(&hdr, f->map + offset, sizeof(hdr));
+	if ((hdr.magic != LFCAPTURE_CYCLE_MAGIC) || (hdr.msPerCycle > DATATRAK_BUF_LEN) ||
+			(hdr.payloadLen > f->size - offset - sizeof(hdr))) {
+		return -1;
+	}
+
+	const uint8_t *p   = f->map + offset + sizeof(hdr);
+	const uint8_t *end = p + hdr.payloadLen;
+	const size_t ms    = hdr.msPerCycle;
+
+	if ((p = LfCaptureDecodeChannel(p, end, vals, ms)) == NULL) return -1;
+	for (size_t i = 0; i < ms; i++) buf->f1_phase[i] = vals[i];
+	if ((p = LfCaptureDecodeChannel(p, end, vals, ms)) == NULL) return -1;
+	for (size_t i = 0; i < ms; i++) buf->f2_phase[i] = vals[i];
+	if ((p = LfCaptureDecodeChannel(p, end, vals, ms)) == NULL) return -1;
+	for (size_t i = 0; i < ms; i++) buf->f1_amplitude[i] = vals[i];
+	if ((p = LfCaptureDecodeChannel(p, end, vals, ms)) == NULL) return -1;
+	for (size_t i = 0; i < ms; i++) buf->f2_amplitude[i] = vals[i];
+
+	ctx->clock_n    = hdr.clock_n;
+	ctx->goldcode_n = hdr.goldcode_n;
+	ctx->msPerCycle = hdr.msPerCycle;
+	ctx->mode       = hdr.mode;
+	return 0;
+}
+
+/// Unmap a capture
+void LfCaptureUnmap(LFCAPTURE_FILE *f)
+{
+	if (f == NULL) {
+		return;
+	}
+	if ((f->map != NULL) && (f->map != MAP_FAILED)) {
+		munmap((void *)f->map, f->size);
+	}
+	free(f->indexBuf);
+	free(f);
+}
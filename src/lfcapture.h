@@ -0,0 +1,78 @@
+/****************************************************************************
+ * LF signal capture
+ *
+ * Records generated LF cycles to a compressed, seekable file, and reads
+ * them back from a memory mapping.
+ ****************************************************************************/
+
+#ifndef LFCAPTURE_H
+#define LFCAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+/// File header magic number ('DTCP')
+#define LFCAPTURE_MAGIC 0x50435444
+/// Cycle record magic number ('DTCY')
+#define LFCAPTURE_CYCLE_MAGIC 0x59435444
+/// Footer magic number ('DTCX')
+#define LFCAPTURE_FOOTER_MAGIC 0x58435444
+/// File format version
+#define LFCAPTURE_VERSION 1
+
+/**
+ * A capture file is laid out as follows, all in host byte order:
+ *
+ *   LFCAPTURE_FILE_HEADER
+ *   one record per cycle: LFCAPTURE_CYCLE_HEADER, then payloadLen bytes
+ *   uint64_t index[cycles]		file offset of each cycle record
+ *   LFCAPTURE_FOOTER
+ *
+ * The payload holds the cycle's f1_phase, f2_phase, f1_amplitude and
+ * f2_amplitude, msPerCycle values each. Each channel is coded as the
+ * differences between successive values (the first from 0), in runs. A
+ * control byte c below 0x80 is followed by c+1 differences. One of 0x80 or
+ * more is followed by a single difference that repeats (c & 0x7F)+1 times.
+ * Differences are zigzag-coded LEB128 varints. Idle slots (no change) and
+ * navslot phase ramps (a steady change) become a few bytes each.
+ *
+ * A file whose writer was killed has no index or footer. The reader then
+ * rebuilds the index from the record headers.
+ */
+typedef struct {
+	uint32_t magic;				///< LFCAPTURE_MAGIC
+	uint16_t version;			///< LFCAPTURE_VERSION
+	uint16_t reserved;
+} LFCAPTURE_FILE_HEADER;
+
+typedef struct {
+	uint32_t magic;				///< LFCAPTURE_CYCLE_MAGIC
+	int32_t  clock_n;			///< Generator clock value for this cycle
+	int32_t  goldcode_n;		///< Generator Gold code offset for this cycle
+	uint16_t msPerCycle;		///< Milliseconds in this cycle
+	uint16_t mode;				///< DATATRAK_MODE
+	uint32_t payloadLen;		///< Payload length in bytes
+} LFCAPTURE_CYCLE_HEADER;
+
+typedef struct {
+	uint64_t indexOffset;		///< File offset of the index
+	uint64_t cycles;			///< Number of cycles in the file
+	uint32_t magic;				///< LFCAPTURE_FOOTER_MAGIC
+	uint32_t reserved;
+} LFCAPTURE_FOOTER;
+
+typedef struct LFCAPTURE LFCAPTURE;
+typedef struct LFCAPTURE_FILE LFCAPTURE_FILE;
+
+LFCAPTURE *LfCaptureOpen(const char *path);
+void LfCapturePush(LFCAPTURE *c, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf);
+void LfCaptureClose(LFCAPTURE *c);
+
+LFCAPTURE_FILE *LfCaptureMap(const char *path);
+size_t LfCaptureCycles(const LFCAPTURE_FILE *f);
+int LfCaptureRead(const LFCAPTURE_FILE *f, const size_t n, DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf);
+void LfCaptureUnmap(LFCAPTURE_FILE *f);
+
+#endif // LFCAPTURE_H
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "datatrak_gen.h"
+#include "lfnoise.h"
+
+/*
+ * RF noise and fading
+ * ===================
+ *
+ * Turns the generator's clean output into something closer to what a
+ * receiver sees off air, scaled by DATATRAK_LF_CTX::rfNoiseLevel.
+ *
+ * Noise
+ * -----
+ * Every millisecond, on each of F1 and F2, the received carrier is taken as
+ *
+ *     r = a·e^(jφ) + N·(g₁ + j·g₂)/√2
+ *
+ * where a and φ are the generated amplitude and phase, N is rfNoiseLevel
+ * (in RSSI counts) and g₁, g₂ are independent unit Gaussians. The output
+ * amplitude is |r| and the phase is φ + arg(r·e^(−jφ)). At high SNR this
+ * is Gaussian phase noise of about N/a radians; where nothing is being
+ * transmitted (a ≈ DATATRAK_RSSI_MIN) the phase is uniformly random and the
+ * RSSI reads about N, as a real receiver would show between slots.
+ *
+ * Fading
+ * ------
+ * Each slot's transmit power is scaled by a log-normal fading factor with
+ * standard deviation fadeDb, following a first-order autoregressive process
+ * so consecutive cycles are correlated by fadeCorr.
+ *
+ * Random numbers
+ * --------------
+ * All randomness comes from Philox-4x32-10, a counter-based generator: the
+ * output is a pure function of (key, counter), with the counter built from
+ * the cycle's clock_n/goldcode_n. Noise for any cycle is therefore the same
+ * whichever thread generates it and however many cycles were generated
+ * before, and a whole cycle's worth is produced in one straight-line block
+ * that the compiler can vectorise.
+ */
+
+// Counter streams, so noise and fading draws never overlap
+#define LFNOISE_STREAM_NOISE 0
+#define LFNOISE_STREAM_FADE  1
+
+// Phase register counts per carrier cycle
+#define LFNOISE_PHASE_COUNTS 1000
+
+/// Philox-4x32-10 block function
+static inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < 10; r++) {
+		uint64_t p0 = (uint64_t)0xD2511F53 * c0;
+		uint64_t p1 = (uint64_t)0xCD9E8D57 * c2;
+		c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t)p1;
+		c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t)p0;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+
+	out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+/// Uniform float in (0, 1] from 32 random bits
+static inline float u01(const uint32_t x)
+{
+	return (x >> 8) * (1.0f / 16777216.0f) + (1.0f / 16777216.0f);
+}
+
+/// Unique counter value for a generator cycle
+static inline uint32_t cycle_id(const DATATRAK_LF_CTX *ctx)
+{
+	return ((uint32_t)ctx->clock_n * 64) + ctx->goldcode_n;
+}
+
+/**
+ * Fill g[0..count-1] with unit Gaussians (count must be a multiple of 4).
+ *
+ * Block i of the output depends only on (key, stream, cycle, i).
+ */
+static void lfnoise_gaussians(const DATATRAK_NOISE *n, const uint32_t stream, const uint32_t cycle, float *g, const size_t count)
+{
+	uint32_t bits[4];
+
+	assert((count % 4) == 0);
+
+	for (size_t i = 0; i < count; i += 4) {
+		const uint32_t ctr[4] = { (uint32_t)(i / 4), stream, cycle, 0 };
+		philox4x32(ctr, n->key, bits);
+
+		// Box-Muller: two uniforms make two Gaussians
+		for (size_t j = 0; j < 4; j += 2) {
+			float r  = sqrtf(-2.0f * logf(u01(bits[j])));
+			float th = (float)(2.0 * M_PI) * u01(bits[j + 1]);
+			g[i + j + 0] = r * cosf(th);
+			g[i + j + 1] = r * sinf(th);
+		}
+	}
+}
+
+/**
+ * Initialise the noise generator.
+ *
+ * seed     - PRNG seed; the same seed always gives the same noise
+ * fadeDb   - slot fading standard deviation in dB (0 to disable fading)
+ * fadeCorr - correlation of the fading between consecutive cycles (0..1)
+ */
+void lfnoise_init(DATATRAK_NOISE *n, const uint64_t seed, const double fadeDb, const double fadeCorr)
+{
+	n->key[0]   = (uint32_t)seed;
+	n->key[1]   = (uint32_t)(seed >> 32);
+	n->fadeDb   = fadeDb;
+	n->fadeCorr = fmin(fmax(fadeCorr, 0.0), 1.0);
+	for (size_t i = 0; i < 24; i++) {
+		n->fade[i] = 0;
+	}
+}
+
+/**
+ * Apply this cycle's fading to the slot powers in ctx.
+ *
+ * Call immediately before datatrak_gen_generate(), and lfnoise_unfade()
+ * immediately after it, so fading doesn't accumulate in the configuration.
+ */
+void lfnoise_fade(DATATRAK_NOISE *n, DATATRAK_LF_CTX *ctx)
+{
+	float g[24];
+
+	memcpy(n->savedPower, ctx->slotPower, sizeof(n->savedPower));
+	if (n->fadeDb <= 0) {
+		return;
+	}
+
+	lfnoise_gaussians(n, LFNOISE_STREAM_FADE, cycle_id(ctx), g, 24);
+
+	const double innov = n->fadeDb * sqrt(1.0 - (n->fadeCorr * n->fadeCorr));
+	for (size_t i = 0; i < 24; i++) {
+		n->fade[i] = (n->fadeCorr * n->fade[i]) + (innov * g[i]);
+
+		// Switched-off slots stay off
+		if (ctx->slotPower[i] > DATATRAK_RSSI_MIN) {
+			double p = ctx->slotPower[i] * pow(10.0, n->fade[i] / 20.0);
+			ctx->slotPower[i] = (uint8_t)lround(fmin(fmax(p, DATATRAK_RSSI_MIN + 1), DATATRAK_RSSI_MAX));
+		}
+	}
+}
+
+/// Restore the slot powers changed by lfnoise_fade()
+void lfnoise_unfade(DATATRAK_NOISE *n, DATATRAK_LF_CTX *ctx)
+{
+	memcpy(ctx->slotPower, n->savedPower, sizeof(n->savedPower));
+}
+
+/**
+ * Add receiver noise to a generated cycle, in place.
+ *
+ * ctx is the generator state the cycle was generated from. Does nothing if
+ * ctx->rfNoiseLevel is zero.
+ */
+void lfnoise_apply(DATATRAK_NOISE *n, const DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf)
+{
+	float g[DATATRAK_BUF_LEN * 4];
+	const float N = ctx->rfNoiseLevel * (float)M_SQRT1_2;
+	const size_t ms = ctx->msPerCycle;
+
+	if (ctx->rfNoiseLevel == 0) {
+		return;
+	}
+
+	// Four Gaussians per ms: F1 I/Q, F2 I/Q
+	lfnoise_gaussians(n, LFNOISE_STREAM_NOISE, cycle_id(ctx), g, (ms * 4 + 3) & ~(size_t)3);
+
+	for (size_t i = 0; i < ms; i++) {
+		uint16_t *ph[2] = { &buf->f1_phase[i], &buf->f2_phase[i] };
+		uint8_t  *am[2] = { &buf->f1_amplitude[i], &buf->f2_amplitude[i] };
+
+		for (size_t f = 0; f < 2; f++) {
+			// Work relative to the clean phase, so only the deviation is computed
+			float re = *am[f] + (N * g[(i * 4) + (f * 2) + 0]);
+			float im =          (N * g[(i * 4) + (f * 2) + 1]);
+
+			float a = sqrtf((re * re) + (im * im));
+			int dev = lrintf(atan2f(im, re) * (LFNOISE_PHASE_COUNTS / (float)(2.0 * M_PI)));
+
+			int p = (*ph[f] + dev) % LFNOISE_PHASE_COUNTS;
+			if (p < 0) {
+				p += LFNOISE_PHASE_COUNTS;
+			}
+			*ph[f] = p;
+			*am[f] = lrintf(fminf(fmaxf(a, DATATRAK_RSSI_MIN), DATATRAK_RSSI_MAX));
+		}
+	}
+}
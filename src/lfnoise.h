@@ -0,0 +1,25 @@
+/**************
+ * Datatrak LF noise and fading
+ */
+
+#ifndef _LFNOISE_H
+#define _LFNOISE_H
+
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+typedef struct {
+	uint32_t key[2];					///< PRNG key (from the seed)
+	double fadeDb;						///< Slot fading standard deviation (dB), 0 = no fading
+	double fadeCorr;					///< Cycle-to-cycle fading correlation (0..1)
+	double fade[24];					///< Current slot fading state (dB)
+	uint8_t savedPower[24];				///< Slot powers before fading was applied
+} DATATRAK_NOISE;
+
+void lfnoise_init(DATATRAK_NOISE *n, const uint64_t seed, const double fadeDb, const double fadeCorr);
+void lfnoise_fade(DATATRAK_NOISE *n, DATATRAK_LF_CTX *ctx);
+void lfnoise_unfade(DATATRAK_NOISE *n, DATATRAK_LF_CTX *ctx);
+void lfnoise_apply(DATATRAK_NOISE *n, const DATATRAK_LF_CTX *ctx, DATATRAK_OUTBUF *buf);
+
+#endif
@@ -0,0 +1,409 @@
+/***
+ * LF signal source
+ *
+ * Generating a cycle (plus any streaming and debug dumps) takes a good
+ * fraction of a millisecond. Doing it on the CPU thread, inside the phase
+ * register read that wraps the buffer, stalls the emulation once a cycle.
+ *
+ * Instead a producer thread keeps LFSOURCE_RING_SIZE cycles generated ahead
+ * in a lock-free SPSC ring. At a cycle boundary the CPU thread only hands
+ * the finished cycle back and takes a pointer to the next one.
+ *
+ * Each ring slot is a DATATRAK_CYCLE, so the generator state (clock_n,
+ * goldcode_n) that goes with the data the CPU is reading travels with it,
+ * even though the producer's own context is already a few cycles ahead.
+ *
+ * The lock-margin analyser, LF streams and capture are given each cycle
+ * once the CPU has finished with it, not when it's generated. A reset
+ * (control change, rewind, sweep checkpoint) throws away the cycles
+ * generated ahead, and the one the CPU was reading, so they must not have
+ * been output yet. The producer outputs the cycles the CPU has released
+ * before it generates over their slots, which keeps the work off the CPU
+ * thread; LfSourceStop() outputs any it didn't get to.
+ *
+ * Instead of generating cycles, the producer can replay them from a capture
+ * file (lfcapture.c), mapped into memory. The capture cycle to replay next
+ * is kept in the generator state (replay_n), so rewinding, forking and the
+ * control socket's seek all go through LfSourceGetState()/LfSourceReset()
+ * as they do for generated cycles. A replayed cycle is decoded into its ring
+ * slot ahead of time, and the CPU reads it from there, as it does any other.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "datatrak_gen.h"
+#include "ifstrip.h"
+#include "lfcapture.h"
+#include "lfnoise.h"
+#include "lockmargin.h"
+#include "lfstream.h"
+#include "propagation.h"
+#include "spsc.h"
+
+#include "lfsource.h"
+
+
+// Debug: write modulated (audible) phase data to a file. Data format is 16bit signed, mono, 44100 Hz.
+//#define WRITE_PHASEDATA_MODULATED
+// Debug: write raw phase data to a file. Data format is 16bit signed, mono, 44100 Hz.
+//#define WRITE_PHASEDATA
+
+// Number of cycles generated ahead of the CPU, plus the one it is reading.
+// Must be a power of two.
+#define LFSOURCE_RING_SIZE 4
+
+// How long the producer sleeps when the ring is full (microseconds)
+#define LFSOURCE_IDLE_US 200
+
+// Maximum number of LF streams fed from the producer thread
+#define LFSOURCE_MAX_STREAMS 4
+
+static struct {
+	DATATRAK_LF_CTX ctx;		// generator state (producer-owned)
+
+	SPSC_RING ring;
+	DATATRAK_CYCLE cycles[LFSOURCE_RING_SIZE];
+	DATATRAK_LF_CTX starts[LFSOURCE_RING_SIZE];	// generator state each slot was started from
+	bool holding;				// CPU thread holds the slot at the ring tail
+	size_t outputs;				// ring position of the next released cycle to output
+
+	LFSTREAM *streams[LFSOURCE_MAX_STREAMS];
+	size_t numStreams;
+
+	PROP_MODEL *prop;			// vehicle propagation model (NULL if static)
+	IFSTRIP *ifstrip;			// receiver IF-strip model (NULL to bypass)
+	DATATRAK_NOISE *noise;		// noise and fading (NULL for a clean signal)
+	LOCKMARGIN *lockmargin;		// trigger lock-margin analyser (NULL if off)
+	LFCAPTURE *capture;			// phase capture file (NULL if off)
+
+	const LFCAPTURE_FILE *replay;	// capture being replayed (NULL to generate)
+	bool replayLoop;			// go back to the start at the end of the capture
+	bool ends[LFSOURCE_RING_SIZE];	// slot is past the end of the replay
+	bool replayDamaged;			// a damaged capture cycle has been reported
+
+	unsigned long underruns;	// times the CPU had to wait for the producer
+
+	pthread_t thread;
+	bool running;
+	bool stop;
+} LfSource;
+
+
+// Analyse, stream and record a cycle the CPU has finished with
+static void LfSourceOutput(DATATRAK_CYCLE *cyc)
+{
+	if (LfSource.lockmargin != NULL) {
+		lockmargin_analyse(LfSource.lockmargin, &cyc->ctx, &cyc->buf);
+	}
+
+	for (size_t i=0; i<LfSource.numStreams; i++) {
+		LfStreamPush(LfSource.streams[i], &cyc->ctx, &cyc->buf);
+	}
+
+	if (LfSource.capture != NULL) {
+		LfCapturePush(LfSource.capture, &cyc->ctx, &cyc->buf);
+	}
+
+#ifdef WRITE_PHASEDATA_MODULATED
+	datatrak_gen_dumpModulated(&cyc->ctx, &cyc->buf, "phasedata_modulated.raw");
+#endif
+#ifdef WRITE_PHASEDATA
+	datatrak_gen_dumpRaw(&cyc->ctx, &cyc->buf, "phasedata_raw.raw");
+#endif
+}
+
+// Generate one cycle into the given slot
+static void LfSourceGenerate(DATATRAK_CYCLE *cyc, DATATRAK_LF_CTX *start)
+{
+	// Before propagation and fading alter it, so the cycle can be regenerated
+	*start = LfSource.ctx;
+
+	if (LfSource.prop != NULL) {
+		prop_apply(LfSource.prop, &LfSource.ctx);
+	}
+
+	if (LfSource.noise != NULL) {
+		lfnoise_fade(LfSource.noise, &LfSource.ctx);
+	}
+
+	cyc->ctx = LfSource.ctx;
+	datatrak_gen_generate(&LfSource.ctx, &cyc->buf);
+
+	if (LfSource.ifstrip != NULL) {
+		ifstrip_process(LfSource.ifstrip, &cyc->ctx, &cyc->buf);
+	}
+
+	if (LfSource.noise != NULL) {
+		lfnoise_unfade(LfSource.noise, &LfSource.ctx);
+		lfnoise_apply(LfSource.noise, &cyc->ctx, &cyc->buf);
+	}
+}
+
+/**
+ * Replay the next capture cycle into the given slot. Past the end of the
+ * capture (or at a cycle that can't be read), the slot gets a cycle with no
+ * signal and is marked as the end, and the position stays where it is.
+ */
+static void LfSourceReplay(DATATRAK_CYCLE *cyc, DATATRAK_LF_CTX *start, bool *end)
+{
+	size_t n = LfSource.ctx.replay_n;
+
+	*start = LfSource.ctx;
+	cyc->ctx = LfSource.ctx;
+
+	if ((n >= LfCaptureCycles(LfSource.replay)) && LfSource.replayLoop) {
+		n = 0;
+	}
+
+	if ((LfCaptureRead(LfSource.replay, n, &cyc->ctx, &cyc->buf) != 0) || (cyc->ctx.msPerCycle == 0)) {
+		if ((n < LfCaptureCycles(LfSource.replay)) && !LfSource.replayDamaged) {
+			fprintf(stderr, "LFSOURCE: capture cycle %zu is damaged, ending the replay there\n", n);
+			LfSource.replayDamaged = true;
+		}
+		cyc->ctx = LfSource.ctx;
+		memset(cyc->buf.f1_phase, 0, sizeof(cyc->buf.f1_phase));
+		memset(cyc->buf.f2_phase, 0, sizeof(cyc->buf.f2_phase));
+		memset(cyc->buf.f1_amplitude, DATATRAK_RSSI_MIN, sizeof(cyc->buf.f1_amplitude));
+		memset(cyc->buf.f2_amplitude, DATATRAK_RSSI_MIN, sizeof(cyc->buf.f2_amplitude));
+		*end = true;
+		return;
+	}
+
+	// Follow the capture, so the state looks like the generator's would
+	LfSource.ctx.clock_n    = cyc->ctx.clock_n;
+	LfSource.ctx.goldcode_n = cyc->ctx.goldcode_n;
+	LfSource.ctx.msPerCycle = cyc->ctx.msPerCycle;
+	LfSource.ctx.mode       = cyc->ctx.mode;
+	LfSource.ctx.replay_n   = n + 1;
+	cyc->ctx.replay_n       = n;
+	*end = false;
+}
+
+/**
+ * Output the cycles the CPU has released since the last call. Called by the
+ * producer before it reuses their slots, or once it has stopped. The slots
+ * past the end of a replay weren't received, so they're left out.
+ */
+static void LfSourceFlush(void)
+{
+	const size_t tail = __atomic_load_n(&LfSource.ring.tail, __ATOMIC_ACQUIRE);
+
+	for (; LfSource.outputs != tail; LfSource.outputs++) {
+		const size_t slot = LfSource.outputs & (LfSource.ring.size - 1);
+		if ((LfSource.replay == NULL) || !LfSource.ends[slot]) {
+			LfSourceOutput(&LfSource.cycles[slot]);
+		}
+	}
+}
+
+static void *LfSourceThread(void *arg)
+{
+	(void)arg;
+
+	while (!__atomic_load_n(&LfSource.stop, __ATOMIC_ACQUIRE)) {
+		LfSourceFlush();
+
+		ptrdiff_t slot = SpscWriteSlot(&LfSource.ring);
+		if (slot < 0) {
+			usleep(LFSOURCE_IDLE_US);
+			continue;
+		}
+
+		if (LfSource.replay != NULL) {
+			LfSourceReplay(&LfSource.cycles[slot], &LfSource.starts[slot], &LfSource.ends[slot]);
+		} else {
+			LfSourceGenerate(&LfSource.cycles[slot], &LfSource.starts[slot]);
+		}
+		SpscPublish(&LfSource.ring);
+	}
+
+	return NULL;
+}
+
+// Start the generator thread from the given state, with an empty ring
+static int LfSourceStart(const DATATRAK_LF_CTX *ctx)
+{
+	LfSource.ctx = *ctx;
+	SpscInit(&LfSource.ring, LFSOURCE_RING_SIZE);
+	LfSource.holding   = false;
+	LfSource.outputs   = 0;
+	LfSource.stop      = false;
+
+	if (pthread_create(&LfSource.thread, NULL, LfSourceThread, NULL) != 0) {
+		fprintf(stderr, "LFSOURCE: can't start generator thread\n");
+		return -1;
+	}
+	LfSource.running = true;
+
+	return 0;
+}
+
+/**
+ * Start the generator thread.
+ *
+ * ctx is the initial generator configuration; the source keeps its own copy,
+ * so changes to ctx after this call have no effect.
+ */
+int LfSourceInit(const DATATRAK_LF_CTX *ctx)
+{
+	LfSource.underruns = 0;
+	return LfSourceStart(ctx);
+}
+
+/// Feed every cycle the CPU reads to the given stream. Call before LfSourceInit().
+void LfSourceAddStream(LFSTREAM *s)
+{
+	if (LfSource.numStreams < LFSOURCE_MAX_STREAMS) {
+		LfSource.streams[LfSource.numStreams++] = s;
+	}
+}
+
+/// Drive slot phases and powers from a propagation model. Call before LfSourceInit().
+void LfSourceSetPropagation(PROP_MODEL *pm)
+{
+	LfSource.prop = pm;
+}
+
+/// Pass every cycle through a receiver IF-strip model. Call before LfSourceInit().
+void LfSourceSetIfStrip(IFSTRIP *f)
+{
+	LfSource.ifstrip = f;
+}
+
+/// Add noise and fading to every cycle. Call before LfSourceInit().
+void LfSourceSetNoise(DATATRAK_NOISE *n)
+{
+	LfSource.noise = n;
+}
+
+/**
+ * Score the trigger of every cycle with a lock-margin analyser. Call before
+ * LfSourceInit(), and don't read the analyser until after LfSourceDone().
+ */
+void LfSourceSetLockMargin(LOCKMARGIN *lm)
+{
+	LfSource.lockmargin = lm;
+}
+
+/// Record every cycle the CPU reads to a capture file. Call before LfSourceInit().
+void LfSourceSetCapture(LFCAPTURE *c)
+{
+	LfSource.capture = c;
+}
+
+/**
+ * Replay cycles from a mapped capture file instead of generating them,
+ * starting from the capture cycle in the generator state's replay_n. With
+ * loop, the replay goes back to the first cycle after the last, otherwise
+ * LfSourceReplayEnded() says when the CPU has reached the end. Call before
+ * LfSourceInit().
+ */
+void LfSourceSetReplay(const LFCAPTURE_FILE *f, const bool loop)
+{
+	LfSource.replay     = f;
+	LfSource.replayLoop = loop;
+}
+
+/// True if a capture is being replayed
+bool LfSourceReplaying(void)
+{
+	return (LfSource.replay != NULL);
+}
+
+/// True if the CPU's current cycle is past the end of the replayed capture
+bool LfSourceReplayEnded(void)
+{
+	return LfSource.holding && LfSource.ends[LfSource.ring.tail & (LfSource.ring.size - 1)];
+}
+
+/**
+ * Move on to the next cycle.
+ *
+ * Releases the cycle returned by the previous call (the pointer becomes
+ * invalid) and returns the next one. Only waits if the producer has fallen
+ * behind, which shouldn't happen in normal running.
+ */
+const DATATRAK_CYCLE *LfSourceNext(void)
+{
+	ptrdiff_t slot;
+
+	if (LfSource.holding) {
+		SpscRelease(&LfSource.ring);
+	}
+
+	slot = SpscReadSlot(&LfSource.ring);
+	if (slot < 0) {
+		LfSource.underruns++;
+		do {
+			sched_yield();
+			slot = SpscReadSlot(&LfSource.ring);
+		} while (slot < 0);
+	}
+
+	LfSource.holding = true;
+	return &LfSource.cycles[slot];
+}
+
+// Stop the generator thread, and output the cycles the CPU has finished with
+static void LfSourceStop(void)
+{
+	if (LfSource.running) {
+		__atomic_store_n(&LfSource.stop, true, __ATOMIC_RELEASE);
+		pthread_join(LfSource.thread, NULL);
+		LfSource.running = false;
+		LfSourceFlush();
+	}
+}
+
+/**
+ * Get the generator state the CPU's current cycle (the last one returned by
+ * LfSourceNext()) was generated from, for LfSourceReset().
+ */
+void LfSourceGetState(DATATRAK_LF_CTX *ctx)
+{
+	*ctx = LfSource.starts[LfSource.ring.tail & (LfSource.ring.size - 1)];
+}
+
+/**
+ * Throw away the cycles generated ahead and start again from ctx (as
+ * returned by LfSourceGetState()). The next LfSourceNext() returns the cycle
+ * generated from ctx; earlier cycle pointers become invalid.
+ *
+ * The signal configuration and cycle position are restored exactly. Stateful
+ * stages -- the propagation model's trajectory, the fading process and the
+ * IF-strip filter -- carry on from where they were.
+ *
+ * None of the cycles thrown away have been output, so analysers, streams
+ * and the capture only see the cycles the CPU goes on to read.
+ */
+int LfSourceReset(const DATATRAK_LF_CTX *ctx)
+{
+	LfSourceStop();
+	return LfSourceStart(ctx);
+}
+
+/**
+ * Stop the generator thread but keep the cycle the CPU is reading, e.g.
+ * before a fork(). Carry on with LfSourceReset().
+ */
+void LfSourceSuspend(void)
+{
+	LfSourceStop();
+}
+
+/// Stop the generator thread
+void LfSourceDone(void)
+{
+	LfSourceStop();
+
+	if (LfSource.underruns > 0) {
+		fprintf(stderr, "LFSOURCE: CPU waited for the generator %lu times\n", LfSource.underruns);
+	}
+}
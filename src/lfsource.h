@@ -0,0 +1,38 @@
+/****************************************************************************
+ * LF signal source
+ *
+ * Runs the LF signal generator (or replays a capture) on its own thread, a
+ * few cycles ahead of the emulated CPU, and hands finished cycles over
+ * through a lock-free ring.
+ ****************************************************************************/
+
+#ifndef LFSOURCE_H
+#define LFSOURCE_H
+
+#include <stdbool.h>
+
+#include "datatrak_gen.h"
+#include "ifstrip.h"
+#include "lfcapture.h"
+#include "lfnoise.h"
+#include "lockmargin.h"
+#include "lfstream.h"
+#include "propagation.h"
+
+int LfSourceInit(const DATATRAK_LF_CTX *ctx);
+void LfSourceAddStream(LFSTREAM *s);
+void LfSourceSetPropagation(PROP_MODEL *pm);
+void LfSourceSetIfStrip(IFSTRIP *f);
+void LfSourceSetNoise(DATATRAK_NOISE *n);
+void LfSourceSetLockMargin(LOCKMARGIN *lm);
+void LfSourceSetCapture(LFCAPTURE *c);
+void LfSourceSetReplay(const LFCAPTURE_FILE *f, const bool loop);
+bool LfSourceReplaying(void);
+bool LfSourceReplayEnded(void);
+const DATATRAK_CYCLE *LfSourceNext(void);
+void LfSourceGetState(DATATRAK_LF_CTX *ctx);
+int LfSourceReset(const DATATRAK_LF_CTX *ctx);
+void LfSourceSuspend(void);
+void LfSourceDone(void);
+
+#endif // LFSOURCE_H
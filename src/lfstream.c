@@ -0,0 +1,428 @@
+/***
+ * LF signal streaming
+ *
+ * Each stream owns a lock-free ring of generated cycles and a writer thread.
+ * The emulator pushes cycles into the ring and never waits: if the consumer
+ * falls behind (or nobody is connected) the ring fills and cycles are
+ * dropped, so the CPU loop runs at the same speed with or without a viewer.
+ *
+ * I/Q streams regenerate each cycle with DATATRAK_COMPENSATION_NONE before
+ * upconverting it: an SDR drives a real receiver through its own IF strip,
+ * which adds the group delay the Mk2 compensation stands in for. I/Q has
+ * no cycle framing for a consumer to check, so it relies on the LF source
+ * pushing each cycle once, after the CPU has read it: a control change
+ * never puts a cycle into the samples twice. Only a rewind goes back, as
+ * the firmware does.
+ *
+ * The stream target is either:
+ *   - an existing FIFO (mkfifo), opened when a reader appears, or
+ *   - a UNIX domain socket, created at the given path. One client at a time.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "datatrak_gen.h"
+#include "iqgen.h"
+#include "spsc.h"
+
+#include "lfstream.h"
+
+
+// Number of cycles buffered between the emulator and the writer thread.
+// Must be a power of two.
+#define LFSTREAM_RING_SIZE 8
+
+// How long the writer thread sleeps when it has nothing to do (microseconds)
+#define LFSTREAM_IDLE_US 1000
+
+// Milliseconds of I/Q output collected before each write
+#define LFSTREAM_IQ_CHUNK_MS 16
+
+struct LFSTREAM {
+	char *path;
+	LFSTREAM_FORMAT format;
+	bool isFifo;				// target is a FIFO rather than a UNIX socket
+
+	int listenFd;				// listening socket (-1 for FIFO targets)
+	int fd;						// connected consumer (-1 when none)
+
+	SPSC_RING ring;
+	DATATRAK_CYCLE frames[LFSTREAM_RING_SIZE];
+	uint32_t seq;				// next sequence number (producer-owned)
+	uint32_t seqs[LFSTREAM_RING_SIZE];
+	uint32_t dropped;			// dropped cycle count (producer-owned, read by writer)
+
+	DATATRAK_MODSTATE mod;		// modulator state (writer-owned)
+	uint8_t *payload;			// encode buffer (writer-owned)
+
+	IQGEN *iq;					// I/Q upconverter (writer-owned)
+	DATATRAK_LF_CTX iqCtx;		// uncompensated generator for I/Q output
+	DATATRAK_OUTBUF iqBuf;
+	bool iqCtxReady;
+
+	pthread_t thread;
+	bool running;				// writer thread has been started
+	bool stop;					// writer thread should exit
+};
+
+
+// Close the consumer connection, if any
+static void LfStreamDisconnect(LFSTREAM *s)
+{
+	if (s->fd >= 0) {
+		close(s->fd);
+		s->fd = -1;
+		fprintf(stderr, "LFSTREAM %s: consumer disconnected\n", s->path);
+	}
+}
+
+// Try to pick up a consumer. Waits up to LFSTREAM_IDLE_US for a socket client.
+static void LfStreamTryConnect(LFSTREAM *s)
+{
+	if (s->isFifo) {
+		// Non-blocking open fails with ENXIO until a reader has the FIFO open
+		int fd = open(s->path, O_WRONLY | O_NONBLOCK);
+		if (fd < 0) {
+			usleep(LFSTREAM_IDLE_US);
+			return;
+		}
+		s->fd = fd;
+	} else {
+		struct pollfd pfd = { .fd = s->listenFd, .events = POLLIN };
+		if (poll(&pfd, 1, LFSTREAM_IDLE_US / 1000) <= 0) {
+			return;
+		}
+		int fd = accept(s->listenFd, NULL, NULL);
+		if (fd < 0) {
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		s->fd = fd;
+	}
+
+	fprintf(stderr, "LFSTREAM %s: consumer connected\n", s->path);
+}
+
+// Write a whole buffer to the consumer. Returns false if the consumer went away,
+// or the stream is closing. The fd is non-blocking, so a consumer that stops
+// reading can't hold up LfStreamClose().
+static bool LfStreamWrite(LFSTREAM *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 0) {
+		if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+		ssize_t n;
+		if (s->isFifo) {
+			n = write(s->fd, p, len);
+		} else {
+			n = send(s->fd, p, len, MSG_NOSIGNAL);
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+				poll(&pfd, 1, LFSTREAM_IDLE_US / 1000);
+				continue;
+			}
+			return false;
+		}
+		p   += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Encode one cycle into s->payload. Returns the payload length.
+static size_t LfStreamEncode(LFSTREAM *s, DATATRAK_CYCLE *cyc)
+{
+	const size_t ms = cyc->ctx.msPerCycle;
+	uint8_t *p = s->payload;
+
+	switch (s->format) {
+		case LFSTREAM_FORMAT_PHASE:
+			memcpy(p, cyc->buf.f1_phase, ms * sizeof(uint16_t));		p += ms * sizeof(uint16_t);
+			memcpy(p, cyc->buf.f2_phase, ms * sizeof(uint16_t));		p += ms * sizeof(uint16_t);
+			memcpy(p, cyc->buf.f1_amplitude, ms);						p += ms;
+			memcpy(p, cyc->buf.f2_amplitude, ms);						p += ms;
+			return p - s->payload;
+
+		case LFSTREAM_FORMAT_MODULATED:
+			return datatrak_gen_modulate(&cyc->ctx, &cyc->buf, &s->mod, (int16_t *)s->payload)
+				* 2 * sizeof(int16_t);
+
+		case LFSTREAM_FORMAT_IQ:
+			// Written in chunks by LfStreamWriteIQ()
+			break;
+	}
+
+	return 0;
+}
+
+// Regenerate one cycle without IF compensation and write it as I/Q samples.
+// Returns false if the consumer went away.
+static bool LfStreamWriteIQ(LFSTREAM *s, const DATATRAK_CYCLE *cyc)
+{
+	if (!s->iqCtxReady) {
+		datatrak_gen_init(&s->iqCtx, cyc->ctx.mode, DATATRAK_COMPENSATION_NONE);
+		s->iqCtxReady = true;
+	}
+	datatrak_gen_sync(&s->iqCtx, &cyc->ctx);
+	datatrak_gen_generate(&s->iqCtx, &s->iqBuf);
+
+	const size_t sampSize = iqgen_sample_size(s->iq);
+	size_t n = 0;
+
+	for (size_t msec = 0; msec < s->iqCtx.msPerCycle; msec++) {
+		n += iqgen_process_ms(s->iq, &s->iqBuf, msec, s->payload + (n * sampSize));
+
+		if (((msec + 1) % LFSTREAM_IQ_CHUNK_MS == 0) || (msec + 1 == s->iqCtx.msPerCycle)) {
+			if (!LfStreamWrite(s, s->payload, n * sampSize)) {
+				return false;
+			}
+			n = 0;
+		}
+	}
+
+	return true;
+}
+
+static void *LfStreamThread(void *arg)
+{
+	LFSTREAM *s = arg;
+
+	while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+		if (s->fd < 0) {
+			// Nobody listening -- discard anything queued so a new consumer
+			// starts with live data, then wait for a connection.
+			while (SpscReadSlot(&s->ring) >= 0) {
+				SpscRelease(&s->ring);
+			}
+			LfStreamTryConnect(s);
+			continue;
+		}
+
+		ptrdiff_t slot = SpscReadSlot(&s->ring);
+		if (slot < 0) {
+			usleep(LFSTREAM_IDLE_US);
+			continue;
+		}
+
+		DATATRAK_CYCLE *cyc = &s->frames[slot];
+
+		if (s->format == LFSTREAM_FORMAT_IQ) {
+			bool ok = LfStreamWriteIQ(s, cyc);
+			SpscRelease(&s->ring);
+			if (!ok) {
+				LfStreamDisconnect(s);
+			}
+			continue;
+		}
+
+		LFSTREAM_HEADER hdr = {
+			.magic      = LFSTREAM_MAGIC,
+			.version    = LFSTREAM_VERSION,
+			.format     = s->format,
+			.seq        = s->seqs[slot],
+			.dropped    = __atomic_load_n(&s->dropped, __ATOMIC_RELAXED),
+			.clock_n    = cyc->ctx.clock_n,
+			.goldcode_n = cyc->ctx.goldcode_n,
+			.msPerCycle = cyc->ctx.msPerCycle,
+			.reserved   = 0
+		};
+		hdr.payloadLen = LfStreamEncode(s, cyc);
+		SpscRelease(&s->ring);
+
+		if (!LfStreamWrite(s, &hdr, sizeof(hdr)) ||
+				!LfStreamWrite(s, s->payload, hdr.payloadLen)) {
+			LfStreamDisconnect(s);
+		}
+	}
+
+	return NULL;
+}
+
+// Create a listening UNIX domain socket at the given path
+static int LfStreamListen(const char *path)
+{
+	struct sockaddr_un sa;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "LFSTREAM: socket path too long: %s\n", path);
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("LFSTREAM socket");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	// Remove a stale socket left behind by a previous run
+	unlink(path);
+
+	if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) || (listen(fd, 1) < 0)) {
+		perror("LFSTREAM bind");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Open a stream to the given path.
+ *
+ * If the path is an existing FIFO, cycles are written to it whenever a reader
+ * has it open. Otherwise a UNIX domain socket is created at the path.
+ *
+ * iqcfg configures LFSTREAM_FORMAT_IQ streams and is ignored otherwise.
+ *
+ * Returns NULL on error.
+ */
+LFSTREAM *LfStreamOpen(const char *path, const LFSTREAM_FORMAT format, const IQGEN_CONFIG *iqcfg)
+{
+	struct stat st;
+
+	LFSTREAM *s = calloc(1, sizeof(LFSTREAM));
+	if (s == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	s->path     = strdup(path);
+	s->format   = format;
+	s->isFifo   = (stat(path, &st) == 0) && S_ISFIFO(st.st_mode);
+	s->listenFd = -1;
+	s->fd       = -1;
+	SpscInit(&s->ring, LFSTREAM_RING_SIZE);
+
+	// Size the encode buffer for the largest payload this format can produce
+	switch (format) {
+		case LFSTREAM_FORMAT_PHASE:
+			s->payload = malloc(DATATRAK_BUF_LEN * (2 * sizeof(uint16_t) + 2 * sizeof(uint8_t)));
+			break;
+
+		case LFSTREAM_FORMAT_MODULATED:
+			s->payload = malloc(DATATRAK_BUF_LEN * DATATRAK_MOD_SAMPLES_PER_MS * 2 * sizeof(int16_t));
+			break;
+
+		case LFSTREAM_FORMAT_IQ:
+			s->iq = iqgen_init(iqcfg);
+			if (s->iq == NULL) {
+				LfStreamClose(s);
+				return NULL;
+			}
+			s->payload = malloc(LFSTREAM_IQ_CHUNK_MS * iqgen_max_samples_per_ms(s->iq) * iqgen_sample_size(s->iq));
+			break;
+	}
+	if ((s->path == NULL) || (s->payload == NULL)) {
+		fprintf(stderr, "Error allocating memory.\n");
+		LfStreamClose(s);
+		return NULL;
+	}
+
+	if (!s->isFifo) {
+		s->listenFd = LfStreamListen(path);
+		if (s->listenFd < 0) {
+			LfStreamClose(s);
+			return NULL;
+		}
+	}
+
+	// A FIFO reader going away must not kill the emulator
+	signal(SIGPIPE, SIG_IGN);
+
+	if (pthread_create(&s->thread, NULL, LfStreamThread, s) != 0) {
+		fprintf(stderr, "LFSTREAM: can't start writer thread\n");
+		LfStreamClose(s);
+		return NULL;
+	}
+	s->running = true;
+
+	const char *what = "phase data";
+	if (format == LFSTREAM_FORMAT_MODULATED) {
+		what = "modulated audio";
+	} else if (format == LFSTREAM_FORMAT_IQ) {
+		what = "I/Q samples";
+	}
+	fprintf(stderr, "LFSTREAM: streaming %s to %s %s\n", what, s->isFifo ? "FIFO" : "UNIX socket", path);
+
+	return s;
+}
+
+/**
+ * Queue one cycle for streaming. The LF source calls this once the CPU has
+ * finished with the cycle, so a stream carries what the firmware received.
+ *
+ * ctx is the generator state the cycle was generated from (i.e. a copy taken
+ * before datatrak_gen_generate() advanced it). Never blocks: if the ring is
+ * full the cycle is dropped and counted.
+ */
+void LfStreamPush(LFSTREAM *s, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf)
+{
+	uint32_t seq = s->seq++;
+
+	ptrdiff_t slot = SpscWriteSlot(&s->ring);
+	if (slot < 0) {
+		__atomic_store_n(&s->dropped, s->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	DATATRAK_CYCLE *cyc = &s->frames[slot];
+	cyc->ctx = *ctx;
+	memcpy(cyc->buf.f1_phase,     buf->f1_phase,     ctx->msPerCycle * sizeof(uint16_t));
+	memcpy(cyc->buf.f2_phase,     buf->f2_phase,     ctx->msPerCycle * sizeof(uint16_t));
+	memcpy(cyc->buf.f1_amplitude, buf->f1_amplitude, ctx->msPerCycle);
+	memcpy(cyc->buf.f2_amplitude, buf->f2_amplitude, ctx->msPerCycle);
+	s->seqs[slot] = seq;
+
+	SpscPublish(&s->ring);
+}
+
+/// Stop the writer thread and release the stream
+void LfStreamClose(LFSTREAM *s)
+{
+	if (s == NULL) {
+		return;
+	}
+
+	if (s->running) {
+		__atomic_store_n(&s->stop, true, __ATOMIC_RELEASE);
+		pthread_join(s->thread, NULL);
+	}
+
+	LfStreamDisconnect(s);
+	if (s->listenFd >= 0) {
+		close(s->listenFd);
+		unlink(s->path);
+	}
+
+	iqgen_free(s->iq);
+	free(s->payload);
+	free(s->path);
+	free(s);
+}
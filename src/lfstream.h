@@ -0,0 +1,59 @@
+/****************************************************************************
+ * LF signal streaming
+ *
+ * Streams generated LF cycles to an external consumer (scope, SDR tooling)
+ * through a UNIX domain socket or a FIFO, while the emulator runs.
+ ****************************************************************************/
+
+#ifndef LFSTREAM_H
+#define LFSTREAM_H
+
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+#include "iqgen.h"
+
+/// Stream frame magic number ('DTLF')
+#define LFSTREAM_MAGIC 0x464C5444
+/// Stream frame format version
+#define LFSTREAM_VERSION 1
+
+typedef enum {
+	LFSTREAM_FORMAT_PHASE,			///< Per-ms phase and amplitude for F1 and F2
+	LFSTREAM_FORMAT_MODULATED,		///< 44.1kHz stereo modulated audio (F1 left, F2 right)
+	LFSTREAM_FORMAT_IQ				///< Raw complex baseband I/Q, no frame headers (see iqgen.h)
+} LFSTREAM_FORMAT;
+
+/**
+ * Frame header, written in host byte order before each cycle's payload.
+ *
+ * LFSTREAM_FORMAT_PHASE payload:
+ *   uint16_t f1_phase[msPerCycle], uint16_t f2_phase[msPerCycle],
+ *   uint8_t  f1_amplitude[msPerCycle], uint8_t f2_amplitude[msPerCycle]
+ *
+ * LFSTREAM_FORMAT_MODULATED payload:
+ *   int16_t samples[msPerCycle * DATATRAK_MOD_SAMPLES_PER_MS][2]
+ *
+ * LFSTREAM_FORMAT_IQ streams carry no headers at all, only interleaved I/Q
+ * samples, so they can be fed straight into SDR tools.
+ */
+typedef struct {
+	uint32_t magic;				///< LFSTREAM_MAGIC
+	uint16_t version;			///< LFSTREAM_VERSION
+	uint16_t format;			///< LFSTREAM_FORMAT
+	uint32_t seq;				///< Cycle sequence number (counts dropped cycles too)
+	uint32_t dropped;			///< Total cycles dropped so far
+	int32_t  clock_n;			///< Generator clock value for this cycle
+	int32_t  goldcode_n;		///< Generator Gold code offset for this cycle
+	uint16_t msPerCycle;		///< Milliseconds in this cycle
+	uint16_t reserved;
+	uint32_t payloadLen;		///< Payload length in bytes
+} LFSTREAM_HEADER;
+
+typedef struct LFSTREAM LFSTREAM;
+
+LFSTREAM *LfStreamOpen(const char *path, const LFSTREAM_FORMAT format, const IQGEN_CONFIG *iqcfg);
+void LfStreamPush(LFSTREAM *s, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf);
+void LfStreamClose(LFSTREAM *s);
+
+#endif // LFSTREAM_H
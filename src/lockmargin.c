@@ -0,0 +1,229 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "datatrak_gen.h"
+#include "lockmargin.h"
+
+/*
+ * Trigger lock-margin analyser
+ * ============================
+ *
+ * The firmware finds the start of a cycle by passing the F1 phase through
+ * an integer IIR bandpass (getPhaseMeas, 0x97CE) and comparing the 40
+ * samples of the trigger window against its two stored templates by sum of
+ * absolute differences. A window scoring over 1000 against the template for
+ * the bit that was sent doesn't lock.
+ *
+ * This runs the same filter and correlator over every cycle the CPU reads, so
+ * the lock margin can be watched directly rather than inferred from the
+ * firmware's UART output. It sees the cycle as the CPU did (after the IF
+ * strip model and noise, if enabled). Cycles are analysed once the CPU has
+ * finished with them, so the ones generated ahead and thrown away by a
+ * control change or rewind are never counted.
+ *
+ * The filter is
+ *
+ *     H(z) = (65/256)(1 − z⁻¹) / [(1 − (13/16)z⁻¹)(1 − (11/16)z⁻¹)]
+ *
+ * in two integer sections with the state held ×256:
+ *
+ *     iir1 = (13 × iir1 >> 4) + 65 × Δphase
+ *     iir2 = (11 × iir2 >> 4) + iir1
+ *     out  = iir2 >> 8
+ *
+ * Phase steps are taken the shorter way round the 0-999 phase register.
+ * The filter starts from rest at the start of the cycle and settles on the
+ * first anti-aliasing slot, well before the trigger.
+ *
+ * The firmware times the cycle from the trigger it locked to, so a constant
+ * receiver delay (such as the simulated IF strip's) only moves its window.
+ * The window is scored at each delay from 0 to LOCKMARGIN_MAX_DELAY ms and
+ * the best alignment kept.
+ *
+ * The firmware also has a large-step guard which kicks iir1 by ±5333 on the
+ * first sample of the trigger. Its exact trigger condition isn't known, so
+ * it is left out by default: without it the model scores the generator's
+ * Mk2-compensated triggers at 526 (50Hz) and 394 (37.5Hz), against 493 and
+ * 392 measured on hardware. Define LOCKMARGIN_ONSET_KICK to include it.
+ *
+ * The cost is under a microsecond per cycle.
+ */
+
+// Define to model the firmware's large-step guard on the trigger onset
+//#define LOCKMARGIN_ONSET_KICK
+
+// Guard kick size (iir1 units)
+#define LOCKMARGIN_KICK 5333
+
+// Phase register counts per carrier cycle
+#define LOCKMARGIN_PHASE_COUNTS 1000
+
+
+void lockmargin_init(LOCKMARGIN *lm)
+{
+	for (size_t i = 0; i < LOCKMARGIN_POSITIONS; i++) {
+		LOCKMARGIN_POS *p = &lm->pos[i];
+		p->count = p->overTarget = p->overThreshold = p->confused = 0;
+		p->last = p->lastDelay = p->min = p->max = 0;
+		p->sum = 0;
+	}
+	lm->log = NULL;
+}
+
+/**
+ * Log every analysed trigger window to fp, one line each:
+ *
+ *     clock_n goldcode_n bit sad other_sad margin delay
+ *
+ * where other_sad is the score against the other bit's template, margin
+ * is LOCKMARGIN_THRESHOLD - sad and delay is the best alignment in ms.
+ */
+void lockmargin_set_log(LOCKMARGIN *lm, FILE *fp)
+{
+	lm->log = fp;
+	if (fp != NULL) {
+		fprintf(fp, "# clock_n goldcode_n bit sad other_sad margin delay (threshold %d, target %d)\n",
+				LOCKMARGIN_THRESHOLD, LOCKMARGIN_TARGET);
+	}
+}
+
+/**
+ * Score the trigger window of one cycle's F1 phase data.
+ *
+ * bit is the Gold code bit that was sent. On return *sad is the score
+ * against that bit's template and *other the score against the other one,
+ * both at the best alignment. Returns the alignment (delay in ms).
+ */
+int lockmargin_sad(const uint16_t *phase, const int bit, int *sad, int *other)
+{
+	const size_t len = DATATRAK_TRIG_START + LOCKMARGIN_MAX_DELAY + DATATRAK_TRIG_LEN;
+	const int16_t *match  = bit ? DT_TRIG375_TEMPLATE : DT_TRIG50_TEMPLATE;
+	const int16_t *nomatch = bit ? DT_TRIG50_TEMPLATE : DT_TRIG375_TEMPLATE;
+	int out[DATATRAK_TRIG_LEN + LOCKMARGIN_MAX_DELAY];
+	int32_t iir1 = 0, iir2 = 0;
+	int prev = phase[0];
+	int best = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		int step = (phase[i] - prev) % LOCKMARGIN_PHASE_COUNTS;
+		if (step >= LOCKMARGIN_PHASE_COUNTS / 2) {
+			step -= LOCKMARGIN_PHASE_COUNTS;
+		} else if (step < -LOCKMARGIN_PHASE_COUNTS / 2) {
+			step += LOCKMARGIN_PHASE_COUNTS;
+		}
+		prev = phase[i];
+
+		iir1 = ((iir1 * 13) >> 4) + (65 * step);
+#ifdef LOCKMARGIN_ONSET_KICK
+		if ((i == DATATRAK_TRIG_START) && (step != 0)) {
+			iir1 += (step > 0) ? LOCKMARGIN_KICK : -LOCKMARGIN_KICK;
+		}
+#endif
+		iir2 = ((iir2 * 11) >> 4) + iir1;
+
+		if (i >= DATATRAK_TRIG_START) {
+			out[i - DATATRAK_TRIG_START] = iir2 >> 8;
+		}
+	}
+
+	*sad = -1;
+	for (int d = 0; d <= LOCKMARGIN_MAX_DELAY; d++) {
+		int s = 0;
+		for (size_t i = 0; i < DATATRAK_TRIG_LEN; i++) {
+			s += abs(out[d + i] - match[i]);
+		}
+		if ((*sad < 0) || (s < *sad)) {
+			*sad = s;
+			best = d;
+		}
+	}
+
+	*other = 0;
+	for (size_t i = 0; i < DATATRAK_TRIG_LEN; i++) {
+		*other += abs(out[best + i] - nomatch[i]);
+	}
+
+	return best;
+}
+
+/**
+ * Analyse one cycle the CPU has read.
+ *
+ * ctx is the generator state the cycle was generated from.
+ */
+void lockmargin_analyse(LOCKMARGIN *lm, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf)
+{
+	const int bit = datatrak_gen_goldcode_bit(ctx->goldcode_n);
+	LOCKMARGIN_POS *p = &lm->pos[ctx->goldcode_n];
+	int sad, other;
+	int delay = lockmargin_sad(buf->f1_phase, bit, &sad, &other);
+
+	if ((p->count == 0) || (sad < p->min)) {
+		p->min = sad;
+	}
+	if ((p->count == 0) || (sad > p->max)) {
+		p->max = sad;
+	}
+	p->last = sad;
+	p->lastDelay = delay;
+	p->sum += sad;
+	p->count++;
+	if (sad > LOCKMARGIN_TARGET) {
+		p->overTarget++;
+	}
+	if (sad > LOCKMARGIN_THRESHOLD) {
+		p->overThreshold++;
+	}
+	if (other <= sad) {
+		p->confused++;
+	}
+
+	if (lm->log != NULL) {
+		fprintf(lm->log, "%d %d %d %d %d %d %d\n",
+				ctx->clock_n, ctx->goldcode_n, bit, sad, other, LOCKMARGIN_THRESHOLD - sad, delay);
+	}
+}
+
+/// Print a summary of the scores so far, with any positions that failed to lock
+void lockmargin_report(const LOCKMARGIN *lm, FILE *fp)
+{
+	unsigned long count = 0, overTarget = 0, overThreshold = 0, confused = 0;
+	double sum = 0;
+	int worst = -1;
+
+	for (size_t i = 0; i < LOCKMARGIN_POSITIONS; i++) {
+		const LOCKMARGIN_POS *p = &lm->pos[i];
+		if (p->count == 0) {
+			continue;
+		}
+		count         += p->count;
+		overTarget    += p->overTarget;
+		overThreshold += p->overThreshold;
+		confused      += p->confused;
+		sum           += p->sum;
+		if ((worst < 0) || (p->max > lm->pos[worst].max)) {
+			worst = i;
+		}
+	}
+
+	if (count == 0) {
+		fprintf(fp, "LOCKMARGIN: no trigger windows analysed\n");
+		return;
+	}
+
+	fprintf(fp, "LOCKMARGIN: %lu windows, mean SAD %.0f, worst %d at goldcode_n %d (threshold %d, target %d)\n",
+			count, sum / count, lm->pos[worst].max, worst, LOCKMARGIN_THRESHOLD, LOCKMARGIN_TARGET);
+	fprintf(fp, "LOCKMARGIN: %lu over target, %lu over threshold, %lu closer to the wrong bit\n",
+			overTarget, overThreshold, confused);
+
+	for (size_t i = 0; i < LOCKMARGIN_POSITIONS; i++) {
+		const LOCKMARGIN_POS *p = &lm->pos[i];
+		if ((p->overThreshold == 0) && (p->confused == 0)) {
+			continue;
+		}
+		fprintf(fp, "LOCKMARGIN:   gc %2zu bit %d: SAD %d-%d (mean %.0f), %lu/%lu over threshold, %lu closer to the wrong bit\n",
+				i, datatrak_gen_goldcode_bit(i), p->min, p->max, p->sum / p->count,
+				p->overThreshold, p->count, p->confused);
+	}
+}
@@ -0,0 +1,48 @@
+/**************
+ * Datatrak trigger lock-margin analyser
+ */
+
+#ifndef _LOCKMARGIN_H
+#define _LOCKMARGIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "datatrak_gen.h"
+
+// Firmware SAD lock threshold: a trigger scoring above this doesn't lock
+#define LOCKMARGIN_THRESHOLD 1000
+// Target SAD for a healthy margin
+#define LOCKMARGIN_TARGET 500
+
+// Receiver delays searched for the best trigger alignment (ms)
+#define LOCKMARGIN_MAX_DELAY 4
+
+// Number of Gold code positions per clock
+#define LOCKMARGIN_POSITIONS 64
+
+
+/// Scores for one goldcode_n position
+typedef struct {
+	unsigned long count;				///< Trigger windows analysed
+	unsigned long overTarget;			///< Windows scoring above LOCKMARGIN_TARGET
+	unsigned long overThreshold;		///< Windows scoring above LOCKMARGIN_THRESHOLD
+	unsigned long confused;				///< Windows where the other bit's template matched better
+	int last;							///< Most recent SAD
+	int lastDelay;						///< Alignment of the most recent SAD (ms)
+	int min, max;						///< Best and worst SAD
+	double sum;							///< Sum of SADs, for the mean
+} LOCKMARGIN_POS;
+
+typedef struct {
+	LOCKMARGIN_POS pos[LOCKMARGIN_POSITIONS];	///< Scores by goldcode_n
+	FILE *log;							///< Per-window log (NULL for none)
+} LOCKMARGIN;
+
+void lockmargin_init(LOCKMARGIN *lm);
+void lockmargin_set_log(LOCKMARGIN *lm, FILE *fp);
+int lockmargin_sad(const uint16_t *phase, const int bit, int *sad, int *other);
+void lockmargin_analyse(LOCKMARGIN *lm, const DATATRAK_LF_CTX *ctx, const DATATRAK_OUTBUF *buf);
+void lockmargin_report(const LOCKMARGIN *lm, FILE *fp);
+
+#endif
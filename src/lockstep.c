@@ -0,0 +1,264 @@
+/***
+ * Lock-step differential execution
+ *
+ * Two emulator processes started with the same --lockstep=PATH pair up over
+ * a UNIX socket at PATH. The first to start (the leader) creates the socket
+ * and waits for the second (the follower). Both then boot and run the same
+ * ROM with the same generator settings, and after every tick they swap
+ * state hashes (see statehash.c). The intended use is an optimised build
+ * against a reference build: any behaviour change shows up as a mismatch.
+ *
+ * Inputs have to be the same on both sides. The signal generator is
+ * deterministic; UART input is only taken by the leader, which passes each
+ * received byte to the follower in the same tick (the follower doesn't open
+ * the UART ports at all).
+ *
+ * On the first mismatch both sides rewind to the start of the tick (using
+ * the rewind ring, which runs a snapshot per tick in this mode) and replay
+ * it one instruction at a time, comparing after each. With incremental
+ * hashing that costs no more than a bisection and finds the exact
+ * instruction in a single pass. Both machine states are then printed, and
+ * the emulators stop.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "m68k.h"
+
+#include "machine.h"
+#include "main.h"
+#include "uart.h"
+
+#include "lockstep.h"
+
+
+// Registers shown in the mismatch report
+static const struct {
+	m68k_register_t reg;
+	const char *name;
+} LockstepRegs[] = {
+	{ M68K_REG_D0, "D0" }, { M68K_REG_D1, "D1" }, { M68K_REG_D2, "D2" }, { M68K_REG_D3, "D3" },
+	{ M68K_REG_D4, "D4" }, { M68K_REG_D5, "D5" }, { M68K_REG_D6, "D6" }, { M68K_REG_D7, "D7" },
+	{ M68K_REG_A0, "A0" }, { M68K_REG_A1, "A1" }, { M68K_REG_A2, "A2" }, { M68K_REG_A3, "A3" },
+	{ M68K_REG_A4, "A4" }, { M68K_REG_A5, "A5" }, { M68K_REG_A6, "A6" }, { M68K_REG_A7, "A7" },
+	{ M68K_REG_USP, "USP" }, { M68K_REG_ISP, "ISP" }, { M68K_REG_SR, "SR" }, { M68K_REG_PC, "PC" }
+};
+#define LOCKSTEP_NUM_REGS (sizeof(LockstepRegs) / sizeof(LockstepRegs[0]))
+
+// State exchanged after every tick (or instruction, while bisecting)
+typedef struct {
+	uint64_t tick;				// emulated ms
+	uint64_t step;				// instruction within the tick (0 = whole tick)
+	STATEHASH hash;
+	uint32_t ppc;				// address of the last instruction executed
+	uint32_t regs[LOCKSTEP_NUM_REGS];
+	char disasm[64];			// the last instruction executed
+} LOCKSTEP_MSG;
+
+// UART bytes received by the leader in this tick
+typedef struct {
+	uint8_t valid;				// bit 0: channel A, bit 1: channel B
+	uint8_t rx[2];
+} LOCKSTEP_RX;
+
+static struct {
+	bool enabled;
+	bool leader;
+	int sock;
+	LOCKSTEP_MSG mine, theirs;	// the last exchange
+} Lockstep = { .sock = -1 };
+
+
+// Send or receive exactly len bytes
+static int LockstepIo(void *buf, const size_t len, const bool sending)
+{
+	uint8_t *p = buf;
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = sending ? send(Lockstep.sock, p + done, len - done, MSG_NOSIGNAL) :
+				recv(Lockstep.sock, p + done, len - done, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("LOCKSTEP");
+			return -1;
+		} else if (n == 0) {
+			fprintf(stderr, "LOCKSTEP: peer went away\n");
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/**
+ * Pair up with the other emulator through a UNIX socket at path. Blocks
+ * until both are present.
+ */
+int LockstepInit(const char *path)
+{
+	struct sockaddr_un sa;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "LOCKSTEP: socket path too long\n");
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("LOCKSTEP: socket");
+		return -1;
+	}
+
+	// If the leader is already waiting, join it as the follower
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+		Lockstep.sock   = fd;
+		Lockstep.leader = false;
+		fprintf(stderr, "LOCKSTEP: connected to leader at %s\n", path);
+	} else {
+		unlink(path);
+		if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) || (listen(fd, 1) < 0)) {
+			perror("LOCKSTEP: bind/listen");
+			close(fd);
+			return -1;
+		}
+		fprintf(stderr, "LOCKSTEP: waiting for follower at %s...\n", path);
+		Lockstep.sock = accept(fd, NULL, NULL);
+		close(fd);
+		unlink(path);
+		if (Lockstep.sock < 0) {
+			perror("LOCKSTEP: accept");
+			return -1;
+		}
+		Lockstep.leader = true;
+		fprintf(stderr, "LOCKSTEP: follower connected\n");
+	}
+
+	Lockstep.enabled = true;
+	return 0;
+}
+
+void LockstepDone(void)
+{
+	if (Lockstep.sock >= 0) {
+		close(Lockstep.sock);
+		Lockstep.sock = -1;
+	}
+	Lockstep.enabled = false;
+}
+
+bool LockstepEnabled(void)
+{
+	return Lockstep.enabled;
+}
+
+bool LockstepIsLeader(void)
+{
+	return Lockstep.leader;
+}
+
+/**
+ * Pass UART input from the leader to the follower. Call straight after
+ * UartPollRx(), with the RX ready flags from before it.
+ */
+int LockstepSyncRx(const bool wasReadyA, const bool wasReadyB)
+{
+	LOCKSTEP_RX rx = { 0, { 0, 0 } };
+
+	if (Lockstep.leader) {
+		if (!wasReadyA && Uart.RxReadyA) {
+			rx.valid |= 1;
+			rx.rx[0] = Uart.RxBufA;
+		}
+		if (!wasReadyB && Uart.RxReadyB) {
+			rx.valid |= 2;
+			rx.rx[1] = Uart.RxBufB;
+		}
+		return LockstepIo(&rx, sizeof(rx), true);
+	}
+
+	if (LockstepIo(&rx, sizeof(rx), false) != 0) {
+		return -1;
+	}
+	for (int ch = 0; ch < 2; ch++) {
+		if (rx.valid & (1 << ch)) {
+			UartInjectRx(ch, rx.rx[ch]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Swap state with the peer. Returns 1 if the states match, 0 if they
+ * differ and -1 if the peer has gone.
+ */
+int LockstepCompare(const uint64_t tick, const uint64_t step, const STATEHASH *h)
+{
+	LOCKSTEP_MSG *m = &Lockstep.mine;
+
+	m->tick = tick;
+	m->step = step;
+	m->hash = *h;
+	if (step > 0) {
+		m->ppc = m68k_get_reg(NULL, M68K_REG_PPC);
+		for (size_t i = 0; i < LOCKSTEP_NUM_REGS; i++) {
+			m->regs[i] = m68k_get_reg(NULL, LockstepRegs[i].reg);
+		}
+		m68k_disassemble(m->disasm, m->ppc, M68K_CPU_TYPE_68000);
+	}
+
+	if ((LockstepIo(m, sizeof(*m), true) != 0) || (LockstepIo(&Lockstep.theirs, sizeof(Lockstep.theirs), false) != 0)) {
+		return -1;
+	}
+
+	return (Lockstep.theirs.hash.total == m->hash.total) ? 1 : 0;
+}
+
+/// Print both sides of the last comparison
+void LockstepReport(void)
+{
+	const LOCKSTEP_MSG *a = Lockstep.leader ? &Lockstep.mine : &Lockstep.theirs;
+	const LOCKSTEP_MSG *b = Lockstep.leader ? &Lockstep.theirs : &Lockstep.mine;
+
+	fprintf(stderr, "LOCKSTEP: states differ at t=%llu ms", (unsigned long long)a->tick);
+	if (a->step == 0) {
+		fprintf(stderr, ", outside CPU execution (end-of-tick device update)\n");
+	} else {
+		fprintf(stderr, ", instruction %llu of the tick\n", (unsigned long long)a->step);
+	}
+
+	fprintf(stderr, "LOCKSTEP: %-8s %-40s %s\n", "", "leader", "follower");
+	fprintf(stderr, "LOCKSTEP: %-8s %-40s %s\n", "RAM",  (a->hash.ram  == b->hash.ram)  ? "same" : "DIFFERENT", "");
+	fprintf(stderr, "LOCKSTEP: %-8s %-40s %s\n", "UART", (a->hash.uart == b->hash.uart) ? "same" : "DIFFERENT", "");
+	fprintf(stderr, "LOCKSTEP: %-8s %-40llu %llu\n", "rpos", (unsigned long long)a->hash.rpos, (unsigned long long)b->hash.rpos);
+	if (a->step == 0) {
+		return;
+	}
+
+	char pa[80], pb[80];
+	snprintf(pa, sizeof(pa), "%06X  %s", a->ppc, a->disasm);
+	snprintf(pb, sizeof(pb), "%06X  %s", b->ppc, b->disasm);
+	fprintf(stderr, "LOCKSTEP: %-8s %-40s %s\n", "insn", pa, pb);
+	for (size_t i = 0; i < LOCKSTEP_NUM_REGS; i++) {
+		snprintf(pa, sizeof(pa), "%08X", a->regs[i]);
+		snprintf(pb, sizeof(pb), "%08X", b->regs[i]);
+		fprintf(stderr, "LOCKSTEP: %-8s %-40s %s%s\n", LockstepRegs[i].name, pa, pb,
+				(a->regs[i] != b->regs[i]) ? "   <--" : "");
+	}
+}
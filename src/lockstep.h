@@ -0,0 +1,24 @@
+/****************************************************************************
+ * Lock-step differential execution
+ *
+ * Runs two emulator processes (usually two builds) side by side and checks
+ * after every tick that their machine states still match.
+ ****************************************************************************/
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "statehash.h"
+
+int LockstepInit(const char *path);
+void LockstepDone(void);
+bool LockstepEnabled(void);
+bool LockstepIsLeader(void);
+int LockstepSyncRx(const bool wasReadyA, const bool wasReadyB);
+int LockstepCompare(const uint64_t tick, const uint64_t step, const STATEHASH *h);
+void LockstepReport(void);
+
+#endif // LOCKSTEP_H
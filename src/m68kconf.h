@@ -43,6 +43,10 @@
 #define OPT_ON              1
 #define OPT_SPECIFY_HANDLER 2
 
+/* Instruction hook: ROM coverage and GDB stub breakpoints */
+#include "coverage.h"
+#include "gdbstub.h"
+
 
 /* ======================================================================== */
 /* ============================== MAME STUFF ============================== */
@@ -74,8 +78,14 @@
 /* If ON, the CPU will call m68k_read_immediate_xx() for immediate addressing
  * and m68k_read_pcrelative_xx() for PC-relative addressing.
  * If off, all read requests from the CPU will be redirected to m68k_read_xx()
+ *
+ * Off unless built with "make SEPARATE_READS=yes" -- not yet benchmarked.
  */
+#ifdef EMUTRAK_SEPARATE_READS
+#define M68K_SEPARATE_READS         OPT_ON
+#else
 #define M68K_SEPARATE_READS         OPT_OFF
+#endif
 
 /* If ON, the CPU will call m68k_write_32_pd() when it executes move.l with a
  * predecrement destination EA mode instead of m68k_write_32().
@@ -161,8 +171,8 @@
 /* If ON, CPU will call the instruction hook callback before every
  * instruction.
  */
-#define M68K_INSTRUCTION_HOOK       OPT_OFF
-#define M68K_INSTRUCTION_CALLBACK(pc) your_instruction_hook_function(pc)
+#define M68K_INSTRUCTION_HOOK       OPT_SPECIFY_HANDLER
+#define M68K_INSTRUCTION_CALLBACK(pc) do { COVERAGE_MARK(pc); GDB_INSTR_HOOK(pc); } while (0)
 
 
 /* If ON, the CPU will emulate the 4-byte prefetch queue of a real 68000 */
@@ -2,6 +2,9 @@
 #define MACHINE_H_INCLUDED
 
 
+/// CPU clock (Hz)
+#define SYSTEM_CLOCK 20000000
+
 /// ROM length
 #define ROM_LENGTH (256*1024)
 
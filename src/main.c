@@ -1,12 +1,15 @@
 #include <assert.h>
 #include <ctype.h>
+#include <getopt.h>
 #include <malloc.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "m68k.h"
@@ -16,6 +19,28 @@
 #include "wordops.h"
 
 #include "datatrak_gen.h"
+#include "iqgen.h"
+#include "ifstrip.h"
+#include "lfstream.h"
+#include "lfsource.h"
+#include "lfcapture.h"
+#include "propagation.h"
+#include "lfnoise.h"
+#include "lockmargin.h"
+#include "gdbstub.h"
+#include "coverage.h"
+#include "rewind.h"
+#include "statehash.h"
+#include "lockstep.h"
+#include "bench.h"
+#include "sweep.h"
+#include "uartscript.h"
+#include "control.h"
+#include "eeprom.h"
+#include "coproc.h"
+#include "devtimer.h"
+#include "updown.h"
+#include "mmiotrace.h"
 
 #include "main.h"
 
@@ -27,19 +52,13 @@
 // #define LOG_INTERRPUT_VECTOR
 
 // Suppress logging from noisy unimplemented devices
-#define LOG_SILENCE_240800
 #define LOG_SILENCE_ADC
 
-// Debug: write modulated (audible) phase data to a file. Data format is 16bit signed, mono, 44100 Hz.
-//#define WRITE_PHASEDATA_MODULATED
-// Debug: write raw phase data to a file. Data format is 16bit signed, mono, 44100 Hz.
-//#define WRITE_PHASEDATA
-
 // System ROM
-uint8_t rom[ROM_LENGTH];
+uint8_t rom[ROM_LENGTH] __attribute__((aligned(4)));
 
 // System RAM
-uint8_t ram[RAM_LENGTH];
+uint8_t ram[RAM_LENGTH] __attribute__((aligned(4)));
 
 // Active interrupts
 volatile InterruptFlags_s InterruptFlags;
@@ -53,29 +72,98 @@ volatile InterruptFlags_s InterruptFlags;
 // Phase tick could be interrupt 85, 170 or 255 -- all go to the same handler
 #define	IVEC_PHASE_TICK		255
 
-// LF signal gen context and buffer
+// LF signal gen initial configuration
 DATATRAK_LF_CTX dtrkCtx;
-DATATRAK_OUTBUF dtrkBuf;
+// LF cycle currently being read by the CPU (owned by the LF source)
+const DATATRAK_CYCLE *dtrkCycle;
 // Current read position in phase buffer
 size_t phasebuf_rpos = 0;
 
+// Live LF signal streams (--lf-stream, --iq-stream), fed by the LF source
+#define MAX_LF_STREAMS 4
+LFSTREAM *lfStreams[MAX_LF_STREAMS];
+size_t numLfStreams = 0;
+
+// Phase capture file (--lf-capture), fed by the LF source
+LFCAPTURE *lfCapture = NULL;
+
+// Capture replayed instead of generating the signal (--replay), and
+// whether it goes round again at the end (--replay-loop)
+LFCAPTURE_FILE *lfReplay = NULL;
+bool replayLoop = false;
+
+// Vehicle propagation model (--stations, --trajectory)
+PROP_MODEL *propModel = NULL;
+
+// Receiver IF-strip model (--if-strip)
+IFSTRIP *ifStrip = NULL;
+
+// RF noise and fading (--noise, --fading)
+unsigned long noiseLevel = 0;
+DATATRAK_NOISE lfNoise;
+bool useNoise = false;
+
+// Trigger lock-margin analyser (--lock-margin)
+LOCKMARGIN lockMargin;
+bool useLockMargin = false;
+
+// GDB remote stub TCP port (--gdb), or -1 for none
+int gdbPort = -1;
+
+// ROM coverage output file (--coverage), or NULL for none
+const char *coveragePath = NULL;
+
+// Boot-to-fix benchmark runs (--bench), and the noise seed for the first
+unsigned int benchRuns = 0;
+uint64_t benchSeed = 1;
+
+// Parameter sweep (--sweep) and the number of runs at once
+bool sweepMode = false;
+unsigned int sweepJobs = 0;
+
+// Emulated time since reset, in phase ticks (ms)
+uint64_t emulatedMs = 0;
+
+// Emulated time per real time (--speed), or 0 to run as fast as possible
+double runSpeed = 0;
+
+// I/O access trace (--mmio-trace), or NULL for none
+MMIOTRACE *mmioTrace = NULL;
+
+// I/O access trace to drive the devices from (--mmio-replay), or NULL to
+// run the CPU
+const char *mmioReplayPath = NULL;
+
+// Machine cycles run before the current m68k_execute() slice, and whether
+// the CPU is in one
+static uint64_t cycleBase = 0;
+static bool cpuRunning = false;
+
+// Set when the machine is rewound between ticks
+static bool machineRewound = false;
+
+// Machine state saved with each rewind snapshot, besides RAM, CPU and UART
+typedef struct {
+	DATATRAK_LF_CTX genCtx;		///< Generator state of the cycle being read
+	size_t phasebuf_rpos;		///< Read position in that cycle
+	uint8_t gpio7_freqsel;
+	uint8_t gpio7_adsel;
+	InterruptFlags_s interrupts;
+	EEPROM_STATE eeprom;		///< EEPROM serial interface (not its contents)
+	uint64_t cycles;			///< Machine cycles since reset
+	UPDOWN_STATE updown;
+} MACHINE_STATE;
+
+// Set by signal handlers: stop the emulator, or save the coverage map
+volatile sig_atomic_t quitRequested = 0;
+volatile sig_atomic_t coverageSaveRequested = 0;
+
 // GPIO 240701
 // Current selected frequency (1=F1, 0=F2)
 uint8_t gpio7_freqsel = 0;
 // Current A/D converter selection (0=RSSI, 1=UHF P14, 2=5V divided by 2.5, 3=12V divided by 5.556)
 uint8_t gpio7_adsel = 0;
 
-static inline void fillLFBuffer(void)
-{
-	datatrak_gen_generate(&dtrkCtx, &dtrkBuf);
-#ifdef WRITE_PHASEDATA_MODULATED
-	datatrak_gen_dumpModulated(&dtrkCtx, &dtrkBuf, "phasedata_modulated.raw");
-#endif
-#ifdef WRITE_PHASEDATA
-	datatrak_gen_dumpRaw(&dtrkCtx, &dtrkBuf, "phasedata_raw.raw");
-#endif
-}
-
 const char *GetDevFromAddr(const uint32_t address)
 {
 	if ((address >= 0x240000) && (address <= 0x24FFFF)) {
@@ -164,13 +252,111 @@ uint32_t m68k_read_disassembler_16(uint32_t address)/*{{{*/
 }
 /*}}}*/
 
-uint32_t m68k_read_memory_32(uint32_t address)/*{{{*/
+#if M68K_SEPARATE_READS == OPT_ON
+// Opcode and immediate operand fetches. These are instruction stream, not
+// data, so GDB watchpoints don't apply; anything outside ROM and RAM takes
+// the ordinary path.
+uint32_t m68k_read_immediate_32(uint32_t address)/*{{{*/
 {
 	if (address < ROM_LENGTH) {
 		return DWORD_READ(rom, address);
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
 		return DWORD_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
-	} else if ((address >= 0x240300) && (address <= 0x2403FF)) {
+	} else {
+		return m68k_read_memory_32(address);
+	}
+}
+/*}}}*/
+
+uint32_t m68k_read_immediate_16(uint32_t address)/*{{{*/
+{
+	if (address < ROM_LENGTH) {
+		return WORD_READ(rom, address);
+	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
+		return WORD_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
+	} else {
+		return m68k_read_memory_16(address);
+	}
+}
+/*}}}*/
+
+// PC-relative operand reads: data (tables in ROM), so watchpoints still apply
+uint32_t m68k_read_pcrelative_32(uint32_t address)/*{{{*/
+{
+	if (address < ROM_LENGTH) {
+		GdbWatchCheck(address, 4, false);
+		return DWORD_READ(rom, address);
+	} else {
+		return m68k_read_memory_32(address);
+	}
+}
+/*}}}*/
+
+uint32_t m68k_read_pcrelative_16(uint32_t address)/*{{{*/
+{
+	if (address < ROM_LENGTH) {
+		GdbWatchCheck(address, 2, false);
+		return WORD_READ(rom, address);
+	} else {
+		return m68k_read_memory_16(address);
+	}
+}
+/*}}}*/
+
+uint32_t m68k_read_pcrelative_8(uint32_t address)/*{{{*/
+{
+	if (address < ROM_LENGTH) {
+		GdbWatchCheck(address, 1, false);
+		return BYTE_READ(rom, address);
+	} else {
+		return m68k_read_memory_8(address);
+	}
+}
+/*}}}*/
+#endif
+
+/**
+ * The CPU has read the whole of the current cycle: move on to the next one.
+ * Generator changes from the control socket take effect here, by restarting
+ * the generator from the new cycle with them applied.
+ */
+static void PhaseNextCycle(void)
+{
+	phasebuf_rpos = 0;
+	dtrkCycle = LfSourceNext();
+
+	if (ControlPending()) {
+		DATATRAK_LF_CTX ctx;
+		LfSourceGetState(&ctx);
+		ControlApply(&ctx);
+		if (LfSourceReset(&ctx) != 0) {
+			exit(EXIT_FAILURE);
+		}
+		dtrkCycle = LfSourceNext();
+	}
+}
+
+// Trace an I/O read (--mmio-trace), and pass its value on
+static inline uint32_t IoTraceRead(const uint32_t address, const uint8_t size, const uint32_t value)
+{
+	if (mmioTrace != NULL) {
+		MmioTraceAccess(mmioTrace, MachineCycles(), address, size, value, m68k_get_reg(NULL, M68K_REG_PPC));
+	}
+	return value;
+}
+
+// Trace an I/O write (--mmio-trace)
+static inline void IoTraceWrite(const uint32_t address, const uint8_t size, const uint32_t value)
+{
+	if (mmioTrace != NULL) {
+		MmioTraceAccess(mmioTrace, MachineCycles(), address, MMIOTRACE_WRITE | size, value, m68k_get_reg(NULL, M68K_REG_PPC));
+	}
+}
+
+// I/O space reads, 32 bit
+static uint32_t IoRead32(const uint32_t address)
+{
+	if ((address >= 0x240300) && (address <= 0x2403FF)) {
 		fprintf(stderr, "RD32 %s <%s> 0x%08x ignored, pc=%08X\n",
 				GetDevFromAddr(address), GetUartRegFromAddr(address, true),
 				address, m68k_get_reg(NULL, M68K_REG_PPC));
@@ -183,15 +369,25 @@ uint32_t m68k_read_memory_32(uint32_t address)/*{{{*/
 		return UNIMPLEMENTED_VALUE;
 	}
 }
-/*}}}*/
 
-uint32_t m68k_read_memory_16(uint32_t address)/*{{{*/
+uint32_t m68k_read_memory_32(uint32_t address)/*{{{*/
 {
+	GdbWatchCheck(address, 4, false);
+
 	if (address < ROM_LENGTH) {
-		return WORD_READ(rom, address);
+		return DWORD_READ(rom, address);
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
-		return WORD_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
-	} else if (address == 0x240200) {
+		return DWORD_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
+	} else {
+		return IoTraceRead(address, 4, IoRead32(address));
+	}
+}
+/*}}}*/
+
+// I/O space reads, 16 bit
+static uint32_t IoRead16(const uint32_t address)
+{
+	if (address == 0x240200) {
 #ifdef LOG_PHASE_REG
 		printf("\nPHASE_L RD16\n");
 #endif
@@ -202,16 +398,15 @@ uint32_t m68k_read_memory_16(uint32_t address)/*{{{*/
 		// FIXME Handle RSSI readback
 		uint8_t val;
 		if (gpio7_freqsel == 1) {
-			val = dtrkBuf.f1_phase[phasebuf_rpos] >> 8;
+			val = dtrkCycle->buf.f1_phase[phasebuf_rpos] >> 8;
 		} else {
-			val = dtrkBuf.f2_phase[phasebuf_rpos] >> 8;
+			val = dtrkCycle->buf.f2_phase[phasebuf_rpos] >> 8;
 		}
 		phasebuf_rpos++;
 
-		// emptied the buffer
-		if (phasebuf_rpos >= dtrkCtx.msPerCycle) {
-			phasebuf_rpos = 0;
-			fillLFBuffer();
+		// emptied the buffer -- swap in the next pre-generated cycle
+		if (phasebuf_rpos >= dtrkCycle->ctx.msPerCycle) {
+			PhaseNextCycle();
 		}
 		
 		return val;
@@ -220,6 +415,10 @@ uint32_t m68k_read_memory_16(uint32_t address)/*{{{*/
 				GetDevFromAddr(address), GetUartRegFromAddr(address, true),
 				address, m68k_get_reg(NULL, M68K_REG_PPC));
 		return UNIMPLEMENTED_VALUE & 0xFFFF;
+	} else if ((address >= 0x240A00) && (address <= 0x240BFF)) {
+		// Up/down counters: high byte first, which latches the low byte
+		uint16_t val = UpDownRead(address) << 8;
+		return val | UpDownRead(address + 1);
 	} else {
 		// log unhandled access
 #ifdef LOG_UNHANDLED
@@ -228,20 +427,27 @@ uint32_t m68k_read_memory_16(uint32_t address)/*{{{*/
 		return UNIMPLEMENTED_VALUE & 0xFFFF;
 	}
 }
-/*}}}*/
 
-uint32_t m68k_read_memory_8(uint32_t address)/*{{{*/
+uint32_t m68k_read_memory_16(uint32_t address)/*{{{*/
 {
-	if (address == 0x2CC96) {
-		printf("*** 2cc96 trap -> pc = %08X\n", m68k_get_reg(NULL, M68K_REG_PC));
-	}
+	GdbWatchCheck(address, 2, false);
 
 	if (address < ROM_LENGTH) {
-		return rom[address];
+		return WORD_READ(rom, address);
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
-		return ram[(address - RAM_BASE) & (RAM_LENGTH - 1)];
-	} else if ((address == 0x240100) || (address == 0x240101)) {
-		return 0xff;		// FIXME 240101 EEPROM DATA READ REG
+		return WORD_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
+	} else {
+		return IoTraceRead(address, 2, IoRead16(address));
+	}
+}
+/*}}}*/
+
+// I/O space reads, 8 bit
+static uint32_t IoRead8(const uint32_t address)
+{
+	if ((address == 0x240100) || (address == 0x240101)) {
+		// RDIO: EEPROM data out, and other inputs
+		return EepromRead();
 	} else if (address == 0x240200) {
 #ifdef LOG_PHASE_REG
 		printf("\nPHASE_L RD8\n");
@@ -252,16 +458,15 @@ uint32_t m68k_read_memory_8(uint32_t address)/*{{{*/
 		// FIXME Implement frequency switching
 		uint8_t val;
 		if (gpio7_freqsel == 1) {
-			val = dtrkBuf.f1_phase[phasebuf_rpos] >> 8;
+			val = dtrkCycle->buf.f1_phase[phasebuf_rpos] >> 8;
 		} else {
-			val = dtrkBuf.f2_phase[phasebuf_rpos] >> 8;
+			val = dtrkCycle->buf.f2_phase[phasebuf_rpos] >> 8;
 		}
 		phasebuf_rpos++;
 
-		// emptied the buffer
-		if (phasebuf_rpos >= dtrkCtx.msPerCycle) {
-			phasebuf_rpos = 0;
-			fillLFBuffer();
+		// emptied the buffer -- swap in the next pre-generated cycle
+		if (phasebuf_rpos >= dtrkCycle->ctx.msPerCycle) {
+			PhaseNextCycle();
 		}
 		
 		return val;
@@ -271,22 +476,27 @@ uint32_t m68k_read_memory_8(uint32_t address)/*{{{*/
 		printf("\nPHASE_H RD8\n");
 #endif
 		if (gpio7_freqsel == 1) {
-			return dtrkBuf.f1_phase[phasebuf_rpos] & 0xFF;
+			return dtrkCycle->buf.f1_phase[phasebuf_rpos] & 0xFF;
 		} else {
-			return dtrkBuf.f2_phase[phasebuf_rpos] & 0xFF;
+			return dtrkCycle->buf.f2_phase[phasebuf_rpos] & 0xFF;
 		}
 	} else if ((address >= 0x240300) && (address <= 0x2403FF)) {
 		return UartRegRead(address);
+	} else if ((address == 0x240401) && CoprocEnabled()) {
+		// 8051 mailbox
+		return CoprocRead();
 
 		// 240401 -- Alarm port
+	} else if ((address >= 0x240A00) && (address <= 0x240BFF)) {
+		return UpDownRead(address);
 	} else if ((address == 0x240000) || (address == 0x240001)) {
 		// FIXME UNHANDLED 2400xx ADC
 		if (gpio7_adsel == 0) {
 			// RSSI
 			if (gpio7_freqsel == 1) {
-				return dtrkBuf.f1_amplitude[phasebuf_rpos];
+				return dtrkCycle->buf.f1_amplitude[phasebuf_rpos];
 			} else {
-				return dtrkBuf.f2_amplitude[phasebuf_rpos];
+				return dtrkCycle->buf.f2_amplitude[phasebuf_rpos];
 			}
 		} else {
 			// FIXME Provide readings for 5V, 12V and the UHF board indication voltage
@@ -305,19 +515,25 @@ uint32_t m68k_read_memory_8(uint32_t address)/*{{{*/
 		return UNIMPLEMENTED_VALUE & 0xFF;
 	}
 }
-/*}}}*/
 
-void m68k_write_memory_32(unsigned int address, unsigned int value)/*{{{*/
+uint32_t m68k_read_memory_8(uint32_t address)/*{{{*/
 {
+	GdbWatchCheck(address, 1, false);
+
 	if (address < ROM_LENGTH) {
-		// WRITE TO ROM
-#ifdef LOG_UNHANDLED_ROM
-		fprintf(stderr, "WR32 to ROM 0x%08x => 0x%08X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
-#endif
+		return BYTE_READ(rom, address);
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
-		// write to RAM
-		DWORD_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
-	} else if ((address >= 0x240300) && (address <= 0x2403FF)) {
+		return BYTE_READ(ram, (address - RAM_BASE) & (RAM_LENGTH - 1));
+	} else {
+		return IoTraceRead(address, 1, IoRead8(address));
+	}
+}
+/*}}}*/
+
+// I/O space writes, 32 bit
+static void IoWrite32(const uint32_t address, const uint32_t value)
+{
+	if ((address >= 0x240300) && (address <= 0x2403FF)) {
 		fprintf(stderr, "WR32 %s <%s> 0x%08x => 0x%08x ignored, pc=%08X\n",
 				GetDevFromAddr(address), GetUartRegFromAddr(address, false),
 				address, value, m68k_get_reg(NULL, M68K_REG_PPC));
@@ -328,24 +544,39 @@ void m68k_write_memory_32(unsigned int address, unsigned int value)/*{{{*/
 #endif
 	}
 }
-/*}}}*/
 
-void m68k_write_memory_16(unsigned int address, unsigned int value)/*{{{*/
+void m68k_write_memory_32(unsigned int address, unsigned int value)/*{{{*/
 {
-	assert(value <= 0xFFFF);
+	GdbWatchCheck(address, 4, true);
 
 	if (address < ROM_LENGTH) {
 		// WRITE TO ROM
 #ifdef LOG_UNHANDLED_ROM
-		fprintf(stderr, "WR16 to ROM 0x%08x => 0x%04X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
+		fprintf(stderr, "WR32 to ROM 0x%08x => 0x%08X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
 #endif
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
 		// write to RAM
-		WORD_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
-	} else if ((address >= 0x240300) && (address <= 0x2403FF)) {
+		StateHashRamWrite((address - RAM_BASE) & (RAM_LENGTH - 1), value, 4);
+		DWORD_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
+		REWIND_MARK_DIRTY(address - RAM_BASE, 4);
+	} else {
+		IoTraceWrite(address, 4, value);
+		IoWrite32(address, value);
+	}
+}
+/*}}}*/
+
+// I/O space writes, 16 bit
+static void IoWrite16(const uint32_t address, const uint32_t value)
+{
+	if ((address >= 0x240300) && (address <= 0x2403FF)) {
 		fprintf(stderr, "WR16 %s <%s> 0x%08x => 0x%04x ignored, pc=%08X\n",
 				GetDevFromAddr(address), GetUartRegFromAddr(address, false),
 				address, value, m68k_get_reg(NULL, M68K_REG_PPC));
+	} else if ((address >= 0x240A00) && (address <= 0x240BFF)) {
+		// Up/down counters: high byte first, then the low byte loads the count
+		UpDownWrite(address, value >> 8);
+		UpDownWrite(address + 1, value & 0xFF);
 	} else {
 		// log unhandled access
 #ifdef LOG_UNHANDLED
@@ -353,23 +584,41 @@ void m68k_write_memory_16(unsigned int address, unsigned int value)/*{{{*/
 #endif
 	}
 }
-/*}}}*/
 
-void m68k_write_memory_8(unsigned int address, unsigned int value)/*{{{*/
+void m68k_write_memory_16(unsigned int address, unsigned int value)/*{{{*/
 {
-	assert(value <= 0xFF);
+	assert(value <= 0xFFFF);
+	GdbWatchCheck(address, 2, true);
 
 	if (address < ROM_LENGTH) {
 		// WRITE TO ROM
 #ifdef LOG_UNHANDLED_ROM
-		fprintf(stderr, "WR-8 to ROM 0x%08x => 0x%02X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
+		fprintf(stderr, "WR16 to ROM 0x%08x => 0x%04X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
 #endif
 	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
 		// write to RAM
-		ram[(address - RAM_BASE) & (RAM_LENGTH - 1)] = value;
-	} else if ((address >= 0x240300) && (address <= 0x2403FF)) {
+		StateHashRamWrite((address - RAM_BASE) & (RAM_LENGTH - 1), value, 2);
+		WORD_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
+		REWIND_MARK_DIRTY(address - RAM_BASE, 2);
+	} else {
+		IoTraceWrite(address, 2, value);
+		IoWrite16(address, value);
+	}
+}
+/*}}}*/
+
+// I/O space writes, 8 bit
+static void IoWrite8(const uint32_t address, const uint32_t value)
+{
+	if ((address >= 0x240300) && (address <= 0x2403FF)) {
 		// UART -- SCC68692
 		UartRegWrite(address, value);
+	} else if ((address == 0x240401) && CoprocEnabled()) {
+		// 8051 mailbox latch
+		CoprocWrite(value);
+	} else if ((address >= 0x240A00) && (address <= 0x240BFF)) {
+		// Up/down counters
+		UpDownWrite(address, value);
 #ifdef LOG_SILENCE_ADC
 	} else if ((address == 0x240000) || (address == 0x240001)) {
 		// FIXME UNHANDLED 2400xx ADC
@@ -380,10 +629,9 @@ void m68k_write_memory_8(unsigned int address, unsigned int value)/*{{{*/
 		// Bit 1 is always set, apparently a spare bit
 		gpio7_adsel = (value >> 2) & 3;
 		//printf("GPIO7 %02X  freqsel=%d adsel=%d fselbits=%d\n", value, gpio7_freqsel, gpio7_adsel, value & 3);
-#ifdef LOG_SILENCE_240800
 	} else if ((address == 0x240800) || (address == 0x240801)) {
-		// FIXME UNHANDLED 2408xx
-#endif
+		// DIGOP2: EEPROM serial interface, and other outputs
+		EepromWrite(value);
 	} else if ((address >= 0x240000) && (address <= 0x24FFFF)) {
 		fprintf(stderr, "WR-8 to ASIC 0x%08X => 0x%02X, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
 	} else {
@@ -395,6 +643,27 @@ void m68k_write_memory_8(unsigned int address, unsigned int value)/*{{{*/
 #endif
 	}
 }
+
+void m68k_write_memory_8(unsigned int address, unsigned int value)/*{{{*/
+{
+	assert(value <= 0xFF);
+	GdbWatchCheck(address, 1, true);
+
+	if (address < ROM_LENGTH) {
+		// WRITE TO ROM
+#ifdef LOG_UNHANDLED_ROM
+		fprintf(stderr, "WR-8 to ROM 0x%08x => 0x%02X ignored, pc=%08X\n", address, value, m68k_get_reg(NULL, M68K_REG_PPC));
+#endif
+	} else if ((address >= RAM_BASE) && (address < (RAM_BASE + RAM_WINDOW))) {
+		// write to RAM
+		StateHashRamWrite((address - RAM_BASE) & (RAM_LENGTH - 1), value, 1);
+		BYTE_WRITE(ram, (address - RAM_BASE) & (RAM_LENGTH - 1), value);
+		REWIND_MARK_DIRTY(address - RAM_BASE, 1);
+	} else {
+		IoTraceWrite(address, 1, value);
+		IoWrite8(address, value);
+	}
+}
 /*}}}*/
 
 
@@ -444,8 +713,981 @@ int m68k_irq_callback(int int_level)
 	return vector;
 }
 
+/// Machine cycles since reset, up to the instruction being run
+uint64_t MachineCycles(void)
+{
+	return cycleBase + (cpuRunning ? m68k_cycles_run() : 0);
+}
+
+/**
+ * A device event is due at machine cycle cycle. If that's before the end of
+ * the slice the CPU is running, end the slice there.
+ */
+void MachineSchedule(const uint64_t cycle)
+{
+	if (!cpuRunning) {
+		return;
+	}
+
+	const uint64_t now = MachineCycles();
+	const uint64_t end = now + m68k_cycles_remaining();
+	if (cycle < end) {
+		m68k_modify_timeslice(-(int)(end - ((cycle > now) ? cycle : now)));
+	}
+}
+
+/**
+ * Run the CPU for (at least) cycles cycles, stopping at each device timer
+ * expiry on the way to run it. Returns the cycles run.
+ */
+static int MachineExecute(const int cycles)
+{
+	int done = 0;
+
+	while (done < cycles) {
+		const uint64_t next = DevTimerNext();
+		int slice = cycles - done;
+
+		if ((next > cycleBase) && ((next - cycleBase) < (uint64_t)slice)) {
+			slice = next - cycleBase;
+		}
+
+		cpuRunning = true;
+		const int ran = m68k_execute(slice);
+		cpuRunning = false;
+
+		cycleBase += ran;
+		done += ran;
+		DevTimerRun(cycleBase);
+		if (mmioTrace != NULL) {
+			MmioTraceEvent(mmioTrace, cycleBase, MMIOTRACE_TIMERS, 0);
+		}
+	}
+
+	return done;
+}
+
+static void MachineSave(MACHINE_STATE *m)
+{
+	LfSourceGetState(&m->genCtx);
+	m->phasebuf_rpos = phasebuf_rpos;
+	m->gpio7_freqsel = gpio7_freqsel;
+	m->gpio7_adsel   = gpio7_adsel;
+	m->interrupts    = InterruptFlags;
+	EepromGetState(&m->eeprom);
+	m->cycles = cycleBase;
+	UpDownGetState(&m->updown);
+}
+
+/**
+ * Step the emulation back by ms milliseconds of emulated time (to the
+ * nearest earlier snapshot). Needs --rewind.
+ */
+int MachineRewind(const uint64_t ms)
+{
+	MACHINE_STATE m;
+	uint64_t restored;
+
+	if (!RewindEnabled()) {
+		fprintf(stderr, "REWIND: not enabled (use --rewind)\n");
+		return -1;
+	}
+	if (RewindRestore((ms < emulatedMs) ? (emulatedMs - ms) : 0, &restored, &m) != 0) {
+		return -1;
+	}
+
+	if (LfSourceReset(&m.genCtx) != 0) {
+		return -1;
+	}
+	if (StateHashEnabled) {
+		StateHashRecompute();
+	}
+
+	dtrkCycle      = LfSourceNext();
+	phasebuf_rpos  = m.phasebuf_rpos;
+	gpio7_freqsel  = m.gpio7_freqsel;
+	gpio7_adsel    = m.gpio7_adsel;
+	InterruptFlags = m.interrupts;
+	EepromSetState(&m.eeprom);
+	UpDownSetState(&m.updown);
+
+	// From GDB the CPU is stopped part way through a slice, and the cycles
+	// the slice has run so far are added to cycleBase when it returns. The
+	// slice may also now run past the next timer expiry.
+	if (cpuRunning) {
+		cycleBase = m.cycles - m68k_cycles_run();
+		MachineSchedule(DevTimerNext());
+	} else {
+		cycleBase = m.cycles;
+		machineRewound = true;
+	}
+
+	fprintf(stderr, "REWIND: back %llu ms to t=%llu ms, pc=%08X\n",
+			(unsigned long long)(emulatedMs - restored), (unsigned long long)restored,
+			m68k_get_reg(NULL, M68K_REG_PC));
+	emulatedMs = restored;
+
+	return 0;
+}
+
+/**
+ * Fork the sweep runs from the current machine state. Threads don't survive
+ * fork(), so the signal generator and the 8051 are stopped first. Each child
+ * restarts them, the generator with its own settings from the cycle being
+ * received.
+ */
+static void SweepFromCheckpoint(void)
+{
+	DATATRAK_LF_CTX ctx;
+
+	LfSourceGetState(&ctx);
+	LfSourceSuspend();
+	CoprocSuspend();
+	fprintf(stderr, "SWEEP: checkpoint at t=%llu ms\n", (unsigned long long)emulatedMs);
+
+	SweepApply(SweepFork(sweepJobs), &ctx);
+	if ((LfSourceReset(&ctx) != 0) || (CoprocStart() != 0)) {
+		exit(EXIT_FAILURE);
+	}
+	dtrkCycle = LfSourceNext();
+}
+
+/**
+ * The lock-step peer's state differs at the end of this tick. Go back to the
+ * start of the tick and replay it an instruction at a time, in step with the
+ * peer, to find the instruction where the two first differ.
+ */
+static void LockstepBisect(const int clocksPerTick)
+{
+	const uint64_t tick = emulatedMs;
+	uint64_t step = 0;
+	int cycles = 0;
+	STATEHASH h;
+
+	if (MachineRewind(1) != 0) {
+		LockstepReport();
+		return;
+	}
+
+	while (cycles < clocksPerTick) {
+		cycles += MachineExecute(1);
+		step++;
+		StateHashGet(&h, phasebuf_rpos);
+		int r = LockstepCompare(tick, step, &h);
+		if (r < 0) {
+			return;
+		} else if (r == 0) {
+			LockstepReport();
+			return;
+		}
+	}
+
+	// The CPU agreed all the way through, so the devices differ -- unless
+	// the whole tick agrees this time
+	StateHashGet(&h, phasebuf_rpos);
+	int r = LockstepCompare(tick, 0, &h);
+	if (r == 0) {
+		LockstepReport();
+	} else if (r > 0) {
+		fprintf(stderr, "LOCKSTEP: states differed at t=%llu ms, but agreed when the tick was run again\n",
+				(unsigned long long)tick);
+	}
+}
+
+// Most differing reads reported by an MMIO replay
+#define MMIO_REPLAY_MAX_REPORT 20
+
+/**
+ * Drive the devices from an MMIO trace (--mmio-replay) instead of running
+ * the CPU. Each access is made at the machine cycle it was traced at, and
+ * the device timers, ticks and received UART bytes come where the trace has
+ * them. Every read is checked against the value in the trace.
+ *
+ * Returns the number of reads that differ, or -1 if the trace can't be read.
+ */
+static long MmioReplay(const char *path)
+{
+	MMIOTRACE_EVENT e;
+	unsigned long long accesses = 0, reads = 0;
+	long differ = 0;
+	struct timespec t0, t1;
+
+	MMIOTRACE_FILE *f = MmioTraceMap(path);
+	if (f == NULL) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	while (MmioTraceNext(f, &e)) {
+		cycleBase = e.cycle;
+
+		if (e.type & MMIOTRACE_TIMERS) {
+			DevTimerRun(cycleBase);
+			continue;
+		}
+
+		if (e.type & MMIOTRACE_TICK) {
+			if (e.value & MMIOTRACE_RX_A) {
+				UartInjectRx(0, e.value & 0xFF);
+			}
+			if (e.value & MMIOTRACE_RX_B) {
+				UartInjectRx(1, (e.value >> 8) & 0xFF);
+			}
+			emulatedMs++;
+			CoprocSync(emulatedMs);
+			continue;
+		}
+
+		const int size = e.type & MMIOTRACE_SIZE;
+		accesses++;
+
+		if (e.type & MMIOTRACE_WRITE) {
+			switch (size) {
+				case 1:		IoWrite8(e.address, e.value);	break;
+				case 2:		IoWrite16(e.address, e.value);	break;
+				default:	IoWrite32(e.address, e.value);	break;
+			}
+			continue;
+		}
+
+		uint32_t val;
+		switch (size) {
+			case 1:		val = IoRead8(e.address);	break;
+			case 2:		val = IoRead16(e.address);	break;
+			default:	val = IoRead32(e.address);	break;
+		}
+		reads++;
+
+		if (val != e.value) {
+			if (differ < MMIO_REPLAY_MAX_REPORT) {
+				fprintf(stderr, "MMIO replay: t=%llu ms cycle %llu pc=%06X RD%d 0x%06X => 0x%0*X, traced 0x%0*X\n",
+						(unsigned long long)emulatedMs, (unsigned long long)e.cycle, e.pc, size * 8,
+						e.address, size * 2, val, size * 2, e.value);
+			}
+			differ++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "MMIO replay: %llu accesses (%llu reads, %ld differ), %llu ms of emulated time in %.3f s\n",
+			accesses, reads, differ, (unsigned long long)emulatedMs,
+			(t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9));
+
+	MmioTraceUnmap(f);
+	return differ;
+}
+
+/**
+ * Hold the emulator back to runSpeed times real time. If it has fallen
+ * behind (paused, stopped in GDB, rewound, or on a slow host) it carries on
+ * from where it is, rather than running flat out to catch up.
+ */
+static void PaceTick(void)
+{
+	static struct timespec start;
+	static uint64_t startMs;
+	static bool started = false;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const double elapsed = (now.tv_sec - start.tv_sec) + ((now.tv_nsec - start.tv_nsec) / 1e9);
+	const double due = (emulatedMs - startMs) / (runSpeed * 1000.0);
+
+	if (!started || (emulatedMs < startMs) || (elapsed > due + 0.1)) {
+		start   = now;
+		startMs = emulatedMs;
+		started = true;
+	} else if (due > elapsed) {
+		usleep((due - elapsed) * 1e6);
+	}
+}
+
+static void SignalHandler(int sig)
+{
+	if (sig == SIGUSR1) {
+		coverageSaveRequested = 1;
+	} else {
+		quitRequested = 1;
+	}
+}
+
+static void SaveCoverage(void)
+{
+	if (CoverageSave(coveragePath, CoverageMap) == 0) {
+		fprintf(stderr, "Coverage: %lu ROM words executed, saved to %s\n",
+				CoverageCount(CoverageMap), coveragePath);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"       %s --coverage-merge=OUT FILE...\n"
+			"       %s --coverage-diff FILE_A FILE_B\n"
+			"\n"
+			"Options:\n"
+			"  --uart-a=SPEC            Transport for UART A: tcp:PORT (default\n"
+			"                           tcp:10000), unix:PATH, pty[:LINK] or shm:/NAME\n"
+			"  --uart-b=SPEC            Transport for UART B (default tcp:10001)\n"
+			"  --lf-stream=PATH         Stream generated LF cycles to PATH. If PATH is a\n"
+			"                           FIFO it is written to, otherwise a UNIX domain\n"
+			"                           socket is created there. May be repeated.\n"
+			"  --lf-stream-format=FMT   Format for following --lf-stream options:\n"
+			"                           'phase' (default) or 'audio' (modulated, 44.1kHz)\n"
+			"  --iq-stream=PATH         Stream complex baseband I/Q to PATH (FIFO or\n"
+			"                           UNIX socket, as --lf-stream)\n"
+			"  --iq-rate=HZ             I/Q sample rate (default %d)\n"
+			"  --iq-format=FMT          I/Q sample format: 'f32' (default) or 's16'\n"
+			"  --iq-offsets=F1,F2       F1/F2 offsets from the centre frequency in Hz\n"
+			"                           (default %.0f,%.0f)\n"
+			"  --lf-capture=FILE        Record every generated LF cycle to FILE, coded\n"
+			"                           and indexed for seeking\n"
+			"  --replay=FILE            Replay the LF cycles in capture FILE instead of\n"
+			"                           generating them, and stop at the end\n"
+			"  --replay-seek=N          Start the replay at capture cycle N (default 0)\n"
+			"  --replay-loop            Go back to the first capture cycle after the last\n"
+			"  --stations=FILE          Station positions for the propagation model\n"
+			"  --trajectory=FILE        Vehicle trajectory (time lat lon speed); moves\n"
+			"                           the receiver, overriding the fixed slot setup\n"
+			"  --truth-log=FILE         Log the true vehicle position for every cycle\n"
+			"  --if-strip[=SPEC]        Pass the signal through a simulated receiver IF\n"
+			"                           filter instead of pre-compensating the trigger\n"
+			"                           phases. SPEC is 'mk2' (default) or a list of\n"
+			"                           tuned sections, e.g. 21100:60.6,19200:60.6\n"
+			"  --if-carrier=HZ          IF carrier frequency (default %.0f)\n"
+			"  --noise=LEVEL            RF noise level, in RSSI counts (0-255, default 0)\n"
+			"  --noise-seed=N           Noise/fading PRNG seed (default 1)\n"
+			"  --fading=DB[,CORR]       Slot fading depth in dB, and cycle-to-cycle\n"
+			"                           correlation (default 0.9)\n"
+			"  --lock-margin[=FILE]     Score every trigger against the firmware's lock\n"
+			"                           threshold; log each score to FILE, and print a\n"
+			"                           summary on exit\n",
+			argv0, argv0, argv0, IQGEN_DEFAULT_RATE, IQGEN_DEFAULT_F1_OFFSET, IQGEN_DEFAULT_F2_OFFSET,
+			IFSTRIP_MK2_CARRIER);
+	fprintf(stderr,
+			"  --gdb[=PORT]             Accept a GDB remote connection on localhost:PORT\n"
+			"                           (default %d)\n"
+			"  --coverage=FILE          Save a map of the ROM words executed to FILE on\n"
+			"                           exit, or when sent SIGUSR1\n"
+			"  --coverage-merge=OUT     Combine coverage FILEs into OUT, then exit\n"
+			"  --coverage-diff          Print the ROM ranges executed in only one of two\n"
+			"                           coverage files, then exit\n"
+			"  --rewind[=MS[,SEC[,MB]]] Snapshot the machine every MS of emulated time\n"
+			"                           (default %d), keeping SEC seconds of history\n"
+			"                           (default %d) in up to MB of saved RAM pages\n"
+			"                           (default %d). Rewind from GDB: monitor rewind N\n"
+			"  --lockstep=PATH          Run in lock-step with another emulator started\n"
+			"                           with the same PATH, and stop at the first\n"
+			"                           instruction where their states differ\n"
+			"  --bench[=RUNS]           Boot-to-fix benchmark: boot headless RUNS times\n"
+			"                           (default 1, noise seeds counting up from\n"
+			"                           --noise-seed) and report the time to first fix\n"
+			"  --bench-script=FILE      UART input for --bench: 'MS TEXT' or\n"
+			"                           'every MS TEXT' per line\n"
+			"  --bench-fix=REGEX        UART A output marking a fix (default\n"
+			"                           '%s')\n"
+			"  --bench-timeout=SEC      Give up after SEC emulated seconds (default %d)\n"
+			"  --bench-slots=SET        Slots enabled for --bench, e.g. 0-6 or 0,4,5,9,11\n"
+			"  --bench-power=N          Transmit power of the --bench slots (1-255)\n"
+			"  --bench-phase=SET        Slot phase offsets for --bench, e.g. 4:100,5:-50\n"
+			"  --sweep=FILE             Run the firmware headless for every combination\n"
+			"                           of the generator settings in FILE, and tabulate\n"
+			"                           its UART A output\n"
+			"  --sweep-jobs=N           Runs at once (default: one per CPU)\n"
+			"  --sweep-logs=DIR         Keep each run's UART A output in DIR\n"
+			"  --control=PATH           Accept control commands (generator settings,\n"
+			"                           pause/resume, ignition, status) on a UNIX socket\n"
+			"  --eeprom=FILE            Keep the EEPROM contents in FILE (created blank\n"
+			"                           if missing; read-only with --bench, --sweep or\n"
+			"                           --lockstep)\n"
+			"  --8051[=ROM]             Emulate the 8051 I/O mailbox at 0x240400, and\n"
+			"                           run the 8051 program in ROM (a raw binary) on\n"
+			"                           its own thread\n"
+			"  --8051-clock=HZ          8051 crystal frequency (default %d)\n"
+			"  --speed=FACTOR           Run at FACTOR times real time (default: as fast\n"
+			"                           as possible)\n"
+			"  --mmio-trace=FILE        Record every I/O access (cycle, address, size,\n"
+			"                           value, PC) to FILE\n"
+			"  --mmio-replay=FILE       Drive the devices from an --mmio-trace FILE with\n"
+			"                           no CPU, check the reads match, then exit\n"
+			"  -h, --help               Show this help\n",
+			GDB_DEFAULT_PORT,
+			REWIND_DEFAULT_INTERVAL, REWIND_DEFAULT_DEPTH, REWIND_DEFAULT_POOL_MB,
+			BENCH_DEFAULT_FIX, BENCH_DEFAULT_TIMEOUT, COPROC_DEFAULT_CLOCK);
+}
+
 int main(int argc, char **argv)
 {
+	// Parse command line
+	{
+		enum {
+			OPT_LF_STREAM = 0x100,
+			OPT_LF_STREAM_FORMAT,
+			OPT_IQ_STREAM,
+			OPT_IQ_RATE,
+			OPT_IQ_FORMAT,
+			OPT_IQ_OFFSETS,
+			OPT_STATIONS,
+			OPT_TRAJECTORY,
+			OPT_TRUTH_LOG,
+			OPT_IF_STRIP,
+			OPT_IF_CARRIER,
+			OPT_NOISE,
+			OPT_NOISE_SEED,
+			OPT_FADING,
+			OPT_LOCK_MARGIN,
+			OPT_GDB,
+			OPT_COVERAGE,
+			OPT_COVERAGE_MERGE,
+			OPT_COVERAGE_DIFF,
+			OPT_REWIND,
+			OPT_LOCKSTEP,
+			OPT_BENCH,
+			OPT_BENCH_SCRIPT,
+			OPT_BENCH_FIX,
+			OPT_BENCH_TIMEOUT,
+			OPT_BENCH_SLOTS,
+			OPT_BENCH_POWER,
+			OPT_BENCH_PHASE,
+			OPT_SWEEP,
+			OPT_SWEEP_JOBS,
+			OPT_SWEEP_LOGS,
+			OPT_UART_A,
+			OPT_UART_B,
+			OPT_CONTROL,
+			OPT_EEPROM,
+			OPT_8051,
+			OPT_8051_CLOCK,
+			OPT_LF_CAPTURE,
+			OPT_REPLAY,
+			OPT_REPLAY_SEEK,
+			OPT_REPLAY_LOOP,
+			OPT_SPEED,
+			OPT_MMIO_TRACE,
+			OPT_MMIO_REPLAY
+		};
+		static const struct option longopts[] = {
+			{ "lf-stream",			required_argument,	NULL,	OPT_LF_STREAM },
+			{ "lf-stream-format",	required_argument,	NULL,	OPT_LF_STREAM_FORMAT },
+			{ "iq-stream",			required_argument,	NULL,	OPT_IQ_STREAM },
+			{ "iq-rate",			required_argument,	NULL,	OPT_IQ_RATE },
+			{ "iq-format",			required_argument,	NULL,	OPT_IQ_FORMAT },
+			{ "iq-offsets",			required_argument,	NULL,	OPT_IQ_OFFSETS },
+			{ "stations",			required_argument,	NULL,	OPT_STATIONS },
+			{ "trajectory",			required_argument,	NULL,	OPT_TRAJECTORY },
+			{ "truth-log",			required_argument,	NULL,	OPT_TRUTH_LOG },
+			{ "if-strip",			optional_argument,	NULL,	OPT_IF_STRIP },
+			{ "if-carrier",			required_argument,	NULL,	OPT_IF_CARRIER },
+			{ "noise",				required_argument,	NULL,	OPT_NOISE },
+			{ "noise-seed",			required_argument,	NULL,	OPT_NOISE_SEED },
+			{ "fading",				required_argument,	NULL,	OPT_FADING },
+			{ "lock-margin",		optional_argument,	NULL,	OPT_LOCK_MARGIN },
+			{ "gdb",				optional_argument,	NULL,	OPT_GDB },
+			{ "coverage",			required_argument,	NULL,	OPT_COVERAGE },
+			{ "coverage-merge",		required_argument,	NULL,	OPT_COVERAGE_MERGE },
+			{ "coverage-diff",		no_argument,		NULL,	OPT_COVERAGE_DIFF },
+			{ "rewind",				optional_argument,	NULL,	OPT_REWIND },
+			{ "lockstep",			required_argument,	NULL,	OPT_LOCKSTEP },
+			{ "bench",				optional_argument,	NULL,	OPT_BENCH },
+			{ "bench-script",		required_argument,	NULL,	OPT_BENCH_SCRIPT },
+			{ "bench-fix",			required_argument,	NULL,	OPT_BENCH_FIX },
+			{ "bench-timeout",		required_argument,	NULL,	OPT_BENCH_TIMEOUT },
+			{ "bench-slots",		required_argument,	NULL,	OPT_BENCH_SLOTS },
+			{ "bench-power",		required_argument,	NULL,	OPT_BENCH_POWER },
+			{ "bench-phase",		required_argument,	NULL,	OPT_BENCH_PHASE },
+			{ "sweep",				required_argument,	NULL,	OPT_SWEEP },
+			{ "sweep-jobs",			required_argument,	NULL,	OPT_SWEEP_JOBS },
+			{ "sweep-logs",			required_argument,	NULL,	OPT_SWEEP_LOGS },
+			{ "uart-a",				required_argument,	NULL,	OPT_UART_A },
+			{ "uart-b",				required_argument,	NULL,	OPT_UART_B },
+			{ "control",			required_argument,	NULL,	OPT_CONTROL },
+			{ "eeprom",				required_argument,	NULL,	OPT_EEPROM },
+			{ "8051",				optional_argument,	NULL,	OPT_8051 },
+			{ "8051-clock",			required_argument,	NULL,	OPT_8051_CLOCK },
+			{ "lf-capture",			required_argument,	NULL,	OPT_LF_CAPTURE },
+			{ "replay",				required_argument,	NULL,	OPT_REPLAY },
+			{ "replay-seek",		required_argument,	NULL,	OPT_REPLAY_SEEK },
+			{ "replay-loop",		no_argument,		NULL,	OPT_REPLAY_LOOP },
+			{ "speed",				required_argument,	NULL,	OPT_SPEED },
+			{ "mmio-trace",			required_argument,	NULL,	OPT_MMIO_TRACE },
+			{ "mmio-replay",		required_argument,	NULL,	OPT_MMIO_REPLAY },
+			{ "help",				no_argument,		NULL,	'h' },
+			{ NULL,					0,					NULL,	0 }
+		};
+		LFSTREAM_FORMAT streamFormat = LFSTREAM_FORMAT_PHASE;
+		IQGEN_CONFIG iqcfg = {
+			.sampleRate = IQGEN_DEFAULT_RATE,
+			.f1Offset   = IQGEN_DEFAULT_F1_OFFSET,
+			.f2Offset   = IQGEN_DEFAULT_F2_OFFSET,
+			.format     = IQGEN_FORMAT_F32
+		};
+		// Streams are opened once all options have been read
+		const char *streamPaths[MAX_LF_STREAMS];
+		LFSTREAM_FORMAT streamFormats[MAX_LF_STREAMS];
+		size_t numStreams = 0;
+		const char *capturePath = NULL;
+		const char *replayPath = NULL;
+		unsigned long replaySeek = 0;
+		const char *mmioTracePath = NULL;
+		const char *stationFile = NULL, *trajectoryFile = NULL, *truthFile = NULL;
+		IFSTRIP_CONFIG ifcfg;
+		bool useIfStrip = false;
+		uint64_t noiseSeed = 1;
+		double fadeDb = 0, fadeCorr = 0.9;
+		const char *coverageMergePath = NULL;
+		bool coverageDiff = false;
+		bool useRewind = false;
+		unsigned int rewindInterval = REWIND_DEFAULT_INTERVAL, rewindDepth = REWIND_DEFAULT_DEPTH;
+		unsigned int rewindPoolMb = REWIND_DEFAULT_POOL_MB;
+		const char *lockstepPath = NULL;
+		const char *benchScript = NULL, *benchFix = BENCH_DEFAULT_FIX;
+		unsigned int benchTimeout = BENCH_DEFAULT_TIMEOUT;
+		const char *benchSlots = NULL, *benchPower = NULL, *benchPhase = NULL;
+		const char *sweepPath = NULL, *sweepLogs = NULL;
+		const char *controlPath = NULL;
+		const char *eepromPath = NULL;
+		bool useCoproc = false;
+		const char *coprocRom = NULL;
+		unsigned long coprocClock = COPROC_DEFAULT_CLOCK;
+		int opt;
+
+		ifstrip_config_mk2(&ifcfg);
+
+		while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+			switch (opt) {
+				case OPT_LF_STREAM:
+				case OPT_IQ_STREAM:
+					if (numStreams >= MAX_LF_STREAMS) {
+						fprintf(stderr, "Error: too many LF streams (max %d)\n", MAX_LF_STREAMS);
+						return EXIT_FAILURE;
+					}
+					streamPaths[numStreams]   = optarg;
+					streamFormats[numStreams] = (opt == OPT_IQ_STREAM) ? LFSTREAM_FORMAT_IQ : streamFormat;
+					numStreams++;
+					break;
+
+				case OPT_LF_CAPTURE:
+					capturePath = optarg;
+					break;
+
+				case OPT_REPLAY:
+					replayPath = optarg;
+					break;
+
+				case OPT_REPLAY_SEEK:
+					replaySeek = strtoul(optarg, NULL, 0);
+					break;
+
+				case OPT_REPLAY_LOOP:
+					replayLoop = true;
+					break;
+
+				case OPT_MMIO_TRACE:
+					mmioTracePath = optarg;
+					break;
+
+				case OPT_MMIO_REPLAY:
+					mmioReplayPath = optarg;
+					break;
+
+				case OPT_SPEED:
+					runSpeed = strtod(optarg, NULL);
+					if (runSpeed <= 0) {
+						fprintf(stderr, "Error: --speed must be more than 0\n");
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_LF_STREAM_FORMAT:
+					if (strcmp(optarg, "phase") == 0) {
+						streamFormat = LFSTREAM_FORMAT_PHASE;
+					} else if (strcmp(optarg, "audio") == 0) {
+						streamFormat = LFSTREAM_FORMAT_MODULATED;
+					} else {
+						fprintf(stderr, "Error: unknown LF stream format '%s'\n", optarg);
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_IQ_RATE:
+					iqcfg.sampleRate = strtoul(optarg, NULL, 0);
+					break;
+
+				case OPT_IQ_FORMAT:
+					if (strcmp(optarg, "f32") == 0) {
+						iqcfg.format = IQGEN_FORMAT_F32;
+					} else if (strcmp(optarg, "s16") == 0) {
+						iqcfg.format = IQGEN_FORMAT_S16;
+					} else {
+						fprintf(stderr, "Error: unknown I/Q format '%s'\n", optarg);
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_IQ_OFFSETS:
+					if (sscanf(optarg, "%lf,%lf", &iqcfg.f1Offset, &iqcfg.f2Offset) != 2) {
+						fprintf(stderr, "Error: --iq-offsets needs two frequencies, e.g. 10000,-10000\n");
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_STATIONS:
+					stationFile = optarg;
+					break;
+
+				case OPT_TRAJECTORY:
+					trajectoryFile = optarg;
+					break;
+
+				case OPT_TRUTH_LOG:
+					truthFile = optarg;
+					break;
+
+				case OPT_IF_STRIP:
+					if ((optarg != NULL) && (strcmp(optarg, "mk2") != 0)) {
+						// Comma-separated FREQ:Q sections
+						char *p = optarg;
+						ifcfg.numSections = 0;
+						while (*p != '\0') {
+							int len;
+							if ((ifcfg.numSections >= IFSTRIP_MAX_SECTIONS) ||
+									(sscanf(p, "%lf:%lf%n", &ifcfg.section[ifcfg.numSections].freq,
+											&ifcfg.section[ifcfg.numSections].q, &len) != 2)) {
+								fprintf(stderr, "Error: bad --if-strip section list '%s'\n", optarg);
+								return EXIT_FAILURE;
+							}
+							ifcfg.numSections++;
+							p += len;
+							if (*p == ',') {
+								p++;
+							}
+						}
+					}
+					useIfStrip = true;
+					break;
+
+				case OPT_IF_CARRIER:
+					ifcfg.carrier = strtod(optarg, NULL);
+					break;
+
+				case OPT_NOISE:
+					noiseLevel = strtoul(optarg, NULL, 0);
+					if (noiseLevel > 255) {
+						fprintf(stderr, "Error: noise level must be 0-255\n");
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_NOISE_SEED:
+					noiseSeed = strtoull(optarg, NULL, 0);
+					break;
+
+				case OPT_FADING:
+					if (sscanf(optarg, "%lf,%lf", &fadeDb, &fadeCorr) < 1) {
+						fprintf(stderr, "Error: --fading needs a depth in dB\n");
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_LOCK_MARGIN:
+					lockmargin_init(&lockMargin);
+					if (optarg != NULL) {
+						FILE *fp = fopen(optarg, "w");
+						if (fp == NULL) {
+							fprintf(stderr, "Error: can't open %s\n", optarg);
+							return EXIT_FAILURE;
+						}
+						setvbuf(fp, NULL, _IOLBF, 0);
+						lockmargin_set_log(&lockMargin, fp);
+					}
+					useLockMargin = true;
+					break;
+
+				case OPT_GDB:
+					gdbPort = (optarg != NULL) ? (int)strtoul(optarg, NULL, 0) : GDB_DEFAULT_PORT;
+					break;
+
+				case OPT_COVERAGE:
+					coveragePath = optarg;
+					break;
+
+				case OPT_COVERAGE_MERGE:
+					coverageMergePath = optarg;
+					break;
+
+				case OPT_COVERAGE_DIFF:
+					coverageDiff = true;
+					break;
+
+				case OPT_REWIND:
+					if ((optarg != NULL) && (sscanf(optarg, "%u,%u,%u", &rewindInterval, &rewindDepth, &rewindPoolMb) < 1)) {
+						fprintf(stderr, "Error: --rewind needs an interval in ms, e.g. 100,10\n");
+						return EXIT_FAILURE;
+					}
+					useRewind = true;
+					break;
+
+				case OPT_LOCKSTEP:
+					lockstepPath = optarg;
+					break;
+
+				case OPT_BENCH:
+					benchRuns = (optarg != NULL) ? strtoul(optarg, NULL, 0) : 1;
+					if (benchRuns == 0) {
+						fprintf(stderr, "Error: --bench needs at least one run\n");
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case OPT_BENCH_SCRIPT:
+					benchScript = optarg;
+					break;
+
+				case OPT_BENCH_FIX:
+					benchFix = optarg;
+					break;
+
+				case OPT_BENCH_TIMEOUT:
+					benchTimeout = strtoul(optarg, NULL, 0);
+					break;
+
+				case OPT_BENCH_SLOTS:
+					benchSlots = optarg;
+					break;
+
+				case OPT_BENCH_POWER:
+					benchPower = optarg;
+					break;
+
+				case OPT_BENCH_PHASE:
+					benchPhase = optarg;
+					break;
+
+				case OPT_SWEEP:
+					sweepPath = optarg;
+					break;
+
+				case OPT_SWEEP_JOBS:
+					sweepJobs = strtoul(optarg, NULL, 0);
+					break;
+
+				case OPT_SWEEP_LOGS:
+					sweepLogs = optarg;
+					break;
+
+				case OPT_CONTROL:
+					controlPath = optarg;
+					break;
+
+				case OPT_EEPROM:
+					eepromPath = optarg;
+					break;
+
+				case OPT_8051:
+					useCoproc = true;
+					coprocRom = optarg;
+					break;
+
+				case OPT_8051_CLOCK:
+					coprocClock = strtoul(optarg, NULL, 0);
+					break;
+
+				case OPT_UART_A:
+				case OPT_UART_B:
+					if (UartSetTransport((opt == OPT_UART_A) ? 0 : 1, optarg) != 0) {
+						return EXIT_FAILURE;
+					}
+					break;
+
+				case 'h':
+					usage(argv[0]);
+					return EXIT_SUCCESS;
+
+				default:
+					usage(argv[0]);
+					return EXIT_FAILURE;
+			}
+		}
+
+		// Coverage file tools: no emulation
+		if (coverageMergePath != NULL) {
+			if (optind >= argc) {
+				fprintf(stderr, "Error: --coverage-merge needs at least one input file\n");
+				return EXIT_FAILURE;
+			}
+			return (CoverageMerge(coverageMergePath, (const char * const *)&argv[optind], argc - optind) == 0) ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+		} else if (coverageDiff) {
+			if ((argc - optind) != 2) {
+				fprintf(stderr, "Error: --coverage-diff needs two coverage files\n");
+				return EXIT_FAILURE;
+			}
+			return (CoverageDiff(argv[optind], argv[optind + 1]) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+
+		for (size_t i=0; i<numStreams; i++) {
+			lfStreams[i] = LfStreamOpen(streamPaths[i], streamFormats[i], &iqcfg);
+			if (lfStreams[i] == NULL) {
+				return EXIT_FAILURE;
+			}
+			numLfStreams++;
+		}
+
+		if ((stationFile != NULL) || (trajectoryFile != NULL)) {
+			if ((stationFile == NULL) || (trajectoryFile == NULL)) {
+				fprintf(stderr, "Error: --stations and --trajectory must be used together\n");
+				return EXIT_FAILURE;
+			}
+			propModel = prop_load(stationFile, trajectoryFile);
+			if (propModel == NULL) {
+				return EXIT_FAILURE;
+			}
+			if (truthFile != NULL) {
+				FILE *fp = fopen(truthFile, "w");
+				if (fp == NULL) {
+					fprintf(stderr, "Error: can't open %s\n", truthFile);
+					return EXIT_FAILURE;
+				}
+				setvbuf(fp, NULL, _IOLBF, 0);
+				prop_set_truth_log(propModel, fp);
+			}
+		}
+
+		if (useIfStrip) {
+			ifStrip = ifstrip_init(&ifcfg);
+			if (ifStrip == NULL) {
+				return EXIT_FAILURE;
+			}
+			fprintf(stderr, "IF strip: %zu sections, %.3f ms group delay at %.0f Hz\n",
+					ifcfg.numSections, ifstrip_group_delay(ifStrip), ifcfg.carrier);
+		}
+
+		// Bench runs are forked children: the LF stream writer threads don't
+		// exist in them, and they can't share one GDB connection
+		if (benchRuns > 0) {
+			if ((lockstepPath != NULL) || (gdbPort >= 0) || (numLfStreams > 0)) {
+				fprintf(stderr, "Error: --bench can't be used with --lockstep, --gdb or LF streams\n");
+				return EXIT_FAILURE;
+			}
+			if (BenchInit(benchScript, benchFix, benchTimeout) != 0) {
+				return EXIT_FAILURE;
+			}
+			if (BenchSetSlots(benchSlots, benchPower, benchPhase) != 0) {
+				return EXIT_FAILURE;
+			}
+			benchSeed = noiseSeed;
+		}
+
+		// Sweep runs are separate headless processes: nothing they'd share
+		if (sweepPath != NULL) {
+			if ((benchRuns > 0) || (lockstepPath != NULL) || (gdbPort >= 0) || (numLfStreams > 0)) {
+				fprintf(stderr, "Error: --sweep can't be used with --bench, --lockstep, --gdb or LF streams\n");
+				return EXIT_FAILURE;
+			}
+			if (SweepInit(sweepPath, sweepLogs) != 0) {
+				return EXIT_FAILURE;
+			}
+			sweepMode = true;
+		}
+
+		// A capture is one file from one run
+		if (capturePath != NULL) {
+			if ((benchRuns > 0) || sweepMode) {
+				fprintf(stderr, "Error: --lf-capture can't be used with --bench or --sweep\n");
+				return EXIT_FAILURE;
+			}
+			lfCapture = LfCaptureOpen(capturePath);
+			if (lfCapture == NULL) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		// A replay is the signal as it was recorded, so nothing else shapes
+		// it, and repeating the run gives the same result
+		if (replayPath != NULL) {
+			if ((benchRuns > 0) || sweepMode || (propModel != NULL) || (ifStrip != NULL) ||
+					(noiseLevel > 0) || (fadeDb > 0)) {
+				fprintf(stderr, "Error: --replay can't be used with --bench, --sweep, --stations, --if-strip, --noise or --fading\n");
+				return EXIT_FAILURE;
+			}
+			lfReplay = LfCaptureMap(replayPath);
+			if (lfReplay == NULL) {
+				return EXIT_FAILURE;
+			}
+			if (replaySeek >= LfCaptureCycles(lfReplay)) {
+				fprintf(stderr, "Error: %s only has %zu cycles\n", replayPath, LfCaptureCycles(lfReplay));
+				return EXIT_FAILURE;
+			}
+			fprintf(stderr, "Replaying %s: %zu cycles, from cycle %lu\n",
+					replayPath, LfCaptureCycles(lfReplay), replaySeek);
+			dtrkCtx.replay_n = replaySeek;
+		}
+
+		// The control socket changes the run as it goes, so it doesn't mix
+		// with the modes that compare or repeat runs
+		if (controlPath != NULL) {
+			if ((benchRuns > 0) || sweepMode || (lockstepPath != NULL)) {
+				fprintf(stderr, "Error: --control can't be used with --bench, --sweep or --lockstep\n");
+				return EXIT_FAILURE;
+			}
+			if (ControlInit(controlPath) != 0) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		// An MMIO trace follows one run through from reset, and a replay of
+		// one has no CPU to run with anything else
+		if ((mmioTracePath != NULL) || (mmioReplayPath != NULL)) {
+			if ((benchRuns > 0) || sweepMode || (lockstepPath != NULL) || useRewind || (controlPath != NULL)) {
+				fprintf(stderr, "Error: --mmio-trace and --mmio-replay can't be used with --bench, --sweep, --lockstep, --rewind or --control\n");
+				return EXIT_FAILURE;
+			}
+			if ((mmioTracePath != NULL) && (mmioReplayPath != NULL)) {
+				fprintf(stderr, "Error: --mmio-trace and --mmio-replay can't be used together\n");
+				return EXIT_FAILURE;
+			}
+		}
+		if (mmioTracePath != NULL) {
+			mmioTrace = MmioTraceOpen(mmioTracePath, cycleBase);
+			if (mmioTrace == NULL) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		// Runs that have to start from the same state don't save EEPROM writes
+		if (EepromInit(eepromPath, (benchRuns == 0) && !sweepMode && (lockstepPath == NULL) && (mmioReplayPath == NULL)) != 0) {
+			return EXIT_FAILURE;
+		}
+
+		if (useCoproc && (CoprocInit(coprocRom, coprocClock) != 0)) {
+			return EXIT_FAILURE;
+		}
+
+		// Lock-step needs a snapshot every tick, to replay a mismatching tick from
+		if (lockstepPath != NULL) {
+			if (LockstepInit(lockstepPath) != 0) {
+				return EXIT_FAILURE;
+			}
+			StateHashInit();
+			rewindInterval = 1;
+			if (!useRewind) {
+				rewindDepth = 1;
+			}
+			useRewind = true;
+		}
+
+		if (useRewind && (RewindInit(rewindInterval, rewindDepth, rewindPoolMb, sizeof(MACHINE_STATE)) != 0)) {
+			return EXIT_FAILURE;
+		}
+
+		if ((noiseLevel > 0) || (fadeDb > 0)) {
+			lfnoise_init(&lfNoise, noiseSeed, fadeDb, fadeCorr);
+			useNoise = true;
+		}
+	}
+
 	// Load ROM. Order is: A byte from IC2, then a byte from IC1.
 #if 1
 	{
@@ -502,10 +1744,10 @@ int main(int argc, char **argv)
 		fclose(oddf);
 		fclose(evenf);
 
-		// Sort odd and even bytes into the correct order
+		// Sort odd and even bytes into words, in host byte order
 		for (uint32_t i=0, j=0; i<ROM_LENGTH; i+=2, j++) {
-			rom[i+0] = oddbuf[j];
-			rom[i+1] = evenbuf[j];
+			BYTE_WRITE(rom, i+0, oddbuf[j]);
+			BYTE_WRITE(rom, i+1, evenbuf[j]);
 		}
 
 		// Free the read buffers
@@ -518,24 +1760,51 @@ int main(int argc, char **argv)
 		FILE *f = fopen("./monitor_rom/tutor13.bin", "rb");
 		fread(rom, 1, sizeof(rom), f);
 		fclose(f);
+		WORDS_FROM_BE(rom, sizeof(rom));
 	}
 #endif
 
-	// Init the debug UART
-	UartInit();
+	// Stop cleanly on Ctrl-C or kill, so shutdown (and the coverage save) runs.
+	// Interrupted system calls are restarted: the flag is checked where the
+	// emulator waits (the main loop, the GDB stop loop), so the transports
+	// don't all need to handle EINTR.
+	{
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SignalHandler;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGUSR1, &sa, NULL);
+	}
+
+	// Init the debug UART. A lock-step follower takes its UART input from
+	// the leader instead.
+	UartInit((benchRuns == 0) && !sweepMode && (!LockstepEnabled() || LockstepIsLeader()) && (mmioReplayPath == NULL));
+	UpDownInit();
+
+	// Start the GDB stub. GDB can attach at any time once the CPU is running.
+	if ((gdbPort >= 0) && (GdbInit(gdbPort) != 0)) {
+		return EXIT_FAILURE;
+	}
 
 	// Wait for a client to connect to UART A before booting the CPU,
 	// so the firmware's boot output is not lost.
-	fprintf(stderr, "Waiting for UART A client (nc localhost %d)...\n", 10000);
-	while (Uart.SocketA < 0) {
-		UartPollRx();
-		usleep(10000);  // poll every 10ms
+	if (Uart.ListenA >= 0) {
+		fprintf(stderr, "Waiting for UART A client...\n");
+		while ((Uart.SocketA < 0) && !quitRequested) {
+			UartPollRx();
+			usleep(10000);  // poll every 10ms
+		}
+		fprintf(stderr, "Client connected, starting emulation.\n");
 	}
-	fprintf(stderr, "Client connected, starting emulation.\n");
 
 	// Init the phase modulation engine
-	// Compensate for the Mk2 IF strip and IIR behaviour
-	datatrak_gen_init(&dtrkCtx, DATATRAK_MODE_INTERLACED, DATATRAK_COMPENSATION_MK2);
+	// Compensate for the Mk2 IF strip and IIR behaviour, unless the IF strip
+	// is being simulated -- then it supplies the delay itself.
+	datatrak_gen_init(&dtrkCtx, DATATRAK_MODE_INTERLACED,
+			(ifStrip != NULL) ? DATATRAK_COMPENSATION_NONE : DATATRAK_COMPENSATION_MK2);
 
 	// DEBUG: start GC at a nonzero offset
 	// GC=14 gives a mix of 0/1 bits for FTS
@@ -557,12 +1826,50 @@ int main(int argc, char **argv)
 	dtrkCtx.slotPower[5] = 255;
 	dtrkCtx.slotPower[6] = 255;
 
-	// Fill the LF buffer
-	fillLFBuffer();
+	// Benchmark: from here on, each run is a child process with its own seed
+	if (benchRuns > 0) {
+		BenchApply(&dtrkCtx);
+		unsigned int run = BenchFork(benchRuns, benchSeed);
+		if (useNoise) {
+			lfnoise_init(&lfNoise, benchSeed + run, lfNoise.fadeDb, lfNoise.fadeCorr);
+		}
+	}
+
+	// Sweep: likewise, each run applies its own generator settings (unless
+	// they're to be forked from a checkpoint later)
+	if (sweepMode && !SweepHasCheckpoint()) {
+		SweepApply(SweepFork(sweepJobs), &dtrkCtx);
+	}
+
+	// Start generating LF cycles, and take the first one
+	for (size_t i=0; i<numLfStreams; i++) {
+		LfSourceAddStream(lfStreams[i]);
+	}
+	LfSourceSetPropagation(propModel);
+	LfSourceSetIfStrip(ifStrip);
+	LfSourceSetCapture(lfCapture);
+	if (lfReplay != NULL) {
+		LfSourceSetReplay(lfReplay, replayLoop);
+	}
+	if (useLockMargin) {
+		LfSourceSetLockMargin(&lockMargin);
+	}
+	if (useNoise) {
+		dtrkCtx.rfNoiseLevel = noiseLevel;
+		LfSourceSetNoise(&lfNoise);
+	}
+	if (LfSourceInit(&dtrkCtx) != 0) {
+		return EXIT_FAILURE;
+	}
+	dtrkCycle = LfSourceNext();
+
+	// Start the 8051 alongside
+	if (CoprocStart() != 0) {
+		return EXIT_FAILURE;
+	}
 
 	// Boot the 68000
 	//
-#define SYSTEM_CLOCK 20e6 /*Hz*/
 #define INTERRUPT_RATE 1000 /* Hz */
 #define CLOCKS_PER_INTERRUPT  (SYSTEM_CLOCK / INTERRUPT_RATE)
 
@@ -570,29 +1877,158 @@ int main(int argc, char **argv)
 	m68k_set_cpu_type(M68K_CPU_TYPE_68000);
 	m68k_set_int_ack_callback(&m68k_irq_callback);
 	m68k_pulse_reset();
+	BenchStart();
+	SweepStart();
 
 	uint32_t clock_cycles = 0;
 
-	for (;;) {
+	// Save the coverage map however the emulator exits
+	if (coveragePath != NULL) {
+		atexit(SaveCoverage);
+	}
+
+	// MMIO replay: drive the devices from the trace, and don't run the CPU
+	int exitStatus = EXIT_SUCCESS;
+	if (mmioReplayPath != NULL) {
+		if (MmioReplay(mmioReplayPath) != 0) {
+			exitStatus = EXIT_FAILURE;
+		}
+		quitRequested = 1;
+	}
+
+	while (!quitRequested) {
+		// Hold here while a control client has the CPU paused
+		while (ControlPaused() && !quitRequested) {
+			ControlPoll();
+			usleep(1000);
+		}
+		machineRewound = false;
+
 		// Run one tick interrupt worth of instructions
-		uint32_t tmp = m68k_execute(CLOCKS_PER_INTERRUPT);
+		uint32_t tmp = MachineExecute(CLOCKS_PER_INTERRUPT);
 		clock_cycles += tmp;
 
 		// Poll for incoming UART data and new client connections
+		bool rxWasReadyA = Uart.RxReadyA, rxWasReadyB = Uart.RxReadyB;
 		UartPollRx();
+		if (LockstepEnabled() && (LockstepSyncRx(rxWasReadyA, rxWasReadyB) != 0)) {
+			break;
+		}
+
+		// Poll for a GDB connection or interrupt, and control commands
+		GdbPoll();
+		ControlPoll();
+
+		// A rewind restored the state at the end of an earlier tick: carry
+		// on from there, rather than finishing this one on top of it
+		if (machineRewound) {
+			continue;
+		}
 
 		// Trigger a tick interrupt
 		InterruptFlags.phase_tick = true;
 
 		m68k_update_ipl();
+		emulatedMs++;
+
+		// Keep the 8051 within reach
+		CoprocSync(emulatedMs);
+
+		// Scripted UART input, for headless runs
+		UartScriptTick(emulatedMs);
+
+		// MMIO trace: the end of the tick, and the bytes the UARTs received
+		if (mmioTrace != NULL) {
+			uint32_t rx = 0;
+			if (!rxWasReadyA && Uart.RxReadyA) {
+				rx |= MMIOTRACE_RX_A | Uart.RxBufA;
+			}
+			if (!rxWasReadyB && Uart.RxReadyB) {
+				rx |= MMIOTRACE_RX_B | (Uart.RxBufB << 8);
+			}
+			MmioTraceEvent(mmioTrace, cycleBase, MMIOTRACE_TICK, rx);
+		}
+
+		// Benchmark: stop on the fix or timeout
+		if (BenchTick(emulatedMs)) {
+			break;
+		}
+
+		// Sweep: stop at the end of the run, or start the runs at the checkpoint
+		if (SweepTick(emulatedMs)) {
+			break;
+		}
+		if (SweepCheckpointDue(emulatedMs)) {
+			SweepFromCheckpoint();
+		}
+
+		// Replay: stop when the CPU gets to the end of the capture
+		if (LfSourceReplayEnded()) {
+			fprintf(stderr, "End of the LF replay at t=%llu ms\n", (unsigned long long)emulatedMs);
+			break;
+		}
+
+		// Check against the lock-step peer, and stop at the first difference
+		if (LockstepEnabled()) {
+			STATEHASH h;
+			StateHashGet(&h, phasebuf_rpos);
+			int r = LockstepCompare(emulatedMs, 0, &h);
+			if (r == 0) {
+				LockstepBisect(CLOCKS_PER_INTERRUPT);
+			}
+			if (r <= 0) {
+				break;
+			}
+		}
+
+		// Rewind snapshot, if one is due
+		if (RewindDue(emulatedMs)) {
+			MACHINE_STATE m;
+			MachineSave(&m);
+			RewindCapture(emulatedMs, &m);
+		}
+
+		if (coverageSaveRequested) {
+			coverageSaveRequested = 0;
+			if (coveragePath != NULL) {
+				SaveCoverage();
+			}
+		}
 
-		// TODO: Delay 1/TIMESLOT_FREQUENCY to make this run at real time
-		//
-		//return 0;
+		// Hold back to real time (or a multiple of it), if asked
+		if (runSpeed > 0) {
+			PaceTick();
+		}
 	}
 
-	// Shut down the UART
+	// Shut down the UART and GDB stub
 	UartDone();
+	GdbDone();
+	RewindDone();
+	LockstepDone();
+	BenchFinish();
+	SweepFinish();
+	ControlDone();
+	EepromDone();
+	CoprocDone();
+
+	// Shut down the LF source and streams
+	LfSourceDone();
+	for (size_t i=0; i<numLfStreams; i++) {
+		LfStreamClose(lfStreams[i]);
+	}
+	LfCaptureClose(lfCapture);
+	LfCaptureUnmap(lfReplay);
+	MmioTraceClose(mmioTrace);
+	if (ifStrip != NULL) {
+		ifstrip_free(ifStrip);
+	}
+	if (useLockMargin) {
+		lockmargin_report(&lockMargin, stderr);
+		if (lockMargin.log != NULL) {
+			fclose(lockMargin.log);
+		}
+	}
 
-	return 0;
+	return exitStatus;
 }
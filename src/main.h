@@ -1,6 +1,8 @@
 #ifndef MAIN_H_INCLUDED
 #define MAIN_H_INCLUDED
 
+#include <signal.h>
+
 typedef struct {
 	bool phase_tick;
 	bool uart;
@@ -8,6 +10,20 @@ typedef struct {
 
 extern volatile InterruptFlags_s InterruptFlags;
 
+// Emulated time since reset (ms)
+extern uint64_t emulatedMs;
+
+// Set by SIGINT/SIGTERM to stop the emulator
+extern volatile sig_atomic_t quitRequested;
+
+// System ROM and RAM, for direct (side-effect free) access. They're in host
+// word order: use the wordops.h functions.
+extern uint8_t rom[];
+extern uint8_t ram[];
+
 void m68k_update_ipl(void);
+uint64_t MachineCycles(void);
+void MachineSchedule(const uint64_t cycle);
+int MachineRewind(const uint64_t ms);
 
 #endif // MAIN_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,1004 @@
+/***
+ * MCS-51 core
+ *
+ * Executes one instruction per mcs51_step() call, and returns the machine
+ * cycles it took (12 oscillator clocks each), from the timing table in the
+ * MCS-51 programmer's guide. Timers 0 and 1 advance by the same count
+ * afterwards, so they stay exact to the instruction.
+ *
+ * Ports are quasi-bidirectional: reading a port gives its latch ANDed with
+ * whatever the outside world drives (portRead), except in read-modify-write
+ * instructions, which read the latch as the real part does. /INT0 and /INT1
+ * are P3.2 and P3.3 and are sampled once per instruction.
+ *
+ * The serial port sends each byte written to SBUF straight away and sets TI;
+ * the baud rate isn't modelled. Timer 1 overflows still set TF1 whether or
+ * not it clocks the serial port.
+ *
+ * Not modelled: timer 2 (8052), counting external pulses on T0/T1, and
+ * multiprocessor serial modes.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mcs51.h"
+
+// SFR addresses
+#define SFR_P0		0x80
+#define SFR_SP		0x81
+#define SFR_DPL		0x82
+#define SFR_DPH		0x83
+#define SFR_PCON	0x87
+#define SFR_TCON	0x88
+#define SFR_TMOD	0x89
+#define SFR_TL0		0x8A
+#define SFR_TL1		0x8B
+#define SFR_TH0		0x8C
+#define SFR_TH1		0x8D
+#define SFR_P1		0x90
+#define SFR_SCON	0x98
+#define SFR_SBUF	0x99
+#define SFR_P2		0xA0
+#define SFR_IE		0xA8
+#define SFR_P3		0xB0
+#define SFR_IP		0xB8
+#define SFR_PSW		0xD0
+#define SFR_ACC		0xE0
+#define SFR_B		0xF0
+
+#define SFR(m, a)	((m)->sfr[(a) - 0x80])
+#define ACC(m)		SFR(m, SFR_ACC)
+#define PSW(m)		SFR(m, SFR_PSW)
+
+// PSW bits
+#define PSW_CY		0x80
+#define PSW_AC		0x40
+#define PSW_OV		0x04
+#define PSW_P		0x01
+
+// TCON bits
+#define TCON_TF1	0x80
+#define TCON_TR1	0x40
+#define TCON_TF0	0x20
+#define TCON_TR0	0x10
+#define TCON_IE1	0x08
+#define TCON_IT1	0x04
+#define TCON_IE0	0x02
+#define TCON_IT0	0x01
+
+// SCON bits
+#define SCON_REN	0x10
+#define SCON_TI		0x02
+#define SCON_RI		0x01
+
+// Machine cycles per opcode
+static const uint8_t mcs51_cycles[256] = {
+	1,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 0x
+	2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 1x
+	2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 2x
+	2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,	// 3x
+	2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 4x
+	2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 5x
+	2,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 6x
+	2,2,2,2,1,2,1,1,1,1,1,1,1,1,1,1,	// 7x
+	2,2,2,2,4,2,2,2,2,2,2,2,2,2,2,2,	// 8x
+	2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,	// 9x
+	2,2,1,2,4,1,2,2,2,2,2,2,2,2,2,2,	// Ax
+	2,2,1,1,2,2,2,2,2,2,2,2,2,2,2,2,	// Bx
+	2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	// Cx
+	2,2,1,1,1,2,1,1,2,2,2,2,2,2,2,2,	// Dx
+	2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,	// Ex
+	2,2,2,2,1,1,1,1,1,1,1,1,1,1,1,1		// Fx
+};
+
+// Interrupt vectors, in polling order within a priority level, with their
+// IE/IP bit
+static const struct {
+	uint16_t vector;
+	uint8_t mask;
+} mcs51_irqs[] = {
+	{ 0x0003, 0x01 },	// /INT0
+	{ 0x000B, 0x02 },	// Timer 0
+	{ 0x0013, 0x04 },	// /INT1
+	{ 0x001B, 0x08 },	// Timer 1
+	{ 0x0023, 0x10 }	// Serial port
+};
+
+
+/// Set up a core with blank (0xFF) program memory, and reset it
+void mcs51_init(MCS51 *m)
+{
+	memset(m, 0, sizeof(*m));
+	memset(m->code, 0xFF, sizeof(m->code));
+	mcs51_reset(m);
+}
+
+/// Load a raw binary program image at code address 0
+int mcs51_load(MCS51 *m, const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	size_t n;
+
+	if (fp == NULL) {
+		fprintf(stderr, "8051: can't open %s\n", path);
+		return -1;
+	}
+	n = fread(m->code, 1, sizeof(m->code), fp);
+	fclose(fp);
+	if (n == 0) {
+		fprintf(stderr, "8051: %s is empty\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/// Hardware reset: SFRs to their reset values, PC to 0. RAM is kept.
+void mcs51_reset(MCS51 *m)
+{
+	memset(m->sfr, 0, sizeof(m->sfr));
+	SFR(m, SFR_SP) = 0x07;
+	SFR(m, SFR_P0) = 0xFF;
+	SFR(m, SFR_P1) = 0xFF;
+	SFR(m, SFR_P2) = 0xFF;
+	SFR(m, SFR_P3) = 0xFF;
+	m->pc = 0;
+	m->inService = 0;
+	m->noIrq = false;
+	m->int0Prev = m->int1Prev = true;
+}
+
+
+/****************************************************************************
+ * Memory access
+ ****************************************************************************/
+
+static inline uint8_t fetch(MCS51 *m)
+{
+	return m->code[m->pc++];
+}
+
+static inline uint8_t *reg(MCS51 *m, const unsigned int n)
+{
+	return &m->iram[(PSW(m) & 0x18) + n];
+}
+
+static inline bool is_port(const uint8_t addr)
+{
+	return (addr >= 0x80) && ((addr & 0x0F) == 0) && (addr <= SFR_P3);
+}
+
+static inline uint8_t port_pins(MCS51 *m, const uint8_t addr)
+{
+	uint8_t latch = SFR(m, addr);
+
+	if (m->portRead == NULL) {
+		return latch;
+	}
+	return latch & m->portRead(m->user, (addr >> 4) & 3);
+}
+
+static inline uint8_t parity(uint8_t v)
+{
+	v ^= v >> 4;
+	v ^= v >> 2;
+	v ^= v >> 1;
+	return v & 1;
+}
+
+// Direct address read. rmw: read-modify-write, so ports read their latch.
+static uint8_t dir_read(MCS51 *m, const uint8_t addr, const bool rmw)
+{
+	if (addr < 0x80) {
+		return m->iram[addr];
+	}
+	if (is_port(addr) && !rmw) {
+		return port_pins(m, addr);
+	}
+	switch (addr) {
+		case SFR_PSW:
+			return (PSW(m) & ~PSW_P) | parity(ACC(m));
+		case SFR_SBUF:
+			return m->sbufRx;
+		default:
+			return SFR(m, addr);
+	}
+}
+
+static void dir_write(MCS51 *m, const uint8_t addr, const uint8_t val)
+{
+	if (addr < 0x80) {
+		m->iram[addr] = val;
+		return;
+	}
+	switch (addr) {
+		case SFR_P0:
+		case SFR_P1:
+		case SFR_P2:
+		case SFR_P3:
+			SFR(m, addr) = val;
+			if (m->portWrite != NULL) {
+				m->portWrite(m->user, (addr >> 4) & 3, val);
+			}
+			break;
+		case SFR_SBUF:
+			if (m->serialTx != NULL) {
+				m->serialTx(m->user, val);
+			}
+			SFR(m, SFR_SCON) |= SCON_TI;
+			break;
+		case SFR_IE:
+		case SFR_IP:
+			SFR(m, addr) = val;
+			m->noIrq = true;
+			break;
+		default:
+			SFR(m, addr) = val;
+			break;
+	}
+}
+
+static inline uint8_t ind_read(MCS51 *m, const unsigned int ri)
+{
+	return m->iram[*reg(m, ri)];
+}
+
+static inline void ind_write(MCS51 *m, const unsigned int ri, const uint8_t val)
+{
+	m->iram[*reg(m, ri)] = val;
+}
+
+// Bit address to byte address and mask
+static inline uint8_t bit_addr(const uint8_t bit)
+{
+	return (bit < 0x80) ? (0x20 + (bit >> 3)) : (bit & 0xF8);
+}
+
+static bool bit_read(MCS51 *m, const uint8_t bit)
+{
+	return (dir_read(m, bit_addr(bit), false) >> (bit & 7)) & 1;
+}
+
+static void bit_write(MCS51 *m, const uint8_t bit, const bool val)
+{
+	uint8_t addr = bit_addr(bit);
+	uint8_t v = dir_read(m, addr, true);
+
+	if (val) {
+		v |= 1 << (bit & 7);
+	} else {
+		v &= ~(1 << (bit & 7));
+	}
+	dir_write(m, addr, v);
+}
+
+static inline void push(MCS51 *m, const uint8_t val)
+{
+	m->iram[++SFR(m, SFR_SP)] = val;
+}
+
+static inline uint8_t pop(MCS51 *m)
+{
+	return m->iram[SFR(m, SFR_SP)--];
+}
+
+static inline uint16_t dptr(MCS51 *m)
+{
+	return (SFR(m, SFR_DPH) << 8) | SFR(m, SFR_DPL);
+}
+
+static inline void set_cy(MCS51 *m, const bool cy)
+{
+	PSW(m) = (PSW(m) & ~PSW_CY) | (cy ? PSW_CY : 0);
+}
+
+static inline bool get_cy(MCS51 *m)
+{
+	return (PSW(m) & PSW_CY) != 0;
+}
+
+// Relative branch: fetch the offset, and take it if cond
+static inline void branch(MCS51 *m, const bool cond)
+{
+	int8_t rel = (int8_t)fetch(m);
+
+	if (cond) {
+		m->pc += rel;
+	}
+}
+
+
+/****************************************************************************
+ * Arithmetic
+ ****************************************************************************/
+
+static void add(MCS51 *m, const uint8_t v, const bool c)
+{
+	uint8_t a = ACC(m);
+	unsigned int r = a + v + c;
+	uint8_t psw = PSW(m) & ~(PSW_CY | PSW_AC | PSW_OV);
+
+	if (r > 0xFF) {
+		psw |= PSW_CY;
+	}
+	if (((a & 0x0F) + (v & 0x0F) + c) > 0x0F) {
+		psw |= PSW_AC;
+	}
+	if (~(a ^ v) & (a ^ r) & 0x80) {
+		psw |= PSW_OV;
+	}
+	PSW(m) = psw;
+	ACC(m) = r;
+}
+
+static void subb(MCS51 *m, const uint8_t v)
+{
+	uint8_t a = ACC(m);
+	bool c = get_cy(m);
+	uint8_t r = a - v - c;
+	uint8_t psw = PSW(m) & ~(PSW_CY | PSW_AC | PSW_OV);
+
+	if (a < (v + c)) {
+		psw |= PSW_CY;
+	}
+	if ((a & 0x0F) < ((v & 0x0F) + c)) {
+		psw |= PSW_AC;
+	}
+	if ((a ^ v) & (a ^ r) & 0x80) {
+		psw |= PSW_OV;
+	}
+	PSW(m) = psw;
+	ACC(m) = r;
+}
+
+static void cjne(MCS51 *m, const uint8_t a, const uint8_t b)
+{
+	set_cy(m, a < b);
+	branch(m, a != b);
+}
+
+static void da(MCS51 *m)
+{
+	unsigned int a = ACC(m);
+
+	if (((a & 0x0F) > 9) || (PSW(m) & PSW_AC)) {
+		a += 0x06;
+		if (a > 0xFF) {
+			PSW(m) |= PSW_CY;
+		}
+	}
+	if ((((a >> 4) & 0x0F) > 9) || (PSW(m) & PSW_CY)) {
+		a += 0x60;
+		if (a > 0xFF) {
+			PSW(m) |= PSW_CY;
+		}
+	}
+	ACC(m) = a;
+}
+
+
+/****************************************************************************
+ * Timers and interrupts
+ ****************************************************************************/
+
+static void timers(MCS51 *m, const unsigned int cycles)
+{
+	uint8_t tmod = SFR(m, SFR_TMOD);
+	uint8_t tcon = SFR(m, SFR_TCON);
+	uint8_t p3 = port_pins(m, SFR_P3);
+
+	for (int t = 0; t < 2; t++) {
+		uint8_t mode = (tmod >> (t * 4)) & 0x0F;
+		uint8_t tr = t ? TCON_TR1 : TCON_TR0;
+		uint8_t tf = t ? TCON_TF1 : TCON_TF0;
+		uint8_t *tl = &SFR(m, t ? SFR_TL1 : SFR_TL0);
+		uint8_t *th = &SFR(m, t ? SFR_TH1 : SFR_TH0);
+
+		bool run = (tcon & tr) && !((mode & 0x08) && !(p3 & (t ? 0x08 : 0x04)));
+
+		// Timer 1 stops in mode 3, or while timer 0 is in mode 3
+		if (t && (((tmod & 0x03) == 3) || ((mode & 3) == 3))) {
+			continue;
+		}
+		// Counting external pulses isn't modelled
+		if (mode & 0x04) {
+			continue;
+		}
+		// In mode 3, TH0 runs whenever TR1 is set
+		if (!run && ((mode & 3) != 3)) {
+			continue;
+		}
+
+		switch (mode & 3) {
+			case 0:		// 13-bit
+			case 1: {	// 16-bit
+				unsigned int bits = (mode & 3) ? 16 : 13;
+				uint32_t v = (mode & 3) ? ((*th << 8) | *tl) : ((*th << 5) | (*tl & 0x1F));
+				v += cycles;
+				if (v >> bits) {
+					tcon |= tf;
+				}
+				if (mode & 3) {
+					*th = v >> 8;
+					*tl = v;
+				} else {
+					*th = v >> 5;
+					*tl = (*tl & 0xE0) | (v & 0x1F);
+				}
+				break;
+			}
+			case 2: {	// 8-bit auto-reload
+				unsigned int v = *tl + cycles;
+				if (v > 0xFF) {
+					tcon |= tf;
+					v = *th + (v - 0x100);
+				}
+				*tl = v;
+				break;
+			}
+			case 3: {	// Timer 0 split into two 8-bit timers; TH0 runs off TR1
+				unsigned int v = *tl + cycles;
+				if (run) {
+					if (v > 0xFF) {
+						tcon |= TCON_TF0;
+					}
+					*tl = v;
+				}
+				if (tcon & TCON_TR1) {
+					v = *th + cycles;
+					if (v > 0xFF) {
+						tcon |= TCON_TF1;
+					}
+					*th = v;
+				}
+				break;
+			}
+		}
+	}
+
+	SFR(m, SFR_TCON) = tcon;
+}
+
+// Sample /INT0 and /INT1
+static void ext_irqs(MCS51 *m)
+{
+	uint8_t p3 = port_pins(m, SFR_P3);
+	uint8_t tcon = SFR(m, SFR_TCON);
+	bool int0 = (p3 & 0x04) != 0, int1 = (p3 & 0x08) != 0;
+
+	if (tcon & TCON_IT0) {
+		if (m->int0Prev && !int0) {
+			tcon |= TCON_IE0;
+		}
+	} else {
+		tcon = int0 ? (tcon & ~TCON_IE0) : (tcon | TCON_IE0);
+	}
+	if (tcon & TCON_IT1) {
+		if (m->int1Prev && !int1) {
+			tcon |= TCON_IE1;
+		}
+	} else {
+		tcon = int1 ? (tcon & ~TCON_IE1) : (tcon | TCON_IE1);
+	}
+	m->int0Prev = int0;
+	m->int1Prev = int1;
+	SFR(m, SFR_TCON) = tcon;
+}
+
+// Take the highest priority pending interrupt, if it can preempt what's
+// running. Returns the cycles taken (the LCALL), or 0.
+static unsigned int take_irq(MCS51 *m)
+{
+	uint8_t ie = SFR(m, SFR_IE), tcon = SFR(m, SFR_TCON), scon = SFR(m, SFR_SCON);
+	uint8_t pending = 0;
+
+	if (!(ie & 0x80)) {
+		return 0;
+	}
+	if (tcon & TCON_IE0)				pending |= 0x01;
+	if (tcon & TCON_TF0)				pending |= 0x02;
+	if (tcon & TCON_IE1)				pending |= 0x04;
+	if (tcon & TCON_TF1)				pending |= 0x08;
+	if (scon & (SCON_TI | SCON_RI))		pending |= 0x10;
+	pending &= ie;
+	if (pending == 0) {
+		return 0;
+	}
+
+	for (int level = 1; level >= 0; level--) {
+		uint8_t atLevel = pending & (level ? SFR(m, SFR_IP) : ~SFR(m, SFR_IP));
+
+		// A level can only be interrupted by a higher one
+		if ((atLevel == 0) || (m->inService >> level)) {
+			continue;
+		}
+		for (size_t i = 0; i < sizeof(mcs51_irqs) / sizeof(mcs51_irqs[0]); i++) {
+			if (!(atLevel & mcs51_irqs[i].mask)) {
+				continue;
+			}
+			// Edge-triggered and timer flags are cleared by the hardware
+			switch (mcs51_irqs[i].mask) {
+				case 0x01: if (tcon & TCON_IT0) tcon &= ~TCON_IE0; break;
+				case 0x02: tcon &= ~TCON_TF0; break;
+				case 0x04: if (tcon & TCON_IT1) tcon &= ~TCON_IE1; break;
+				case 0x08: tcon &= ~TCON_TF1; break;
+				default: break;
+			}
+			SFR(m, SFR_TCON) = tcon;
+			SFR(m, SFR_PCON) &= ~0x01;		// leave idle mode
+			m->inService |= 1 << level;
+			push(m, m->pc & 0xFF);
+			push(m, m->pc >> 8);
+			m->pc = mcs51_irqs[i].vector;
+			return 2;
+		}
+	}
+	return 0;
+}
+
+
+/****************************************************************************
+ * Execution
+ ****************************************************************************/
+
+/// Execute one instruction (or take an interrupt), and return the machine
+/// cycles it took
+unsigned int mcs51_step(MCS51 *m)
+{
+	unsigned int cyc;
+	uint8_t op, a, b;
+	uint16_t addr;
+
+	ext_irqs(m);
+	if (!m->noIrq && ((cyc = take_irq(m)) != 0)) {
+		timers(m, cyc);
+		m->cycles += cyc;
+		return cyc;
+	}
+	m->noIrq = false;
+
+	// Idle and power-down: the CPU stops until an interrupt (or reset)
+	if (SFR(m, SFR_PCON) & 0x03) {
+		if (!(SFR(m, SFR_PCON) & 0x02)) {
+			timers(m, 1);
+		}
+		m->cycles++;
+		return 1;
+	}
+
+	op = fetch(m);
+	cyc = mcs51_cycles[op];
+
+	switch (op) {
+		// NOP
+		case 0x00:
+			break;
+
+		// AJMP / ACALL addr11
+		case 0x01: case 0x21: case 0x41: case 0x61: case 0x81: case 0xA1: case 0xC1: case 0xE1:
+		case 0x11: case 0x31: case 0x51: case 0x71: case 0x91: case 0xB1: case 0xD1: case 0xF1:
+			a = fetch(m);
+			addr = (m->pc & 0xF800) | ((op & 0xE0) << 3) | a;
+			if (op & 0x10) {
+				push(m, m->pc & 0xFF);
+				push(m, m->pc >> 8);
+			}
+			m->pc = addr;
+			break;
+
+		// LJMP / LCALL addr16
+		case 0x02:
+		case 0x12:
+			addr = fetch(m) << 8;
+			addr |= fetch(m);
+			if (op == 0x12) {
+				push(m, m->pc & 0xFF);
+				push(m, m->pc >> 8);
+			}
+			m->pc = addr;
+			break;
+
+		// RR / RRC / RL / RLC A
+		case 0x03:
+			ACC(m) = (ACC(m) >> 1) | (ACC(m) << 7);
+			break;
+		case 0x13:
+			a = ACC(m);
+			ACC(m) = (a >> 1) | (get_cy(m) ? 0x80 : 0);
+			set_cy(m, a & 1);
+			break;
+		case 0x23:
+			ACC(m) = (ACC(m) << 1) | (ACC(m) >> 7);
+			break;
+		case 0x33:
+			a = ACC(m);
+			ACC(m) = (a << 1) | get_cy(m);
+			set_cy(m, a & 0x80);
+			break;
+
+		// INC / DEC
+		case 0x04:
+			ACC(m)++;
+			break;
+		case 0x05:
+			a = fetch(m);
+			dir_write(m, a, dir_read(m, a, true) + 1);
+			break;
+		case 0x06: case 0x07:
+			ind_write(m, op & 1, ind_read(m, op & 1) + 1);
+			break;
+		case 0x08: case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D: case 0x0E: case 0x0F:
+			(*reg(m, op & 7))++;
+			break;
+		case 0x14:
+			ACC(m)--;
+			break;
+		case 0x15:
+			a = fetch(m);
+			dir_write(m, a, dir_read(m, a, true) - 1);
+			break;
+		case 0x16: case 0x17:
+			ind_write(m, op & 1, ind_read(m, op & 1) - 1);
+			break;
+		case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: case 0x1F:
+			(*reg(m, op & 7))--;
+			break;
+		case 0xA3:
+			addr = dptr(m) + 1;
+			SFR(m, SFR_DPH) = addr >> 8;
+			SFR(m, SFR_DPL) = addr;
+			break;
+
+		// JBC / JB / JNB bit, rel
+		case 0x10:
+			a = fetch(m);
+			if (bit_read(m, a)) {
+				bit_write(m, a, false);
+				branch(m, true);
+			} else {
+				branch(m, false);
+			}
+			break;
+		case 0x20:
+			branch(m, bit_read(m, fetch(m)));
+			break;
+		case 0x30:
+			branch(m, !bit_read(m, fetch(m)));
+			break;
+
+		// JC / JNC / JZ / JNZ / SJMP rel
+		case 0x40:
+			branch(m, get_cy(m));
+			break;
+		case 0x50:
+			branch(m, !get_cy(m));
+			break;
+		case 0x60:
+			branch(m, ACC(m) == 0);
+			break;
+		case 0x70:
+			branch(m, ACC(m) != 0);
+			break;
+		case 0x80:
+			branch(m, true);
+			break;
+
+		// RET / RETI
+		case 0x22:
+		case 0x32:
+			addr = pop(m) << 8;
+			addr |= pop(m);
+			m->pc = addr;
+			if (op == 0x32) {
+				m->inService &= (m->inService & 2) ? 1 : 0;
+				m->noIrq = true;
+			}
+			break;
+
+		// ADD / ADDC / SUBB A, src
+		case 0x24: case 0x34: case 0x94:
+			b = fetch(m);
+			goto arith;
+		case 0x25: case 0x35: case 0x95:
+			b = dir_read(m, fetch(m), false);
+			goto arith;
+		case 0x26: case 0x27: case 0x36: case 0x37: case 0x96: case 0x97:
+			b = ind_read(m, op & 1);
+			goto arith;
+		case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C: case 0x2D: case 0x2E: case 0x2F:
+		case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D: case 0x3E: case 0x3F:
+		case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F:
+			b = *reg(m, op & 7);
+		arith:
+			if ((op & 0xF0) == 0x90) {
+				subb(m, b);
+			} else {
+				add(m, b, ((op & 0xF0) == 0x30) && get_cy(m));
+			}
+			break;
+
+		// ORL / ANL / XRL
+		case 0x42: case 0x52: case 0x62:
+		case 0x43: case 0x53: case 0x63:
+			a = fetch(m);
+			b = (op & 1) ? fetch(m) : ACC(m);
+			switch (op & 0xF0) {
+				case 0x40: dir_write(m, a, dir_read(m, a, true) | b); break;
+				case 0x50: dir_write(m, a, dir_read(m, a, true) & b); break;
+				default:   dir_write(m, a, dir_read(m, a, true) ^ b); break;
+			}
+			break;
+		case 0x44: case 0x54: case 0x64:
+		case 0x45: case 0x55: case 0x65:
+		case 0x46: case 0x56: case 0x66: case 0x47: case 0x57: case 0x67:
+		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
+		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+		case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6E: case 0x6F:
+			switch (op & 0x0F) {
+				case 0x04: b = fetch(m); break;
+				case 0x05: b = dir_read(m, fetch(m), false); break;
+				case 0x06: case 0x07: b = ind_read(m, op & 1); break;
+				default:   b = *reg(m, op & 7); break;
+			}
+			switch (op & 0xF0) {
+				case 0x40: ACC(m) |= b; break;
+				case 0x50: ACC(m) &= b; break;
+				default:   ACC(m) ^= b; break;
+			}
+			break;
+
+		// Boolean operations on C
+		case 0x72:
+			set_cy(m, get_cy(m) | bit_read(m, fetch(m)));
+			break;
+		case 0x82:
+			set_cy(m, get_cy(m) & bit_read(m, fetch(m)));
+			break;
+		case 0xA0:
+			set_cy(m, get_cy(m) | !bit_read(m, fetch(m)));
+			break;
+		case 0xB0:
+			set_cy(m, get_cy(m) & !bit_read(m, fetch(m)));
+			break;
+		case 0xA2:
+			set_cy(m, bit_read(m, fetch(m)));
+			break;
+		case 0x92:
+			bit_write(m, fetch(m), get_cy(m));
+			break;
+		case 0xB2:
+			a = fetch(m);
+			bit_write(m, a, !((dir_read(m, bit_addr(a), true) >> (a & 7)) & 1));
+			break;
+		case 0xB3:
+			PSW(m) ^= PSW_CY;
+			break;
+		case 0xC2:
+			bit_write(m, fetch(m), false);
+			break;
+		case 0xC3:
+			set_cy(m, false);
+			break;
+		case 0xD2:
+			bit_write(m, fetch(m), true);
+			break;
+		case 0xD3:
+			set_cy(m, true);
+			break;
+
+		// JMP @A+DPTR
+		case 0x73:
+			m->pc = dptr(m) + ACC(m);
+			break;
+
+		// MOV
+		case 0x74:
+			ACC(m) = fetch(m);
+			break;
+		case 0x75:
+			a = fetch(m);
+			dir_write(m, a, fetch(m));
+			break;
+		case 0x76: case 0x77:
+			ind_write(m, op & 1, fetch(m));
+			break;
+		case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+			*reg(m, op & 7) = fetch(m);
+			break;
+		case 0x85:
+			// MOV dest, src is encoded src first
+			a = fetch(m);
+			b = fetch(m);
+			dir_write(m, b, dir_read(m, a, false));
+			break;
+		case 0x86: case 0x87:
+			dir_write(m, fetch(m), ind_read(m, op & 1));
+			break;
+		case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8E: case 0x8F:
+			dir_write(m, fetch(m), *reg(m, op & 7));
+			break;
+		case 0x90:
+			SFR(m, SFR_DPH) = fetch(m);
+			SFR(m, SFR_DPL) = fetch(m);
+			break;
+		case 0xA6: case 0xA7:
+			ind_write(m, op & 1, dir_read(m, fetch(m), false));
+			break;
+		case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF:
+			*reg(m, op & 7) = dir_read(m, fetch(m), false);
+			break;
+		case 0xE5:
+			ACC(m) = dir_read(m, fetch(m), false);
+			break;
+		case 0xE6: case 0xE7:
+			ACC(m) = ind_read(m, op & 1);
+			break;
+		case 0xE8: case 0xE9: case 0xEA: case 0xEB: case 0xEC: case 0xED: case 0xEE: case 0xEF:
+			ACC(m) = *reg(m, op & 7);
+			break;
+		case 0xF5:
+			dir_write(m, fetch(m), ACC(m));
+			break;
+		case 0xF6: case 0xF7:
+			ind_write(m, op & 1, ACC(m));
+			break;
+		case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD: case 0xFE: case 0xFF:
+			*reg(m, op & 7) = ACC(m);
+			break;
+
+		// MOVC
+		case 0x83:
+			ACC(m) = m->code[(uint16_t)(m->pc + ACC(m))];
+			break;
+		case 0x93:
+			ACC(m) = m->code[(uint16_t)(dptr(m) + ACC(m))];
+			break;
+
+		// MOVX
+		case 0xE0:
+			ACC(m) = (m->xread != NULL) ? m->xread(m->user, dptr(m)) : 0xFF;
+			break;
+		case 0xE2: case 0xE3:
+			// @Ri puts P2 on the high address byte
+			addr = (SFR(m, SFR_P2) << 8) | *reg(m, op & 1);
+			ACC(m) = (m->xread != NULL) ? m->xread(m->user, addr) : 0xFF;
+			break;
+		case 0xF0:
+			if (m->xwrite != NULL) {
+				m->xwrite(m->user, dptr(m), ACC(m));
+			}
+			break;
+		case 0xF2: case 0xF3:
+			addr = (SFR(m, SFR_P2) << 8) | *reg(m, op & 1);
+			if (m->xwrite != NULL) {
+				m->xwrite(m->user, addr, ACC(m));
+			}
+			break;
+
+		// MUL / DIV AB
+		case 0xA4: {
+			unsigned int r = ACC(m) * SFR(m, SFR_B);
+			ACC(m) = r;
+			SFR(m, SFR_B) = r >> 8;
+			PSW(m) = (PSW(m) & ~(PSW_CY | PSW_OV)) | ((r > 0xFF) ? PSW_OV : 0);
+			break;
+		}
+		case 0x84:
+			b = SFR(m, SFR_B);
+			PSW(m) &= ~(PSW_CY | PSW_OV);
+			if (b == 0) {
+				PSW(m) |= PSW_OV;
+			} else {
+				a = ACC(m);
+				ACC(m) = a / b;
+				SFR(m, SFR_B) = a % b;
+			}
+			break;
+
+		// CJNE
+		case 0xB4:
+			b = fetch(m);
+			cjne(m, ACC(m), b);
+			break;
+		case 0xB5:
+			b = dir_read(m, fetch(m), false);
+			cjne(m, ACC(m), b);
+			break;
+		case 0xB6: case 0xB7:
+			b = fetch(m);
+			cjne(m, ind_read(m, op & 1), b);
+			break;
+		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+			b = fetch(m);
+			cjne(m, *reg(m, op & 7), b);
+			break;
+
+		// PUSH / POP
+		case 0xC0:
+			push(m, dir_read(m, fetch(m), false));
+			break;
+		case 0xD0:
+			a = fetch(m);
+			dir_write(m, a, pop(m));
+			break;
+
+		// SWAP / XCH / XCHD
+		case 0xC4:
+			ACC(m) = (ACC(m) << 4) | (ACC(m) >> 4);
+			break;
+		case 0xC5:
+			a = fetch(m);
+			b = dir_read(m, a, true);
+			dir_write(m, a, ACC(m));
+			ACC(m) = b;
+			break;
+		case 0xC6: case 0xC7:
+			b = ind_read(m, op & 1);
+			ind_write(m, op & 1, ACC(m));
+			ACC(m) = b;
+			break;
+		case 0xC8: case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+			b = *reg(m, op & 7);
+			*reg(m, op & 7) = ACC(m);
+			ACC(m) = b;
+			break;
+		case 0xD6: case 0xD7:
+			b = ind_read(m, op & 1);
+			ind_write(m, op & 1, (b & 0xF0) | (ACC(m) & 0x0F));
+			ACC(m) = (ACC(m) & 0xF0) | (b & 0x0F);
+			break;
+
+		// DA A
+		case 0xD4:
+			da(m);
+			break;
+
+		// DJNZ
+		case 0xD5:
+			a = fetch(m);
+			b = dir_read(m, a, true) - 1;
+			dir_write(m, a, b);
+			branch(m, b != 0);
+			break;
+		case 0xD8: case 0xD9: case 0xDA: case 0xDB: case 0xDC: case 0xDD: case 0xDE: case 0xDF:
+			branch(m, --(*reg(m, op & 7)) != 0);
+			break;
+
+		// CLR / CPL A
+		case 0xE4:
+			ACC(m) = 0;
+			break;
+		case 0xF4:
+			ACC(m) = ~ACC(m);
+			break;
+
+		// 0xA5 is undefined: treat as NOP
+		default:
+			break;
+	}
+
+	timers(m, cyc);
+	m->cycles += cyc;
+	return cyc;
+}
+
+/// Run until at least `cycles` machine cycles have been executed in total
+void mcs51_run(MCS51 *m, const uint64_t cycles)
+{
+	while (m->cycles < cycles) {
+		mcs51_step(m);
+	}
+}
+
+/// Receive a byte on the serial port. Returns false if REN is off.
+bool mcs51_serial_rx(MCS51 *m, const uint8_t val)
+{
+	if (!(SFR(m, SFR_SCON) & SCON_REN)) {
+		return false;
+	}
+	m->sbufRx = val;
+	SFR(m, SFR_SCON) |= SCON_RI;
+	return true;
+}
@@ -0,0 +1,52 @@
+/****************************************************************************
+ * MCS-51 core
+ *
+ * An 8051 instruction set interpreter, with the timers, serial port and
+ * interrupt controller of the original part. The outside world is reached
+ * through callbacks for the ports and the external data bus.
+ ****************************************************************************/
+
+#ifndef MCS51_H
+#define MCS51_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Code address space
+#define MCS51_CODE_SIZE 65536
+
+typedef struct MCS51 MCS51;
+
+struct MCS51 {
+	uint8_t code[MCS51_CODE_SIZE];	///< Program memory
+	uint8_t iram[256];				///< Internal RAM (upper 128 bytes indirect only)
+	uint8_t sfr[128];				///< Special function registers (0x80-0xFF)
+	uint16_t pc;
+	uint8_t sbufRx;					///< Serial receive buffer (SBUF reads)
+	uint8_t inService;				///< Interrupt levels in service (bit 0 low, bit 1 high)
+	bool noIrq;						///< Don't take an interrupt before the next instruction
+	bool int0Prev, int1Prev;		///< Previous /INT0 and /INT1 pin levels, for edge detection
+	uint64_t cycles;				///< Machine cycles executed
+
+	void *user;						///< Passed to the callbacks
+	/// External data read (MOVX)
+	uint8_t (*xread)(void *user, const uint16_t addr);
+	/// External data write (MOVX)
+	void (*xwrite)(void *user, const uint16_t addr, const uint8_t val);
+	/// Levels driven onto port pins from outside (1 = released). NULL for all released.
+	uint8_t (*portRead)(void *user, const int port);
+	/// Port latch written
+	void (*portWrite)(void *user, const int port, const uint8_t val);
+	/// Byte sent from the serial port
+	void (*serialTx)(void *user, const uint8_t val);
+};
+
+void mcs51_init(MCS51 *m);
+int mcs51_load(MCS51 *m, const char *path);
+void mcs51_reset(MCS51 *m);
+unsigned int mcs51_step(MCS51 *m);
+void mcs51_run(MCS51 *m, const uint64_t cycles);
+bool mcs51_serial_rx(MCS51 *m, const uint8_t val);
+
+#endif // MCS51_H
@@ -0,0 +1,231 @@
+/***
+ * MMIO trace
+ *
+ * --mmio-trace=FILE records every read and write the CPU makes outside ROM
+ * and RAM: the machine cycle, the address, the size, the value and the PC,
+ * 16 bytes each. The main loop adds a record where the device timers were
+ * run, and one at the end of every tick with the bytes the UARTs received
+ * in it. Between them these are everything the devices see from outside,
+ * apart from the LF signal, which is the same given the same options.
+ *
+ * --mmio-replay=FILE reads a trace back and makes the same accesses, at the
+ * same cycles, with no CPU (see MmioReplay() in main.c). A read that gives
+ * a different value from the one traced means a device model has changed
+ * how it behaves. With no firmware to run, a trace replays in a fraction
+ * of the time the run it came from took.
+ *
+ * Records are collected in memory and written out a block at a time, so
+ * tracing costs a few stores per access.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmiotrace.h"
+
+
+// Records collected before they're written out
+#define MMIOTRACE_BLOCK 65536
+
+struct MMIOTRACE {
+	FILE *fp;
+	const char *path;
+	uint64_t lastCycle;			// cycle of the last record
+	uint64_t records;			// records written
+	size_t used;				// records in the block
+	MMIOTRACE_RECORD block[MMIOTRACE_BLOCK];
+};
+
+struct MMIOTRACE_FILE {
+	const uint8_t *map;			// mapped file
+	size_t size;				// file size
+	const MMIOTRACE_RECORD *records;
+	size_t count;				// whole records in the file
+	size_t next;				// next record to read
+	uint64_t cycle;				// cycle of the last record read
+};
+
+
+/**
+ * Start a trace, from machine cycle startCycle.
+ *
+ * Returns NULL on error.
+ */
+MMIOTRACE *MmioTraceOpen(const char *path, const uint64_t startCycle)
+{
+	MMIOTRACE_FILE_HEADER hdr = {
+		.magic      = MMIOTRACE_MAGIC,
+		.version    = MMIOTRACE_VERSION,
+		.reserved   = 0,
+		.startCycle = startCycle
+	};
+
+	MMIOTRACE *t = malloc(sizeof(MMIOTRACE));
+	if (t == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	t->fp = fopen(path, "wb");
+	if (t->fp == NULL) {
+		fprintf(stderr, "MMIOTRACE: can't create %s: %s\n", path, strerror(errno));
+		free(t);
+		return NULL;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, t->fp) != 1) {
+		fprintf(stderr, "MMIOTRACE: can't write %s: %s\n", path, strerror(errno));
+		fclose(t->fp);
+		free(t);
+		return NULL;
+	}
+
+	t->path      = path;
+	t->lastCycle = startCycle;
+	t->records   = 0;
+	t->used      = 0;
+
+	fprintf(stderr, "MMIOTRACE: tracing I/O accesses to %s\n", path);
+	return t;
+}
+
+// Write out the records collected so far
+static void MmioTraceFlush(MMIOTRACE *t)
+{
+	if ((t->used > 0) && (fwrite(t->block, sizeof(MMIOTRACE_RECORD), t->used, t->fp) != t->used)) {
+		fprintf(stderr, "MMIOTRACE: can't write %s: %s\n", t->path, strerror(errno));
+	}
+	t->records += t->used;
+	t->used = 0;
+}
+
+/// Add a record of an access (type is its size, and MMIOTRACE_WRITE for a write)
+void MmioTraceAccess(MMIOTRACE *t, const uint64_t cycle, const uint32_t address, const uint8_t type,
+		const uint32_t value, const uint32_t pc)
+{
+	MMIOTRACE_RECORD *r = &t->block[t->used];
+
+	r->delta   = cycle - t->lastCycle;
+	r->address = (address & 0xFFFFFF) | ((uint32_t)type << 24);
+	r->value   = value;
+	r->pc      = pc;
+	t->lastCycle = cycle;
+
+	if (++t->used == MMIOTRACE_BLOCK) {
+		MmioTraceFlush(t);
+	}
+}
+
+/// Add an event record (MMIOTRACE_TIMERS or MMIOTRACE_TICK)
+void MmioTraceEvent(MMIOTRACE *t, const uint64_t cycle, const uint8_t type, const uint32_t value)
+{
+	MmioTraceAccess(t, cycle, 0, type, value, 0);
+}
+
+/// Finish a trace and close the file
+void MmioTraceClose(MMIOTRACE *t)
+{
+	if (t == NULL) {
+		return;
+	}
+
+	MmioTraceFlush(t);
+	fclose(t->fp);
+	fprintf(stderr, "MMIOTRACE: %llu records written to %s\n", (unsigned long long)t->records, t->path);
+	free(t);
+}
+
+/**
+ * Map a trace file for reading with MmioTraceNext(). A trace that was cut
+ * short is read up to its last whole record.
+ *
+ * Returns NULL on error.
+ */
+MMIOTRACE_FILE *MmioTraceMap(const char *path)
+{
+	struct stat st;
+	MMIOTRACE_FILE_HEADER hdr;
+
+	MMIOTRACE_FILE *f = calloc(1, sizeof(MMIOTRACE_FILE));
+	if (f == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "MMIOTRACE: can't open %s: %s\n", path, strerror(errno));
+		free(f);
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(hdr))) {
+		fprintf(stderr, "MMIOTRACE: %s is not an MMIO trace\n", path);
+		close(fd);
+		free(f);
+		return NULL;
+	}
+
+	f->size = st.st_size;
+	f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		fprintf(stderr, "MMIOTRACE: can't map %s: %s\n", path, strerror(errno));
+		free(f);
+		return NULL;
+	}
+
+	memcpy(&hdr, f->map, sizeof(hdr));
+	if ((hdr.magic != MMIOTRACE_MAGIC) || (hdr.version != MMIOTRACE_VERSION)) {
+		fprintf(stderr, "MMIOTRACE: %s is not a version %d MMIO trace\n", path, MMIOTRACE_VERSION);
+		MmioTraceUnmap(f);
+		return NULL;
+	}
+
+	f->records = (const MMIOTRACE_RECORD *)(f->map + sizeof(hdr));
+	f->count   = (f->size - sizeof(hdr)) / sizeof(MMIOTRACE_RECORD);
+	f->cycle   = hdr.startCycle;
+	return f;
+}
+
+/// Number of records in a mapped trace
+size_t MmioTraceRecords(const MMIOTRACE_FILE *f)
+{
+	return f->count;
+}
+
+/// Read the next record of a mapped trace. Returns false at the end.
+bool MmioTraceNext(MMIOTRACE_FILE *f, MMIOTRACE_EVENT *e)
+{
+	if (f->next >= f->count) {
+		return false;
+	}
+
+	const MMIOTRACE_RECORD *r = &f->records[f->next++];
+	f->cycle  += r->delta;
+	e->cycle   = f->cycle;
+	e->address = r->address & 0xFFFFFF;
+	e->type    = r->address >> 24;
+	e->value   = r->value;
+	e->pc      = r->pc;
+	return true;
+}
+
+/// Unmap a trace
+void MmioTraceUnmap(MMIOTRACE_FILE *f)
+{
+	if (f == NULL) {
+		return;
+	}
+	if ((f->map != NULL) && (f->map != MAP_FAILED)) {
+		munmap((void *)f->map, f->size);
+	}
+	free(f);
+}
@@ -0,0 +1,76 @@
+/****************************************************************************
+ * MMIO trace
+ *
+ * Records every access the CPU makes to the I/O space, with the machine
+ * cycle and PC, and reads the trace back to drive the devices without it.
+ ****************************************************************************/
+
+#ifndef MMIOTRACE_H
+#define MMIOTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// File header magic number ('DTMT')
+#define MMIOTRACE_MAGIC 0x544D5444
+/// File format version
+#define MMIOTRACE_VERSION 1
+
+/// Record types (the top byte of MMIOTRACE_RECORD.address)
+#define MMIOTRACE_SIZE		0x07	///< Access size in bytes (1, 2 or 4), 0 for events
+#define MMIOTRACE_WRITE		0x08	///< Write access (otherwise a read)
+#define MMIOTRACE_TIMERS	0x10	///< Event: device timers run up to this cycle
+#define MMIOTRACE_TICK		0x20	///< Event: end of a 1 ms tick
+
+/// MMIOTRACE_TICK value: UART bytes received during the tick
+#define MMIOTRACE_RX_A		0x10000	///< Byte in bits 0-7 was received on channel A
+#define MMIOTRACE_RX_B		0x20000	///< Byte in bits 8-15 was received on channel B
+
+/**
+ * A trace file is an MMIOTRACE_FILE_HEADER followed by MMIOTRACE_RECORDs
+ * until the end of the file, all in host byte order.
+ *
+ * Each record's cycle is given as the number of machine cycles since the
+ * one before (or since the header's startCycle for the first). There are
+ * MMIOTRACE_TIMERS and MMIOTRACE_TICK records at least once a tick, so the
+ * difference always fits.
+ */
+typedef struct {
+	uint32_t magic;				///< MMIOTRACE_MAGIC
+	uint16_t version;			///< MMIOTRACE_VERSION
+	uint16_t reserved;
+	uint64_t startCycle;		///< Machine cycle the trace starts at
+} MMIOTRACE_FILE_HEADER;
+
+typedef struct {
+	uint32_t delta;				///< Machine cycles since the previous record
+	uint32_t address;			///< Bits 0-23: bus address. Bits 24-31: record type.
+	uint32_t value;				///< Value read or written (MMIOTRACE_TICK: MMIOTRACE_RX_*)
+	uint32_t pc;				///< Instruction that made the access
+} MMIOTRACE_RECORD;
+
+/// One record of a trace being read, with its machine cycle
+typedef struct {
+	uint64_t cycle;				///< Machine cycle
+	uint32_t address;			///< Bus address
+	uint32_t value;				///< Value read or written (MMIOTRACE_TICK: MMIOTRACE_RX_*)
+	uint32_t pc;				///< Instruction that made the access
+	uint8_t  type;				///< MMIOTRACE_SIZE and the other type bits
+} MMIOTRACE_EVENT;
+
+typedef struct MMIOTRACE MMIOTRACE;
+typedef struct MMIOTRACE_FILE MMIOTRACE_FILE;
+
+MMIOTRACE *MmioTraceOpen(const char *path, const uint64_t startCycle);
+void MmioTraceAccess(MMIOTRACE *t, const uint64_t cycle, const uint32_t address, const uint8_t type,
+		const uint32_t value, const uint32_t pc);
+void MmioTraceEvent(MMIOTRACE *t, const uint64_t cycle, const uint8_t type, const uint32_t value);
+void MmioTraceClose(MMIOTRACE *t);
+
+MMIOTRACE_FILE *MmioTraceMap(const char *path);
+size_t MmioTraceRecords(const MMIOTRACE_FILE *f);
+bool MmioTraceNext(MMIOTRACE_FILE *f, MMIOTRACE_EVENT *e);
+void MmioTraceUnmap(MMIOTRACE_FILE *f);
+
+#endif // MMIOTRACE_H
@@ -0,0 +1,419 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "datatrak_gen.h"
+#include "propagation.h"
+
+/*
+ * Propagation model
+ * =================
+ *
+ * Moves the emulated receiver along a recorded trajectory and works out,
+ * for every cycle, the phase offset and signal strength the receiver would
+ * see from each of the 24 slot transmitters.
+ *
+ * Station file -- one transmitter per line, '#' starts a comment:
+ *
+ *     # slot  lat(deg)   lon(deg)   [erp(dB)]
+ *     1       52.0480    -0.7390    60
+ *     freq    146455     131245          (optional: F1 and F2 in Hz)
+ *
+ * Slots are numbered 1-24 as in the Datatrak documentation. Slots with no
+ * station are left switched off.
+ *
+ * Trajectory file -- one fix per line, in time order:
+ *
+ *     # time(s)  lat(deg)   lon(deg)   speed(m/s)
+ *     0.0        51.5000    -0.1200    0.0
+ *
+ * The position is interpolated linearly between fixes, and held at the last
+ * fix once the trajectory runs out.
+ *
+ *
+ * Phase
+ * -----
+ * Each slot's phase is the ground-wave path length in carrier wavelengths,
+ * as a lag in phase register counts (1000 counts = one wavelength):
+ *
+ *     φ = −(d / λ) × 1000  (mod 1000)
+ *
+ * F1 and F2 have different wavelengths, so the F2 phase is passed to the
+ * generator as slotF2PhaseDelta = φ_F2 − φ_F1. Each phase is evaluated at
+ * the middle of the navslot in which the slot actually transmits on that
+ * frequency, so vehicle motion during a cycle (Doppler) is reproduced.
+ *
+ * Distance is the great-circle distance on a spherical Earth, which is
+ * well inside the accuracy of a ground-wave phase model at these ranges.
+ *
+ *
+ * Signal strength
+ * ---------------
+ *     level(dB) = ERP − 20·log10(d/1 km) − PROP_ATTEN_DB_PER_KM · d
+ *
+ * mapped linearly onto DATATRAK_RSSI_MIN..MAX over PROP_RSSI_RANGE_DB, so a
+ * 60 dB station is at full scale at 1 km and fades out around 700 km.
+ *
+ *
+ * Batching
+ * --------
+ * Offsets are computed PROP_BATCH cycles at a time, in structure-of-arrays
+ * form so the per-slot distance loop vectorises, and handed out one cycle
+ * at a time by prop_apply(). This runs on the LF source's producer thread,
+ * ahead of the CPU, so it costs the emulation nothing.
+ */
+
+// Cycles computed per batch
+#define PROP_BATCH 64
+// Number of slots
+#define PROP_SLOTS 24
+// Mean Earth radius (m)
+#define PROP_EARTH_RADIUS 6371008.8
+// Speed of light (m/s)
+#define PROP_C 299792458.0
+// Ground-wave attenuation beyond spreading loss (dB/km)
+#define PROP_ATTEN_DB_PER_KM 0.01
+// Level range mapped onto the RSSI scale (dB)
+#define PROP_RSSI_RANGE_DB 60.0
+// Start of the F1 and F2 navslot periods, and navslot length (ms)
+#define PROP_F1_PERIOD_MS 340
+#define PROP_F2_PERIOD_MS (340 + (8 * 80) + 40)
+#define PROP_NAVSLOT_MS 80
+
+typedef struct {
+	double t;			///< Time (s)
+	double lat, lon;	///< Position (radians)
+	double speed;		///< Speed (m/s)
+} PROP_FIX;
+
+typedef struct {
+	int16_t phase[PROP_SLOTS];
+	int16_t f2Delta[PROP_SLOTS];
+	uint8_t power[PROP_SLOTS];
+	int goldcode_n;			///< Gold code offset this entry was computed for
+	double t, lat, lon, speed;	///< Truth at the start of the cycle
+} PROP_CYCLE;
+
+struct PROP_MODEL {
+	// Stations, structure-of-arrays, ECEF unit vectors
+	bool present[PROP_SLOTS];
+	double sx[PROP_SLOTS], sy[PROP_SLOTS], sz[PROP_SLOTS];
+	double erp[PROP_SLOTS];
+	double lambda1, lambda2;		///< F1/F2 wavelengths (m)
+
+	PROP_FIX *fixes;
+	size_t numFixes;
+	size_t fixPos;					///< Interpolation cursor
+
+	unsigned long cycle;			///< Index of the next cycle to be computed
+	PROP_CYCLE batch[PROP_BATCH];
+	size_t batchLen, batchPos;
+
+	FILE *truth;
+};
+
+
+// Read the next non-blank, non-comment line. Returns false at EOF.
+static bool prop_getline(FILE *fp, char *line, size_t len, int *lineno)
+{
+	while (fgets(line, len, fp) != NULL) {
+		(*lineno)++;
+		char *hash = strchr(line, '#');
+		if (hash != NULL) {
+			*hash = '\0';
+		}
+		if (strspn(line, " \t\r\n") != strlen(line)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool prop_load_stations(PROP_MODEL *pm, const char *filename)
+{
+	char line[256];
+	int lineno = 0;
+
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: can't open station file %s\n", filename);
+		return false;
+	}
+
+	double f1 = PROP_DEFAULT_F1_HZ, f2 = PROP_DEFAULT_F2_HZ;
+
+	while (prop_getline(fp, line, sizeof(line), &lineno)) {
+		int slot;
+		double lat, lon, erp = PROP_DEFAULT_ERP_DB;
+
+		if (sscanf(line, " freq %lf %lf", &f1, &f2) == 2) {
+			continue;
+		}
+		if ((sscanf(line, "%d %lf %lf %lf", &slot, &lat, &lon, &erp) < 3) ||
+				(slot < 1) || (slot > PROP_SLOTS)) {
+			fprintf(stderr, "%s:%d: expected 'slot lat lon [erp]' with slot 1-%d\n",
+					filename, lineno, PROP_SLOTS);
+			fclose(fp);
+			return false;
+		}
+
+		lat *= M_PI / 180.0;
+		lon *= M_PI / 180.0;
+		pm->present[slot-1] = true;
+		pm->sx[slot-1] = cos(lat) * cos(lon);
+		pm->sy[slot-1] = cos(lat) * sin(lon);
+		pm->sz[slot-1] = sin(lat);
+		pm->erp[slot-1] = erp;
+	}
+	fclose(fp);
+
+	pm->lambda1 = PROP_C / f1;
+	pm->lambda2 = PROP_C / f2;
+	return true;
+}
+
+static bool prop_load_trajectory(PROP_MODEL *pm, const char *filename)
+{
+	char line[256];
+	int lineno = 0;
+	size_t alloc = 0;
+
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: can't open trajectory file %s\n", filename);
+		return false;
+	}
+
+	while (prop_getline(fp, line, sizeof(line), &lineno)) {
+		PROP_FIX fix;
+
+		if (sscanf(line, "%lf %lf %lf %lf", &fix.t, &fix.lat, &fix.lon, &fix.speed) != 4) {
+			fprintf(stderr, "%s:%d: expected 'time lat lon speed'\n", filename, lineno);
+			fclose(fp);
+			return false;
+		}
+		if ((pm->numFixes > 0) && (fix.t < pm->fixes[pm->numFixes-1].t)) {
+			fprintf(stderr, "%s:%d: fixes must be in time order\n", filename, lineno);
+			fclose(fp);
+			return false;
+		}
+		fix.lat *= M_PI / 180.0;
+		fix.lon *= M_PI / 180.0;
+
+		if (pm->numFixes == alloc) {
+			alloc = (alloc == 0) ? 1024 : alloc * 2;
+			PROP_FIX *p = realloc(pm->fixes, alloc * sizeof(PROP_FIX));
+			if (p == NULL) {
+				fprintf(stderr, "Error allocating memory.\n");
+				fclose(fp);
+				return false;
+			}
+			pm->fixes = p;
+		}
+		pm->fixes[pm->numFixes++] = fix;
+	}
+	fclose(fp);
+
+	if (pm->numFixes == 0) {
+		fprintf(stderr, "%s: no fixes in trajectory\n", filename);
+		return false;
+	}
+	return true;
+}
+
+PROP_MODEL *prop_load(const char *stationFile, const char *trajectoryFile)
+{
+	PROP_MODEL *pm = calloc(1, sizeof(PROP_MODEL));
+	if (pm == NULL) {
+		fprintf(stderr, "Error allocating memory.\n");
+		return NULL;
+	}
+
+	if (!prop_load_stations(pm, stationFile) || !prop_load_trajectory(pm, trajectoryFile)) {
+		prop_free(pm);
+		return NULL;
+	}
+
+	return pm;
+}
+
+/// Log the true vehicle position at the start of every cycle to fp
+void prop_set_truth_log(PROP_MODEL *pm, FILE *fp)
+{
+	pm->truth = fp;
+	if (fp != NULL) {
+		fprintf(fp, "# time(s) lat(deg) lon(deg) speed(m/s) clock_n goldcode_n\n");
+	}
+}
+
+/// Interpolate the vehicle position at time t (seconds from trajectory start)
+static void prop_position(PROP_MODEL *pm, double t, double *lat, double *lon, double *speed)
+{
+	const PROP_FIX *f = pm->fixes;
+	t += f[0].t;
+
+	// Times only move forward within a batch, so the cursor rarely moves far
+	while ((pm->fixPos > 0) && (f[pm->fixPos].t > t)) {
+		pm->fixPos--;
+	}
+	while ((pm->fixPos + 1 < pm->numFixes) && (f[pm->fixPos + 1].t <= t)) {
+		pm->fixPos++;
+	}
+
+	const PROP_FIX *a = &f[pm->fixPos];
+	if ((pm->fixPos + 1 >= pm->numFixes) || (t <= a->t)) {
+		*lat = a->lat;
+		*lon = a->lon;
+		*speed = a->speed;
+		return;
+	}
+
+	const PROP_FIX *b = a + 1;
+	double k = (t - a->t) / (b->t - a->t);
+	*lat   = a->lat   + (b->lat   - a->lat)   * k;
+	*lon   = a->lon   + (b->lon   - a->lon)   * k;
+	*speed = a->speed + (b->speed - a->speed) * k;
+}
+
+/// Receiver ECEF unit vector at time t
+static void prop_rx(PROP_MODEL *pm, double t, double *x, double *y, double *z)
+{
+	double lat, lon, speed;
+	prop_position(pm, t, &lat, &lon, &speed);
+	*x = cos(lat) * cos(lon);
+	*y = cos(lat) * sin(lon);
+	*z = sin(lat);
+}
+
+/// Great-circle distances (m) from per-slot receiver positions to each station
+static void prop_distances(const PROP_MODEL *pm, const double *rx, const double *ry, const double *rz, double *d)
+{
+	double chord[PROP_SLOTS];
+
+	// Straight-line distance on the unit sphere; vectorises across stations
+	for (size_t s = 0; s < PROP_SLOTS; s++) {
+		double dx = pm->sx[s] - rx[s];
+		double dy = pm->sy[s] - ry[s];
+		double dz = pm->sz[s] - rz[s];
+		chord[s] = sqrt((dx * dx) + (dy * dy) + (dz * dz));
+	}
+
+	for (size_t s = 0; s < PROP_SLOTS; s++) {
+		d[s] = 2.0 * PROP_EARTH_RADIUS * asin(fmin(chord[s] * 0.5, 1.0));
+	}
+}
+
+/// Path length in wavelengths, as a phase lag in counts 0..999
+static inline int16_t prop_phase(const double d, const double lambda)
+{
+	double cycles = d / lambda;
+	int counts = (int)lround((cycles - floor(cycles)) * 1000.0) % 1000;
+	return (counts == 0) ? 0 : 1000 - counts;
+}
+
+/// Compute the next PROP_BATCH cycles, starting at Gold code offset goldcode_n
+static void prop_fill_batch(PROP_MODEL *pm, const DATATRAK_LF_CTX *ctx)
+{
+	const double cycleSec = ctx->msPerCycle / 1000.0;
+	int goldcode_n = ctx->goldcode_n;
+
+	for (size_t c = 0; c < PROP_BATCH; c++, pm->cycle++) {
+		PROP_CYCLE *pc = &pm->batch[c];
+		const double t0 = pm->cycle * cycleSec;
+		const bool odd = (goldcode_n & 1);
+
+		double x1[PROP_SLOTS], y1[PROP_SLOTS], z1[PROP_SLOTS];
+		double x2[PROP_SLOTS], y2[PROP_SLOTS], z2[PROP_SLOTS];
+		double d1[PROP_SLOTS], d2[PROP_SLOTS];
+
+		pc->goldcode_n = goldcode_n;
+		pc->t = t0;
+		prop_position(pm, t0, &pc->lat, &pc->lon, &pc->speed);
+
+		// Receiver position at the middle of each slot's F1 and F2 navslot.
+		// Slots 1-8 transmit on F1 then F2. Interlaced slots transmit on one
+		// frequency per cycle; which one alternates with the Gold code.
+		for (size_t n = 0; n < 8; n++) {
+			const double tF1 = t0 + (PROP_F1_PERIOD_MS + (n * PROP_NAVSLOT_MS) + (PROP_NAVSLOT_MS / 2)) / 1000.0;
+			const double tF2 = t0 + (PROP_F2_PERIOD_MS + (n * PROP_NAVSLOT_MS) + (PROP_NAVSLOT_MS / 2)) / 1000.0;
+
+			// Slot n+1: F1 in the F1 period, F2 in the F2 period
+			prop_rx(pm, tF1, &x1[n], &y1[n], &z1[n]);
+			prop_rx(pm, tF2, &x2[n], &y2[n], &z2[n]);
+
+			// Interlaced slots: on F2 during the F1 period, or F1 during the F2 period
+			const size_t ilF2 = n + (odd ? 16 : 8);
+			const size_t ilF1 = n + (odd ? 8 : 16);
+			prop_rx(pm, tF1, &x2[ilF2], &y2[ilF2], &z2[ilF2]);
+			x1[ilF2] = x2[ilF2]; y1[ilF2] = y2[ilF2]; z1[ilF2] = z2[ilF2];
+			prop_rx(pm, tF2, &x1[ilF1], &y1[ilF1], &z1[ilF1]);
+			x2[ilF1] = x1[ilF1]; y2[ilF1] = y1[ilF1]; z2[ilF1] = z1[ilF1];
+		}
+
+		prop_distances(pm, x1, y1, z1, d1);
+		prop_distances(pm, x2, y2, z2, d2);
+
+		for (size_t s = 0; s < PROP_SLOTS; s++) {
+			if (!pm->present[s]) {
+				pc->phase[s] = 0;
+				pc->f2Delta[s] = 0;
+				pc->power[s] = DATATRAK_RSSI_MIN;
+				continue;
+			}
+
+			pc->phase[s]   = prop_phase(d1[s], pm->lambda1);
+			pc->f2Delta[s] = prop_phase(d2[s], pm->lambda2) - pc->phase[s];
+
+			// Ground-wave level, clamped to 1 km minimum range
+			double km = fmax(d1[s] / 1000.0, 1.0);
+			double level = pm->erp[s] - (20.0 * log10(km)) - (PROP_ATTEN_DB_PER_KM * km);
+			double rssi = DATATRAK_RSSI_MIN + ((DATATRAK_RSSI_MAX - DATATRAK_RSSI_MIN) * level / PROP_RSSI_RANGE_DB);
+			pc->power[s] = (uint8_t)lround(fmax(DATATRAK_RSSI_MIN, fmin(DATATRAK_RSSI_MAX, rssi)));
+		}
+
+		goldcode_n = (goldcode_n + 1) % 64;
+	}
+
+	pm->batchLen = PROP_BATCH;
+	pm->batchPos = 0;
+}
+
+/**
+ * Set the slot phase offsets and powers in ctx for the next cycle.
+ *
+ * Call once per cycle, immediately before datatrak_gen_generate().
+ */
+void prop_apply(PROP_MODEL *pm, DATATRAK_LF_CTX *ctx)
+{
+	// Refill when the batch runs out, or if the Gold code offset was changed
+	// under us (interlaced slot frequencies depend on it)
+	if ((pm->batchPos >= pm->batchLen) || (pm->batch[pm->batchPos].goldcode_n != ctx->goldcode_n)) {
+		pm->cycle -= (pm->batchLen - pm->batchPos);
+		prop_fill_batch(pm, ctx);
+	}
+
+	const PROP_CYCLE *pc = &pm->batch[pm->batchPos++];
+
+	memcpy(ctx->slotPhaseOffset, pc->phase, sizeof(pc->phase));
+	memcpy(ctx->slotF2PhaseDelta, pc->f2Delta, sizeof(pc->f2Delta));
+	memcpy(ctx->slotPower, pc->power, sizeof(pc->power));
+
+	if (pm->truth != NULL) {
+		fprintf(pm->truth, "%.3f %.7f %.7f %.2f %d %d\n",
+				pc->t, pc->lat * (180.0 / M_PI), pc->lon * (180.0 / M_PI), pc->speed,
+				ctx->clock_n, ctx->goldcode_n);
+	}
+}
+
+void prop_free(PROP_MODEL *pm)
+{
+	if (pm == NULL) {
+		return;
+	}
+	free(pm->fixes);
+	free(pm);
+}
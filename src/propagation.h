@@ -0,0 +1,26 @@
+/**************
+ * Datatrak propagation model
+ */
+
+#ifndef _PROPAGATION_H
+#define _PROPAGATION_H
+
+#include <stdio.h>
+
+#include "datatrak_gen.h"
+
+// Nominal carrier frequencies (Hz); can be overridden in the station file
+#define PROP_DEFAULT_F1_HZ 146455.0
+#define PROP_DEFAULT_F2_HZ 131245.0
+
+// Default station effective radiated power (dB, relative to the RSSI scale)
+#define PROP_DEFAULT_ERP_DB 60.0
+
+typedef struct PROP_MODEL PROP_MODEL;
+
+PROP_MODEL *prop_load(const char *stationFile, const char *trajectoryFile);
+void prop_set_truth_log(PROP_MODEL *pm, FILE *fp);
+void prop_apply(PROP_MODEL *pm, DATATRAK_LF_CTX *ctx);
+void prop_free(PROP_MODEL *pm);
+
+#endif
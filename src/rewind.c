@@ -0,0 +1,275 @@
+/***
+ * Rewind
+ *
+ * Every intervalMs of emulated time the main loop takes a snapshot: the CPU
+ * context, the UART registers, a machine state block from main.c (generator
+ * position, GPIO latches, pending interrupts) and whatever RAM has changed.
+ * Snapshots go into a bounded ring; the oldest are dropped when it fills, or
+ * when the RAM page pool runs out.
+ *
+ * RAM is tracked in 256-byte pages. The bus write handlers set a byte in
+ * RewindDirty for every write (a single store, so it can stay on). A shadow
+ * copy holds RAM as it was at the most recent snapshot. When a snapshot is
+ * taken, each dirty page's shadow contents -- its value at the *previous*
+ * snapshot -- are saved into the pool as that snapshot's undo data, and the
+ * shadow is brought up to date. A snapshot therefore costs two page copies
+ * per page written since the last one, and nothing for untouched RAM.
+ *
+ * To rewind to snapshot K: put the currently dirty pages back from the
+ * shadow (RAM as of the newest snapshot), then apply the undo pages of each
+ * newer snapshot in turn, newest first. The snapshots after K are discarded.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m68k.h"
+
+#include "machine.h"
+#include "main.h"
+#include "uart.h"
+
+#include "rewind.h"
+
+
+typedef struct {
+	uint64_t timeMs;			// emulated time of the snapshot
+	size_t poolStart;			// first undo page (pool sequence number)
+	size_t numPages;			// number of undo pages
+	void *cpu;					// Musashi context
+	uart_s uart;				// UART state
+	void *machine;				// main.c machine state
+} REWIND_SNAPSHOT;
+
+uint8_t RewindDirty[REWIND_NUM_PAGES];
+
+static struct {
+	bool enabled;
+	unsigned int intervalMs;
+	uint64_t lastMs;			// time of the newest snapshot
+
+	REWIND_SNAPSHOT *snaps;		// snapshot ring
+	size_t maxSnaps;
+	size_t snapHead, snapTail;	// sequence numbers: next to write, oldest kept
+
+	uint8_t (*pool)[REWIND_PAGE_SIZE];	// undo page ring
+	uint16_t *poolPage;			// RAM page number of each pool entry
+	size_t poolSize;
+	size_t poolHead;			// sequence number of the next pool entry
+
+	size_t cpuSize, machineSize;
+	uint8_t shadow[RAM_LENGTH];	// RAM at the newest snapshot
+} Rewind;
+
+
+/**
+ * Allocate the snapshot ring.
+ *
+ * intervalMs   - emulated time between snapshots
+ * depthSec     - how far back snapshots are kept
+ * poolMb       - memory for saved RAM pages
+ * machineSize  - size of the caller's machine state block
+ */
+int RewindInit(const unsigned int intervalMs, const unsigned int depthSec, const size_t poolMb, const size_t machineSize)
+{
+	if ((intervalMs == 0) || (depthSec == 0)) {
+		fprintf(stderr, "REWIND: interval and depth must be nonzero\n");
+		return -1;
+	}
+
+	Rewind.intervalMs  = intervalMs;
+	Rewind.maxSnaps    = (((uint64_t)depthSec * 1000) / intervalMs) + 1;
+	Rewind.cpuSize     = m68k_context_size();
+	Rewind.machineSize = machineSize;
+
+	// Enough pool for at least one snapshot of all of RAM
+	Rewind.poolSize = (poolMb * 1024 * 1024) / REWIND_PAGE_SIZE;
+	if (Rewind.poolSize < REWIND_NUM_PAGES) {
+		Rewind.poolSize = REWIND_NUM_PAGES;
+	}
+
+	Rewind.snaps    = calloc(Rewind.maxSnaps, sizeof(REWIND_SNAPSHOT));
+	Rewind.pool     = malloc(Rewind.poolSize * REWIND_PAGE_SIZE);
+	Rewind.poolPage = malloc(Rewind.poolSize * sizeof(uint16_t));
+	if ((Rewind.snaps == NULL) || (Rewind.pool == NULL) || (Rewind.poolPage == NULL)) {
+		fprintf(stderr, "REWIND: can't allocate snapshot memory\n");
+		RewindDone();
+		return -1;
+	}
+	for (size_t i = 0; i < Rewind.maxSnaps; i++) {
+		Rewind.snaps[i].cpu     = malloc(Rewind.cpuSize);
+		Rewind.snaps[i].machine = malloc(machineSize);
+		if ((Rewind.snaps[i].cpu == NULL) || (Rewind.snaps[i].machine == NULL)) {
+			fprintf(stderr, "REWIND: can't allocate snapshot memory\n");
+			RewindDone();
+			return -1;
+		}
+	}
+
+	Rewind.snapHead = Rewind.snapTail = 0;
+	Rewind.poolHead = 0;
+	Rewind.enabled  = true;
+
+	return 0;
+}
+
+void RewindDone(void)
+{
+	if (Rewind.snaps != NULL) {
+		for (size_t i = 0; i < Rewind.maxSnaps; i++) {
+			free(Rewind.snaps[i].cpu);
+			free(Rewind.snaps[i].machine);
+		}
+	}
+	free(Rewind.snaps);
+	free(Rewind.pool);
+	free(Rewind.poolPage);
+	Rewind.snaps    = NULL;
+	Rewind.pool     = NULL;
+	Rewind.poolPage = NULL;
+	Rewind.enabled  = false;
+}
+
+bool RewindEnabled(void)
+{
+	return Rewind.enabled;
+}
+
+/// True if a snapshot should be taken at timeMs
+bool RewindDue(const uint64_t timeMs)
+{
+	return Rewind.enabled &&
+		((Rewind.snapHead == Rewind.snapTail) || ((timeMs - Rewind.lastMs) >= Rewind.intervalMs));
+}
+
+static inline REWIND_SNAPSHOT *RewindSnap(const size_t seq)
+{
+	return &Rewind.snaps[seq % Rewind.maxSnaps];
+}
+
+/**
+ * Take a snapshot. Call between m68k_execute() slices, with the CPU at an
+ * instruction boundary.
+ */
+void RewindCapture(const uint64_t timeMs, const void *machine)
+{
+	size_t dirty = 0;
+	const bool first = (Rewind.snapHead == Rewind.snapTail);
+
+	if (!Rewind.enabled) {
+		return;
+	}
+
+	for (size_t p = 0; p < REWIND_NUM_PAGES; p++) {
+		dirty += (RewindDirty[p] != 0);
+	}
+
+	// Drop the oldest snapshots to make room. The oldest snapshot's own undo
+	// pages are never needed (there's nothing older to go back to).
+	if (first) {
+		dirty = 0;
+	}
+	while ((Rewind.snapHead - Rewind.snapTail) >= Rewind.maxSnaps) {
+		Rewind.snapTail++;
+	}
+	while ((Rewind.snapHead != Rewind.snapTail) &&
+			((Rewind.poolHead + dirty) - RewindSnap(Rewind.snapTail)->poolStart > Rewind.poolSize)) {
+		Rewind.snapTail++;
+	}
+
+	REWIND_SNAPSHOT *s = RewindSnap(Rewind.snapHead);
+	s->timeMs    = timeMs;
+	s->poolStart = Rewind.poolHead;
+	s->numPages  = dirty;
+
+	if (first) {
+		// Start of history: everything up to now is the baseline
+		memcpy(Rewind.shadow, ram, RAM_LENGTH);
+		memset(RewindDirty, 0, sizeof(RewindDirty));
+	} else {
+		for (size_t p = 0; p < REWIND_NUM_PAGES; p++) {
+			if (!RewindDirty[p]) {
+				continue;
+			}
+			const size_t slot = Rewind.poolHead++ % Rewind.poolSize;
+			memcpy(Rewind.pool[slot], &Rewind.shadow[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE);
+			Rewind.poolPage[slot] = p;
+			memcpy(&Rewind.shadow[p * REWIND_PAGE_SIZE], &ram[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE);
+			RewindDirty[p] = 0;
+		}
+	}
+
+	m68k_get_context(s->cpu);
+	s->uart = Uart;
+	memcpy(s->machine, machine, Rewind.machineSize);
+
+	Rewind.snapHead++;
+	Rewind.lastMs = timeMs;
+}
+
+/**
+ * Go back to the newest snapshot taken at or before timeMs (or the oldest
+ * one, if history doesn't go back that far).
+ *
+ * Restores RAM, the CPU and the UART registers (the UART's client
+ * connections are kept), and copies the snapshot's machine state block to
+ * machine for the caller to apply. *restoredMs is set to the snapshot time.
+ */
+int RewindRestore(const uint64_t timeMs, uint64_t *restoredMs, void *machine)
+{
+	if (!Rewind.enabled || (Rewind.snapHead == Rewind.snapTail)) {
+		fprintf(stderr, "REWIND: no snapshots\n");
+		return -1;
+	}
+
+	// Find the target snapshot
+	size_t target = Rewind.snapHead - 1;
+	while ((target != Rewind.snapTail) && (RewindSnap(target)->timeMs > timeMs)) {
+		target--;
+	}
+
+	// RAM back to the newest snapshot...
+	for (size_t p = 0; p < REWIND_NUM_PAGES; p++) {
+		if (RewindDirty[p]) {
+			memcpy(&ram[p * REWIND_PAGE_SIZE], &Rewind.shadow[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE);
+			RewindDirty[p] = 0;
+		}
+	}
+
+	// ...then undo each newer snapshot in turn
+	for (size_t seq = Rewind.snapHead - 1; seq != target; seq--) {
+		const REWIND_SNAPSHOT *s = RewindSnap(seq);
+		for (size_t i = 0; i < s->numPages; i++) {
+			const size_t slot = (s->poolStart + i) % Rewind.poolSize;
+			memcpy(&ram[Rewind.poolPage[slot] * REWIND_PAGE_SIZE], Rewind.pool[slot], REWIND_PAGE_SIZE);
+		}
+	}
+	memcpy(Rewind.shadow, ram, RAM_LENGTH);
+
+	// Restore the rest of the machine, keeping the UART's connections
+	const REWIND_SNAPSHOT *s = RewindSnap(target);
+	uart_s uart = s->uart;
+	uart.ListenA   = Uart.ListenA;
+	uart.ListenB   = Uart.ListenB;
+	uart.SocketA   = Uart.SocketA;
+	uart.SocketB   = Uart.SocketB;
+	uart.IacStateA = Uart.IacStateA;
+	uart.IacStateB = Uart.IacStateB;
+	uart.IacPendingCmdA = Uart.IacPendingCmdA;
+	uart.IacPendingCmdB = Uart.IacPendingCmdB;
+	Uart = uart;
+
+	m68k_set_context(s->cpu);
+	memcpy(machine, s->machine, Rewind.machineSize);
+	*restoredMs = s->timeMs;
+
+	// History after the target is gone
+	Rewind.snapHead = target + 1;
+	Rewind.poolHead = s->poolStart + s->numPages;
+	Rewind.lastMs   = s->timeMs;
+
+	return 0;
+}
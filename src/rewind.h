@@ -0,0 +1,44 @@
+/****************************************************************************
+ * Rewind
+ *
+ * Periodic in-memory snapshots of the emulated machine, so it can be stepped
+ * back a few seconds without replaying from boot.
+ ****************************************************************************/
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+// RAM page size for dirty tracking (log2 bytes)
+#define REWIND_PAGE_BITS 8
+#define REWIND_PAGE_SIZE (1 << REWIND_PAGE_BITS)
+#define REWIND_NUM_PAGES (RAM_LENGTH / REWIND_PAGE_SIZE)
+
+// Defaults for --rewind: snapshot interval (ms), history kept (s) and
+// memory for saved RAM pages (MB)
+#define REWIND_DEFAULT_INTERVAL 100
+#define REWIND_DEFAULT_DEPTH 10
+#define REWIND_DEFAULT_POOL_MB 64
+
+// RAM pages written since the last snapshot (nonzero = dirty)
+extern uint8_t RewindDirty[REWIND_NUM_PAGES];
+
+/// Mark the RAM bytes at offset..offset+len-1 as written (len <= page size)
+#define REWIND_MARK_DIRTY(offset, len) do {										\
+		RewindDirty[((offset) & (RAM_LENGTH - 1)) >> REWIND_PAGE_BITS] = 1;		\
+		RewindDirty[(((offset) + (len) - 1) & (RAM_LENGTH - 1)) >> REWIND_PAGE_BITS] = 1;	\
+	} while (0)
+
+int RewindInit(const unsigned int intervalMs, const unsigned int depthSec, const size_t poolMb, const size_t machineSize);
+void RewindDone(void);
+bool RewindEnabled(void);
+bool RewindDue(const uint64_t timeMs);
+void RewindCapture(const uint64_t timeMs, const void *machine);
+int RewindRestore(const uint64_t timeMs, uint64_t *restoredMs, void *machine);
+
+#endif // REWIND_H
@@ -0,0 +1,76 @@
+/****************************************************************************
+ * SPSC
+ *
+ * Lock-free single-producer, single-consumer ring buffer indices.
+ *
+ * Only the indices live here; the caller owns the slot storage (an array of
+ * SPSC_RING.size elements) and copies data in and out of it. The producer
+ * fills the slot returned by SpscWriteSlot() then calls SpscPublish(); the
+ * consumer reads the slot returned by SpscReadSlot() then calls
+ * SpscRelease(). Neither side ever blocks or takes a lock.
+ ****************************************************************************/
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	size_t size;		///< Number of slots (must be a power of two)
+	size_t head;		///< Next slot to be written (owned by producer)
+	size_t tail;		///< Next slot to be read (owned by consumer)
+} SPSC_RING;
+
+/// Initialise a ring with `size` slots. `size` must be a power of two.
+static inline void SpscInit(SPSC_RING *r, const size_t size)
+{
+	r->size = size;
+	r->head = 0;
+	r->tail = 0;
+}
+
+/// Number of slots currently filled.
+static inline size_t SpscCount(const SPSC_RING *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/// Producer: get the index of the next free slot, or -1 if the ring is full.
+static inline ptrdiff_t SpscWriteSlot(const SPSC_RING *r)
+{
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if ((head - tail) >= r->size) {
+		return -1;
+	}
+	return head & (r->size - 1);
+}
+
+/// Producer: make the slot returned by SpscWriteSlot() visible to the consumer.
+static inline void SpscPublish(SPSC_RING *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/// Consumer: get the index of the oldest filled slot, or -1 if the ring is empty.
+static inline ptrdiff_t SpscReadSlot(const SPSC_RING *r)
+{
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		return -1;
+	}
+	return tail & (r->size - 1);
+}
+
+/// Consumer: hand the slot returned by SpscReadSlot() back to the producer.
+static inline void SpscRelease(SPSC_RING *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif // SPSC_H
@@ -0,0 +1,89 @@
+/***
+ * State hash
+ *
+ * The RAM hash is the sum, mod 2^64, of a mixing function of every
+ * (offset, byte) pair. Being a sum, it doesn't depend on the order RAM was
+ * written in, and a write only has to subtract the old byte's term and add
+ * the new one. The CPU registers, UART registers and phase read position
+ * are small enough to hash from scratch each time.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "m68k.h"
+
+#include "machine.h"
+#include "main.h"
+#include "uart.h"
+
+#include "statehash.h"
+
+
+bool StateHashEnabled = false;
+uint64_t StateHashRam;
+
+// Registers included in the CPU hash
+static const m68k_register_t StateHashRegs[] = {
+	M68K_REG_D0, M68K_REG_D1, M68K_REG_D2, M68K_REG_D3,
+	M68K_REG_D4, M68K_REG_D5, M68K_REG_D6, M68K_REG_D7,
+	M68K_REG_A0, M68K_REG_A1, M68K_REG_A2, M68K_REG_A3,
+	M68K_REG_A4, M68K_REG_A5, M68K_REG_A6, M68K_REG_A7,
+	M68K_REG_USP, M68K_REG_ISP, M68K_REG_SR, M68K_REG_PC
+};
+
+
+/// Start keeping the RAM hash up to date
+void StateHashInit(void)
+{
+	StateHashEnabled = true;
+	StateHashRecompute();
+}
+
+/// Rehash all of RAM, after it has been changed behind the bus handlers' back
+void StateHashRecompute(void)
+{
+	StateHashRam = 0;
+	for (uint32_t i = 0; i < RAM_LENGTH; i++) {
+		StateHashRam += StateHashByte(i, BYTE_READ(ram, i));
+	}
+}
+
+// Fold a value into a running hash
+static inline uint64_t StateHashAdd(const uint64_t h, const uint64_t v)
+{
+	return StateHashMix(h ^ v) + 0x9E3779B97F4A7C15ULL;
+}
+
+/// Hash the current machine state
+void StateHashGet(STATEHASH *h, const size_t phasebuf_rpos)
+{
+	uint64_t x;
+
+	h->ram = StateHashRam;
+
+	x = 0;
+	for (size_t i = 0; i < sizeof(StateHashRegs) / sizeof(StateHashRegs[0]); i++) {
+		x = StateHashAdd(x, m68k_get_reg(NULL, StateHashRegs[i]));
+	}
+	h->cpu = x;
+
+	// Register state only: the client sockets differ between processes
+	x = 0;
+	x = StateHashAdd(x, Uart.TxEnA | (Uart.TxEnB << 1) | (Uart.RxEnA << 2) | (Uart.RxEnB << 3) |
+			(Uart.MRnA << 4) | (Uart.MRnB << 5) | (Uart.RxReadyA << 6) | (Uart.RxReadyB << 7));
+	x = StateHashAdd(x, Uart.MRA[0] | (Uart.MRA[1] << 8) | (Uart.MRB[0] << 16) | ((uint32_t)Uart.MRB[1] << 24));
+	x = StateHashAdd(x, Uart.IMR | (Uart.IVR << 8) | (Uart.OutPort << 16) | ((uint32_t)Uart.InPort << 24));
+	x = StateHashAdd(x, Uart.RxBufA | (Uart.RxBufB << 8));
+	x = StateHashAdd(x, Uart.ACR | (Uart.CTPreset << 8) | ((uint64_t)Uart.CounterLoad << 24) |
+			((uint64_t)Uart.CounterTimerMode << 40) | ((uint64_t)Uart.CounterReady << 41));
+	x = StateHashAdd(x, Uart.Counter.start);
+	x = StateHashAdd(x, Uart.Counter.expiry);
+	h->uart = x;
+
+	h->rpos = phasebuf_rpos;
+
+	h->total = StateHashAdd(StateHashAdd(StateHashAdd(StateHashAdd(0, h->ram), h->cpu), h->uart), h->rpos);
+}
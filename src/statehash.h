@@ -0,0 +1,67 @@
+/****************************************************************************
+ * State hash
+ *
+ * Hash of the emulated machine state, kept up to date incrementally as RAM
+ * is written so it can be taken every tick (or every instruction).
+ ****************************************************************************/
+
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+#include "main.h"
+#include "wordops.h"
+
+/// Hash of each part of the machine state
+typedef struct {
+	uint64_t ram;				///< RAM contents
+	uint64_t cpu;				///< CPU registers
+	uint64_t uart;				///< UART registers (not connections)
+	uint64_t rpos;				///< Phase buffer read position
+	uint64_t total;				///< Combination of the above
+} STATEHASH;
+
+extern bool StateHashEnabled;
+extern uint64_t StateHashRam;
+
+/// 64-bit mixing function (splitmix64 finaliser)
+static inline uint64_t StateHashMix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/// Contribution of one RAM byte to the RAM hash
+static inline uint64_t StateHashByte(const uint32_t offset, const uint8_t value)
+{
+	return StateHashMix(((uint64_t)offset << 8) | value);
+}
+
+/**
+ * Update the RAM hash for a write of size bytes (big-endian value) at RAM
+ * offset. Call before the write, while RAM still holds the old value.
+ */
+static inline void StateHashRamWrite(const uint32_t offset, const uint32_t value, const unsigned int size)
+{
+	if (StateHashEnabled) {
+		for (unsigned int i = 0; i < size; i++) {
+			const uint32_t o = (offset + i) & (RAM_LENGTH - 1);
+			const uint8_t v = value >> (8 * (size - 1 - i));
+			StateHashRam += StateHashByte(o, v) - StateHashByte(o, BYTE_READ(ram, o));
+		}
+	}
+}
+
+void StateHashInit(void);
+void StateHashRecompute(void);
+void StateHashGet(STATEHASH *h, const size_t phasebuf_rpos);
+
+#endif // STATEHASH_H
@@ -0,0 +1,707 @@
+/***
+ * Generator parameter sweep
+ *
+ * The matrix file lists the values to try for each generator setting, and
+ * the firmware is run once for every combination of them (so two modes and
+ * three slot sets make six runs). Each line is a setting name followed by
+ * its values, separated by spaces:
+ *
+ *     mode MODE...            interlaced, eightslot
+ *     compensation COMP...    mk2, none
+ *     clock N...              starting clock_n
+ *     goldcode N...           starting goldcode_n
+ *     slots SET...            enabled slots, e.g. 0-6 or 0,4,5,9,11
+ *     power N...              transmit power of the enabled slots
+ *     phase SET...            slot phase offsets, e.g. 4:100,5:-50 ('-' = none)
+ *     script FILE...          UART A input script (see uartscript.c), timed
+ *                             from the start of the run ('-' = none)
+ *
+ * Settings not in the matrix are left as main() sets them up. More lines
+ * control the runs themselves:
+ *
+ *     time SEC                emulated run length (default 300)
+ *     match NAME REGEX        count UART A lines matching REGEX (the rest of
+ *                             the line, POSIX extended) as column NAME
+ *     checkpoint MS           boot once, and start every run from MS
+ *                             milliseconds after reset
+ *     checkpoint match REGEX  ... or from the first UART A line matching REGEX
+ *
+ * Blank lines and lines starting '#' are ignored.
+ *
+ * Each run is a forked child, up to one per CPU core at once. The children
+ * start from the parent's state just before the signal generator starts,
+ * apply their settings, and boot the firmware with no UART client. Each
+ * child counts its matches and the time of the first, and sends them to the
+ * parent through a pipe when the run ends. The parent prints the table once
+ * every run has finished. A copy of each run's UART A output can be kept
+ * for a closer look.
+ *
+ * With a checkpoint, the parent boots the firmware itself up to that point
+ * (acquiring the chain, say), and forks the runs from there instead. The
+ * children share the parent's memory copy-on-write, so the boot is only
+ * done once and costs nothing per run. The parent keeps its machine at the
+ * checkpoint while the runs go. Each child restarts the signal generator
+ * with its own settings from the start of the cycle that was being received
+ * at the checkpoint. Matches, the run length and the logs then count from
+ * the checkpoint.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <regex.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "datatrak_gen.h"
+#include "main.h"
+#include "uart.h"
+#include "uartscript.h"
+
+#include "sweep.h"
+
+
+// Matrix limits
+#define SWEEP_MAX_VALUES 32
+#define SWEEP_MAX_VALUE_LEN 80
+#define SWEEP_MAX_MATCHES 16
+#define SWEEP_MAX_NAME 16
+#define SWEEP_MAX_RUNS 100000
+// Longest UART output line examined for matches
+#define SWEEP_MAX_LINE 256
+
+typedef enum {
+	SWEEP_MODE,
+	SWEEP_COMPENSATION,
+	SWEEP_CLOCK,
+	SWEEP_GOLDCODE,
+	SWEEP_SLOTS,
+	SWEEP_POWER,
+	SWEEP_PHASE,
+	SWEEP_SCRIPT,
+	SWEEP_NUM_AXES
+} SWEEP_AXIS_ID;
+
+static const char *SWEEP_AXIS_NAMES[SWEEP_NUM_AXES] = {
+	"mode", "compensation", "clock", "goldcode", "slots", "power", "phase", "script"
+};
+
+typedef struct {
+	unsigned int count;			// 0 = not swept
+	char values[SWEEP_MAX_VALUES][SWEEP_MAX_VALUE_LEN];
+} SWEEP_AXIS;
+
+// Result of one run, sent from the child to the parent
+typedef struct {
+	unsigned long count[SWEEP_MAX_MATCHES];
+	uint64_t firstMs[SWEEP_MAX_MATCHES];	// time of the first match (ms from the run start)
+	double wallSec;
+} SWEEP_RESULT;
+
+// A running child
+typedef struct {
+	pid_t pid;
+	int fd;
+	unsigned int run;
+} SWEEP_JOB;
+
+static struct {
+	bool enabled;
+	SWEEP_AXIS axes[SWEEP_NUM_AXES];
+	unsigned int numRuns;
+	uint64_t timeMs;
+
+	regex_t match[SWEEP_MAX_MATCHES];
+	char matchName[SWEEP_MAX_MATCHES][SWEEP_MAX_NAME];
+	unsigned int numMatches;
+
+	uint64_t checkpointMs;		// checkpoint time (0 = none, or by match)
+	regex_t checkpointMatch;
+	bool checkpointByMatch, checkpointHit;
+
+	const char *logDir;
+	FILE *log;					// this run's UART A output (child only)
+
+	char line[SWEEP_MAX_LINE];	// current UART A output line
+	size_t lineLen;
+
+	struct timespec start;
+	uint64_t startMs;			// emulated time the run started
+	uint64_t lastMs;
+	SWEEP_RESULT result;
+	int resultFd;				// pipe to the parent (child only)
+} Sweep = { .resultFd = -1 };
+
+
+/// Parse a slot list such as "0-6" or "0,4,5,9,11" into a bitmap
+int SweepParseSlots(const char *s, uint32_t *slots)
+{
+	*slots = 0;
+	while (*s != '\0') {
+		char *end;
+		long a = strtol(s, &end, 10), b = a;
+		if (end == s) {
+			return -1;
+		}
+		if (*end == '-') {
+			s = end + 1;
+			b = strtol(s, &end, 10);
+			if (end == s) {
+				return -1;
+			}
+		}
+		if ((a < 0) || (b > 23) || (a > b)) {
+			return -1;
+		}
+		for (long i = a; i <= b; i++) {
+			*slots |= 1UL << i;
+		}
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return -1;
+		}
+		s = end;
+	}
+	return 0;
+}
+
+/// Parse a phase list such as "4:100,5:-50" ("-" for none)
+int SweepParsePhase(const char *s, int16_t offsets[24])
+{
+	memset(offsets, 0, 24 * sizeof(offsets[0]));
+	if (strcmp(s, "-") == 0) {
+		return 0;
+	}
+	while (*s != '\0') {
+		int slot, offset, len;
+		if ((sscanf(s, "%d:%d%n", &slot, &offset, &len) != 2) || (slot < 0) || (slot > 23)) {
+			return -1;
+		}
+		offsets[slot] = offset;
+		s += len;
+		if (*s == ',') {
+			s++;
+		} else if (*s != '\0') {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/// Parse a plain integer value, within [min, max]
+static int SweepParseInt(const char *s, const long min, const long max, long *value)
+{
+	char *end;
+	*value = strtol(s, &end, 0);
+	return ((end == s) || (*end != '\0') || (*value < min) || (*value > max)) ? -1 : 0;
+}
+
+/// Check that a value is valid for its axis
+static int SweepCheckValue(const SWEEP_AXIS_ID axis, const char *s)
+{
+	uint32_t slots;
+	int16_t offsets[24];
+	long v;
+
+	switch (axis) {
+		case SWEEP_MODE:
+			return ((strcmp(s, "interlaced") == 0) || (strcmp(s, "eightslot") == 0)) ? 0 : -1;
+		case SWEEP_COMPENSATION:
+			return ((strcmp(s, "mk2") == 0) || (strcmp(s, "none") == 0)) ? 0 : -1;
+		case SWEEP_CLOCK:
+			return SweepParseInt(s, 0, 65535, &v);
+		case SWEEP_GOLDCODE:
+			return SweepParseInt(s, 0, 63, &v);
+		case SWEEP_SLOTS:
+			return SweepParseSlots(s, &slots);
+		case SWEEP_POWER:
+			return SweepParseInt(s, DATATRAK_RSSI_MIN, 255, &v);
+		case SWEEP_PHASE:
+			return SweepParsePhase(s, offsets);
+		case SWEEP_SCRIPT:
+			return ((strcmp(s, "-") == 0) || (UartScriptLoad(s) == 0)) ? 0 : -1;
+		default:
+			return -1;
+	}
+}
+
+static int SweepLoadMatrix(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char buf[1024];
+	unsigned int lineNum = 0;
+
+	if (fp == NULL) {
+		fprintf(stderr, "SWEEP: can't open matrix %s\n", path);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		char *save, *key;
+
+		lineNum++;
+		buf[strcspn(buf, "\r\n")] = '\0';
+		key = strtok_r(buf, " \t", &save);
+		if ((key == NULL) || (key[0] == '#')) {
+			continue;
+		}
+
+		if (strcmp(key, "time") == 0) {
+			const char *v = strtok_r(NULL, " \t", &save);
+			long sec;
+			if ((v == NULL) || (SweepParseInt(v, 1, 1000000, &sec) != 0)) {
+				fprintf(stderr, "SWEEP: %s:%u: bad run time\n", path, lineNum);
+				goto fail;
+			}
+			Sweep.timeMs = (uint64_t)sec * 1000;
+			continue;
+		}
+
+		if (strcmp(key, "checkpoint") == 0) {
+			const char *v = strtok_r(NULL, " \t", &save);
+			const char *re = (save != NULL) ? save + strspn(save, " \t") : NULL;
+			long ms;
+			if ((v != NULL) && (strcmp(v, "match") == 0) && (re != NULL) && (*re != '\0')) {
+				int err = regcomp(&Sweep.checkpointMatch, re, REG_EXTENDED | REG_NOSUB);
+				if (err != 0) {
+					char msg[128];
+					regerror(err, &Sweep.checkpointMatch, msg, sizeof(msg));
+					fprintf(stderr, "SWEEP: %s:%u: bad pattern: %s\n", path, lineNum, msg);
+					goto fail;
+				}
+				Sweep.checkpointByMatch = true;
+			} else if ((v != NULL) && (SweepParseInt(v, 1, LONG_MAX, &ms) == 0)) {
+				Sweep.checkpointMs = ms;
+			} else {
+				fprintf(stderr, "SWEEP: %s:%u: expected 'checkpoint MS' or 'checkpoint match REGEX'\n", path, lineNum);
+				goto fail;
+			}
+			continue;
+		}
+
+		if (strcmp(key, "match") == 0) {
+			const char *name = strtok_r(NULL, " \t", &save);
+			const char *re = (save != NULL) ? save + strspn(save, " \t") : NULL;
+			if ((name == NULL) || (re == NULL) || (*re == '\0') || (Sweep.numMatches >= SWEEP_MAX_MATCHES)) {
+				fprintf(stderr, "SWEEP: %s:%u: expected 'match NAME REGEX' (at most %d)\n",
+						path, lineNum, SWEEP_MAX_MATCHES);
+				goto fail;
+			}
+			int err = regcomp(&Sweep.match[Sweep.numMatches], re, REG_EXTENDED | REG_NOSUB);
+			if (err != 0) {
+				char msg[128];
+				regerror(err, &Sweep.match[Sweep.numMatches], msg, sizeof(msg));
+				fprintf(stderr, "SWEEP: %s:%u: bad pattern: %s\n", path, lineNum, msg);
+				goto fail;
+			}
+			snprintf(Sweep.matchName[Sweep.numMatches], SWEEP_MAX_NAME, "%s", name);
+			Sweep.numMatches++;
+			continue;
+		}
+
+		int axis;
+		for (axis = 0; axis < SWEEP_NUM_AXES; axis++) {
+			if (strcmp(key, SWEEP_AXIS_NAMES[axis]) == 0) {
+				break;
+			}
+		}
+		if (axis == SWEEP_NUM_AXES) {
+			fprintf(stderr, "SWEEP: %s:%u: unknown setting '%s'\n", path, lineNum, key);
+			goto fail;
+		}
+
+		SWEEP_AXIS *a = &Sweep.axes[axis];
+		if (a->count > 0) {
+			fprintf(stderr, "SWEEP: %s:%u: '%s' given twice\n", path, lineNum, key);
+			goto fail;
+		}
+		for (const char *v; (v = strtok_r(NULL, " \t", &save)) != NULL; ) {
+			if ((a->count >= SWEEP_MAX_VALUES) || (strlen(v) >= SWEEP_MAX_VALUE_LEN) ||
+					(SweepCheckValue(axis, v) != 0)) {
+				fprintf(stderr, "SWEEP: %s:%u: bad or too many values for '%s' at '%s'\n", path, lineNum, key, v);
+				goto fail;
+			}
+			strcpy(a->values[a->count++], v);
+		}
+		if (a->count == 0) {
+			fprintf(stderr, "SWEEP: %s:%u: no values for '%s'\n", path, lineNum, key);
+			goto fail;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+
+fail:
+	fclose(fp);
+	return -1;
+}
+
+/// Value index of each axis for a run (the last axis varies fastest)
+static void SweepDecode(unsigned int run, unsigned int idx[SWEEP_NUM_AXES])
+{
+	for (int i = SWEEP_NUM_AXES - 1; i >= 0; i--) {
+		const unsigned int n = (Sweep.axes[i].count > 0) ? Sweep.axes[i].count : 1;
+		idx[i] = run % n;
+		run /= n;
+	}
+}
+
+// UART transmit tap: collect UART A lines, log them and look for matches
+static void SweepUartTx(const int channel, const uint8_t byte)
+{
+	if (channel != 0) {
+		return;
+	}
+	if (Sweep.log != NULL) {
+		fputc(byte, Sweep.log);
+	}
+
+	if ((byte == '\r') || (byte == '\n')) {
+		Sweep.line[Sweep.lineLen] = '\0';
+		if (Sweep.checkpointByMatch && (Sweep.resultFd < 0) && (Sweep.lineLen > 0) &&
+				(regexec(&Sweep.checkpointMatch, Sweep.line, 0, NULL, 0) == 0)) {
+			Sweep.checkpointHit = true;
+		}
+		for (unsigned int i = 0; (Sweep.lineLen > 0) && (i < Sweep.numMatches); i++) {
+			if (regexec(&Sweep.match[i], Sweep.line, 0, NULL, 0) == 0) {
+				if (Sweep.result.count[i]++ == 0) {
+					Sweep.result.firstMs[i] = Sweep.lastMs - Sweep.startMs;
+				}
+			}
+		}
+		Sweep.lineLen = 0;
+	} else if (Sweep.lineLen < SWEEP_MAX_LINE - 1) {
+		Sweep.line[Sweep.lineLen++] = byte;
+	}
+}
+
+/**
+ * Set up a sweep.
+ *
+ * matrixPath  - settings matrix (see above)
+ * logDir      - directory to keep each run's UART A output in (NULL for none)
+ */
+int SweepInit(const char *matrixPath, const char *logDir)
+{
+	Sweep.timeMs = (uint64_t)SWEEP_DEFAULT_TIME * 1000;
+	if (SweepLoadMatrix(matrixPath) != 0) {
+		return -1;
+	}
+	// Checking the script names loaded them: the parent doesn't want one
+	UartScriptLoad(NULL);
+
+	Sweep.numRuns = 1;
+	for (int i = 0; i < SWEEP_NUM_AXES; i++) {
+		if (Sweep.axes[i].count > 0) {
+			Sweep.numRuns *= Sweep.axes[i].count;
+		}
+		if (Sweep.numRuns > SWEEP_MAX_RUNS) {
+			fprintf(stderr, "SWEEP: more than %d combinations\n", SWEEP_MAX_RUNS);
+			return -1;
+		}
+	}
+	if (Sweep.numMatches == 0) {
+		fprintf(stderr, "SWEEP: warning: no 'match' lines, the table will only show that each run finished\n");
+	}
+
+	Sweep.logDir = logDir;
+	Sweep.enabled = true;
+	UartSetTxTap(SweepUartTx);
+
+	return 0;
+}
+
+static void SweepPrintTable(const SWEEP_RESULT *results, const bool *done)
+{
+	printf("%5s", "run");
+	for (int i = 0; i < SWEEP_NUM_AXES; i++) {
+		if (Sweep.axes[i].count > 0) {
+			printf("  %-12s", SWEEP_AXIS_NAMES[i]);
+		}
+	}
+	for (unsigned int i = 0; i < Sweep.numMatches; i++) {
+		printf("  %8s %10s", Sweep.matchName[i], "first_ms");
+	}
+	printf("  %8s\n", "wall_s");
+
+	for (unsigned int run = 0; run < Sweep.numRuns; run++) {
+		unsigned int idx[SWEEP_NUM_AXES];
+		SweepDecode(run, idx);
+
+		printf("%5u", run);
+		for (int i = 0; i < SWEEP_NUM_AXES; i++) {
+			if (Sweep.axes[i].count > 0) {
+				printf("  %-12s", Sweep.axes[i].values[idx[i]]);
+			}
+		}
+		if (!done[run]) {
+			printf("  (not run, or failed)\n");
+			continue;
+		}
+		const SWEEP_RESULT *r = &results[run];
+		for (unsigned int i = 0; i < Sweep.numMatches; i++) {
+			if (r->count[i] > 0) {
+				printf("  %8lu %10llu", r->count[i], (unsigned long long)r->firstMs[i]);
+			} else {
+				printf("  %8d %10s", 0, "-");
+			}
+		}
+		printf("  %8.2f\n", r->wallSec);
+	}
+}
+
+/**
+ * Run the sweep in child processes, up to jobs at once (0 = one per CPU).
+ *
+ * Returns the run number in each child, which should then apply its
+ * settings with SweepApply() and run the emulator. The parent waits for all
+ * the runs, prints the table and exits.
+ */
+unsigned int SweepFork(unsigned int jobs)
+{
+	if (jobs == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = (n > 0) ? n : 1;
+	}
+	if (jobs > Sweep.numRuns) {
+		jobs = Sweep.numRuns;
+	}
+
+	SWEEP_RESULT *results = calloc(Sweep.numRuns, sizeof(SWEEP_RESULT));
+	bool *done = calloc(Sweep.numRuns, sizeof(bool));
+	SWEEP_JOB *running = calloc(jobs, sizeof(SWEEP_JOB));
+	unsigned int next = 0, numRunning = 0, numDone = 0;
+	struct timespec start, now;
+
+	if ((results == NULL) || (done == NULL) || (running == NULL)) {
+		fprintf(stderr, "SWEEP: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "SWEEP: %u runs of %llu s, %u at a time\n",
+			Sweep.numRuns, (unsigned long long)(Sweep.timeMs / 1000), jobs);
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((next < Sweep.numRuns) || (numRunning > 0)) {
+		// Start runs until every job slot is busy (unless we're stopping)
+		while (!quitRequested && (numRunning < jobs) && (next < Sweep.numRuns)) {
+			int fds[2];
+			if (pipe(fds) != 0) {
+				perror("SWEEP: pipe");
+				exit(EXIT_FAILURE);
+			}
+
+			pid_t pid = fork();
+			if (pid < 0) {
+				perror("SWEEP: fork");
+				exit(EXIT_FAILURE);
+			} else if (pid == 0) {
+				close(fds[0]);
+				for (unsigned int i = 0; i < numRunning; i++) {
+					close(running[i].fd);
+				}
+				Sweep.resultFd = fds[1];
+				memset(&Sweep.result, 0, sizeof(Sweep.result));
+				Sweep.startMs = Sweep.lastMs;
+				clock_gettime(CLOCK_MONOTONIC, &Sweep.start);
+				const unsigned int run = next;
+				free(results);
+				free(done);
+				free(running);
+				return run;
+			}
+
+			close(fds[1]);
+			running[numRunning++] = (SWEEP_JOB){ .pid = pid, .fd = fds[0], .run = next++ };
+		}
+		if (numRunning == 0) {
+			break;
+		}
+
+		// Collect whichever run finishes next. Its result fits in the pipe
+		// buffer, so it's all there once the child has exited.
+		pid_t pid = waitpid(-1, NULL, 0);
+		if (pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("SWEEP: waitpid");
+			exit(EXIT_FAILURE);
+		}
+		for (unsigned int i = 0; i < numRunning; i++) {
+			if (running[i].pid != pid) {
+				continue;
+			}
+			const unsigned int run = running[i].run;
+			ssize_t n;
+			do {
+				n = read(running[i].fd, &results[run], sizeof(SWEEP_RESULT));
+			} while ((n < 0) && (errno == EINTR));
+			done[run] = (n == sizeof(SWEEP_RESULT));
+			close(running[i].fd);
+			running[i] = running[--numRunning];
+			numDone++;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			fprintf(stderr, "SWEEP: %u/%u done (%.0f s)%s\n", numDone, Sweep.numRuns,
+					(now.tv_sec - start.tv_sec) + ((now.tv_nsec - start.tv_nsec) / 1e9),
+					done[run] ? "" : " -- a run failed");
+			break;
+		}
+	}
+
+	SweepPrintTable(results, done);
+
+	unsigned int failed = 0;
+	for (unsigned int run = 0; run < Sweep.numRuns; run++) {
+		if (!done[run]) {
+			failed++;
+		}
+	}
+	exit((failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/// Apply a run's settings to the generator. Call in the child, before the LF source starts.
+void SweepApply(const unsigned int run, DATATRAK_LF_CTX *ctx)
+{
+	const SWEEP_AXIS *a = Sweep.axes;
+	unsigned int idx[SWEEP_NUM_AXES];
+	long v;
+
+	SweepDecode(run, idx);
+
+	if ((a[SWEEP_MODE].count > 0) || (a[SWEEP_COMPENSATION].count > 0)) {
+		DATATRAK_MODE mode = ctx->mode;
+		DATATRAK_COMPENSATION comp = ctx->compensation;
+
+		if (a[SWEEP_MODE].count > 0) {
+			mode = (strcmp(a[SWEEP_MODE].values[idx[SWEEP_MODE]], "eightslot") == 0) ?
+					DATATRAK_MODE_EIGHTSLOT : DATATRAK_MODE_INTERLACED;
+		}
+		if (a[SWEEP_COMPENSATION].count > 0) {
+			comp = (strcmp(a[SWEEP_COMPENSATION].values[idx[SWEEP_COMPENSATION]], "none") == 0) ?
+					DATATRAK_COMPENSATION_NONE : DATATRAK_COMPENSATION_MK2;
+		}
+		datatrak_gen_reconfigure(ctx, mode, comp);
+	}
+
+	if ((a[SWEEP_CLOCK].count > 0) && (SweepParseInt(a[SWEEP_CLOCK].values[idx[SWEEP_CLOCK]], 0, 65535, &v) == 0)) {
+		ctx->clock_n = v;
+	}
+	if ((a[SWEEP_GOLDCODE].count > 0) && (SweepParseInt(a[SWEEP_GOLDCODE].values[idx[SWEEP_GOLDCODE]], 0, 63, &v) == 0)) {
+		ctx->goldcode_n = v;
+	}
+
+	// Enabled slots, at the swept power or full power
+	uint32_t slots = 0;
+	if (a[SWEEP_SLOTS].count > 0) {
+		SweepParseSlots(a[SWEEP_SLOTS].values[idx[SWEEP_SLOTS]], &slots);
+	} else {
+		for (int i = 0; i < ctx->numNavslotsTotal; i++) {
+			if (ctx->slotPower[i] > DATATRAK_RSSI_MIN) {
+				slots |= 1UL << i;
+			}
+		}
+	}
+	long power = 255;
+	if (a[SWEEP_POWER].count > 0) {
+		SweepParseInt(a[SWEEP_POWER].values[idx[SWEEP_POWER]], DATATRAK_RSSI_MIN, 255, &power);
+	}
+	if ((a[SWEEP_SLOTS].count > 0) || (a[SWEEP_POWER].count > 0)) {
+		for (int i = 0; i < 24; i++) {
+			ctx->slotPower[i] = (slots & (1UL << i)) ? power : DATATRAK_RSSI_MIN;
+		}
+	}
+
+	if (a[SWEEP_PHASE].count > 0) {
+		SweepParsePhase(a[SWEEP_PHASE].values[idx[SWEEP_PHASE]], ctx->slotPhaseOffset);
+	}
+
+	if ((a[SWEEP_SCRIPT].count > 0) && (strcmp(a[SWEEP_SCRIPT].values[idx[SWEEP_SCRIPT]], "-") != 0)) {
+		UartScriptLoad(a[SWEEP_SCRIPT].values[idx[SWEEP_SCRIPT]]);
+		UartScriptStart(Sweep.startMs);
+	}
+
+	// Keep the UART output, if asked
+	if (Sweep.logDir != NULL) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/run-%05u.log", Sweep.logDir, run);
+		Sweep.log = fopen(path, "w");
+		if (Sweep.log == NULL) {
+			fprintf(stderr, "SWEEP: can't create %s\n", path);
+		}
+	}
+}
+
+/// Start the clock. Call at CPU reset.
+void SweepStart(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &Sweep.start);
+}
+
+/// Per-tick update. Returns true when the run is over.
+bool SweepTick(const uint64_t timeMs)
+{
+	if (!Sweep.enabled) {
+		return false;
+	}
+
+	Sweep.lastMs = timeMs;
+
+	// Still booting to the checkpoint
+	if (SweepHasCheckpoint() && (Sweep.resultFd < 0)) {
+		if (Sweep.checkpointByMatch && (timeMs >= (uint64_t)SWEEP_CHECKPOINT_TIMEOUT * 1000)) {
+			fprintf(stderr, "SWEEP: checkpoint pattern not seen in %d s\n", SWEEP_CHECKPOINT_TIMEOUT);
+			exit(EXIT_FAILURE);
+		}
+		return false;
+	}
+
+	return (timeMs >= Sweep.startMs + Sweep.timeMs);
+}
+
+/// Whether the runs start from a checkpoint rather than from reset
+bool SweepHasCheckpoint(void)
+{
+	return Sweep.enabled && ((Sweep.checkpointMs > 0) || Sweep.checkpointByMatch);
+}
+
+/// True (in the parent) once the machine has reached the checkpoint
+bool SweepCheckpointDue(const uint64_t timeMs)
+{
+	if (!SweepHasCheckpoint() || (Sweep.resultFd >= 0)) {
+		return false;
+	}
+	return Sweep.checkpointByMatch ? Sweep.checkpointHit : (timeMs >= Sweep.checkpointMs);
+}
+
+/// Hand the run's result to the parent
+void SweepFinish(void)
+{
+	struct timespec now;
+
+	if (Sweep.log != NULL) {
+		fclose(Sweep.log);
+		Sweep.log = NULL;
+	}
+
+	if (Sweep.resultFd >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		Sweep.result.wallSec = (now.tv_sec - Sweep.start.tv_sec) + ((now.tv_nsec - Sweep.start.tv_nsec) / 1e9);
+		if (write(Sweep.resultFd, &Sweep.result, sizeof(Sweep.result)) != sizeof(Sweep.result)) {
+			perror("SWEEP: write");
+		}
+		close(Sweep.resultFd);
+		Sweep.resultFd = -1;
+	}
+}
@@ -0,0 +1,34 @@
+/****************************************************************************
+ * Generator parameter sweep
+ *
+ * Runs the firmware headless once for every combination of a matrix of
+ * generator settings, several at a time, and tabulates what it printed.
+ ****************************************************************************/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "datatrak_gen.h"
+
+// Default run length (emulated seconds)
+#define SWEEP_DEFAULT_TIME 300
+// Longest wait for a 'checkpoint match' (emulated seconds)
+#define SWEEP_CHECKPOINT_TIMEOUT 3600
+
+int SweepInit(const char *matrixPath, const char *logDir);
+bool SweepHasCheckpoint(void);
+bool SweepCheckpointDue(const uint64_t timeMs);
+unsigned int SweepFork(unsigned int jobs);
+void SweepApply(const unsigned int run, DATATRAK_LF_CTX *ctx);
+void SweepStart(void);
+bool SweepTick(const uint64_t timeMs);
+void SweepFinish(void);
+
+// Setting parsers, also used for --bench
+int SweepParseSlots(const char *s, uint32_t *slots);
+int SweepParsePhase(const char *s, int16_t offsets[24]);
+
+#endif // SWEEP_H
@@ -1,11 +1,31 @@
 /***
  * UART Emulation
  *
- * SCC68692 dual UART emulation. Each channel listens on a TCP port;
- * connect with 'nc localhost 10000' or 'telnet localhost 10000'.
+ * SCC68692 dual UART emulation. By default each channel listens on a TCP
+ * port; connect with 'nc localhost 10000' or 'telnet localhost 10000'.
  * Telnet IAC negotiation bytes are stripped automatically.
+ *
+ * Each channel can use a different transport instead (UartSetTransport):
+ *
+ *     tcp:PORT     TCP on localhost (the default, ports 10000 and 10001)
+ *     unix:PATH    a UNIX domain socket, handled like TCP
+ *     pty[:LINK]   a pseudo-terminal for serial host software, optionally
+ *                  symlinked from LINK; raw, with no telnet handling. Output
+ *                  is lost while nothing has the terminal open.
+ *     shm:NAME     a POSIX shared memory ring pair (UART_SHM), raw, for test
+ *                  harnesses; output is lost (and counted) if the ring fills
+ *
+ * The first client on a port is the interactive one: it sees the output and
+ * its input goes to the firmware. Anyone connecting while it is there joins
+ * as a read-only observer. Transmitted bytes go into a ring for each
+ * channel, and each observer has its own cursor into it, which is sent on
+ * once per tick with non-blocking writes. An observer that falls a whole
+ * ring behind is dropped, so a stalled logger can't hold up the CPU.
  */
 
+// For posix_openpt() and friends
+#define _GNU_SOURCE
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -17,8 +37,12 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
 
 #include "m68k.h"
 
@@ -42,10 +66,60 @@
 // Log state changes of the UART output port
 // #define LOG_UART_OUTPORT
 
+// Pending connections allowed on each port
+#define UART_LISTEN_BACKLOG 8
+
+// Read-only observers per channel
+#define UART_MAX_OBSERVERS 8
+
+// Transmitted bytes kept for observers, per channel (power of two)
+#define UART_RING_SIZE 65536
+
+// Crystal on X1/X2 (Hz)
+#define UART_X1_CLOCK 3686400
+
+// Counter/timer clock from IP2 or a transmitter clock (Hz). Neither is
+// modelled, so they're taken as X1/16. The firmware doesn't use them.
+#define UART_CT_EXT_CLOCK (UART_X1_CLOCK / 16)
+
 
 
 uart_s Uart;
 
+// Transmit tap (UartSetTxTap)
+static void (*UartTxTap)(const int channel, const uint8_t byte) = NULL;
+
+// Output port tap (UartSetOutPortTap)
+static void (*UartOutPortTap)(const uint8_t outPort) = NULL;
+
+// Output fan-out to the read-only observers of one channel
+typedef struct {
+	uint8_t ring[UART_RING_SIZE];			// transmitted bytes
+	uint64_t head;							// bytes ever transmitted
+	int sockets[UART_MAX_OBSERVERS];		// observer sockets (-1 when free)
+	uint64_t cursors[UART_MAX_OBSERVERS];	// next byte to send to each
+} UART_FANOUT;
+
+static UART_FANOUT UartFanout[2];
+
+typedef enum {
+	UART_TRANSPORT_TCP,
+	UART_TRANSPORT_UNIX,
+	UART_TRANSPORT_PTY,
+	UART_TRANSPORT_SHM
+} UART_TRANSPORT;
+
+// Transport for each channel
+static struct {
+	UART_TRANSPORT type;
+	int port;					// TCP port
+	char path[108];				// UNIX socket path, PTY link or SHM name
+	UART_SHM *shm;				// mapped SHM ring pair
+} UartChannel[2] = {
+	{ .type = UART_TRANSPORT_TCP, .port = UART_PORT_A },
+	{ .type = UART_TRANSPORT_TCP, .port = UART_PORT_B }
+};
+
 
 static void die(char *s)
 {
@@ -84,14 +158,337 @@ static int make_listen_socket(int port)
 	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
 		die("bind");
 
-	if (listen(fd, 1) < 0)
+	if (listen(fd, UART_LISTEN_BACKLOG) < 0)
+		die("listen");
+
+	return fd;
+}
+
+// Create a non-blocking UNIX domain listening socket at the given path.
+static int make_unix_listen_socket(const char *path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) die("socket");
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		die("fcntl O_NONBLOCK");
+
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die("bind");
+
+	if (listen(fd, UART_LISTEN_BACKLOG) < 0)
 		die("listen");
 
 	return fd;
 }
 
+// Open a raw pseudo-terminal and return its (non-blocking) master side.
+static int make_pty(const char *link, const char *name)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+		die("posix_openpt");
+
+	const char *slave = ptsname(fd);
+	if (slave == NULL)
+		die("ptsname");
+
+	// Raw mode, so bytes pass through the line discipline untouched
+	struct termios tio;
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		die("fcntl O_NONBLOCK");
+
+	if (link[0] != '\0') {
+		unlink(link);
+		if (symlink(slave, link) < 0)
+			die("symlink");
+		fprintf(stderr, "%s on %s (%s)\n", name, slave, link);
+	} else {
+		fprintf(stderr, "%s on %s\n", name, slave);
+	}
+
+	return fd;
+}
+
+// Create and map a shared memory ring pair.
+static UART_SHM *make_shm(const char *shmName, const char *name)
+{
+	int fd = shm_open(shmName, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) die("shm_open");
+
+	if (ftruncate(fd, sizeof(UART_SHM)) < 0)
+		die("ftruncate");
+
+	UART_SHM *shm = mmap(NULL, sizeof(UART_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		die("mmap");
+
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	shm->size = UART_SHM_SIZE;
+	SpscInit(&shm->toEmu, UART_SHM_SIZE);
+	SpscInit(&shm->fromEmu, UART_SHM_SIZE);
+	shm->txDropped = 0;
+	__atomic_store_n(&shm->magic, UART_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	fprintf(stderr, "%s on shared memory %s\n", name, shmName);
+	return shm;
+}
+
+
+/**
+ * Choose the transport for channel 0 (A) or 1 (B), from a spec such as
+ * "tcp:10000", "unix:/tmp/uart-a", "pty", "pty:/tmp/ttyA" or "shm:/uart-a".
+ * Call before UartInit().
+ */
+int UartSetTransport(const int channel, const char *spec)
+{
+	const char *arg = strchr(spec, ':');
+	const size_t len = (arg != NULL) ? (size_t)(arg - spec) : strlen(spec);
+	arg = (arg != NULL) ? arg + 1 : "";
+
+	if ((channel < 0) || (channel > 1)) {
+		return -1;
+	}
+
+	UartChannel[channel].path[0] = '\0';
+	if (strlen(arg) >= sizeof(UartChannel[channel].path)) {
+		fprintf(stderr, "UART: path too long in '%s'\n", spec);
+		return -1;
+	}
+
+	if ((len == 3) && (strncmp(spec, "tcp", 3) == 0)) {
+		char *end;
+		long port = strtol(arg, &end, 0);
+		if ((end == arg) || (*end != '\0') || (port < 1) || (port > 65535)) {
+			fprintf(stderr, "UART: bad TCP port in '%s'\n", spec);
+			return -1;
+		}
+		UartChannel[channel].type = UART_TRANSPORT_TCP;
+		UartChannel[channel].port = port;
+	} else if ((len == 4) && (strncmp(spec, "unix", 4) == 0) && (arg[0] != '\0')) {
+		UartChannel[channel].type = UART_TRANSPORT_UNIX;
+	} else if ((len == 3) && (strncmp(spec, "pty", 3) == 0)) {
+		UartChannel[channel].type = UART_TRANSPORT_PTY;
+	} else if ((len == 3) && (strncmp(spec, "shm", 3) == 0) && (arg[0] == '/') && (strchr(arg + 1, '/') == NULL)) {
+		UartChannel[channel].type = UART_TRANSPORT_SHM;
+	} else {
+		fprintf(stderr, "UART: bad transport '%s' (tcp:PORT, unix:PATH, pty[:LINK] or shm:/NAME)\n", spec);
+		return -1;
+	}
+	strcpy(UartChannel[channel].path, arg);
+
+	return 0;
+}
+
+// Open a channel's transport
+static void UartOpenChannel(const int ch, int *listenSock, int *clientSock)
+{
+	const char *name = ch ? "UART_B" : "UART_A";
+
+	switch (UartChannel[ch].type) {
+		case UART_TRANSPORT_TCP:
+			*listenSock = make_listen_socket(UartChannel[ch].port);
+			fprintf(stderr, "%s listening on port %d\n", name, UartChannel[ch].port);
+			break;
+
+		case UART_TRANSPORT_UNIX:
+			*listenSock = make_unix_listen_socket(UartChannel[ch].path);
+			fprintf(stderr, "%s listening on %s\n", name, UartChannel[ch].path);
+			break;
+
+		case UART_TRANSPORT_PTY:
+			// Always "connected": the host software opens the other side
+			*clientSock = make_pty(UartChannel[ch].path, name);
+			break;
+
+		case UART_TRANSPORT_SHM:
+			UartChannel[ch].shm = make_shm(UartChannel[ch].path, name);
+			break;
+	}
+}
+
+// Close a channel's transport
+static void UartCloseChannel(const int ch)
+{
+	switch (UartChannel[ch].type) {
+		case UART_TRANSPORT_UNIX:
+			unlink(UartChannel[ch].path);
+			break;
+
+		case UART_TRANSPORT_PTY:
+			if (UartChannel[ch].path[0] != '\0')
+				unlink(UartChannel[ch].path);
+			break;
+
+		case UART_TRANSPORT_SHM:
+			if (UartChannel[ch].shm != NULL) {
+				munmap(UartChannel[ch].shm, sizeof(UART_SHM));
+				UartChannel[ch].shm = NULL;
+				shm_unlink(UartChannel[ch].path);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Whether a channel has a client to talk to
+static bool UartClientConnected(const int ch, const int sock)
+{
+	return (sock >= 0) || (UartChannel[ch].shm != NULL);
+}
+
+// Read one byte from a channel's client. Returns like recv(): 1 for a byte,
+// 0 if the client has gone, or -1 with errno EAGAIN if nothing is waiting.
+static int UartClientRead(const int ch, const int sock, uint8_t *byte)
+{
+	switch (UartChannel[ch].type) {
+		case UART_TRANSPORT_PTY: {
+			// EIO just means nothing has the terminal open at the moment
+			ssize_t n = read(sock, byte, 1);
+			if (n == 0 || (n < 0 && errno == EIO)) {
+				errno = EAGAIN;
+				return -1;
+			}
+			return n;
+		}
+
+		case UART_TRANSPORT_SHM: {
+			UART_SHM *shm = UartChannel[ch].shm;
+			ptrdiff_t slot = SpscReadSlot(&shm->toEmu);
+			if (slot < 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			*byte = shm->toEmuData[slot];
+			SpscRelease(&shm->toEmu);
+			return 1;
+		}
+
+		default:
+			return recv(sock, byte, 1, MSG_DONTWAIT);
+	}
+}
+
+// Send one transmitted byte to a channel's client
+static void UartClientWrite(const int ch, int *sock, const uint8_t byte)
+{
+	switch (UartChannel[ch].type) {
+		case UART_TRANSPORT_PTY: {
+			// Lost if nothing is reading, as on a real serial line
+			ssize_t n = write(*sock, &byte, 1);
+			(void)n;
+			break;
+		}
+
+		case UART_TRANSPORT_SHM: {
+			UART_SHM *shm = UartChannel[ch].shm;
+			ptrdiff_t slot = SpscWriteSlot(&shm->fromEmu);
+			if (slot < 0) {
+				shm->txDropped++;
+			} else {
+				shm->fromEmuData[slot] = byte;
+				SpscPublish(&shm->fromEmu);
+			}
+			break;
+		}
+
+		default:
+			if (*sock >= 0) {
+				if (send(*sock, &byte, 1, MSG_NOSIGNAL) != 1)
+					UartClientClose(sock);
+			}
+			break;
+	}
+}
+
+
+/*
+ * Counter/timer. Its count is worked out from the machine cycle count when
+ * CUR/CLR are read (devtimer.c), and only the next terminal count is
+ * scheduled. In counter mode it counts down from the preset, sets
+ * CounterReady at zero and carries on down from 0xFFFF. In timer mode it
+ * reloads the preset at zero, and CounterReady is set once per cycle of the
+ * square wave, every second reload. A preset of 0 counts as 0x10000.
+ *
+ * The firmware sets ACR to 0xB4 (counter mode, X1/16 = 230400 Hz) and the
+ * preset to 0x0900, so the counter reaches zero 10 ms after each START
+ * COUNTER. In timer mode the same preset would give a 20 ms square wave.
+ */
+
+// Counter/timer count rate, from the clock source in ACR[6:4]
+static uint32_t UartCounterHz(void)
+{
+	switch ((Uart.ACR >> 4) & 0x07) {
+		case 3:		// counter, X1/16
+		case 7:		// timer, X1/16
+			return UART_X1_CLOCK / 16;
+		case 6:		// timer, X1
+			return UART_X1_CLOCK;
+		case 5:		// timer, IP2/16
+			return UART_CT_EXT_CLOCK / 16;
+		default:	// IP2, TxCA or TxCB
+			return UART_CT_EXT_CLOCK;
+	}
+}
+
+// Current counter/timer value
+static uint16_t UartCounterValue(void)
+{
+	const uint64_t counts = DevTimerCounts(&Uart.Counter, MachineCycles());
+
+	if (Uart.CounterTimerMode) {
+		const uint32_t preset = (Uart.CounterLoad != 0) ? Uart.CounterLoad : 0x10000;
+		return preset - (counts % preset);
+	}
+	return Uart.CounterLoad - (uint16_t)counts;
+}
+
+// START COUNTER: load the preset and start counting, clearing CounterReady
+static void UartCounterStart(void)
+{
+	const uint32_t preset = (Uart.CTPreset != 0) ? Uart.CTPreset : 0x10000;
+
+	Uart.CounterReady     = false;
+	Uart.CounterTimerMode = (Uart.ACR & 0x40) != 0;
+	Uart.CounterLoad      = Uart.CTPreset;
+
+	if (Uart.CounterTimerMode) {
+		DevTimerStart(&Uart.Counter, MachineCycles(), UartCounterHz(), 2 * preset, 2 * preset);
+	} else {
+		DevTimerStart(&Uart.Counter, MachineCycles(), UartCounterHz(), preset, 0x10000);
+	}
+}
+
+// Counter/timer terminal count (device timer expiry)
+static void UartCounterExpired(void)
+{
+	Uart.CounterReady = true;
+	if (Uart.IMR & 0x08) {   // CounterReady interrupt enabled
+		InterruptFlags.uart = true;
+		m68k_update_ipl();
+	}
+}
 
-int UartInit(void)
+
+/**
+ * Reset the UART and, if listen is set, open the transports for the two
+ * channels. Without them the UART only sees input from UartInjectRx().
+ */
+int UartInit(const bool listen)
 {
 	memset(&Uart, '\0', sizeof(Uart));
 
@@ -110,18 +507,29 @@ int UartInit(void)
 	// Input port: IP4 = Ignition Sense (1 = ignition on)
 	Uart.InPort = (1 << 4);
 
-	// Counter/Timer: starts not-ready; only begins ticking once the firmware
-	// issues its first START COUNTER read (UartRegRead case 14).
-	Uart.CounterTick    = 0;
-	Uart.CounterReady   = false;
-	Uart.CounterStarted = false;
-
-	// Create listening sockets
-	Uart.ListenA = make_listen_socket(UART_PORT_A);
-	fprintf(stderr, "UART_A listening on port %d\n", UART_PORT_A);
+	// Counter/Timer: starts stopped and not-ready; only begins counting once
+	// the firmware issues its first START COUNTER read (UartRegRead case 14).
+	Uart.ACR              = 0;
+	Uart.CTPreset         = 0;
+	Uart.CounterLoad      = 0;
+	Uart.CounterTimerMode = false;
+	Uart.CounterReady     = false;
+	DevTimerRegister(&Uart.Counter, UartCounterExpired);
+
+	// No observers either
+	for (int ch = 0; ch < 2; ch++) {
+		UartFanout[ch].head = 0;
+		for (int i = 0; i < UART_MAX_OBSERVERS; i++) {
+			UartFanout[ch].sockets[i] = -1;
+		}
+	}
 
-	Uart.ListenB = make_listen_socket(UART_PORT_B);
-	fprintf(stderr, "UART_B listening on port %d\n", UART_PORT_B);
+	// Open the transports
+	Uart.ListenA = Uart.ListenB = -1;
+	if (listen) {
+		UartOpenChannel(0, &Uart.ListenA, &Uart.SocketA);
+		UartOpenChannel(1, &Uart.ListenB, &Uart.SocketB);
+	}
 
 	return 0;
 }
@@ -131,8 +539,15 @@ void UartDone(void)
 {
 	UartClientClose(&Uart.SocketA);
 	UartClientClose(&Uart.SocketB);
+	for (int ch = 0; ch < 2; ch++) {
+		for (int i = 0; i < UART_MAX_OBSERVERS; i++) {
+			UartClientClose(&UartFanout[ch].sockets[i]);
+		}
+	}
 	if (Uart.ListenA >= 0) close(Uart.ListenA);
 	if (Uart.ListenB >= 0) close(Uart.ListenB);
+	UartCloseChannel(0);
+	UartCloseChannel(1);
 }
 
 
@@ -217,16 +632,46 @@ static bool UartFilterByte(int sockfd, uint8_t byte, IacState *state,
 }
 
 
+// Pass one received byte on to the firmware, through the telnet filter if
+// the transport is a socket. Returns true with *out if there is one.
+static bool UartClientFilter(const int ch, int sockfd, uint8_t byte, IacState *state,
+                              uint8_t *pending_cmd, uint8_t *out)
+{
+	if ((UartChannel[ch].type == UART_TRANSPORT_PTY) || (UartChannel[ch].type == UART_TRANSPORT_SHM)) {
+		*out = byte;
+		return true;
+	}
+	return UartFilterByte(sockfd, byte, state, pending_cmd, out);
+}
+
+
 // Try to accept a new client on the given listening socket.
-// Sets *client_sock, *iac_state on success.
+// Sets *client_sock, *iac_state on success. If there's already a client the
+// new one becomes an observer of the channel instead.
 static void try_accept(int listen_sock, int *client_sock,
-                        IacState *iac_state, const char *name)
+                        IacState *iac_state, UART_FANOUT *fan, const char *name)
 {
-	if (*client_sock >= 0) return;  // already connected
+	if (listen_sock < 0) return;    // not listening
 
 	int fd = accept(listen_sock, NULL, NULL);
 	if (fd < 0) return;  // EAGAIN/EWOULDBLOCK — no pending connection
 
+	if (*client_sock >= 0) {
+		// Observers get non-blocking sends: they must never stall the CPU
+		for (int i = 0; i < UART_MAX_OBSERVERS; i++) {
+			if (fan->sockets[i] < 0) {
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				fan->sockets[i] = fd;
+				fan->cursors[i] = fan->head;
+				fprintf(stderr, "%s: observer %d connected (read-only)\n", name, i);
+				return;
+			}
+		}
+		fprintf(stderr, "%s: too many observers, connection refused\n", name);
+		close(fd);
+		return;
+	}
+
 	// Do NOT set O_NONBLOCK on the accepted socket — send() must remain
 	// blocking so TX never sees EAGAIN and inadvertently closes the connection
 	// when the firmware bursts output and fills the TCP send buffer.
@@ -238,17 +683,63 @@ static void try_accept(int listen_sock, int *client_sock,
 }
 
 
+// Send each observer whatever it hasn't had yet, and drop the ones that
+// have disconnected or fallen too far behind. Their input is thrown away.
+static void UartFanoutFlush(UART_FANOUT *fan, const char *name)
+{
+	for (int i = 0; i < UART_MAX_OBSERVERS; i++) {
+		if (fan->sockets[i] < 0) {
+			continue;
+		}
+
+		uint8_t junk[256];
+		ssize_t n = recv(fan->sockets[i], junk, sizeof(junk), MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			UartClientClose(&fan->sockets[i]);
+			fprintf(stderr, "%s: observer %d disconnected\n", name, i);
+			continue;
+		}
+
+		if (fan->head - fan->cursors[i] > UART_RING_SIZE) {
+			UartClientClose(&fan->sockets[i]);
+			fprintf(stderr, "%s: observer %d dropped (too slow)\n", name, i);
+			continue;
+		}
+
+		// At most two sends: up to the end of the ring, then from the start
+		while (fan->cursors[i] != fan->head) {
+			const size_t pos = fan->cursors[i] & (UART_RING_SIZE - 1);
+			size_t len = fan->head - fan->cursors[i];
+			if (len > UART_RING_SIZE - pos) {
+				len = UART_RING_SIZE - pos;
+			}
+			n = send(fan->sockets[i], &fan->ring[pos], len, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n > 0) {
+				fan->cursors[i] += n;
+			} else {
+				if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+					UartClientClose(&fan->sockets[i]);
+					fprintf(stderr, "%s: observer %d disconnected\n", name, i);
+				}
+				break;
+			}
+		}
+	}
+}
+
+
 void UartPollRx(void)
 {
 	// --- Channel A ---
-	try_accept(Uart.ListenA, &Uart.SocketA, &Uart.IacStateA, "UART_A");
+	try_accept(Uart.ListenA, &Uart.SocketA, &Uart.IacStateA, &UartFanout[0], "UART_A");
+	UartFanoutFlush(&UartFanout[0], "UART_A");
 
-	if (Uart.SocketA >= 0 && Uart.RxEnA && !Uart.RxReadyA) {
+	if (UartClientConnected(0, Uart.SocketA) && Uart.RxEnA && !Uart.RxReadyA) {
 		uint8_t raw;
-		int n = recv(Uart.SocketA, &raw, 1, MSG_DONTWAIT);
+		int n = UartClientRead(0, Uart.SocketA, &raw);
 		if (n == 1) {
 			uint8_t filtered;
-			if (UartFilterByte(Uart.SocketA, raw, &Uart.IacStateA,
+			if (UartClientFilter(0, Uart.SocketA, raw, &Uart.IacStateA,
 			                   &Uart.IacPendingCmdA, &filtered)) {
 				Uart.RxBufA   = filtered;
 				Uart.RxReadyA = true;
@@ -267,14 +758,15 @@ void UartPollRx(void)
 	}
 
 	// --- Channel B ---
-	try_accept(Uart.ListenB, &Uart.SocketB, &Uart.IacStateB, "UART_B");
+	try_accept(Uart.ListenB, &Uart.SocketB, &Uart.IacStateB, &UartFanout[1], "UART_B");
+	UartFanoutFlush(&UartFanout[1], "UART_B");
 
-	if (Uart.SocketB >= 0 && Uart.RxEnB && !Uart.RxReadyB) {
+	if (UartClientConnected(1, Uart.SocketB) && Uart.RxEnB && !Uart.RxReadyB) {
 		uint8_t raw;
-		int n = recv(Uart.SocketB, &raw, 1, MSG_DONTWAIT);
+		int n = UartClientRead(1, Uart.SocketB, &raw);
 		if (n == 1) {
 			uint8_t filtered;
-			if (UartFilterByte(Uart.SocketB, raw, &Uart.IacStateB,
+			if (UartClientFilter(1, Uart.SocketB, raw, &Uart.IacStateB,
 			                   &Uart.IacPendingCmdB, &filtered)) {
 				Uart.RxBufB   = filtered;
 				Uart.RxReadyB = true;
@@ -286,19 +778,43 @@ void UartPollRx(void)
 			fprintf(stderr, "UART_B: client disconnected\n");
 		}
 	}
+}
 
-	// --- Counter/Timer ---
-	// Fire CounterReady (ISR bit 3) every ~10ms (~10 UartPollRx calls).
-	// Only counts after the firmware has issued its first START COUNTER read,
-	// so we never fire a spurious interrupt before the firmware sets up the timer.
-	if (Uart.CounterStarted && !Uart.CounterReady) {
-		Uart.CounterTick++;
-		if (Uart.CounterTick >= 10) {
-			Uart.CounterTick  = 0;
-			Uart.CounterReady = true;
-			if (Uart.IMR & 0x08)   // CounterReady interrupt enabled
-				InterruptFlags.uart = true;
-		}
+
+/**
+ * Call fn with every byte the firmware transmits, on channel 0 (A) or 1 (B),
+ * whether or not a client is connected. NULL to stop.
+ */
+void UartSetTxTap(void (*fn)(const int channel, const uint8_t byte))
+{
+	UartTxTap = fn;
+}
+
+/**
+ * Call fn with the new output port value whenever the firmware sets or
+ * resets output port bits. NULL to stop.
+ */
+void UartSetOutPortTap(void (*fn)(const uint8_t outPort))
+{
+	UartOutPortTap = fn;
+}
+
+/**
+ * Deliver a received byte to channel 0 (A) or 1 (B) as if it had come
+ * from the client, overwriting any byte not yet read.
+ */
+void UartInjectRx(const int channel, const uint8_t byte)
+{
+	if (channel == 0) {
+		Uart.RxBufA   = byte;
+		Uart.RxReadyA = true;
+		if (Uart.IMR & 0x02)   // RxRdy/FFullA
+			InterruptFlags.uart = true;
+	} else {
+		Uart.RxBufB   = byte;
+		Uart.RxReadyB = true;
+		if (Uart.IMR & 0x20)   // RxRdy/FFullB
+			InterruptFlags.uart = true;
 	}
 }
 
@@ -450,10 +966,11 @@ void UartRegWrite(uint32_t address, uint8_t value)
 #ifdef UART_DEBUG_MSGS
 			printf("UARTA --> %c  [%02x]\n", value, value);
 #endif
-			if (Uart.SocketA >= 0) {
-				if (send(Uart.SocketA, &value, 1, MSG_NOSIGNAL) != 1)
-					UartClientClose(&Uart.SocketA);
+			if (UartTxTap != NULL) {
+				UartTxTap(0, value);
 			}
+			UartFanout[0].ring[UartFanout[0].head++ & (UART_RING_SIZE - 1)] = value;
+			UartClientWrite(0, &Uart.SocketA, value);
 
 			// If TxRdyA interrupt is enabled, pend a TX IRQ and
 			// immediately update the CPU IPL so it fires promptly.
@@ -558,10 +1075,11 @@ void UartRegWrite(uint32_t address, uint8_t value)
 #ifdef UART_DEBUG_MSGS
 			printf("UARTB --> %c  [%02x]\n", value, value);
 #endif
-			if (Uart.SocketB >= 0) {
-				if (send(Uart.SocketB, &value, 1, MSG_NOSIGNAL) != 1)
-					UartClientClose(&Uart.SocketB);
+			if (UartTxTap != NULL) {
+				UartTxTap(1, value);
 			}
+			UartFanout[1].ring[UartFanout[1].head++ & (UART_RING_SIZE - 1)] = value;
+			UartClientWrite(1, &Uart.SocketB, value);
 
 			// If TxRdyB interrupt is enabled, pend a TX IRQ and
 			// immediately update the CPU IPL so it fires promptly.
@@ -572,6 +1090,20 @@ void UartRegWrite(uint32_t address, uint8_t value)
 			break;
 
 
+		case 4:		// Auxiliary control register
+			// The counter/timer mode and clock take effect at START COUNTER
+			Uart.ACR = value;
+			break;
+
+		case 6:		// Counter/timer upper preset
+			Uart.CTPreset = (Uart.CTPreset & 0x00FF) | (value << 8);
+			break;
+
+		case 7:		// Counter/timer lower preset
+			Uart.CTPreset = (Uart.CTPreset & 0xFF00) | value;
+			break;
+
+
 		case 12:	// Interrupt vector register
 			Uart.IVR = value;
 #ifdef UART_DEBUG_MSGS
@@ -585,6 +1117,9 @@ void UartRegWrite(uint32_t address, uint8_t value)
 #ifdef LOG_UART_OUTPORT
 			fprintf(stderr, "UART OutPort state change --> now 0x%02X\n", Uart.OutPort);
 #endif
+			if (UartOutPortTap != NULL) {
+				UartOutPortTap(Uart.OutPort);
+			}
 			break;
 
 		case 15:	// Reset Output Port Bits command
@@ -592,6 +1127,9 @@ void UartRegWrite(uint32_t address, uint8_t value)
 #ifdef LOG_UART_OUTPORT
 			fprintf(stderr, "UART OutPort state change --> now 0x%02X\n", Uart.OutPort);
 #endif
+			if (UartOutPortTap != NULL) {
+				UartOutPortTap(Uart.OutPort);
+			}
 			break;
 	}
 }
@@ -658,10 +1196,16 @@ uint8_t UartRegRead(uint32_t address)
 			val = Uart.InPort;
 			break;
 
+		case 6:		// CUR — counter/timer current value, upper
+			val = UartCounterValue() >> 8;
+			break;
+
+		case 7:		// CLR — counter/timer current value, lower
+			val = UartCounterValue() & 0xFF;
+			break;
+
 		case 14:	// START COUNTER — arms/re-arms the counter/timer, clears CounterReady
-			Uart.CounterStarted = true;
-			Uart.CounterReady   = false;
-			Uart.CounterTick    = 0;
+			UartCounterStart();
 			val = 0x00;
 #ifdef UART_DEBUG_KEY
 			fprintf(stderr, "[UART START COUNTER] CounterReady cleared, re-armed  pc=%08X\n",
@@ -669,6 +1213,15 @@ uint8_t UartRegRead(uint32_t address)
 #endif
 			break;
 
+		case 15:	// STOP COUNTER — clears CounterReady; stops the counter (not the timer)
+			Uart.CounterReady = false;
+			if (!Uart.CounterTimerMode && (Uart.Counter.hz != 0)) {
+				Uart.CounterLoad = UartCounterValue();
+				DevTimerStop(&Uart.Counter);
+			}
+			val = 0x00;
+			break;
+
 	default:
 			val = UNIMPLEMENTED_VALUE & 0xFF;
 			break;
@@ -1,6 +1,9 @@
 #ifndef UART_H_INCLUDED
 #define UART_H_INCLUDED
 
+#include "devtimer.h"
+#include "spsc.h"
+
 // Telnet IAC (Interpret As Command) byte-stripping state machine
 typedef enum {
 	IAC_NORMAL,    // normal data
@@ -25,16 +28,40 @@ typedef struct {
 	bool    RxReadyA, RxReadyB;  // data-available flags
 	IacState IacStateA, IacStateB;
 	uint8_t  IacPendingCmdA, IacPendingCmdB;  // buffered IAC command byte
-	int      CounterTick;        // counts UartPollRx() calls since last START COUNTER
+	uint8_t  ACR;                // Auxiliary control register; bits 6-4 are counter/timer mode and clock
+	uint16_t CTPreset;           // CTUR:CTLR
+	uint16_t CounterLoad;        // count at START COUNTER, or held since STOP COUNTER
+	DEVTIMER Counter;            // counter/timer, running since START COUNTER
+	bool     CounterTimerMode;   // timer (square wave) mode, taken from ACR at START COUNTER
 	bool     CounterReady;       // ISR bit 3: counter/timer reached zero
-	bool     CounterStarted;     // true once firmware has issued first START COUNTER read
 } uart_s;
 
 extern uart_s Uart;
 
-int UartInit(void);
+// Shared-memory transport (shm:NAME): a byte ring each way, for test
+// harnesses on the same host. The emulator creates and initialises it, and
+// sets magic last; the harness maps the same POSIX shared memory object,
+// waits for the magic, then produces into toEmu and consumes fromEmu.
+#define UART_SHM_MAGIC 0x55415254	// 'UART'
+#define UART_SHM_SIZE 65536			// bytes each way (power of two)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;					// UART_SHM_SIZE
+	SPSC_RING toEmu;				// harness -> firmware
+	SPSC_RING fromEmu;				// firmware -> harness
+	uint64_t txDropped;				// firmware bytes lost to a full fromEmu
+	uint8_t toEmuData[UART_SHM_SIZE];
+	uint8_t fromEmuData[UART_SHM_SIZE];
+} UART_SHM;
+
+int UartSetTransport(const int channel, const char *spec);
+int UartInit(const bool listen);
 void UartDone(void);
 void UartPollRx(void);
+void UartInjectRx(const int channel, const uint8_t byte);
+void UartSetTxTap(void (*fn)(const int channel, const uint8_t byte));
+void UartSetOutPortTap(void (*fn)(const uint8_t outPort));
 const char *GetUartRegFromAddr(const uint32_t addr, const bool reading);
 void UartRegWrite(uint32_t address, uint8_t value);
 uint8_t UartRegRead(uint32_t address);
@@ -0,0 +1,149 @@
+/***
+ * Scripted UART input
+ *
+ * A script has one command per line, either
+ *
+ *     MS TEXT           send TEXT at MS milliseconds after the start
+ *     every MS TEXT     send TEXT every MS milliseconds
+ *
+ * with a carriage return added. Blank lines and lines starting '#' are
+ * ignored. Bytes are fed to the firmware one at a time, as it reads them.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uart.h"
+
+#include "uartscript.h"
+
+
+// Script limits
+#define UARTSCRIPT_MAX_COMMANDS 64
+#define UARTSCRIPT_MAX_TEXT 80
+// Input queued for the firmware
+#define UARTSCRIPT_INPUT_SIZE 1024
+
+typedef struct {
+	uint64_t at;				// next send time (ms after the start)
+	uint64_t every;				// repeat period (ms), 0 = once
+	bool done;
+	char text[UARTSCRIPT_MAX_TEXT];
+} UARTSCRIPT_COMMAND;
+
+static struct {
+	UARTSCRIPT_COMMAND cmds[UARTSCRIPT_MAX_COMMANDS];
+	size_t numCmds;
+	uint64_t startMs;
+
+	char input[UARTSCRIPT_INPUT_SIZE];	// bytes waiting to go to the firmware
+	size_t inHead, inTail;
+} UartScript;
+
+
+static void UartScriptQueue(const char *text)
+{
+	for (const char *p = text; ; p++) {
+		const char c = (*p != '\0') ? *p : '\r';
+		if (UartScript.inHead - UartScript.inTail < UARTSCRIPT_INPUT_SIZE) {
+			UartScript.input[UartScript.inHead++ % UARTSCRIPT_INPUT_SIZE] = c;
+		}
+		if (*p == '\0') {
+			break;
+		}
+	}
+}
+
+/**
+ * Load a script, replacing any loaded before. NULL unloads the script.
+ * Times in the script count from 0 until UartScriptStart() says otherwise.
+ */
+int UartScriptLoad(const char *path)
+{
+	FILE *fp;
+	char buf[UARTSCRIPT_MAX_TEXT + 32];
+	unsigned int lineNum = 0;
+
+	UartScript.numCmds = 0;
+	UartScript.startMs = 0;
+	UartScript.inHead = UartScript.inTail = 0;
+	if (path == NULL) {
+		return 0;
+	}
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "UARTSCRIPT: can't open script %s\n", path);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		unsigned long long ms;
+		int len = 0;
+		bool every = false;
+
+		lineNum++;
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if ((buf[strspn(buf, " \t")] == '\0') || (buf[strspn(buf, " \t")] == '#')) {
+			continue;
+		}
+
+		if (sscanf(buf, " every %llu %n", &ms, &len) == 1) {
+			every = true;
+		} else if (sscanf(buf, " %llu %n", &ms, &len) != 1) {
+			fprintf(stderr, "UARTSCRIPT: %s:%u: expected 'MS TEXT' or 'every MS TEXT'\n", path, lineNum);
+			goto fail;
+		}
+		if ((UartScript.numCmds >= UARTSCRIPT_MAX_COMMANDS) || (every && (ms == 0))) {
+			fprintf(stderr, "UARTSCRIPT: %s:%u: too many commands, or zero period\n", path, lineNum);
+			goto fail;
+		}
+
+		UARTSCRIPT_COMMAND *c = &UartScript.cmds[UartScript.numCmds++];
+		c->at    = ms;
+		c->every = every ? ms : 0;
+		c->done  = false;
+		snprintf(c->text, sizeof(c->text), "%s", &buf[len]);
+	}
+
+	fclose(fp);
+	return 0;
+
+fail:
+	fclose(fp);
+	UartScript.numCmds = 0;
+	return -1;
+}
+
+/// Count script times from timeMs (emulated ms since reset)
+void UartScriptStart(const uint64_t timeMs)
+{
+	UartScript.startMs = timeMs;
+}
+
+/// Per-tick update: queue any commands due, and feed the firmware
+void UartScriptTick(const uint64_t timeMs)
+{
+	if (UartScript.numCmds == 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < UartScript.numCmds; i++) {
+		UARTSCRIPT_COMMAND *c = &UartScript.cmds[i];
+		if (!c->done && (timeMs >= UartScript.startMs + c->at)) {
+			UartScriptQueue(c->text);
+			if (c->every > 0) {
+				c->at += c->every;
+			} else {
+				c->done = true;
+			}
+		}
+	}
+
+	// One byte at a time, as the firmware takes them
+	if ((UartScript.inTail != UartScript.inHead) && Uart.RxEnA && !Uart.RxReadyA) {
+		UartInjectRx(0, UartScript.input[UartScript.inTail++ % UARTSCRIPT_INPUT_SIZE]);
+	}
+}
@@ -0,0 +1,17 @@
+/****************************************************************************
+ * Scripted UART input
+ *
+ * Feeds timed commands to the firmware's UART A, for headless runs with no
+ * client connected.
+ ****************************************************************************/
+
+#ifndef UARTSCRIPT_H
+#define UARTSCRIPT_H
+
+#include <stdint.h>
+
+int UartScriptLoad(const char *path);
+void UartScriptStart(const uint64_t timeMs);
+void UartScriptTick(const uint64_t timeMs);
+
+#endif // UARTSCRIPT_H
@@ -0,0 +1,115 @@
+/***
+ * Up/down counters
+ *
+ * The address decoder gives two 256-byte blocks to "UPDOWN CNT 1" and
+ * "UPDOWN CNT 2" (0x240A00 and 0x240B00), but the firmware image never
+ * addresses them directly and what's behind them isn't known. They're
+ * modelled as the simplest thing that fits the name and the byte-wide bus:
+ *
+ *   +0  high byte. A write is held until the low byte is written. A read
+ *       latches the low byte, so reading high then low gives a consistent
+ *       count.
+ *   +1  low byte. A write loads the count (with the held high byte) and
+ *       starts it counting down at UPDOWN_CLOCK, wrapping through zero.
+ *
+ * Nothing is known of a direction control or a terminal count output, so
+ * they always count down and never interrupt. The count is worked out from
+ * the machine cycle count on every read (devtimer.c); nothing is done as
+ * time passes.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "machine.h"
+#include "main.h"
+
+#include "updown.h"
+
+// Define this to log counter accesses
+// #define LOG_UPDOWN
+
+static UPDOWN_STATE UpDown;
+
+
+/// Reset both counters (stopped, at zero)
+void UpDownInit(void)
+{
+	memset(&UpDown, 0, sizeof(UpDown));
+	for (int i = 0; i < 2; i++) {
+		DevTimerStop(&UpDown.cnt[i].timer);
+	}
+}
+
+// Current count of a counter
+static uint16_t UpDownCount(const UPDOWN_COUNTER *c)
+{
+	return c->load - (uint16_t)DevTimerCounts(&c->timer, MachineCycles());
+}
+
+/// CPU read from 0x240A00-0x240BFF
+uint8_t UpDownRead(const uint32_t address)
+{
+	UPDOWN_COUNTER *c = &UpDown.cnt[(address >> 8) & 1];
+	uint8_t val;
+
+	switch (address & 0xFF) {
+		case 0: {
+			const uint16_t count = UpDownCount(c);
+			c->latchLow = count & 0xFF;
+			val = count >> 8;
+			break;
+		}
+
+		case 1:
+			val = c->latchLow;
+			break;
+
+		default:
+			val = UNIMPLEMENTED_VALUE & 0xFF;
+			break;
+	}
+
+#ifdef LOG_UPDOWN
+	fprintf(stderr, "UPDOWN: RD 0x%08x => 0x%02x\n", address, val);
+#endif
+	return val;
+}
+
+/// CPU write to 0x240A00-0x240BFF
+void UpDownWrite(const uint32_t address, const uint8_t value)
+{
+	UPDOWN_COUNTER *c = &UpDown.cnt[(address >> 8) & 1];
+
+#ifdef LOG_UPDOWN
+	fprintf(stderr, "UPDOWN: WR 0x%08x <= 0x%02x\n", address, value);
+#endif
+
+	switch (address & 0xFF) {
+		case 0:
+			c->loadHigh = value;
+			break;
+
+		case 1:
+			c->load = (c->loadHigh << 8) | value;
+			DevTimerStart(&c->timer, MachineCycles(), UPDOWN_CLOCK, 0, 0);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/// Save the counters
+void UpDownGetState(UPDOWN_STATE *s)
+{
+	*s = UpDown;
+}
+
+/// Restore the counters
+void UpDownSetState(const UPDOWN_STATE *s)
+{
+	UpDown = *s;
+}
@@ -0,0 +1,38 @@
+/****************************************************************************
+ * Up/down counters
+ *
+ * UPDOWN CNT 1 and 2, at 0x240A00 and 0x240B00: 16-bit counters whose count
+ * is worked out from the machine cycle count when it's read.
+ ****************************************************************************/
+
+#ifndef UPDOWN_H
+#define UPDOWN_H
+
+#include <stdint.h>
+
+#include "devtimer.h"
+#include "machine.h"
+
+// Count rate (Hz). Nothing says what clocks the counters, so this is the
+// 68000's E clock (a tenth of the CPU clock).
+#define UPDOWN_CLOCK (SYSTEM_CLOCK / 10)
+
+typedef struct {
+	DEVTIMER timer;				///< Running since the count was loaded
+	uint16_t load;				///< Count loaded
+	uint8_t loadHigh;			///< High byte written, loaded with the low byte
+	uint8_t latchLow;			///< Low byte latched by reading the high byte
+} UPDOWN_COUNTER;
+
+/// Counter state, saved with rewind snapshots
+typedef struct {
+	UPDOWN_COUNTER cnt[2];
+} UPDOWN_STATE;
+
+void UpDownInit(void);
+uint8_t UpDownRead(const uint32_t address);
+void UpDownWrite(const uint32_t address, const uint8_t value);
+void UpDownGetState(UPDOWN_STATE *s);
+void UpDownSetState(const UPDOWN_STATE *s);
+
+#endif // UPDOWN_H
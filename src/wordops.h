@@ -1,46 +1,107 @@
 /****************************************************************************
  * WORDOPS
  *
- * Word operations. Read/write DWORD and WORD entries from arrays.
+ * Word operations on the emulated ROM and RAM. These are kept as 16-bit
+ * words in host byte order, so an aligned word access is one load or store
+ * and a long is one load or store and a swap of its halves (on a
+ * little-endian host). The byte at 68000 address A is at A ^ BYTE_XOR.
+ * Arrays in this layout must only be accessed through these functions.
  ****************************************************************************/
 
 #ifndef WORDOPS_H
 #define WORDOPS_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+/// XOR applied to a byte address to find the byte in host word order
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define BYTE_XOR 1
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define BYTE_XOR 0
+#else
+#  error "Unknown host byte order"
+#endif
+
+/// Read a BYTE.
+static inline uint8_t BYTE_READ(const uint8_t *arr, const size_t addr)
+{
+	return arr[addr ^ BYTE_XOR];
+}
+
+/// Write a BYTE.
+static inline void BYTE_WRITE(uint8_t *arr, const size_t addr, const uint8_t val)
+{
+	arr[addr ^ BYTE_XOR] = val;
+}
+
+/// Read a WORD, Motorola byte order.
+static inline uint16_t WORD_READ(const uint8_t *arr, const size_t addr)
+{
+	uint16_t val;
+
+	if (addr & 1) {
+		// Misaligned (the 68000 would take an address error)
+		return (BYTE_READ(arr, addr) << 8) | BYTE_READ(arr, addr + 1);
+	}
+	memcpy(&val, &arr[addr], sizeof(val));
+	return val;
+}
 
 /// Read a DWORD, Motorola byte order.
 static inline uint32_t DWORD_READ(const uint8_t *arr, const size_t addr)
 {
-	return
-		(arr[addr+0] << 24) |
-		(arr[addr+1] << 16) |
-		(arr[addr+2] << 8) |
-		(arr[addr+3]);
+	uint32_t val;
+
+	if (addr & 1) {
+		return ((uint32_t)WORD_READ(arr, addr) << 16) | WORD_READ(arr, addr + 2);
+	}
+	memcpy(&val, &arr[addr], sizeof(val));
+#if BYTE_XOR
+	val = (val << 16) | (val >> 16);
+#endif
+	return val;
 }
 
-/// Read a DWORD, Motorola byte order.
-static inline uint16_t WORD_READ(const uint8_t *arr, const size_t addr)
+/// Write a WORD, Motorola byte order.
+static inline void WORD_WRITE(uint8_t *arr, const size_t addr, const uint16_t val)
 {
-	return
-		(arr[addr+0] << 8) |
-		(arr[addr+1]);
+	if (addr & 1) {
+		BYTE_WRITE(arr, addr, val >> 8);
+		BYTE_WRITE(arr, addr + 1, val & 0xFF);
+		return;
+	}
+	memcpy(&arr[addr], &val, sizeof(val));
 }
 
 /// Write a DWORD, Motorola byte order.
-static inline void DWORD_WRITE(uint8_t *arr, const size_t addr, const uint32_t val)
+static inline void DWORD_WRITE(uint8_t *arr, const size_t addr, uint32_t val)
 {
-	arr[addr+0] = (val >> 24) & 0xFF;
-	arr[addr+1] = (val >> 16) & 0xFF;
-	arr[addr+2] = (val >> 8)  & 0xFF;
-	arr[addr+3] =  val        & 0xFF;
+	if (addr & 1) {
+		WORD_WRITE(arr, addr, val >> 16);
+		WORD_WRITE(arr, addr + 2, val & 0xFFFF);
+		return;
+	}
+#if BYTE_XOR
+	val = (val << 16) | (val >> 16);
+#endif
+	memcpy(&arr[addr], &val, sizeof(val));
 }
 
-/// Read a DWORD, Motorola byte order.
-static inline void WORD_WRITE(uint8_t *arr, const size_t addr, const uint16_t val)
+/// Convert len bytes of a Motorola byte order image to host word order, in place.
+static inline void WORDS_FROM_BE(uint8_t *arr, const size_t len)
 {
-	arr[addr+0] = (val >> 8)  & 0xFF;
-	arr[addr+1] =  val        & 0xFF;
+#if BYTE_XOR
+	for (size_t i = 0; i + 1 < len; i += 2) {
+		const uint8_t t = arr[i];
+		arr[i]     = arr[i + 1];
+		arr[i + 1] = t;
+	}
+#else
+	(void)arr;
+	(void)len;
+#endif
 }
 
 #endif // WORDOPS_H